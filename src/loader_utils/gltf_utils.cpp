@@ -1,37 +1,52 @@
 #include "gltf_utils.h"
 #include "vk_utils.h"
+#include "../render/mesh_data_8f.h"
 
-LiteMath::float4x4 transformMatrixFromGLTFNode(const tinygltf::Node &node)
-{
-  LiteMath::float4x4 nodeMatrix;
+#include <algorithm>
+#include <cmath>
+#include <cstring>
 
+GLTFNodeTransform nodeTransformFromGLTF(const tinygltf::Node &node)
+{
+  GLTFNodeTransform res;
   if(node.matrix.size() == 16)
   {
-    nodeMatrix.set_col(0, float4(node.matrix[0], node.matrix[1], node.matrix[2], node.matrix[3]));
-    nodeMatrix.set_col(1, float4(node.matrix[4], node.matrix[5], node.matrix[6], node.matrix[7]));
-    nodeMatrix.set_col(2, float4(node.matrix[8], node.matrix[9], node.matrix[10], node.matrix[11]));
-    nodeMatrix.set_col(3, float4(node.matrix[12], node.matrix[13], node.matrix[14], node.matrix[15]));
-  }
-  else
-  {
-    if(node.scale.size() == 3)
-    {
-      LiteMath::float3 s = LiteMath::float3(node.scale[0], node.scale[1], node.scale[2]);
-      nodeMatrix         = LiteMath::scale4x4(s) * nodeMatrix;
-    }
-    if(node.rotation.size() == 4)// @TODO: add support for quaternion rotations
-    {
-//      LiteMath::float4 rot = LiteMath::float4(node.rotation[0], node.rotation[1], node.rotation[2], node.rotation[3]);
-      //        nodeMatrix *= LiteMath::quternionRot(rot);
-    }
-    if(node.translation.size() == 3)
-    {
-      LiteMath::float3 t = LiteMath::float3(node.translation[0], node.translation[1], node.translation[2]);
-      nodeMatrix         = LiteMath::translate4x4(t) * nodeMatrix;
-    }
+    res.hasMatrix = true;
+    res.matrix.set_col(0, float4(node.matrix[0], node.matrix[1], node.matrix[2], node.matrix[3]));
+    res.matrix.set_col(1, float4(node.matrix[4], node.matrix[5], node.matrix[6], node.matrix[7]));
+    res.matrix.set_col(2, float4(node.matrix[8], node.matrix[9], node.matrix[10], node.matrix[11]));
+    res.matrix.set_col(3, float4(node.matrix[12], node.matrix[13], node.matrix[14], node.matrix[15]));
+    return res;
   }
 
-  return nodeMatrix;
+  if(node.scale.size() == 3)
+    res.scale = LiteMath::float3(node.scale[0], node.scale[1], node.scale[2]);
+  if(node.rotation.size() == 4)
+    res.rotation = LiteMath::float4(node.rotation[0], node.rotation[1], node.rotation[2], node.rotation[3]);
+  if(node.translation.size() == 3)
+    res.translation = LiteMath::float3(node.translation[0], node.translation[1], node.translation[2]);
+  return res;
+}
+
+// T * R * S, rotation is a unit quaternion (x, y, z, w)
+LiteMath::float4x4 matrixFromNodeTransform(const GLTFNodeTransform &a_transform)
+{
+  if(a_transform.hasMatrix)
+    return a_transform.matrix;
+
+  const float4 q = a_transform.rotation;
+  const float3 s = a_transform.scale;
+  LiteMath::float4x4 res;
+  res.set_col(0, float4(1.0f - 2.0f * (q.y * q.y + q.z * q.z), 2.0f * (q.x * q.y + q.z * q.w), 2.0f * (q.x * q.z - q.y * q.w), 0.0f) * s.x);
+  res.set_col(1, float4(2.0f * (q.x * q.y - q.z * q.w), 1.0f - 2.0f * (q.x * q.x + q.z * q.z), 2.0f * (q.y * q.z + q.x * q.w), 0.0f) * s.y);
+  res.set_col(2, float4(2.0f * (q.x * q.z + q.y * q.w), 2.0f * (q.y * q.z - q.x * q.w), 1.0f - 2.0f * (q.x * q.x + q.y * q.y), 0.0f) * s.z);
+  res.set_col(3, float4(a_transform.translation.x, a_transform.translation.y, a_transform.translation.z, 1.0f));
+  return res;
+}
+
+LiteMath::float4x4 transformMatrixFromGLTFNode(const tinygltf::Node &node)
+{
+  return matrixFromNodeTransform(nodeTransformFromGLTF(node));
 }
 
 MaterialData_pbrMR materialDataFromGLTF(const tinygltf::Material &gltfMat)
@@ -63,26 +78,209 @@ MaterialData_pbrMR materialDataFromGLTF(const tinygltf::Material &gltfMat)
   return mat;
 }
 
+// Elements of an accessor read in place from its buffer: buffer views may be interleaved (byteStride larger than
+// the element), and components may be normalized integers (KHR_mesh_quantization, texture coordinates)
+struct GLTFAccessorView
+{
+  const uint8_t* data = nullptr;
+  size_t count  = 0;
+  size_t stride = 0;
+  int componentType = TINYGLTF_COMPONENT_TYPE_FLOAT;
+  int numComponents = 0;
+  bool normalized   = false;
+
+  float Get(size_t a_elem, int a_comp) const
+  {
+    const uint8_t* ptr = data + a_elem * stride;
+    switch(componentType)
+    {
+    case TINYGLTF_COMPONENT_TYPE_FLOAT:
+    {
+      float val;
+      memcpy(&val, ptr + a_comp * sizeof(float), sizeof(val));
+      return val;
+    }
+    case TINYGLTF_COMPONENT_TYPE_UNSIGNED_BYTE:
+    {
+      const float val = float(ptr[a_comp]);
+      return normalized ? val / 255.0f : val;
+    }
+    case TINYGLTF_COMPONENT_TYPE_BYTE:
+    {
+      const float val = float(int8_t(ptr[a_comp]));
+      return normalized ? std::max(val / 127.0f, -1.0f) : val;
+    }
+    case TINYGLTF_COMPONENT_TYPE_UNSIGNED_SHORT:
+    {
+      uint16_t val;
+      memcpy(&val, ptr + a_comp * sizeof(uint16_t), sizeof(val));
+      return normalized ? float(val) / 65535.0f : float(val);
+    }
+    case TINYGLTF_COMPONENT_TYPE_SHORT:
+    {
+      int16_t val;
+      memcpy(&val, ptr + a_comp * sizeof(int16_t), sizeof(val));
+      return normalized ? std::max(float(val) / 32767.0f, -1.0f) : float(val);
+    }
+    default:
+      return 0.0f;
+    }
+  }
+};
+
+// returns false if the accessor doesn't exist or doesn't fit in the buffer; 'a_name' is for warnings
+static bool getAccessorView(const tinygltf::Model &a_model, int a_accessor, const char* a_name, int a_minComponents,
+  GLTFAccessorView* a_pView)
+{
+  if(a_accessor < 0 || size_t(a_accessor) >= a_model.accessors.size())
+    return false;
+
+  const tinygltf::Accessor &accessor = a_model.accessors[a_accessor];
+  if(accessor.bufferView < 0 || size_t(accessor.bufferView) >= a_model.bufferViews.size())
+    return false;
+  const tinygltf::BufferView &view = a_model.bufferViews[accessor.bufferView];
+  if(view.buffer < 0 || size_t(view.buffer) >= a_model.buffers.size())
+    return false;
+  const tinygltf::Buffer &buffer = a_model.buffers[view.buffer];
+
+  const int componentSize = tinygltf::GetComponentSizeInBytes(accessor.componentType);
+  const int numComponents = tinygltf::GetNumComponentsInType(accessor.type);
+  const int stride        = accessor.ByteStride(view);
+  if(componentSize <= 0 || numComponents < a_minComponents || stride <= 0)
+  {
+    vk_utils::logWarning(std::string("[LoadSceneGLTF]: Unsupported format of attribute ") + a_name);
+    return false;
+  }
+
+  const size_t offset   = accessor.byteOffset + view.byteOffset;
+  const size_t elemSize = size_t(componentSize) * size_t(numComponents);
+  if(accessor.count > 0 && offset + size_t(stride) * (accessor.count - 1) + elemSize > buffer.data.size())
+  {
+    vk_utils::logWarning(std::string("[LoadSceneGLTF]: Attribute ") + a_name + " is out of buffer bounds");
+    return false;
+  }
+
+  a_pView->data          = buffer.data.data() + offset;
+  a_pView->count         = accessor.count;
+  a_pView->stride        = size_t(stride);
+  a_pView->componentType = accessor.componentType;
+  a_pView->numComponents = numComponents;
+  a_pView->normalized    = accessor.normalized;
+  return true;
+}
+
+// returns false if the primitive has no such attribute or its accessor doesn't fit in the buffer
+static bool getAttributeView(const tinygltf::Model &a_model, const tinygltf::Primitive &a_primitive, const char* a_name,
+  int a_minComponents, GLTFAccessorView* a_pView)
+{
+  auto found = a_primitive.attributes.find(a_name);
+  if(found == a_primitive.attributes.end())
+    return false;
+  return getAccessorView(a_model, found->second, a_name, a_minComponents, a_pView);
+}
+
+// only triangle lists are loaded; a primitive without indices makes triangles of consecutive vertices
+static bool getTrianglePrimitiveSize(const tinygltf::Model &a_model, const tinygltf::Primitive &a_primitive, uint32_t &a_vertNum, uint32_t &a_indNum)
+{
+  a_vertNum = 0;
+  a_indNum  = 0;
+  auto position = a_primitive.attributes.find("POSITION");
+  if(a_primitive.mode != TINYGLTF_MODE_TRIANGLES || position == a_primitive.attributes.end() ||
+     position->second < 0 || size_t(position->second) >= a_model.accessors.size())
+    return false;
+  if(a_primitive.indices >= 0 && size_t(a_primitive.indices) >= a_model.accessors.size())
+    return false;
+
+  a_vertNum = uint32_t(a_model.accessors[position->second].count);
+  a_indNum  = (a_primitive.indices >= 0) ? uint32_t(a_model.accessors[a_primitive.indices].count) : a_vertNum;
+  a_indNum -= a_indNum % 3;
+  return true;
+}
+
 void getNumVerticesAndIndicesFromGLTFMesh(const tinygltf::Model &a_model, const tinygltf::Mesh &a_mesh, uint32_t& numVertices, uint32_t& numIndices)
 {
-  auto numPrimitives   = a_mesh.primitives.size();
-  for(size_t j = 0; j < numPrimitives; ++j)
+  for(const auto &glTFPrimitive : a_mesh.primitives)
   {
-    const tinygltf::Primitive &glTFPrimitive = a_mesh.primitives[j];
-    if(glTFPrimitive.attributes.find("POSITION") != glTFPrimitive.attributes.end())
+    uint32_t vertNum, indNum;
+    if(getTrianglePrimitiveSize(a_model, glTFPrimitive, vertNum, indNum))
     {
-      numVertices += a_model.accessors[glTFPrimitive.attributes.find("POSITION")->second].count;
+      numVertices += vertNum;
+      numIndices  += indNum;
     }
+  }
+}
+
+template<typename T>
+static uint32_t rebaseIndices(const uint8_t* a_src, size_t a_count, uint32_t a_vertexStart, uint32_t* a_dst)
+{
+  const T* src = reinterpret_cast<const T*>(a_src); // accessors are aligned to their component size by the spec
+  uint32_t maxIndex = 0;
+#pragma omp simd reduction(max:maxIndex)
+  for(size_t i = 0; i < a_count; ++i)
+  {
+    maxIndex = std::max(maxIndex, uint32_t(src[i]));
+    a_dst[i] = uint32_t(src[i]) + a_vertexStart;
+  }
+  return maxIndex;
+}
+
+// writes a_indNum indices of a primitive rebased to a_vertexStart; fails for unsupported or invalid index data
+static bool convertIndices(const tinygltf::Model &a_model, const tinygltf::Primitive &a_primitive, uint32_t a_vertNum, uint32_t a_indNum,
+  uint32_t a_vertexStart, uint32_t* a_dst)
+{
+  if(a_primitive.indices < 0)
+  {
+    for(uint32_t i = 0; i < a_indNum; ++i)
+      a_dst[i] = a_vertexStart + i;
+    return true;
+  }
+
+  const tinygltf::Accessor &accessor = a_model.accessors[a_primitive.indices];
+  if(accessor.bufferView < 0 || size_t(accessor.bufferView) >= a_model.bufferViews.size())
+    return false;
+  const tinygltf::BufferView &bufferView = a_model.bufferViews[accessor.bufferView];
+  if(bufferView.buffer < 0 || size_t(bufferView.buffer) >= a_model.buffers.size())
+    return false;
+  const tinygltf::Buffer &buffer = a_model.buffers[bufferView.buffer];
+
+  const size_t offset        = accessor.byteOffset + bufferView.byteOffset;
+  const int    componentSize = tinygltf::GetComponentSizeInBytes(accessor.componentType);
+  if(componentSize <= 0 || offset + size_t(componentSize) * a_indNum > buffer.data.size())
+  {
+    vk_utils::logWarning("[LoadSceneGLTF]: Indices are out of buffer bounds");
+    return false;
+  }
 
-    numIndices += static_cast<uint32_t>(a_model.accessors[glTFPrimitive.indices].count);
+  const uint8_t* src = buffer.data.data() + offset;
+  uint32_t maxIndex  = 0;
+  switch(accessor.componentType)
+  {
+  case TINYGLTF_PARAMETER_TYPE_UNSIGNED_INT:
+    maxIndex = rebaseIndices<uint32_t>(src, a_indNum, a_vertexStart, a_dst);
+    break;
+  case TINYGLTF_PARAMETER_TYPE_UNSIGNED_SHORT:
+    maxIndex = rebaseIndices<uint16_t>(src, a_indNum, a_vertexStart, a_dst);
+    break;
+  case TINYGLTF_PARAMETER_TYPE_UNSIGNED_BYTE:
+    maxIndex = rebaseIndices<uint8_t>(src, a_indNum, a_vertexStart, a_dst);
+    break;
+  default:
+    vk_utils::logWarning("[LoadSceneGLTF]: Unsupported index component type");
+    return false;
+  }
+
+  if(a_indNum > 0 && maxIndex >= a_vertNum)
+  {
+    vk_utils::logWarning("[LoadSceneGLTF]: Index refers to a vertex out of primitive");
+    return false;
   }
+  return true;
 }
 
 cmesh::SimpleMesh simpleMeshFromGLTFMesh(const tinygltf::Model &a_model, const tinygltf::Mesh &a_mesh)
 {
   uint32_t numVertices = 0;
   uint32_t numIndices  = 0;
-  auto numPrimitives   = a_mesh.primitives.size();
 
   getNumVerticesAndIndicesFromGLTFMesh(a_model, a_mesh, numVertices, numIndices);
 
@@ -90,116 +288,51 @@ cmesh::SimpleMesh simpleMeshFromGLTFMesh(const tinygltf::Model &a_model, const t
 
   uint32_t firstIndex  = 0;
   uint32_t vertexStart = 0;
-  for(size_t j = 0; j < numPrimitives; ++j)
+  for(const auto &glTFPrimitive : a_mesh.primitives)
   {
-    const tinygltf::Primitive &glTFPrimitive = a_mesh.primitives[j];
+    uint32_t vertexCount, indexCount;
+    if(!getTrianglePrimitiveSize(a_model, glTFPrimitive, vertexCount, indexCount))
+      continue;
 
     // Vertices
-    size_t vertexCount = 0;
     {
-      const float *positionBuffer  = nullptr;
-      const float *normalsBuffer   = nullptr;
-      const float *texCoordsBuffer = nullptr;
-      const float *tangentsBuffer  = nullptr;
-
-      if(glTFPrimitive.attributes.find("POSITION") != glTFPrimitive.attributes.end())
-      {
-        const tinygltf::Accessor &accessor = a_model.accessors[glTFPrimitive.attributes.find("POSITION")->second];
-        const tinygltf::BufferView &view   = a_model.bufferViews[accessor.bufferView];
-        positionBuffer = reinterpret_cast<const float *>(&(a_model.buffers[view.buffer].data[accessor.byteOffset + view.byteOffset]));
-        vertexCount                        = accessor.count;
-      }
-
-      if(glTFPrimitive.attributes.find("NORMAL") != glTFPrimitive.attributes.end())
-      {
-        const tinygltf::Accessor &accessor = a_model.accessors[glTFPrimitive.attributes.find("NORMAL")->second];
-        const tinygltf::BufferView &view   = a_model.bufferViews[accessor.bufferView];
-        normalsBuffer = reinterpret_cast<const float *>(&(a_model.buffers[view.buffer].data[accessor.byteOffset + view.byteOffset]));
-      }
+      GLTFAccessorView positions, normals, texCoords, tangents;
+      if(!getAttributeView(a_model, glTFPrimitive, "POSITION", 3, &positions) || positions.count < vertexCount)
+        return { };
 
-      if(glTFPrimitive.attributes.find("TEXCOORD_0") != glTFPrimitive.attributes.end())
-      {
-        const tinygltf::Accessor &accessor = a_model.accessors[glTFPrimitive.attributes.find("TEXCOORD_0")->second];
-        const tinygltf::BufferView &view   = a_model.bufferViews[accessor.bufferView];
-        texCoordsBuffer = reinterpret_cast<const float *>(&(a_model.buffers[view.buffer].data[accessor.byteOffset + view.byteOffset]));
-      }
-
-      if(glTFPrimitive.attributes.find("TANGENT") != glTFPrimitive.attributes.end())
-      {
-        const tinygltf::Accessor &accessor = a_model.accessors[glTFPrimitive.attributes.find("TANGENT")->second];
-        const tinygltf::BufferView &view   = a_model.bufferViews[accessor.bufferView];
-        tangentsBuffer = reinterpret_cast<const float *>(&(a_model.buffers[view.buffer].data[accessor.byteOffset + view.byteOffset]));
-      }
+      const bool hasNormals   = getAttributeView(a_model, glTFPrimitive, "NORMAL", 3, &normals) && normals.count >= vertexCount;
+      const bool hasTexCoords = getAttributeView(a_model, glTFPrimitive, "TEXCOORD_0", 2, &texCoords) && texCoords.count >= vertexCount;
+      const bool hasTangents  = getAttributeView(a_model, glTFPrimitive, "TANGENT", 4, &tangents) && tangents.count >= vertexCount;
 
       for(size_t v = 0; v < vertexCount; v++)
       {
-        simpleMesh.vPos4f[(vertexStart + v) * 4 + 0] = positionBuffer[v * 3 + 0];
-        simpleMesh.vPos4f[(vertexStart + v) * 4 + 1] = positionBuffer[v * 3 + 1];
-        simpleMesh.vPos4f[(vertexStart + v) * 4 + 2] = positionBuffer[v * 3 + 2];
+        simpleMesh.vPos4f[(vertexStart + v) * 4 + 0] = positions.Get(v, 0);
+        simpleMesh.vPos4f[(vertexStart + v) * 4 + 1] = positions.Get(v, 1);
+        simpleMesh.vPos4f[(vertexStart + v) * 4 + 2] = positions.Get(v, 2);
         simpleMesh.vPos4f[(vertexStart + v) * 4 + 3] = 1.0f;
 
-        simpleMesh.vNorm4f[(vertexStart + v) * 4 + 0] = normalsBuffer ? normalsBuffer[v * 3 + 0] : 0.0f;
-        simpleMesh.vNorm4f[(vertexStart + v) * 4 + 1] = normalsBuffer ? normalsBuffer[v * 3 + 1] : 0.0f;
-        simpleMesh.vNorm4f[(vertexStart + v) * 4 + 2] = normalsBuffer ? normalsBuffer[v * 3 + 2] : 0.0f;
-        simpleMesh.vNorm4f[(vertexStart + v) * 4 + 3] = normalsBuffer ? 1.0f : 0.0f;
+        simpleMesh.vNorm4f[(vertexStart + v) * 4 + 0] = hasNormals ? normals.Get(v, 0) : 0.0f;
+        simpleMesh.vNorm4f[(vertexStart + v) * 4 + 1] = hasNormals ? normals.Get(v, 1) : 0.0f;
+        simpleMesh.vNorm4f[(vertexStart + v) * 4 + 2] = hasNormals ? normals.Get(v, 2) : 0.0f;
+        simpleMesh.vNorm4f[(vertexStart + v) * 4 + 3] = hasNormals ? 1.0f : 0.0f;
 
-        simpleMesh.vTexCoord2f[(vertexStart + v) * 2 + 0] = texCoordsBuffer ? texCoordsBuffer[v * 2 + 0] : 0.0f;
-        simpleMesh.vTexCoord2f[(vertexStart + v) * 2 + 1] = texCoordsBuffer ? texCoordsBuffer[v * 2 + 1] : 0.0f;
+        simpleMesh.vTexCoord2f[(vertexStart + v) * 2 + 0] = hasTexCoords ? texCoords.Get(v, 0) : 0.0f;
+        simpleMesh.vTexCoord2f[(vertexStart + v) * 2 + 1] = hasTexCoords ? texCoords.Get(v, 1) : 0.0f;
 
-        simpleMesh.vTang4f[(vertexStart + v) * 4 + 0] = tangentsBuffer ? tangentsBuffer[v * 4 + 0] : 0.0f;
-        simpleMesh.vTang4f[(vertexStart + v) * 4 + 1] = tangentsBuffer ? tangentsBuffer[v * 4 + 1] : 0.0f;
-        simpleMesh.vTang4f[(vertexStart + v) * 4 + 2] = tangentsBuffer ? tangentsBuffer[v * 4 + 2] : 0.0f;
-        simpleMesh.vTang4f[(vertexStart + v) * 4 + 3] = tangentsBuffer ? tangentsBuffer[v * 4 + 3] : 0.0f;
+        simpleMesh.vTang4f[(vertexStart + v) * 4 + 0] = hasTangents ? tangents.Get(v, 0) : 0.0f;
+        simpleMesh.vTang4f[(vertexStart + v) * 4 + 1] = hasTangents ? tangents.Get(v, 1) : 0.0f;
+        simpleMesh.vTang4f[(vertexStart + v) * 4 + 2] = hasTangents ? tangents.Get(v, 2) : 0.0f;
+        simpleMesh.vTang4f[(vertexStart + v) * 4 + 3] = hasTangents ? tangents.Get(v, 3) : 0.0f;
       }
     }
 
     // Indices
     {
-      const tinygltf::Accessor &accessor     = a_model.accessors[glTFPrimitive.indices];
-      const tinygltf::BufferView &bufferView = a_model.bufferViews[accessor.bufferView];
-      const tinygltf::Buffer &buffer         = a_model.buffers[bufferView.buffer];
-
-      auto indexCount = static_cast<uint32_t>(accessor.count);
-
       std::fill(simpleMesh.matIndices.begin() + firstIndex / 3,
             simpleMesh.matIndices.begin() + (firstIndex + indexCount) / 3, glTFPrimitive.material);
 
-      switch(accessor.componentType)
-      {
-      case TINYGLTF_PARAMETER_TYPE_UNSIGNED_INT:
-      {
-        auto *buf = new uint32_t[accessor.count];
-        memcpy(buf, &buffer.data[accessor.byteOffset + bufferView.byteOffset], accessor.count * sizeof(uint32_t));
-        for(size_t index = 0; index < accessor.count; index++)
-        {
-          simpleMesh.indices[firstIndex + index] = buf[index] + vertexStart;
-        }
-        break;
-      }
-      case TINYGLTF_PARAMETER_TYPE_UNSIGNED_SHORT:
-      {
-        auto *buf = new uint16_t[accessor.count];
-        memcpy(buf, &buffer.data[accessor.byteOffset + bufferView.byteOffset], accessor.count * sizeof(uint16_t));
-        for(size_t index = 0; index < accessor.count; index++)
-        {
-          simpleMesh.indices[firstIndex + index] = buf[index] + vertexStart;
-        }
-        break;
-      }
-      case TINYGLTF_PARAMETER_TYPE_UNSIGNED_BYTE:
-      {
-        auto *buf = new uint8_t[accessor.count];
-        memcpy(buf, &buffer.data[accessor.byteOffset + bufferView.byteOffset], accessor.count * sizeof(uint8_t));
-        for(size_t index = 0; index < accessor.count; index++)
-        {
-          simpleMesh.indices[firstIndex + index] = buf[index] + vertexStart;
-        }
-        break;
-      }
-      default:
-        vk_utils::logWarning("[LoadSceneGLTF]: Unsupported index component type");
+      if(!convertIndices(a_model, glTFPrimitive, vertexCount, indexCount, vertexStart, simpleMesh.indices.data() + firstIndex))
         return { };
-      }
 
       firstIndex  += indexCount;
       vertexStart += vertexCount;
@@ -207,4 +340,187 @@ cmesh::SimpleMesh simpleMeshFromGLTFMesh(const tinygltf::Model &a_model, const t
   }
 
   return simpleMesh;
-}
\ No newline at end of file
+}
+
+// One pass to the final vertex layout. Float attributes (the common case) are read with plain strided loads, so the loop
+// over vertices is vectorised together with normal encoding; other component types go through GLTFAccessorView::Get.
+template<bool ALL_FLOAT>
+static void writeVertices8F(const GLTFAccessorView &a_pos, const GLTFAccessorView *a_norm, const GLTFAccessorView *a_texCoord,
+  const GLTFAccessorView *a_tang, size_t a_count, float* a_dst)
+{
+  auto read = [](const GLTFAccessorView *a_view, size_t a_elem, int a_comp) {
+    if(a_view == nullptr)
+      return 0.0f;
+    if(!ALL_FLOAT)
+      return a_view->Get(a_elem, a_comp);
+    float val;
+    memcpy(&val, a_view->data + a_elem * a_view->stride + a_comp * sizeof(float), sizeof(val));
+    return val;
+  };
+
+#pragma omp simd
+  for(size_t v = 0; v < a_count; ++v)
+  {
+    float* dst = a_dst + v * MeshData8F::FLOATS_PER_VERTEX;
+    dst[0] = read(&a_pos, v, 0);
+    dst[1] = read(&a_pos, v, 1);
+    dst[2] = read(&a_pos, v, 2);
+    dst[3] = MeshData8F::EncodeNormal(read(a_norm, v, 0), read(a_norm, v, 1), read(a_norm, v, 2));
+    dst[4] = read(a_texCoord, v, 0);
+    dst[5] = read(a_texCoord, v, 1);
+    dst[6] = MeshData8F::EncodeNormal(read(a_tang, v, 0), read(a_tang, v, 1), read(a_tang, v, 2));
+    dst[7] = 0.0f;
+  }
+}
+
+bool convertGLTFMesh8F(const tinygltf::Model &a_model, const tinygltf::Mesh &a_mesh, float* a_vertices, uint32_t* a_indices,
+  uint32_t* a_matIndices)
+{
+  bool ok = true;
+  uint32_t firstIndex  = 0;
+  uint32_t vertexStart = 0;
+  for(const auto &glTFPrimitive : a_mesh.primitives)
+  {
+    uint32_t vertexCount, indexCount;
+    if(!getTrianglePrimitiveSize(a_model, glTFPrimitive, vertexCount, indexCount))
+      continue;
+
+    float* vertices = a_vertices + size_t(vertexStart) * MeshData8F::FLOATS_PER_VERTEX;
+    GLTFAccessorView positions, normals, texCoords, tangents;
+    if(getAttributeView(a_model, glTFPrimitive, "POSITION", 3, &positions) && positions.count >= vertexCount &&
+       convertIndices(a_model, glTFPrimitive, vertexCount, indexCount, vertexStart, a_indices + firstIndex))
+    {
+      const bool hasNormals   = getAttributeView(a_model, glTFPrimitive, "NORMAL", 3, &normals) && normals.count >= vertexCount;
+      const bool hasTexCoords = getAttributeView(a_model, glTFPrimitive, "TEXCOORD_0", 2, &texCoords) && texCoords.count >= vertexCount;
+      const bool hasTangents  = getAttributeView(a_model, glTFPrimitive, "TANGENT", 4, &tangents) && tangents.count >= vertexCount;
+
+      const bool allFloat = positions.componentType == TINYGLTF_COMPONENT_TYPE_FLOAT &&
+                            (!hasNormals   || normals.componentType   == TINYGLTF_COMPONENT_TYPE_FLOAT) &&
+                            (!hasTexCoords || texCoords.componentType == TINYGLTF_COMPONENT_TYPE_FLOAT) &&
+                            (!hasTangents  || tangents.componentType  == TINYGLTF_COMPONENT_TYPE_FLOAT);
+      if(allFloat)
+        writeVertices8F<true>(positions, hasNormals ? &normals : nullptr, hasTexCoords ? &texCoords : nullptr,
+          hasTangents ? &tangents : nullptr, vertexCount, vertices);
+      else
+        writeVertices8F<false>(positions, hasNormals ? &normals : nullptr, hasTexCoords ? &texCoords : nullptr,
+          hasTangents ? &tangents : nullptr, vertexCount, vertices);
+    }
+    else
+    {
+      // keep the layout of the mesh, but with degenerate triangles only
+      memset(vertices, 0, size_t(vertexCount) * MeshData8F::FLOATS_PER_VERTEX * sizeof(float));
+      memset(a_indices + firstIndex, 0, size_t(indexCount) * sizeof(uint32_t));
+      ok = false;
+    }
+
+    std::fill(a_matIndices + firstIndex / 3, a_matIndices + (firstIndex + indexCount) / 3, uint32_t(glTFPrimitive.material));
+    firstIndex  += indexCount;
+    vertexStart += vertexCount;
+  }
+
+  return ok;
+}
+
+std::vector<GLTFAnimation> animationsFromGLTF(const tinygltf::Model &a_model)
+{
+  std::vector<GLTFAnimation> res;
+  res.reserve(a_model.animations.size());
+  for(const auto &gltfAnim : a_model.animations)
+  {
+    GLTFAnimation anim;
+    anim.name = gltfAnim.name;
+    for(const auto &gltfChannel : gltfAnim.channels)
+    {
+      GLTFAnimationChannel channel;
+      channel.node = gltfChannel.target_node;
+      if(gltfChannel.target_path == "translation")
+        channel.path = GLTFAnimationChannel::TRANSLATION;
+      else if(gltfChannel.target_path == "rotation")
+        channel.path = GLTFAnimationChannel::ROTATION;
+      else if(gltfChannel.target_path == "scale")
+        channel.path = GLTFAnimationChannel::SCALE;
+      else
+        continue; // morph target weights
+
+      if(channel.node < 0 || size_t(channel.node) >= a_model.nodes.size() || gltfChannel.sampler < 0 ||
+         size_t(gltfChannel.sampler) >= gltfAnim.samplers.size())
+        continue;
+
+      const auto &sampler = gltfAnim.samplers[gltfChannel.sampler];
+      const int numComponents = channel.path == GLTFAnimationChannel::ROTATION ? 4 : 3;
+      GLTFAccessorView times, values;
+      if(!getAccessorView(a_model, sampler.input, "animation input", 1, &times) ||
+         !getAccessorView(a_model, sampler.output, "animation output", numComponents, &values) || times.count == 0)
+        continue;
+
+      // cubic spline keys are (in-tangent, value, out-tangent); only values are kept and interpolated linearly
+      const size_t keyStride = sampler.interpolation == "CUBICSPLINE" ? 3 : 1;
+      const size_t valueOffset = keyStride == 3 ? 1 : 0;
+      if(values.count < times.count * keyStride)
+        continue;
+
+      channel.step = sampler.interpolation == "STEP";
+      channel.times.resize(times.count);
+      channel.values.resize(times.count);
+      for(size_t k = 0; k < times.count; ++k)
+      {
+        channel.times[k] = times.Get(k, 0);
+        const size_t elem = k * keyStride + valueOffset;
+        channel.values[k] = float4(values.Get(elem, 0), values.Get(elem, 1), values.Get(elem, 2),
+                                   numComponents == 4 ? values.Get(elem, 3) : 0.0f);
+      }
+      anim.duration = std::max(anim.duration, channel.times.back());
+      anim.channels.push_back(std::move(channel));
+    }
+    res.push_back(std::move(anim));
+  }
+  return res;
+}
+
+static float4 slerp(float4 a, float4 b, float t)
+{
+  float cosTheta = dot(a, b);
+  if(cosTheta < 0.0f) // shortest arc
+  {
+    b        = -1.0f * b;
+    cosTheta = -cosTheta;
+  }
+  if(cosTheta > 0.9995f)
+    return normalize(a + t * (b - a));
+
+  const float theta = std::acos(cosTheta);
+  const float sinTheta = std::sin(theta);
+  return (std::sin((1.0f - t) * theta) / sinTheta) * a + (std::sin(t * theta) / sinTheta) * b;
+}
+
+void sampleGLTFAnimation(const GLTFAnimation &a_anim, float a_time, GLTFNodeTransform* a_nodes)
+{
+  for(const auto &channel : a_anim.channels)
+  {
+    const auto &times = channel.times;
+    float4 value;
+    if(a_time <= times.front() || times.size() == 1)
+      value = channel.values.front();
+    else if(a_time >= times.back())
+      value = channel.values.back();
+    else
+    {
+      const size_t next = size_t(std::upper_bound(times.begin(), times.end(), a_time) - times.begin());
+      const size_t prev = next - 1;
+      const float t = channel.step ? 0.0f : (a_time - times[prev]) / (times[next] - times[prev]);
+      if(channel.path == GLTFAnimationChannel::ROTATION)
+        value = slerp(channel.values[prev], channel.values[next], t);
+      else
+        value = channel.values[prev] + t * (channel.values[next] - channel.values[prev]);
+    }
+
+    auto &node = a_nodes[channel.node];
+    switch(channel.path)
+    {
+    case GLTFAnimationChannel::TRANSLATION: node.translation = to_float3(value); break;
+    case GLTFAnimationChannel::ROTATION:    node.rotation    = value;           break;
+    case GLTFAnimationChannel::SCALE:       node.scale       = to_float3(value); break;
+    default: break;
+    }
+  }
+}
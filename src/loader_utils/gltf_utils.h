@@ -8,7 +8,46 @@
 
 void getNumVerticesAndIndicesFromGLTFMesh(const tinygltf::Model &a_model, const tinygltf::Mesh &a_mesh, uint32_t& numVertices, uint32_t& numIndices);
 cmesh::SimpleMesh  simpleMeshFromGLTFMesh(const tinygltf::Model &a_model, const tinygltf::Mesh &a_mesh);
+// Converts triangles of a mesh straight to the interleaved vertex layout of MeshData8F (8 floats per vertex) with indices
+// rebased to the first vertex of the mesh and a material id per triangle. Outputs are sized by getNumVerticesAndIndicesFromGLTFMesh;
+// returns false if some primitive has unsupported or invalid data (its triangles are written degenerate)
+bool convertGLTFMesh8F(const tinygltf::Model &a_model, const tinygltf::Mesh &a_mesh, float* a_vertices, uint32_t* a_indices,
+  uint32_t* a_matIndices);
 LiteMath::float4x4 transformMatrixFromGLTFNode(const tinygltf::Node &node);
 MaterialData_pbrMR materialDataFromGLTF(const tinygltf::Material &gltfMat);
 
+// local transform of a node in the form animations change it; nodes given by matrix are never animated
+struct GLTFNodeTransform
+{
+  LiteMath::float3   translation = LiteMath::float3(0.0f, 0.0f, 0.0f);
+  LiteMath::float4   rotation    = LiteMath::float4(0.0f, 0.0f, 0.0f, 1.0f); // quaternion (x, y, z, w)
+  LiteMath::float3   scale       = LiteMath::float3(1.0f, 1.0f, 1.0f);
+  LiteMath::float4x4 matrix;
+  bool hasMatrix = false;
+};
+
+struct GLTFAnimationChannel
+{
+  enum PATH { TRANSLATION, ROTATION, SCALE };
+  int  node = -1;
+  PATH path = TRANSLATION;
+  bool step = false; // STEP interpolation, otherwise LINEAR (CUBICSPLINE is loaded as LINEAR between its values)
+  std::vector<float>            times;
+  std::vector<LiteMath::float4> values; // xyz for translation and scale
+};
+
+struct GLTFAnimation
+{
+  std::string name;
+  float duration = 0.0f;
+  std::vector<GLTFAnimationChannel> channels;
+};
+
+GLTFNodeTransform  nodeTransformFromGLTF(const tinygltf::Node &node);
+LiteMath::float4x4 matrixFromNodeTransform(const GLTFNodeTransform &a_transform);
+// node animations only, morph target weights are skipped
+std::vector<GLTFAnimation> animationsFromGLTF(const tinygltf::Model &a_model);
+// writes animated translations, rotations and scales to 'a_nodes' (indexed as nodes of the model) at time 'a_time' in seconds
+void sampleGLTFAnimation(const GLTFAnimation &a_anim, float a_time, GLTFNodeTransform* a_nodes);
+
 #endif// CHIMERA_GLTF_UTILS_H
@@ -1,10 +1,11 @@
 #include "hydraxml.h"
 
+#include <algorithm>
+#include <charconv>
+#include <cctype>
+#include <cstdlib>
 #include <iostream>
-#include <sstream>
 #include <fstream>
-#include <locale>
-#include <codecvt>
 
 #if defined(__ANDROID__)
 #define LOGE(...) \
@@ -13,20 +14,6 @@
 
 namespace hydra_xml
 {
-  std::wstring s2ws(const std::string& str)
-  {
-    using convert_typeX = std::codecvt_utf8<wchar_t>;
-    std::wstring_convert<convert_typeX, wchar_t> converterX;
-    return converterX.from_bytes(str);
-  }
-
-  std::string ws2s(const std::wstring& wstr)
-  {
-    using convert_typeX = std::codecvt_utf8<wchar_t>;
-    std::wstring_convert<convert_typeX, wchar_t> converterX;
-    return converterX.to_bytes(wstr);
-  }
-
   void HydraScene::LogError(const std::string &msg)
   {
     std::cout << "HydraScene ERROR: " << msg << std::endl;
@@ -62,17 +49,17 @@ namespace hydra_xml
       return -1;
     }
 
-    auto pos = path.find_last_of(L'/');
+    auto pos = path.find_last_of('/');
     m_libraryRootDir = path.substr(0, pos);
 
-    auto texturesLib  = xmlDoc.child(L"textures_lib");
-    auto materialsLib = xmlDoc.child(L"materials_lib");
-    auto geometryLib  = xmlDoc.child(L"geometry_lib");
-    auto lightsLib    = xmlDoc.child(L"lights_lib");
+    auto texturesLib  = xmlDoc.child("textures_lib");
+    auto materialsLib = xmlDoc.child("materials_lib");
+    auto geometryLib  = xmlDoc.child("geometry_lib");
+    auto lightsLib    = xmlDoc.child("lights_lib");
 
-    auto cameraLib    = xmlDoc.child(L"cam_lib");
-    auto settingsNode = xmlDoc.child(L"render_lib");
-    auto sceneNode    = xmlDoc.child(L"scenes");
+    auto cameraLib    = xmlDoc.child("cam_lib");
+    auto settingsNode = xmlDoc.child("render_lib");
+    auto sceneNode    = xmlDoc.child("scenes");
 
     if (texturesLib == nullptr || materialsLib == nullptr || lightsLib == nullptr || cameraLib == nullptr ||
         geometryLib == nullptr || settingsNode == nullptr || sceneNode == nullptr)
@@ -93,26 +80,23 @@ namespace hydra_xml
 
     if(!loaded)
     {
-      std::string  str(loaded.description());
-      std::wstring errorMsg(str.begin(), str.end());
-
       LogError("Error loading scene from: " + path);
-      LogError(ws2s(errorMsg));
+      LogError(loaded.description());
 
       return -1;
     }
 
-    auto pos = path.find_last_of(L'/');
+    auto pos = path.find_last_of('/');
     m_libraryRootDir = path.substr(0, pos);
 
-    m_texturesLib  = m_xmlDoc.child(L"textures_lib");
-    m_materialsLib = m_xmlDoc.child(L"materials_lib");
-    m_geometryLib  = m_xmlDoc.child(L"geometry_lib");
-    m_lightsLib    = m_xmlDoc.child(L"lights_lib");
+    m_texturesLib  = m_xmlDoc.child("textures_lib");
+    m_materialsLib = m_xmlDoc.child("materials_lib");
+    m_geometryLib  = m_xmlDoc.child("geometry_lib");
+    m_lightsLib    = m_xmlDoc.child("lights_lib");
 
-    m_cameraLib    = m_xmlDoc.child(L"cam_lib");
-    m_settingsNode = m_xmlDoc.child(L"render_lib");
-    m_sceneNode    = m_xmlDoc.child(L"scenes");
+    m_cameraLib    = m_xmlDoc.child("cam_lib");
+    m_settingsNode = m_xmlDoc.child("render_lib");
+    m_sceneNode    = m_xmlDoc.child("scenes");
 
     if (m_texturesLib == nullptr || m_materialsLib == nullptr || m_lightsLib == nullptr || m_cameraLib == nullptr || m_geometryLib == nullptr || m_settingsNode == nullptr || m_sceneNode == nullptr)
     {
@@ -127,105 +111,143 @@ namespace hydra_xml
   }
 #endif
 
-  void HydraScene::parseInstancedMeshes(pugi::xml_node a_scenelib, pugi::xml_node a_geomlib)
+  int HydraScene::LoadChanges(const std::string &path)
   {
-    auto scene = a_scenelib.first_child();
-    for (pugi::xml_node inst = scene.first_child(); inst != nullptr; inst = inst.next_sibling())
+    auto loaded = m_xmlDoc.load_file(path.c_str());
+    if(!loaded)
     {
-      if (std::wstring(inst.name()) == L"instance_light")
-        break;
+      LogError("Error loading scene changes from: " + path);
+      LogError(loaded.description());
+      return -1;
+    }
 
-      auto mesh_id = inst.attribute(L"mesh_id").as_string();
-      auto matrix = std::wstring(inst.attribute(L"matrix").as_string());
+    auto pos = path.find_last_of('/');
+    m_libraryRootDir = path.substr(0, pos);
 
-      auto meshNode = a_geomlib.find_child_by_attribute(L"id", mesh_id);
+    m_texturesLib  = m_xmlDoc.child("textures_lib");
+    m_materialsLib = m_xmlDoc.child("materials_lib");
+    m_geometryLib  = m_xmlDoc.child("geometry_lib");
+    m_lightsLib    = m_xmlDoc.child("lights_lib");
 
-      if(meshNode != nullptr)
-      {
-        auto meshLoc = ws2s(std::wstring(meshNode.attribute(L"loc").as_string()));
-        meshLoc = m_libraryRootDir + "/" + meshLoc;
+    m_cameraLib    = m_xmlDoc.child("cam_lib");
+    m_settingsNode = m_xmlDoc.child("render_lib");
+    m_sceneNode    = m_xmlDoc.child("scenes");
+
+    return 0;
+  }
+
+  void HydraScene::parseInstancedMeshes(pugi::xml_node a_scenelib, pugi::xml_node a_geomlib)
+  {
+    // instances refer to meshes by integer id, so ids index arrays and each mesh file is checked once
+    uint32_t meshNum = 0;
+    for(pugi::xml_node meshNode : a_geomlib.children())
+      meshNum = std::max(meshNum, meshNode.attribute("id").as_uint() + 1);
+
+    std::vector<bool> meshFound(meshNum, false);
+    for(pugi::xml_node meshNode : a_geomlib.children())
+    {
+      const uint32_t meshId = meshNode.attribute("id").as_uint();
+      std::string meshLoc = m_libraryRootDir + "/" + meshNode.attribute("loc").as_string();
 
 #if not defined(__ANDROID__)
-        std::ifstream checkMesh(meshLoc);
-        if(!checkMesh.good())
-        {
-          LogError("Mesh not found at: " + meshLoc + ". Loader will skip it.");
-          continue;
-        }
-        else
-        {
-          checkMesh.close();
-        }
+      std::ifstream checkMesh(meshLoc);
+      if(!checkMesh.good())
+      {
+        LogError("Mesh not found at: " + meshLoc + ". Loader will skip it.");
+        continue;
+      }
 #endif
+      meshFound[meshId] = true;
+      m_meshIdPerLoc[meshLoc] = meshId;
+    }
 
-        if(unique_meshes.find(meshLoc) == unique_meshes.end())
-        {
-          unique_meshes.emplace(meshLoc);
-          //m_meshloc.push_back(meshLoc);
-        }
-
-
-        if(m_instancesPerMeshLoc.find(meshLoc) != m_instancesPerMeshLoc.end())
-        {
-          m_instancesPerMeshLoc[meshLoc].push_back(float4x4FromString(matrix));
-        }
-        else
-        {
-          std::vector<LiteMath::float4x4> tmp = { float4x4FromString(matrix) };
-          m_instancesPerMeshLoc[meshLoc] = tmp;
-        }
+    // count instances per mesh first, so matrices are parsed straight to their place in one array
+    auto scene = a_scenelib.first_child();
+    m_instanceOffsets.assign(meshNum + 1, 0);
+    for (pugi::xml_node inst = scene.first_child(); inst != nullptr; inst = inst.next_sibling())
+    {
+      if (strcmp(inst.name(), "instance_light") == 0)
+        break;
+      const uint32_t meshId = inst.attribute("mesh_id").as_uint(uint32_t(-1));
+      if(meshId < meshNum && meshFound[meshId])
+        m_instanceOffsets[meshId + 1]++;
+    }
+    for(uint32_t i = 0; i < meshNum; ++i)
+      m_instanceOffsets[i + 1] += m_instanceOffsets[i];
+
+    m_instanceMatrices.resize(m_instanceOffsets[meshNum]);
+    m_instanceIds.resize(m_instanceOffsets[meshNum]);
+    std::vector<uint32_t> instanceNext(m_instanceOffsets.begin(), m_instanceOffsets.end() - 1);
+    for (pugi::xml_node inst = scene.first_child(); inst != nullptr; inst = inst.next_sibling())
+    {
+      if (strcmp(inst.name(), "instance_light") == 0)
+        break;
+      const uint32_t meshId = inst.attribute("mesh_id").as_uint(uint32_t(-1));
+      if(meshId < meshNum && meshFound[meshId])
+      {
+        const uint32_t pos = instanceNext[meshId]++;
+        m_instanceIds[pos]      = inst.attribute("id").as_uint();
+        m_instanceMatrices[pos] = float4x4FromString(inst.attribute("matrix").as_string());
       }
     }
+  }
 
+  int readFloats(const char* a_str, float* a_out, int a_count)
+  {
+    if(a_str == nullptr)
+      return 0;
 
+    const char* end = a_str + strlen(a_str);
+    int i = 0;
+    for(; i < a_count; ++i)
+    {
+      while(a_str < end && (isspace((unsigned char)(*a_str)) || *a_str == ',' || *a_str == '+'))
+        ++a_str;
+#if defined(__cpp_lib_to_chars)
+      auto res = std::from_chars(a_str, end, a_out[i]);
+      if(res.ec != std::errc())
+        break;
+      a_str = res.ptr;
+#else
+      char* next = nullptr;
+      a_out[i] = strtof(a_str, &next);
+      if(next == a_str)
+        break;
+      a_str = next;
+#endif
+    }
+    return i;
   }
 
-  LiteMath::float4x4 float4x4FromString(const std::wstring &matrix_str)
+  LiteMath::float4x4 float4x4FromString(const char* matrix_str)
   {
-    LiteMath::float4x4 result;
-    std::wstringstream inputStream(matrix_str);
-    
-    float data[16];
-    for(int i = 0; i < 16; i++)
-      inputStream >> data[i];
-    
-    result.set_row(0, LiteMath::float4(data[0],data[1], data[2], data[3]));
-    result.set_row(1, LiteMath::float4(data[4],data[5], data[6], data[7]));
-    result.set_row(2, LiteMath::float4(data[8],data[9], data[10], data[11]));
-    result.set_row(3, LiteMath::float4(data[12],data[13], data[14], data[15])); 
-
-    return result;
+    float data[16] = {1, 0, 0, 0,
+                      0, 1, 0, 0,
+                      0, 0, 1, 0,
+                      0, 0, 0, 1};
+    readFloats(matrix_str, data, 16);
+    return LiteMath::float4x4(data); // row-major, as written by Hydra
   }
 
   LiteMath::float3 read3f(pugi::xml_attribute a_attr)
   {
-    LiteMath::float3 res(0, 0, 0);
-    const wchar_t* camPosStr = a_attr.as_string();
-    if (camPosStr != nullptr)
-    {
-      std::wstringstream inputStream(camPosStr);
-      inputStream >> res.x >> res.y >> res.z;
-    }
-    return res;
+    float res[3] = {0, 0, 0};
+    readFloats(a_attr.as_string(), res, 3);
+    return LiteMath::float3(res[0], res[1], res[2]);
   }
 
   LiteMath::float3 read3f(pugi::xml_node a_node)
   {
-    LiteMath::float3 res(0,0,0);
-    const wchar_t* camPosStr = a_node.text().as_string();
-    if (camPosStr != nullptr)
-    {
-      std::wstringstream inputStream(camPosStr);
-      inputStream >> res.x >> res.y >> res.z;
-    }
-    return res;
+    float res[3] = {0, 0, 0};
+    readFloats(a_node.text().as_string(), res, 3);
+    return LiteMath::float3(res[0], res[1], res[2]);
   }
 
   LiteMath::float3 readval3f(pugi::xml_node a_node)
   {
     float3 color;
-    if(a_node.attribute(L"val") != nullptr)
-      color = hydra_xml::read3f(a_node.attribute(L"val"));
+    if(a_node.attribute("val") != nullptr)
+      color = hydra_xml::read3f(a_node.attribute("val"));
     else
       color = hydra_xml::read3f(a_node);
     return color;
@@ -233,13 +255,10 @@ namespace hydra_xml
 
   std::vector<LightInstance> HydraScene::InstancesLights(uint32_t a_sceneId) 
   {
-    auto sceneNode = m_sceneNode.child(L"scene");
+    auto sceneNode = m_sceneNode.child("scene");
     if(a_sceneId != 0)
     {
-      std::wstringstream temp;
-      temp << a_sceneId;
-      std::wstring tempStr = temp.str();
-      sceneNode = m_sceneNode.find_child_by_attribute(L"id", tempStr.c_str());
+      sceneNode = m_sceneNode.find_child_by_attribute("id", std::to_string(a_sceneId).c_str());
     }
 
     std::vector<pugi::xml_node> lights; 
@@ -251,14 +270,13 @@ namespace hydra_xml
     result.reserve(256);
 
     LightInstance inst;
-    for(auto instNode = sceneNode.child(L"instance_light"); instNode != nullptr; instNode = instNode.next_sibling())
+    for(auto instNode = sceneNode.child("instance_light"); instNode != nullptr; instNode = instNode.next_sibling())
     {
-      std::wstring nameStr = instNode.name();
-      if(nameStr != L"instance_light")
+      if(strcmp(instNode.name(), "instance_light") != 0)
         continue;
       inst.instNode  = instNode;
-      inst.instId    = instNode.attribute(L"id").as_uint();
-      inst.lightId   = instNode.attribute(L"light_id").as_uint(); 
+      inst.instId    = instNode.attribute("id").as_uint();
+      inst.lightId   = instNode.attribute("light_id").as_uint(); 
       inst.lightNode = lights[inst.lightId];
     }
     return result;
@@ -6,7 +6,9 @@
 using namespace LiteMath;
 
 #include <vector>
-#include <set>
+#include <string>
+#include <cstring>
+#include <algorithm>
 #include <unordered_map>
 #include <iostream>
 
@@ -17,9 +19,8 @@ using namespace LiteMath;
 
 namespace hydra_xml
 {
-  std::wstring s2ws(const std::string& str);
-  std::string  ws2s(const std::wstring& wstr);
-  LiteMath::float4x4 float4x4FromString(const std::wstring &matrix_str);
+  int                readFloats(const char* a_str, float* a_out, int a_count); ///< returns the number of floats read
+  LiteMath::float4x4 float4x4FromString(const char* matrix_str);
   LiteMath::float3   read3f(pugi::xml_attribute a_attr);
   LiteMath::float3   read3f(pugi::xml_node a_node);
   LiteMath::float3   readval3f(pugi::xml_node a_node);
@@ -31,6 +32,7 @@ namespace hydra_xml
   
   struct Instance
   {
+    uint32_t           instId = uint32_t(-1); ///< instance id
     uint32_t           geomId = uint32_t(-1); ///< geom id
     uint32_t           rmapId = uint32_t(-1); ///< remap list id, todo: add function to get real remap list by id
     LiteMath::float4x4 matrix;                ///< transform matrix
@@ -108,9 +110,8 @@ namespace hydra_xml
   
     std::string operator*() const 
     { 
-      auto attr    = m_iter->attribute(L"loc");
-      auto meshLoc = ws2s(std::wstring(attr.as_string()));
-      return m_libraryRootDir + "/" + meshLoc;
+      auto attr    = m_iter->attribute("loc");
+      return m_libraryRootDir + "/" + attr.as_string();
     }
   
 		const LocIterator& operator++() { ++m_iter; return *this; }
@@ -142,17 +143,18 @@ namespace hydra_xml
     Instance operator*() const 
     { 
       Instance inst;
-      inst.geomId = m_iter->attribute(L"mesh_id").as_uint();
-      inst.rmapId = m_iter->attribute(L"rmap_id").as_uint();
-      inst.matrix = float4x4FromString(m_iter->attribute(L"matrix").as_string());
+      inst.instId = m_iter->attribute("id").as_uint();
+      inst.geomId = m_iter->attribute("mesh_id").as_uint();
+      inst.rmapId = m_iter->attribute("rmap_id").as_uint();
+      inst.matrix = float4x4FromString(m_iter->attribute("matrix").as_string());
       return inst;
     }
   
-		const InstIterator& operator++() { do ++m_iter; while(m_iter != m_end && std::wstring(m_iter->name()) != L"instance"); return *this; }
-		InstIterator operator++(int)     { do m_iter++; while(m_iter != m_end && std::wstring(m_iter->name()) != L"instance"); return *this; }
+		const InstIterator& operator++() { do ++m_iter; while(m_iter != m_end && strcmp(m_iter->name(), "instance") != 0); return *this; }
+		InstIterator operator++(int)     { do m_iter++; while(m_iter != m_end && strcmp(m_iter->name(), "instance") != 0); return *this; }
   
-		const InstIterator& operator--() { do --m_iter; while(m_iter != m_end && std::wstring(m_iter->name()) != L"instance"); return *this; }
-		InstIterator operator--(int)     { do m_iter--; while(m_iter != m_end && std::wstring(m_iter->name()) != L"instance"); return *this; }
+		const InstIterator& operator--() { do --m_iter; while(m_iter != m_end && strcmp(m_iter->name(), "instance") != 0); return *this; }
+		InstIterator operator--(int)     { do m_iter--; while(m_iter != m_end && strcmp(m_iter->name(), "instance") != 0); return *this; }
   
   private:
     pugi::xml_node_iterator m_iter;
@@ -177,13 +179,13 @@ namespace hydra_xml
     Camera operator*() const 
     { 
       Camera cam = {};
-      cam.fov       = m_iter->child(L"fov").text().as_float(); 
-      cam.nearPlane = m_iter->child(L"nearClipPlane").text().as_float();
-      cam.farPlane  = m_iter->child(L"farClipPlane").text().as_float();  
+      cam.fov       = m_iter->child("fov").text().as_float(); 
+      cam.nearPlane = m_iter->child("nearClipPlane").text().as_float();
+      cam.farPlane  = m_iter->child("farClipPlane").text().as_float();  
       
-      LiteMath::float3 pos    = hydra_xml::read3f(m_iter->child(L"position"));
-      LiteMath::float3 lookAt = hydra_xml::read3f(m_iter->child(L"look_at"));
-      LiteMath::float3 up     = hydra_xml::read3f(m_iter->child(L"up"));
+      LiteMath::float3 pos    = hydra_xml::read3f(m_iter->child("position"));
+      LiteMath::float3 lookAt = hydra_xml::read3f(m_iter->child("look_at"));
+      LiteMath::float3 up     = hydra_xml::read3f(m_iter->child("up"));
       for(int i=0;i<3;i++)
       {
         cam.pos   [i] = pos[i];
@@ -229,14 +231,15 @@ namespace hydra_xml
       materialData.metRoughnessData.baseColorTexId = -1;
       materialData.metRoughnessData.metallicRoughnessTexId = -1;
 
-      if(m_iter->child(L"opacity").child(L"texture"))
+      if(m_iter->child("opacity").child("texture"))
       {
         materialData.alphaMode = 1;
       }
 
-      LiteMath::float3 emission = hydra_xml::read3f(m_iter->child(L"emission").child(L"color").attribute(L"val"));
-      LiteMath::float3 diffuse  = hydra_xml::read3f(m_iter->child(L"diffuse").child(L"color").attribute(L"val"));
-      LiteMath::float3 reflect  = hydra_xml::read3f(m_iter->child(L"reflectivity").child(L"color").attribute(L"val"));
+      LiteMath::float3 emission = hydra_xml::read3f(m_iter->child("emission").child("color").attribute("val"));
+      LiteMath::float3 diffuse  = hydra_xml::read3f(m_iter->child("diffuse").child("color").attribute("val"));
+      LiteMath::float3 reflect  = hydra_xml::read3f(m_iter->child("reflectivity").child("color").attribute("val"));
+      LiteMath::float3 transp   = hydra_xml::read3f(m_iter->child("transparency").child("color").attribute("val"));
 
       // determine where to take the base color
       bool diffColor = true;
@@ -251,9 +254,17 @@ namespace hydra_xml
         materialData.metRoughnessData.baseColor[2] = reflect.z;
       }
 
-      materialData.metRoughnessData.roughness = 1.0f - m_iter->child(L"reflectivity").child(L"glossiness").attribute(L"val").as_float();
+      // transparent (glass-like) material: alpha is the part of light which is not transmitted
+      const float transparency = std::max(transp.x, std::max(transp.y, transp.z));
+      materialData.metRoughnessData.baseColor[3] = 1.0f - std::min(transparency, 1.0f);
+      if(transparency > LiteMath::EPSILON && materialData.alphaMode == 0)
+      {
+        materialData.alphaMode = 2;
+      }
+
+      materialData.metRoughnessData.roughness = 1.0f - m_iter->child("reflectivity").child("glossiness").attribute("val").as_float();
 
-      float ior = m_iter->child(L"reflectivity").child(L"fresnel_ior").attribute(L"val").as_float();
+      float ior = m_iter->child("reflectivity").child("fresnel_ior").attribute("val").as_float();
       materialData.metRoughnessData.metallic = ior < LiteMath::EPSILON ? 0 : powf((1 - ior) / (1 + ior), 2);
 
       materialData.emissionColor[0] = emission.x;
@@ -262,35 +273,35 @@ namespace hydra_xml
 
       // texture IDs
       //
-      auto emissionColorTex = m_iter->child(L"emission").child(L"color").child(L"texture");
+      auto emissionColorTex = m_iter->child("emission").child("color").child("texture");
       if(emissionColorTex)
       {
-        materialData.emissionTexId = emissionColorTex.attribute(L"id").as_int();
+        materialData.emissionTexId = emissionColorTex.attribute("id").as_int();
       }
 
-      auto baseColorTex = m_iter->child(L"diffuse").child(L"color").child(L"texture");
+      auto baseColorTex = m_iter->child("diffuse").child("color").child("texture");
       if(!diffColor)
       {
-        baseColorTex = m_iter->child(L"reflectivity").child(L"color").child(L"texture");
+        baseColorTex = m_iter->child("reflectivity").child("color").child("texture");
       }
       if(baseColorTex)
       {
-        materialData.metRoughnessData.baseColorTexId = baseColorTex.attribute(L"id").as_int();
+        materialData.metRoughnessData.baseColorTexId = baseColorTex.attribute("id").as_int();
       }
 
-      auto roughnessTex = m_iter->child(L"reflectivity").child(L"glossiness").child(L"texture");
+      auto roughnessTex = m_iter->child("reflectivity").child("glossiness").child("texture");
       if(roughnessTex)
       {
-        materialData.metRoughnessData.metallicRoughnessTexId = roughnessTex.attribute(L"id").as_int();
+        materialData.metRoughnessData.metallicRoughnessTexId = roughnessTex.attribute("id").as_int();
       }
 
-      auto displaceType = std::wstring(m_iter->child(L"displacement").attribute(L"type").as_string());
-//      if(displaceType == L"height_bump")
+      auto displaceType = std::string(m_iter->child("displacement").attribute("type").as_string());
+//      if(displaceType == "height_bump")
       {
-        auto normalTex = m_iter->child(L"displacement").child(L"height_map").child(L"texture");
+        auto normalTex = m_iter->child("displacement").child("height_map").child("texture");
         if(normalTex)
         {
-          materialData.normalTexId = normalTex.attribute(L"id").as_int();
+          materialData.normalTexId = normalTex.attribute("id").as_int();
         }
       }
         return materialData;
@@ -323,6 +334,10 @@ namespace hydra_xml
     int LoadState(const std::string &path);
     #endif  
 
+    // change file lists only changed library nodes (every library may be absent) and the scene, if its instances have changed
+    int  LoadChanges(const std::string &path);
+    bool DiscardsInstances() { return m_sceneNode.child("scene").attribute("discard").as_int() == 1; } ///< instances of the change replace all previous ones
+
     //// use this functions with C++11 range for 
     //
     pugi::xml_object_range<pugi::xml_node_iterator> TextureNodes()  { return m_texturesLib.children();  } 
@@ -339,8 +354,8 @@ namespace hydra_xml
     pugi::xml_object_range<LocIterator> TextureFiles() { return {LocIterator(m_texturesLib.begin(), m_libraryRootDir),
                                                                  LocIterator(m_texturesLib.end(), m_libraryRootDir)}; }
 
-    pugi::xml_object_range<InstIterator> InstancesGeom() { return {InstIterator(m_sceneNode.child(L"scene").child(L"instance"), m_sceneNode.child(L"scene").end()),
-                                                                   InstIterator(m_sceneNode.child(L"scene").end(), m_sceneNode.child(L"scene").end())}; }
+    pugi::xml_object_range<InstIterator> InstancesGeom() { return {InstIterator(m_sceneNode.child("scene").child("instance"), m_sceneNode.child("scene").end()),
+                                                                   InstIterator(m_sceneNode.child("scene").end(), m_sceneNode.child("scene").end())}; }
     
     std::vector<LightInstance> InstancesLights(uint32_t a_sceneId = 0);
 
@@ -350,20 +365,35 @@ namespace hydra_xml
     pugi::xml_object_range<MaterialIteratorGLTF> MaterialsGLTF() { return {MaterialIteratorGLTF(m_materialsLib.begin()),
         MaterialIteratorGLTF(m_materialsLib.end())}; }
 
+    //// instance matrices of a mesh by its id in geometry_lib, without copying them
+    //
+    pugi::xml_object_range<const LiteMath::float4x4*> InstancesOfMesh(uint32_t a_meshId) const
+    {
+      if(size_t(a_meshId) + 1 >= m_instanceOffsets.size())
+        return {nullptr, nullptr};
+      return {m_instanceMatrices.data() + m_instanceOffsets[a_meshId], m_instanceMatrices.data() + m_instanceOffsets[a_meshId + 1]};
+    }
+
+    pugi::xml_object_range<const uint32_t*> InstanceIdsOfMesh(uint32_t a_meshId) const ///< in the order of InstancesOfMesh
+    {
+      if(size_t(a_meshId) + 1 >= m_instanceOffsets.size())
+        return {nullptr, nullptr};
+      return {m_instanceIds.data() + m_instanceOffsets[a_meshId], m_instanceIds.data() + m_instanceOffsets[a_meshId + 1]};
+    }
+
     std::vector<LiteMath::float4x4> GetAllInstancesOfMeshLoc(const std::string& a_loc) const 
     { 
-      auto pFound = m_instancesPerMeshLoc.find(a_loc);
-      if(pFound == m_instancesPerMeshLoc.end())
+      auto pFound = m_meshIdPerLoc.find(a_loc);
+      if(pFound == m_meshIdPerLoc.end())
         return {};
-      else
-        return pFound->second; 
+      auto instances = InstancesOfMesh(pFound->second);
+      return std::vector<LiteMath::float4x4>(instances.begin(), instances.end());
     }
     
   private:
     void parseInstancedMeshes(pugi::xml_node a_scenelib, pugi::xml_node a_geomlib);
     void LogError(const std::string &msg);  
     
-    std::set<std::string> unique_meshes;
     std::string m_libraryRootDir;
     pugi::xml_node m_texturesLib ; 
     pugi::xml_node m_materialsLib; 
@@ -374,7 +404,11 @@ namespace hydra_xml
     pugi::xml_node m_sceneNode   ; 
     pugi::xml_document m_xmlDoc;
 
-    std::unordered_map<std::string, std::vector<LiteMath::float4x4> > m_instancesPerMeshLoc;
+    // instance matrices grouped by mesh id: matrices of mesh i are in [m_instanceOffsets[i], m_instanceOffsets[i + 1])
+    std::vector<uint32_t>           m_instanceOffsets;
+    std::vector<LiteMath::float4x4> m_instanceMatrices;
+    std::vector<uint32_t>           m_instanceIds;
+    std::unordered_map<std::string, uint32_t> m_meshIdPerLoc;
   };
 
   
@@ -0,0 +1,53 @@
+#include "vsgf.h"
+
+#include <cstring>
+
+namespace
+{
+  struct VSGFHeader
+  {
+    uint64_t fileSizeInBytes;
+    uint32_t verticesNum;
+    uint32_t indicesNum;
+    uint32_t materialsNum;
+    uint32_t flags;
+  };
+
+  enum VSGF_FLAGS : uint32_t
+  {
+    VSGF_HAS_TANGENT    = 1,
+    VSGF_HAS_NO_NORMALS = 8,
+  };
+}
+
+bool ParseVSGF(const uint8_t* a_data, size_t a_size, VSGFMeshView* a_pView)
+{
+  if(a_data == nullptr || a_size < sizeof(VSGFHeader))
+    return false;
+
+  VSGFHeader header;
+  memcpy(&header, a_data, sizeof(header));
+
+  // streams follow the header in this order: positions, normals, tangents, texture coordinates, indices, material ids
+  const uint64_t vert4fSize = uint64_t(header.verticesNum) * 4 * sizeof(float);
+  const uint64_t posOffset  = sizeof(VSGFHeader);
+  const uint64_t normOffset = posOffset + vert4fSize;
+  const uint64_t tangOffset = normOffset + ((header.flags & VSGF_HAS_NO_NORMALS) ? 0 : vert4fSize);
+  const uint64_t texOffset  = tangOffset + ((header.flags & VSGF_HAS_TANGENT) ? vert4fSize : 0);
+  const uint64_t indOffset  = texOffset  + uint64_t(header.verticesNum) * 2 * sizeof(float);
+  const uint64_t matOffset  = indOffset  + uint64_t(header.indicesNum) * sizeof(uint32_t);
+  const uint64_t totalSize  = matOffset  + uint64_t(header.indicesNum / 3) * sizeof(uint32_t);
+
+  if(totalSize > a_size || header.indicesNum % 3 != 0)
+    return false;
+
+  a_pView->vertNum    = header.verticesNum;
+  a_pView->indNum     = header.indicesNum;
+  a_pView->pos4f      = reinterpret_cast<const float*>(a_data + posOffset);
+  a_pView->norm4f     = (header.flags & VSGF_HAS_NO_NORMALS) ? nullptr : reinterpret_cast<const float*>(a_data + normOffset);
+  a_pView->tang4f     = (header.flags & VSGF_HAS_TANGENT) ? reinterpret_cast<const float*>(a_data + tangOffset) : nullptr;
+  a_pView->texCoord2f = reinterpret_cast<const float*>(a_data + texOffset);
+  a_pView->indices    = reinterpret_cast<const uint32_t*>(a_data + indOffset);
+  a_pView->matIndices = reinterpret_cast<const uint32_t*>(a_data + matOffset);
+  return true;
+}
@@ -0,0 +1,29 @@
+#ifndef CHIMERA_VSGF_H
+#define CHIMERA_VSGF_H
+
+#include <cstdint>
+#include <cstddef>
+
+/**
+\brief Mesh in VSGF format ('.vsgf' geometry chunks of Hydra scenes) viewed in place: pointers refer to the file data
+       (e.g. memory mapping) and are valid while it is alive
+*/
+struct VSGFMeshView
+{
+  uint32_t vertNum = 0;
+  uint32_t indNum  = 0;
+  const float*    pos4f      = nullptr;
+  const float*    norm4f     = nullptr; ///< nullptr if the mesh has no normals
+  const float*    tang4f     = nullptr; ///< nullptr if the mesh has no tangents
+  const float*    texCoord2f = nullptr;
+  const uint32_t* indices    = nullptr;
+  const uint32_t* matIndices = nullptr; ///< one per triangle
+};
+
+/**
+\brief Parse VSGF header and locate data streams without copying them
+\return false if data is truncated or the header is inconsistent
+*/
+bool ParseVSGF(const uint8_t* a_data, size_t a_size, VSGFMeshView* a_pView);
+
+#endif// CHIMERA_VSGF_H
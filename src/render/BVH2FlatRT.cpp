@@ -0,0 +1,959 @@
+#include <iostream>
+#include <fstream>
+#include <vector>
+#include <numeric>
+#include <algorithm>
+#include <filesystem>
+#include <cmath>
+#include <cfloat>
+#include <limits>
+#include <cstring>
+#include <cstdlib>
+#include <cassert>
+#include <unordered_map>
+
+#include "CrossRT.h"
+#include "alpha_mask.h"
+#include "utils/mapped_file.h"
+#include "utils/content_hash.h"
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#endif
+
+using LiteMath::float3;
+using LiteMath::float4;
+using LiteMath::float4x4;
+
+/**
+\brief Node of a flattened BVH2; children of an inner node are always stored next to each other
+*/
+struct BVHNodeFlat
+{
+  float    boxMin[3];
+  uint32_t leftOrFirst; ///< index of the left child for inner nodes, index of the first primitive for leaves
+  float    boxMax[3];
+  uint32_t primCount;   ///< zero for inner nodes
+};
+
+/**
+\brief Triangle prepared for Moller-Trumbore test: first vertex and two edges, w is padding
+*/
+struct TriangleFlat
+{
+  float v0[4];
+  float e1[4];
+  float e2[4];
+};
+
+static_assert(sizeof(BVHNodeFlat)  == 32, "BVHNodeFlat is written to the cache as is");
+static_assert(sizeof(TriangleFlat) == 48, "TriangleFlat is written to the cache as is");
+
+/**
+\brief Header of a BLAS cache file. All sections are 64-byte aligned, so that the mapped file can be used in place
+*/
+struct BVHCacheHeader
+{
+  uint32_t magic;
+  uint32_t version;
+  uint64_t key;
+  uint64_t fileSize;
+  uint32_t nodeNum;
+  uint32_t triNum;
+  uint64_t nodesOffset;
+  uint64_t trisOffset;
+  uint64_t primIdsOffset;
+  uint64_t reserved;
+};
+
+static_assert(sizeof(BVHCacheHeader) == 64, "BVHCacheHeader should occupy exactly one cache line");
+
+static constexpr uint32_t BVH_CACHE_MAGIC   = 0x32485642; // "BVH2"
+static constexpr uint32_t BVH_CACHE_VERSION = 2;
+
+// build settings; they are a part of the cache key, so changing them invalidates old cache files
+static constexpr uint32_t BVH_SAH_BINS       = 16;
+static constexpr uint32_t BVH_MAX_LEAF_PRIMS = 8;
+static constexpr float    BVH_TRAVERSAL_COST = 1.0f;
+static constexpr float    BVH_ISECT_COST     = 1.0f;
+static constexpr uint32_t BVH_STACK_SIZE     = 64; // traversal stack; the builder limits tree depth so that it never overflows
+
+static inline uint64_t AlignUp64(uint64_t a_offset) { return (a_offset + 63ull) & ~63ull; }
+
+struct PrimBox
+{
+  float3 boxMin;
+  float3 boxMax;
+  float3 center;
+};
+
+static inline uint32_t CeilLog2(uint32_t a_val)
+{
+  uint32_t res = 0;
+  while(res < 32 && (1ull << res) < a_val)
+    ++res;
+  return res;
+}
+
+static float HalfArea(const float3& a_min, const float3& a_max)
+{
+  const float3 d = a_max - a_min;
+  return d.x * d.y + d.x * d.z + d.y * d.z;
+}
+
+/**
+\brief Binned SAH builder; fills 'a_nodes' (root is node 0) and the order in which primitives should be stored in leaves.
+       Nodes too deep for SAH subtree to fit into BVH_STACK_SIZE switch to median splits, so inner nodes are at most BVH_STACK_SIZE - 1 deep
+*/
+static void BuildBinnedSAH(const std::vector<PrimBox>& a_prims, std::vector<BVHNodeFlat>& a_nodes, std::vector<uint32_t>& a_order)
+{
+  a_nodes.clear();
+  a_order.resize(a_prims.size());
+  std::iota(a_order.begin(), a_order.end(), 0u);
+
+  auto makeNode = [&](uint32_t first, uint32_t count) {
+    float3 bMin(+FLT_MAX, +FLT_MAX, +FLT_MAX);
+    float3 bMax(-FLT_MAX, -FLT_MAX, -FLT_MAX);
+    for(uint32_t i = first; i < first + count; ++i)
+    {
+      bMin = LiteMath::min(bMin, a_prims[a_order[i]].boxMin);
+      bMax = LiteMath::max(bMax, a_prims[a_order[i]].boxMax);
+    }
+    BVHNodeFlat node;
+    for(int k = 0; k < 3; ++k)
+    {
+      node.boxMin[k] = bMin[k];
+      node.boxMax[k] = bMax[k];
+    }
+    node.leftOrFirst = first;
+    node.primCount   = count;
+    return node;
+  };
+
+  if(a_prims.empty())
+  {
+    a_nodes.push_back(makeNode(0, 0));
+    return;
+  }
+
+  a_nodes.reserve(a_prims.size() * 2);
+  a_nodes.push_back(makeNode(0, uint32_t(a_prims.size())));
+
+  std::vector<std::pair<uint32_t, uint32_t> > stack = { {0u, 0u} }; // node and its depth
+  while(!stack.empty())
+  {
+    const auto [nodeId, depth] = stack.back();
+    stack.pop_back();
+
+    const uint32_t first = a_nodes[nodeId].leftOrFirst;
+    const uint32_t count = a_nodes[nodeId].primCount;
+    if(count <= 2)
+      continue;
+
+    float3 cMin(+FLT_MAX, +FLT_MAX, +FLT_MAX);
+    float3 cMax(-FLT_MAX, -FLT_MAX, -FLT_MAX);
+    for(uint32_t i = first; i < first + count; ++i)
+    {
+      cMin = LiteMath::min(cMin, a_prims[a_order[i]].center);
+      cMax = LiteMath::max(cMax, a_prims[a_order[i]].center);
+    }
+
+    // median splits reach nodes of 2 primitives in CeilLog2(count) - 1 levels; keep at least that many for the subtree
+    if(depth + CeilLog2(count) >= BVH_STACK_SIZE)
+    {
+      int axis = 0;
+      for(int k = 1; k < 3; ++k)
+        if(cMax[k] - cMin[k] > cMax[axis] - cMin[axis])
+          axis = k;
+      std::nth_element(a_order.begin() + first, a_order.begin() + first + count / 2, a_order.begin() + first + count,
+                       [&](uint32_t a, uint32_t b) { return a_prims[a].center[axis] < a_prims[b].center[axis]; });
+
+      const uint32_t leftId = uint32_t(a_nodes.size());
+      a_nodes.push_back(makeNode(first, count / 2));
+      a_nodes.push_back(makeNode(first + count / 2, count - count / 2));
+      a_nodes[nodeId].leftOrFirst = leftId;
+      a_nodes[nodeId].primCount   = 0;
+
+      stack.push_back({leftId,     depth + 1});
+      stack.push_back({leftId + 1, depth + 1});
+      continue;
+    }
+
+    const float parentArea = HalfArea(float3(a_nodes[nodeId].boxMin[0], a_nodes[nodeId].boxMin[1], a_nodes[nodeId].boxMin[2]),
+                                      float3(a_nodes[nodeId].boxMax[0], a_nodes[nodeId].boxMax[1], a_nodes[nodeId].boxMax[2]));
+
+    float    bestCost  = FLT_MAX;
+    int      bestAxis  = -1;
+    uint32_t bestSplit = 0;
+    for(int axis = 0; axis < 3; ++axis)
+    {
+      const float extent = cMax[axis] - cMin[axis];
+      if(extent <= 1e-20f)
+        continue;
+
+      uint32_t binCount[BVH_SAH_BINS] = {};
+      float3   binMin[BVH_SAH_BINS];
+      float3   binMax[BVH_SAH_BINS];
+      for(uint32_t b = 0; b < BVH_SAH_BINS; ++b)
+      {
+        binMin[b] = float3(+FLT_MAX, +FLT_MAX, +FLT_MAX);
+        binMax[b] = float3(-FLT_MAX, -FLT_MAX, -FLT_MAX);
+      }
+
+      const float scale = float(BVH_SAH_BINS) / extent;
+      for(uint32_t i = first; i < first + count; ++i)
+      {
+        const PrimBox& prim = a_prims[a_order[i]];
+        const uint32_t b    = std::min(BVH_SAH_BINS - 1, uint32_t((prim.center[axis] - cMin[axis]) * scale));
+        binCount[b]++;
+        binMin[b] = LiteMath::min(binMin[b], prim.boxMin);
+        binMax[b] = LiteMath::max(binMax[b], prim.boxMax);
+      }
+
+      // sweep from the right to get areas of all right parts, then from the left to evaluate every split
+      float    rightArea[BVH_SAH_BINS];
+      uint32_t rightCount[BVH_SAH_BINS];
+      float3   accMin(+FLT_MAX, +FLT_MAX, +FLT_MAX);
+      float3   accMax(-FLT_MAX, -FLT_MAX, -FLT_MAX);
+      uint32_t accCount = 0;
+      for(uint32_t b = BVH_SAH_BINS - 1; b > 0; --b)
+      {
+        accMin    = LiteMath::min(accMin, binMin[b]);
+        accMax    = LiteMath::max(accMax, binMax[b]);
+        accCount += binCount[b];
+        rightCount[b] = accCount;
+        rightArea[b]  = accCount > 0 ? HalfArea(accMin, accMax) : 0.0f;
+      }
+
+      accMin   = float3(+FLT_MAX, +FLT_MAX, +FLT_MAX);
+      accMax   = float3(-FLT_MAX, -FLT_MAX, -FLT_MAX);
+      accCount = 0;
+      for(uint32_t b = 0; b < BVH_SAH_BINS - 1; ++b)
+      {
+        accMin    = LiteMath::min(accMin, binMin[b]);
+        accMax    = LiteMath::max(accMax, binMax[b]);
+        accCount += binCount[b];
+        if(accCount == 0 || rightCount[b + 1] == 0)
+          continue;
+
+        const float cost = BVH_TRAVERSAL_COST +
+          BVH_ISECT_COST * (HalfArea(accMin, accMax) * accCount + rightArea[b + 1] * rightCount[b + 1]) / std::max(parentArea, 1e-20f);
+        if(cost < bestCost)
+        {
+          bestCost  = cost;
+          bestAxis  = axis;
+          bestSplit = b + 1;
+        }
+      }
+    }
+
+    const float leafCost = BVH_ISECT_COST * count;
+    if(bestCost >= leafCost && count <= BVH_MAX_LEAF_PRIMS)
+      continue;
+
+    uint32_t leftCount = 0;
+    if(bestAxis >= 0)
+    {
+      const float scale = float(BVH_SAH_BINS) / (cMax[bestAxis] - cMin[bestAxis]);
+      auto middle = std::partition(a_order.begin() + first, a_order.begin() + first + count, [&](uint32_t primId) {
+        const uint32_t b = std::min(BVH_SAH_BINS - 1, uint32_t((a_prims[primId].center[bestAxis] - cMin[bestAxis]) * scale));
+        return b < bestSplit;
+      });
+      leftCount = uint32_t(middle - (a_order.begin() + first));
+    }
+
+    if(leftCount == 0 || leftCount == count) // all centroids coincide, split by count
+      leftCount = count / 2;
+
+    const uint32_t leftId = uint32_t(a_nodes.size());
+    a_nodes.push_back(makeNode(first, leftCount));
+    a_nodes.push_back(makeNode(first + leftCount, count - leftCount));
+    a_nodes[nodeId].leftOrFirst = leftId;
+    a_nodes[nodeId].primCount   = 0;
+
+    stack.push_back({leftId,     depth + 1});
+    stack.push_back({leftId + 1, depth + 1});
+  }
+}
+
+static inline float SafeInverse(float a_val)
+{
+  return 1.0f / (std::abs(a_val) > 1e-20f ? a_val : std::copysign(1e-20f, a_val));
+}
+
+/**
+\brief Returns entry distance to the node box or +inf if the ray segment misses it
+*/
+static inline float IntersectNodeBox(const BVHNodeFlat& a_node, const float3& a_orig, const float3& a_invDir, float a_tNear, float a_tFar)
+{
+  const float tx1 = (a_node.boxMin[0] - a_orig.x) * a_invDir.x;
+  const float tx2 = (a_node.boxMax[0] - a_orig.x) * a_invDir.x;
+  const float ty1 = (a_node.boxMin[1] - a_orig.y) * a_invDir.y;
+  const float ty2 = (a_node.boxMax[1] - a_orig.y) * a_invDir.y;
+  const float tz1 = (a_node.boxMin[2] - a_orig.z) * a_invDir.z;
+  const float tz2 = (a_node.boxMax[2] - a_orig.z) * a_invDir.z;
+
+  const float tEnter = std::max(std::max(std::min(tx1, tx2), std::min(ty1, ty2)), std::max(std::min(tz1, tz2), a_tNear));
+  const float tExit  = std::min(std::min(std::max(tx1, tx2), std::max(ty1, ty2)), std::min(std::max(tz1, tz2), a_tFar));
+
+  return tEnter <= tExit ? tEnter : std::numeric_limits<float>::infinity();
+}
+
+/**
+\brief Moller-Trumbore test; (u,v) are barycentrics of the second and the third vertices, same as in Embree
+\param a_cullBack - ignore hits with back faces (det < 0 means that ray goes along cross(e1,e2))
+*/
+static inline bool IntersectTriangle(const TriangleFlat& a_tri, const float3& a_orig, const float3& a_dir, float a_tNear, float a_tFar, bool a_cullBack,
+                                     float& a_t, float& a_u, float& a_v)
+{
+  const float3 e1(a_tri.e1[0], a_tri.e1[1], a_tri.e1[2]);
+  const float3 e2(a_tri.e2[0], a_tri.e2[1], a_tri.e2[2]);
+
+  const float3 pvec = LiteMath::cross(a_dir, e2);
+  const float  det  = LiteMath::dot(e1, pvec);
+  if(std::abs(det) < 1e-20f || (a_cullBack && det < 0.0f))
+    return false;
+
+  const float  invDet = 1.0f / det;
+  const float3 tvec   = a_orig - float3(a_tri.v0[0], a_tri.v0[1], a_tri.v0[2]);
+  const float  u      = LiteMath::dot(tvec, pvec) * invDet;
+  if(u < 0.0f || u > 1.0f)
+    return false;
+
+  const float3 qvec = LiteMath::cross(tvec, e1);
+  const float  v    = LiteMath::dot(a_dir, qvec) * invDet;
+  if(v < 0.0f || u + v > 1.0f)
+    return false;
+
+  const float t = LiteMath::dot(e2, qvec) * invDet;
+  if(t <= a_tNear || t >= a_tFar)
+    return false;
+
+  a_t = t;
+  a_u = u;
+  a_v = v;
+  return true;
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+/**
+\brief CPU ray tracing with a BVH built in this repo; bottom level structures are cached on disk
+
+Each BLAS is keyed by a hash of its vertex/index data and of the build settings. When the cache file
+for a key already exists it is memory-mapped and used in place, so the build is skipped entirely.
+The top level is rebuilt on every CommitScene; it is cheap compared to BLAS builds.
+*/
+class BVH2FlatRT : public ISceneObject
+{
+public:
+  BVH2FlatRT(const char* a_cacheDir);
+  ~BVH2FlatRT() override = default;
+  void ClearGeom() override;
+
+  uint32_t AddGeom_Triangles4f(const LiteMath::float4* a_vpos4f, size_t a_vertNumber, const uint32_t* a_triIndices, size_t a_indNumber) override;
+  uint32_t AddGeom_Spheres(const LiteMath::float4* a_posAndRadius, size_t a_count) override;
+  uint32_t AddGeom_Points(const LiteMath::float4* a_posAndRadius, const LiteMath::float4* a_normals, size_t a_count) override;
+  uint32_t AddGeom_Curves(const LiteMath::float4* a_ctrlPoints, size_t a_pointNumber, const uint32_t* a_segmentStart, size_t a_segmentNum,
+                          uint32_t a_type) override;
+  uint32_t AddGeom_User(const LiteMath::float4* a_boxes, size_t a_primNum, CRT_UserIntersectFunc a_intersect, void* a_userData) override;
+  void     UpdateGeom_Triangles4f(uint32_t a_geomId, const LiteMath::float4* a_vpos4f, size_t a_vertNumber, const uint32_t* a_triIndices, size_t a_indNumber) override;
+
+  uint32_t AddAlphaMask(const uint8_t* a_alpha, uint32_t a_width, uint32_t a_height, uint32_t a_pixelStride, uint8_t a_threshold) override;
+  void     SetGeomAlphaTest(uint32_t a_geomId, const uint16_t* a_triMaskIds, const LiteMath::float2* a_texCoords, size_t a_vertNumber) override;
+
+  void ClearScene() override;
+  void CommitScene  () override;
+
+  uint32_t AddInstance(uint32_t a_geomId, const LiteMath::float4x4& a_matrix,
+                       uint32_t a_mask = CRT_RAY_MASK_ALL, uint32_t a_flags = CRT_INSTANCE_DEFAULT) override;
+  void     UpdateInstance(uint32_t a_instanceId, const LiteMath::float4x4& a_matrix) override;
+
+  CRT_Hit  RayQuery_NearestHit(LiteMath::float4 posAndNear, LiteMath::float4 dirAndFar, uint32_t a_rayMask = CRT_RAY_MASK_ALL) override;
+  bool     RayQuery_AnyHit(LiteMath::float4 posAndNear, LiteMath::float4 dirAndFar, uint32_t a_rayMask = CRT_RAY_MASK_ALL) override;
+
+protected:
+
+  struct BLAS
+  {
+    const BVHNodeFlat*  nodes   = nullptr;
+    const TriangleFlat* tris    = nullptr;
+    const uint32_t*     primIds = nullptr;
+    uint32_t nodeNum = 0;
+    uint32_t triNum  = 0;
+
+    // either owned storage (freshly built) or a mapped cache file backs the pointers above
+    std::vector<BVHNodeFlat>  ownNodes;
+    std::vector<TriangleFlat> ownTris;
+    std::vector<uint32_t>     ownPrimIds;
+    MappedFile                mapping;
+
+    std::vector<uint32_t> srcIndices;           ///< original index buffer, alpha test needs it to interpolate texture coordinates
+    const GeomAlphaTest*  pAlphaTest = nullptr;
+  };
+
+  struct Instance
+  {
+    float4x4 matrix;
+    float4x4 invMatrix;
+    uint32_t geomId;
+    uint32_t mask;  ///< effective mask, see CRT_EffectiveInstanceMask
+    uint32_t flags;
+  };
+
+  template<bool AnyHit>
+  bool TraverseBLAS(const BLAS& a_blas, const float3& a_orig, const float3& a_dir, float a_tNear, float& a_tFar, bool a_cullBack,
+                    uint32_t& a_primId, float& a_u, float& a_v) const;
+
+  template<bool AnyHit>
+  bool TraverseScene(float4 posAndNear, float4 dirAndFar, uint32_t a_rayMask, CRT_Hit& a_hit) const;
+
+  bool        LoadFromCache(uint64_t a_key, uint32_t a_triNum, BLAS& a_blas) const; // false if the file is absent or inconsistent
+  void        SaveToCache(uint64_t a_key, const BLAS& a_blas) const;
+  std::string CachePath(uint64_t a_key) const;
+
+  std::string m_cacheDir;
+
+  std::vector<BLAS>     m_blas;
+  std::vector<AlphaMaskBits>                  m_alphaMasks;
+  std::unordered_map<uint32_t, GeomAlphaTest> m_alphaTestByGeomId;
+  std::vector<Instance> m_inst;
+
+  std::vector<BVHNodeFlat> m_tlasNodes;
+  std::vector<uint32_t>    m_tlasInstIds;
+};
+
+BVH2FlatRT::BVH2FlatRT(const char* a_cacheDir) : m_cacheDir(a_cacheDir == nullptr ? "" : a_cacheDir)
+{
+  m_blas.reserve(1024);
+  m_inst.reserve(2048);
+
+  if(!m_cacheDir.empty())
+  {
+    std::error_code ec;
+    std::filesystem::create_directories(m_cacheDir, ec);
+    if(ec)
+    {
+      std::cout << "BVH2FlatRT: can't create cache directory " << m_cacheDir << ", BLAS cache is disabled" << std::endl;
+      m_cacheDir.clear();
+    }
+  }
+}
+
+void BVH2FlatRT::ClearGeom()
+{
+  m_blas.clear();
+  m_alphaMasks.clear();
+  m_alphaTestByGeomId.clear();
+  m_inst.clear();
+  m_tlasNodes.clear();
+  m_tlasInstIds.clear();
+}
+
+std::string BVH2FlatRT::CachePath(uint64_t a_key) const
+{
+  ContentHash64 name;
+  name.AddValue(a_key);
+  return m_cacheDir + "/" + name.GetHex() + ".bvh2";
+}
+
+bool BVH2FlatRT::LoadFromCache(uint64_t a_key, uint32_t a_triNum, BLAS& a_blas) const
+{
+  if(m_cacheDir.empty())
+    return false;
+
+  MappedFile file;
+  if(!file.Open(CachePath(a_key)) || file.Size() < sizeof(BVHCacheHeader))
+    return false;
+
+  BVHCacheHeader header;
+  memcpy(&header, file.Data(), sizeof(header));
+
+  auto sectionFits = [&](uint64_t a_offset, uint64_t a_count, uint64_t a_elemSize) {
+    return a_offset <= file.Size() && a_offset % alignof(uint32_t) == 0 && a_count <= (file.Size() - a_offset) / a_elemSize;
+  };
+  const bool valid = header.magic == BVH_CACHE_MAGIC && header.version == BVH_CACHE_VERSION && header.key == a_key &&
+                     header.fileSize == file.Size() && header.triNum == a_triNum && header.nodeNum > 0 &&
+                     sectionFits(header.nodesOffset,   header.nodeNum, sizeof(BVHNodeFlat)) &&
+                     sectionFits(header.trisOffset,    header.triNum,  sizeof(TriangleFlat)) &&
+                     sectionFits(header.primIdsOffset, header.triNum,  sizeof(uint32_t));
+  if(!valid)
+    return false;
+
+  const auto* nodes   = reinterpret_cast<const BVHNodeFlat*> (file.Data() + header.nodesOffset);
+  const auto* tris    = reinterpret_cast<const TriangleFlat*>(file.Data() + header.trisOffset);
+  const auto* primIds = reinterpret_cast<const uint32_t*>    (file.Data() + header.primIdsOffset);
+
+  // the builder stores children after their parent, so a forward pass finds depths and rejects cycles;
+  // traversal relies on children and leaf ranges being in bounds and on the depth limit, see BuildBinnedSAH
+  // (an empty mesh has a single empty root which is never traversed)
+  std::vector<uint32_t> depth(header.nodeNum, 0);
+  for(uint32_t i = 0; i < header.nodeNum && header.triNum > 0; ++i)
+  {
+    const BVHNodeFlat& node = nodes[i];
+    if(node.primCount > 0)
+    {
+      if(uint64_t(node.leftOrFirst) + node.primCount > header.triNum)
+        return false;
+      continue;
+    }
+    if(node.leftOrFirst <= i || uint64_t(node.leftOrFirst) + 1 >= header.nodeNum || depth[i] >= BVH_STACK_SIZE)
+      return false;
+    for(uint32_t child = node.leftOrFirst; child <= node.leftOrFirst + 1; ++child)
+      depth[child] = std::max(depth[child], depth[i] + 1);
+  }
+  for(uint32_t i = 0; i < header.triNum; ++i)
+  {
+    if(primIds[i] >= header.triNum)
+      return false;
+  }
+
+  a_blas.nodeNum = header.nodeNum;
+  a_blas.triNum  = header.triNum;
+  a_blas.nodes   = nodes;
+  a_blas.tris    = tris;
+  a_blas.primIds = primIds;
+  a_blas.mapping = std::move(file);
+  return true;
+}
+
+void BVH2FlatRT::SaveToCache(uint64_t a_key, const BLAS& a_blas) const
+{
+  if(m_cacheDir.empty())
+    return;
+
+  BVHCacheHeader header = {};
+  header.magic         = BVH_CACHE_MAGIC;
+  header.version       = BVH_CACHE_VERSION;
+  header.key           = a_key;
+  header.nodeNum       = a_blas.nodeNum;
+  header.triNum        = a_blas.triNum;
+  header.nodesOffset   = AlignUp64(sizeof(BVHCacheHeader));
+  header.trisOffset    = AlignUp64(header.nodesOffset + uint64_t(header.nodeNum) * sizeof(BVHNodeFlat));
+  header.primIdsOffset = AlignUp64(header.trisOffset  + uint64_t(header.triNum)  * sizeof(TriangleFlat));
+  header.fileSize      = header.primIdsOffset + uint64_t(header.triNum) * sizeof(uint32_t);
+
+  // write to a temporary file first, so that a concurrent or interrupted run never sees a partial cache file
+  const std::string path    = CachePath(a_key);
+  const std::string tmpPath = path + ".tmp";
+  {
+    std::ofstream out(tmpPath, std::ios::binary | std::ios::trunc);
+    if(!out.is_open())
+      return;
+
+    const char zeros[64] = {};
+    auto writeSection = [&](uint64_t offset, const void* data, size_t size) {
+      const auto pos = uint64_t(out.tellp());
+      out.write(zeros, std::streamsize(offset - pos));
+      out.write(static_cast<const char*>(data), std::streamsize(size));
+    };
+
+    out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    writeSection(header.nodesOffset,   a_blas.nodes,   a_blas.nodeNum * sizeof(BVHNodeFlat));
+    writeSection(header.trisOffset,    a_blas.tris,    a_blas.triNum  * sizeof(TriangleFlat));
+    writeSection(header.primIdsOffset, a_blas.primIds, a_blas.triNum  * sizeof(uint32_t));
+    if(!out.good())
+      return;
+  }
+
+  std::error_code ec;
+  std::filesystem::rename(tmpPath, path, ec);
+  if(ec)
+    std::filesystem::remove(tmpPath, ec);
+}
+
+uint32_t BVH2FlatRT::AddGeom_Triangles4f(const LiteMath::float4* a_vpos4f, size_t a_vertNumber, const uint32_t* a_triIndices, size_t a_indNumber)
+{
+  if(a_vpos4f == nullptr)
+  {
+    std::cout << "BVH2FlatRT::AddGeom_Triangles4f, nullptr input: a_vpos4f" << std::endl;
+    return uint32_t(-1);
+  }
+
+  if(a_triIndices == nullptr)
+  {
+    std::cout << "BVH2FlatRT::AddGeom_Triangles4f, nullptr input: a_triIndices" << std::endl;
+    return uint32_t(-1);
+  }
+
+  // the fourth vertex coordinate is not used, so it is not a part of the key
+  ContentHash64 hash;
+  hash.AddValue(BVH_CACHE_VERSION);
+  hash.AddValue(BVH_SAH_BINS);
+  hash.AddValue(BVH_MAX_LEAF_PRIMS);
+  hash.AddValue(BVH_TRAVERSAL_COST);
+  hash.AddValue(BVH_ISECT_COST);
+  for(size_t i = 0; i < a_vertNumber; ++i)
+    hash.Add(&a_vpos4f[i], 3 * sizeof(float));
+  hash.Add(a_triIndices, a_indNumber * sizeof(uint32_t));
+  const uint64_t key = hash.Get();
+
+  BLAS blas;
+  if(!LoadFromCache(key, uint32_t(a_indNumber / 3), blas))
+  {
+    const size_t triNum = a_indNumber / 3;
+    std::vector<PrimBox> prims(triNum);
+    for(size_t i = 0; i < triNum; ++i)
+    {
+      const float3 a = to_float3(a_vpos4f[a_triIndices[i * 3 + 0]]);
+      const float3 b = to_float3(a_vpos4f[a_triIndices[i * 3 + 1]]);
+      const float3 c = to_float3(a_vpos4f[a_triIndices[i * 3 + 2]]);
+      prims[i].boxMin = LiteMath::min(a, LiteMath::min(b, c));
+      prims[i].boxMax = LiteMath::max(a, LiteMath::max(b, c));
+      prims[i].center = (prims[i].boxMin + prims[i].boxMax) * 0.5f;
+    }
+
+    BuildBinnedSAH(prims, blas.ownNodes, blas.ownPrimIds);
+
+    blas.ownTris.resize(triNum);
+    for(size_t i = 0; i < triNum; ++i)
+    {
+      const uint32_t primId = blas.ownPrimIds[i];
+      const float3 a = to_float3(a_vpos4f[a_triIndices[primId * 3 + 0]]);
+      const float3 b = to_float3(a_vpos4f[a_triIndices[primId * 3 + 1]]);
+      const float3 c = to_float3(a_vpos4f[a_triIndices[primId * 3 + 2]]);
+      const float3 e1 = b - a;
+      const float3 e2 = c - a;
+      blas.ownTris[i] = TriangleFlat{ {a.x, a.y, a.z, 0.0f}, {e1.x, e1.y, e1.z, 0.0f}, {e2.x, e2.y, e2.z, 0.0f} };
+    }
+
+    blas.nodes   = blas.ownNodes.data();
+    blas.tris    = blas.ownTris.data();
+    blas.primIds = blas.ownPrimIds.data();
+    blas.nodeNum = uint32_t(blas.ownNodes.size());
+    blas.triNum  = uint32_t(triNum);
+
+    SaveToCache(key, blas);
+  }
+
+  blas.srcIndices.assign(a_triIndices, a_triIndices + a_indNumber);
+  m_blas.push_back(std::move(blas));
+  return uint32_t(m_blas.size() - 1);
+}
+
+uint32_t BVH2FlatRT::AddGeom_Spheres(const LiteMath::float4* a_posAndRadius, size_t a_count)
+{
+  std::cout << "BVH2FlatRT::AddGeom_Spheres is not implemented yet!" << std::endl;
+  return uint32_t(-1);
+}
+
+uint32_t BVH2FlatRT::AddGeom_Points(const LiteMath::float4* a_posAndRadius, const LiteMath::float4* a_normals, size_t a_count)
+{
+  std::cout << "BVH2FlatRT::AddGeom_Points is not implemented yet!" << std::endl;
+  return uint32_t(-1);
+}
+
+uint32_t BVH2FlatRT::AddGeom_Curves(const LiteMath::float4* a_ctrlPoints, size_t a_pointNumber, const uint32_t* a_segmentStart, size_t a_segmentNum,
+                                   uint32_t a_type)
+{
+  std::cout << "BVH2FlatRT::AddGeom_Curves is not implemented yet!" << std::endl;
+  return uint32_t(-1);
+}
+
+uint32_t BVH2FlatRT::AddGeom_User(const LiteMath::float4* a_boxes, size_t a_primNum, CRT_UserIntersectFunc a_intersect, void* a_userData)
+{
+  std::cout << "BVH2FlatRT::AddGeom_User is not implemented yet!" << std::endl;
+  return uint32_t(-1);
+}
+
+void BVH2FlatRT::UpdateGeom_Triangles4f(uint32_t a_geomId, const LiteMath::float4* a_vpos4f, size_t a_vertNumber, const uint32_t* a_triIndices, size_t a_indNumber)
+{
+  std::cout << "BVH2FlatRT::UpdateGeom_Triangles4f is not implemented yet!" << std::endl;
+}
+
+uint32_t BVH2FlatRT::AddAlphaMask(const uint8_t* a_alpha, uint32_t a_width, uint32_t a_height, uint32_t a_pixelStride, uint8_t a_threshold)
+{
+  if(a_alpha == nullptr || a_width == 0 || a_height == 0 || m_alphaMasks.size() >= GeomAlphaTest::NO_MASK)
+  {
+    std::cout << "BVH2FlatRT::AddAlphaMask, bad input" << std::endl;
+    return uint32_t(-1);
+  }
+
+  m_alphaMasks.emplace_back();
+  m_alphaMasks.back().Init(a_alpha, a_width, a_height, a_pixelStride, a_threshold);
+  return uint32_t(m_alphaMasks.size() - 1);
+}
+
+void BVH2FlatRT::SetGeomAlphaTest(uint32_t a_geomId, const uint16_t* a_triMaskIds, const LiteMath::float2* a_texCoords, size_t a_vertNumber)
+{
+  if(a_geomId >= m_blas.size() || a_triMaskIds == nullptr || a_texCoords == nullptr)
+  {
+    std::cout << "BVH2FlatRT::SetGeomAlphaTest, bad input" << std::endl;
+    return;
+  }
+
+  BLAS& blas = m_blas[a_geomId];
+  GeomAlphaTest& alphaTest = m_alphaTestByGeomId[a_geomId];
+  alphaTest.triMaskIds.assign(a_triMaskIds, a_triMaskIds + blas.triNum);
+  alphaTest.indices   = blas.srcIndices;
+  alphaTest.texCoords.assign(a_texCoords, a_texCoords + a_vertNumber);
+  alphaTest.pMasks    = &m_alphaMasks;
+  blas.pAlphaTest     = &alphaTest;
+}
+
+void BVH2FlatRT::ClearScene()
+{
+  m_inst.clear();
+  m_tlasNodes.clear();
+  m_tlasInstIds.clear();
+}
+
+uint32_t BVH2FlatRT::AddInstance(uint32_t a_geomId, const LiteMath::float4x4& a_matrix, uint32_t a_mask, uint32_t a_flags)
+{
+  if(a_geomId >= m_blas.size())
+    return uint32_t(-1);
+
+  Instance inst;
+  inst.matrix    = a_matrix;
+  inst.invMatrix = LiteMath::inverse4x4(a_matrix);
+  inst.geomId    = a_geomId;
+  inst.mask      = CRT_EffectiveInstanceMask(a_mask, a_flags);
+  inst.flags     = a_flags;
+  m_inst.push_back(inst);
+  return uint32_t(m_inst.size() - 1);
+}
+
+void BVH2FlatRT::UpdateInstance(uint32_t a_instanceId, const LiteMath::float4x4& a_matrix)
+{
+  if(a_instanceId >= m_inst.size())
+    return;
+
+  m_inst[a_instanceId].matrix    = a_matrix;
+  m_inst[a_instanceId].invMatrix = LiteMath::inverse4x4(a_matrix);
+}
+
+void BVH2FlatRT::CommitScene()
+{
+  std::vector<PrimBox> prims(m_inst.size());
+  for(size_t i = 0; i < m_inst.size(); ++i)
+  {
+    const BVHNodeFlat& root = m_blas[m_inst[i].geomId].nodes[0];
+    float3 bMin(+FLT_MAX, +FLT_MAX, +FLT_MAX);
+    float3 bMax(-FLT_MAX, -FLT_MAX, -FLT_MAX);
+    for(int corner = 0; corner < 8; ++corner)
+    {
+      const float3 p(corner & 1 ? root.boxMax[0] : root.boxMin[0],
+                     corner & 2 ? root.boxMax[1] : root.boxMin[1],
+                     corner & 4 ? root.boxMax[2] : root.boxMin[2]);
+      const float3 wp = m_inst[i].matrix * p;
+      bMin = LiteMath::min(bMin, wp);
+      bMax = LiteMath::max(bMax, wp);
+    }
+    prims[i].boxMin = bMin;
+    prims[i].boxMax = bMax;
+    prims[i].center = (bMin + bMax) * 0.5f;
+  }
+
+  BuildBinnedSAH(prims, m_tlasNodes, m_tlasInstIds);
+}
+
+template<bool AnyHit>
+bool BVH2FlatRT::TraverseBLAS(const BLAS& a_blas, const float3& a_orig, const float3& a_dir, float a_tNear, float& a_tFar, bool a_cullBack,
+                              uint32_t& a_primId, float& a_u, float& a_v) const
+{
+  if(a_blas.triNum == 0)
+    return false;
+
+  const float3 invDir(SafeInverse(a_dir.x), SafeInverse(a_dir.y), SafeInverse(a_dir.z));
+
+  uint32_t stack[BVH_STACK_SIZE];
+  int      top  = 0;
+  uint32_t node = 0;
+  bool     hit  = false;
+
+  if(IntersectNodeBox(a_blas.nodes[0], a_orig, invDir, a_tNear, a_tFar) == std::numeric_limits<float>::infinity())
+    return false;
+
+  while(true)
+  {
+    const BVHNodeFlat& cur = a_blas.nodes[node];
+    if(cur.primCount > 0)
+    {
+      for(uint32_t i = cur.leftOrFirst; i < cur.leftOrFirst + cur.primCount; ++i)
+      {
+        float t, u, v;
+        if(IntersectTriangle(a_blas.tris[i], a_orig, a_dir, a_tNear, a_tFar, a_cullBack, t, u, v))
+        {
+          if(a_blas.pAlphaTest != nullptr && !a_blas.pAlphaTest->IsOpaque(a_blas.primIds[i], u, v))
+            continue;
+
+          a_tFar   = t;
+          a_u      = u;
+          a_v      = v;
+          a_primId = a_blas.primIds[i];
+          hit      = true;
+          if(AnyHit)
+            return true;
+        }
+      }
+    }
+    else
+    {
+      // visit the nearest child first, postpone the other one
+      const uint32_t left  = cur.leftOrFirst;
+      const float    tLeft  = IntersectNodeBox(a_blas.nodes[left],     a_orig, invDir, a_tNear, a_tFar);
+      const float    tRight = IntersectNodeBox(a_blas.nodes[left + 1], a_orig, invDir, a_tNear, a_tFar);
+      const bool     hitL   = tLeft  != std::numeric_limits<float>::infinity();
+      const bool     hitR   = tRight != std::numeric_limits<float>::infinity();
+      if(hitL && hitR)
+      {
+        const bool leftFirst = tLeft <= tRight;
+        assert(top < int(BVH_STACK_SIZE));
+        stack[top++] = leftFirst ? left + 1 : left;
+        node = leftFirst ? left : left + 1;
+        continue;
+      }
+      else if(hitL || hitR)
+      {
+        node = hitL ? left : left + 1;
+        continue;
+      }
+    }
+
+    if(top == 0)
+      break;
+    node = stack[--top];
+  }
+
+  return hit;
+}
+
+template<bool AnyHit>
+bool BVH2FlatRT::TraverseScene(float4 posAndNear, float4 dirAndFar, uint32_t a_rayMask, CRT_Hit& a_hit) const
+{
+  if(m_tlasNodes.empty() || m_inst.empty())
+    return false;
+
+  const float3 orig   = to_float3(posAndNear);
+  const float3 dir    = to_float3(dirAndFar);
+  const float3 invDir(SafeInverse(dir.x), SafeInverse(dir.y), SafeInverse(dir.z));
+  const float  tNear  = posAndNear.w;
+  float        tFar   = dirAndFar.w;
+  bool         hit    = false;
+
+  uint32_t stack[BVH_STACK_SIZE];
+  int      top  = 0;
+  uint32_t node = 0;
+
+  if(IntersectNodeBox(m_tlasNodes[0], orig, invDir, tNear, tFar) == std::numeric_limits<float>::infinity())
+    return false;
+
+  while(true)
+  {
+    const BVHNodeFlat& cur = m_tlasNodes[node];
+    if(cur.primCount > 0)
+    {
+      for(uint32_t i = cur.leftOrFirst; i < cur.leftOrFirst + cur.primCount; ++i)
+      {
+        const uint32_t  instId = m_tlasInstIds[i];
+        const Instance& inst   = m_inst[instId];
+        if((inst.mask & a_rayMask) == 0)
+          continue;
+
+        // affine transform keeps ray parametrization, so 't' found in object space is valid in world space too
+        const float3 objOrig = to_float3(inst.invMatrix * to_float4(orig, 1.0f));
+        const float3 objDir  = to_float3(inst.invMatrix * to_float4(dir,  0.0f));
+
+        uint32_t primId;
+        float    u, v;
+        const bool cullBack = (inst.flags & CRT_INSTANCE_DOUBLE_SIDED) == 0;
+        if(TraverseBLAS<AnyHit>(m_blas[inst.geomId], objOrig, objDir, tNear, tFar, cullBack, primId, u, v))
+        {
+          hit          = true;
+          a_hit.t      = tFar;
+          a_hit.instId = instId;
+          a_hit.geomId = inst.geomId;
+          a_hit.primId = primId;
+          a_hit.coords[0] = v;
+          a_hit.coords[1] = u;
+          a_hit.coords[2] = 1.0f - u - v;
+          if(AnyHit)
+            return true;
+        }
+      }
+    }
+    else
+    {
+      const uint32_t left   = cur.leftOrFirst;
+      const float    tLeft  = IntersectNodeBox(m_tlasNodes[left],     orig, invDir, tNear, tFar);
+      const float    tRight = IntersectNodeBox(m_tlasNodes[left + 1], orig, invDir, tNear, tFar);
+      const bool     hitL   = tLeft  != std::numeric_limits<float>::infinity();
+      const bool     hitR   = tRight != std::numeric_limits<float>::infinity();
+      if(hitL && hitR)
+      {
+        const bool leftFirst = tLeft <= tRight;
+        assert(top < int(BVH_STACK_SIZE));
+        stack[top++] = leftFirst ? left + 1 : left;
+        node = leftFirst ? left : left + 1;
+        continue;
+      }
+      else if(hitL || hitR)
+      {
+        node = hitL ? left : left + 1;
+        continue;
+      }
+    }
+
+    if(top == 0)
+      break;
+    node = stack[--top];
+  }
+
+  return hit;
+}
+
+CRT_Hit BVH2FlatRT::RayQuery_NearestHit(LiteMath::float4 posAndNear, LiteMath::float4 dirAndFar, uint32_t a_rayMask)
+{
+  CRT_Hit result;
+  if(!TraverseScene<false>(posAndNear, dirAndFar, a_rayMask, result))
+  {
+    result.t      = dirAndFar.w;
+    result.geomId = uint32_t(-1);
+    result.instId = uint32_t(-1);
+    result.primId = uint32_t(-1);
+  }
+  return result;
+}
+
+bool BVH2FlatRT::RayQuery_AnyHit(LiteMath::float4 posAndNear, LiteMath::float4 dirAndFar, uint32_t a_rayMask)
+{
+  CRT_Hit hit;
+  return TraverseScene<true>(posAndNear, dirAndFar, a_rayMask, hit);
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+static std::filesystem::path ExecutableDir()
+{
+  std::error_code ec;
+#ifdef _WIN32
+  char buf[MAX_PATH];
+  const DWORD len = GetModuleFileNameA(nullptr, buf, MAX_PATH);
+  if(len == 0 || len == MAX_PATH)
+    return {};
+  return std::filesystem::path(std::string(buf, len)).parent_path();
+#else
+  const auto exe = std::filesystem::read_symlink("/proc/self/exe", ec);
+  return ec ? std::filesystem::path() : exe.parent_path();
+#endif
+}
+
+static std::string DefaultCacheDir()
+{
+  if(const char* env = std::getenv("CROSSRT_BVH_CACHE_DIR"))
+    return env;
+  const auto exeDir = ExecutableDir();
+  if(exeDir.empty())
+    return "../cache/bvh";
+  return (exeDir / ".." / "cache" / "bvh").lexically_normal().string();
+}
+
+ISceneObject* CreateBVH2FlatRT(const char* a_cacheDir) 
+{ 
+  if(a_cacheDir == nullptr)
+    return new BVH2FlatRT(DefaultCacheDir().c_str());
+  return new BVH2FlatRT(a_cacheDir); 
+}
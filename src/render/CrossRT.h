@@ -2,6 +2,8 @@
 
 #include <cstdint>
 #include <cstddef>
+#include <cstring>
+#include <vector>
 #include "LiteMath.h"
 
 /**
@@ -13,9 +15,85 @@ struct CRT_Hit
   uint32_t primId; 
   uint32_t instId;
   uint32_t geomId;    ///< use 4 most significant bits for geometry type; thay are zero for triangles 
-  float    coords[4]; ///< custom intersection data; for triangles coords[0] and coords[1] stores baricentric coords (u,v)
+  float    coords[4]; ///< custom intersection data; for triangles coords[0] and coords[1] stores baricentric coords (u,v), for other types coords[0..2] is object space normal
 };
 
+/**
+\brief Geometry type which is stored in 4 most significant bits of CRT_Hit::geomId
+*/
+enum CRT_GEOM_TYPE : uint32_t
+{
+  CRT_GEOM_TRIANGLES = 0,
+  CRT_GEOM_SPHERES   = 1,
+  CRT_GEOM_POINTS    = 2, ///< flat discs facing the ray (or oriented by normals)
+  CRT_GEOM_CURVES    = 3,
+  CRT_GEOM_USER      = 4, ///< custom primitives with user intersection function, see 'AddGeom_User'
+};
+
+static constexpr uint32_t CRT_GEOM_TYPE_SHIFT = 28;
+static constexpr uint32_t CRT_GEOM_ID_MASK    = 0x0FFFFFFF;
+
+static inline uint32_t CRT_GeomType(uint32_t a_geomId) { return a_geomId >> CRT_GEOM_TYPE_SHIFT; }
+static inline uint32_t CRT_GeomId  (uint32_t a_geomId) { return a_geomId & CRT_GEOM_ID_MASK; }
+
+/**
+\brief Intersection function for user geometry. Ray is given in object space of the instance.
+\param a_userData   - pointer passed to 'AddGeom_User'
+\param a_primId     - primitive index
+\param a_posAndNear - ray origin (x,y,z) and t_near (w)
+\param a_dirAndFar  - ray direction (x,y,z) and t_far (w)
+\param a_pHit       - if primitive is hit, 't' and object space normal in 'coords[0..2]' should be written here;
+                      'coords[3]' is free for user data and is returned with the hit as is
+\return true if primitive is hit inside (t_near, t_far)
+*/
+typedef bool (*CRT_UserIntersectFunc)(void* a_userData, uint32_t a_primId, LiteMath::float4 a_posAndNear, LiteMath::float4 a_dirAndFar, CRT_Hit* a_pHit);
+
+/**
+\brief Curve basis for 'AddGeom_Curves'
+*/
+enum CRT_CURVE_TYPE : uint32_t
+{
+  CRT_CURVE_LINEAR = 0, ///< each segment uses 2 control points
+  CRT_CURVE_BEZIER = 1, ///< each segment uses 4 control points (cubic Bezier)
+};
+
+/**
+\brief Ray classes. An instance is visible for a ray only if (instance mask & ray mask) != 0
+*/
+enum CRT_RAY_MASK : uint32_t
+{
+  CRT_RAY_MASK_CAMERA     = 0x00000001, ///< primary (eye) rays
+  CRT_RAY_MASK_SHADOW     = 0x00000002, ///< shadow rays towards light sources
+  CRT_RAY_MASK_REFLECTION = 0x00000004, ///< secondary rays: reflection and refraction
+  CRT_RAY_MASK_ALL        = 0xFFFFFFFF,
+};
+
+/**
+\brief Per-instance visibility flags; a cleared visibility flag removes the corresponding ray class bit from the instance mask
+*/
+enum CRT_INSTANCE_FLAGS : uint32_t
+{
+  CRT_INSTANCE_CAST_SHADOWS           = 0x00000001,
+  CRT_INSTANCE_VISIBLE_TO_CAMERA      = 0x00000002,
+  CRT_INSTANCE_VISIBLE_IN_REFLECTIONS = 0x00000004,
+  CRT_INSTANCE_DOUBLE_SIDED           = 0x00000008, ///< if not set, hits with back faces (counter-clockwise winding is front) are ignored
+  CRT_INSTANCE_DEFAULT                = 0x0000000F,
+};
+
+/**
+\brief Combine instance mask and flags into the mask which is tested against ray mask during traversal
+*/
+static inline uint32_t CRT_EffectiveInstanceMask(uint32_t a_mask, uint32_t a_flags)
+{
+  if((a_flags & CRT_INSTANCE_CAST_SHADOWS) == 0)
+    a_mask &= ~uint32_t(CRT_RAY_MASK_SHADOW);
+  if((a_flags & CRT_INSTANCE_VISIBLE_TO_CAMERA) == 0)
+    a_mask &= ~uint32_t(CRT_RAY_MASK_CAMERA);
+  if((a_flags & CRT_INSTANCE_VISIBLE_IN_REFLECTIONS) == 0)
+    a_mask &= ~uint32_t(CRT_RAY_MASK_REFLECTION);
+  return a_mask;
+}
+
 /**
 \brief API to ray-scene intersection on CPU
 */
@@ -38,7 +116,69 @@ struct ISceneObject
   \return id of added geometry
   */
   virtual uint32_t AddGeom_Triangles4f(const LiteMath::float4* a_vpos4f, size_t a_vertNumber, const uint32_t* a_triIndices, size_t a_indNumber) = 0;
+
+  /**
+  \brief Add geometry of type 'Triangles' which references vertices and indices in place (e.g. in scene manager storage) instead of copying them
+  \param a_vpos3f      - position of a vertex is the first 3 floats of it; 16 bytes from the start of any vertex should be readable
+  \param a_vertNumber  - vertices number
+  \param a_vertStride  - distance between vertices in bytes, multiple of 4
+  \param a_triIndices  - triangle indices (standart index buffer)
+  \param a_indNumber   - number of indices, shiuld be equal to 3*triaglesNum in your mesh
+  \return id of added geometry
+  Data should stay alive and unchanged until ClearGeom. Implementations which can't reference it copy it by default.
+  */
+  virtual uint32_t AddGeom_Triangles3fShared(const float* a_vpos3f, size_t a_vertNumber, size_t a_vertStride, const uint32_t* a_triIndices, size_t a_indNumber)
+  {
+    std::vector<LiteMath::float4> vpos4f(a_vertNumber);
+    const char* src = reinterpret_cast<const char*>(a_vpos3f);
+    for(size_t i = 0; i < a_vertNumber; ++i)
+    {
+      float pos[3];
+      memcpy(pos, src + i * a_vertStride, sizeof(pos));
+      vpos4f[i] = LiteMath::float4(pos[0], pos[1], pos[2], 1.0f);
+    }
+    return AddGeom_Triangles4f(vpos4f.data(), vpos4f.size(), a_triIndices, a_indNumber);
+  }
   
+  /**
+  \brief Add geometry of type 'Spheres' and return geometry id
+  \param a_posAndRadius - sphere centers (x,y,z) and radius (w)
+  \param a_count        - spheres number
+  \return id of added geometry
+  */
+  virtual uint32_t AddGeom_Spheres(const LiteMath::float4* a_posAndRadius, size_t a_count) = 0;
+
+  /**
+  \brief Add geometry of type 'Points' (discs) and return geometry id; convinient for particles
+  \param a_posAndRadius - disc centers (x,y,z) and radius (w)
+  \param a_normals      - disc normals; if nullptr, discs always face the ray
+  \param a_count        - points number
+  \return id of added geometry
+  */
+  virtual uint32_t AddGeom_Points(const LiteMath::float4* a_posAndRadius, const LiteMath::float4* a_normals, size_t a_count) = 0;
+
+  /**
+  \brief Add geometry of type 'Curves' (round tubes of varying radius, i.e. hair) and return geometry id
+  \param a_ctrlPoints   - control points (x,y,z) and radius (w)
+  \param a_pointNumber  - control points number
+  \param a_segmentStart - index of the first control point for each segment
+  \param a_segmentNum   - segments number
+  \param a_type         - curve basis, see CRT_CURVE_TYPE
+  \return id of added geometry
+  */
+  virtual uint32_t AddGeom_Curves(const LiteMath::float4* a_ctrlPoints, size_t a_pointNumber, const uint32_t* a_segmentStart, size_t a_segmentNum, 
+                                  uint32_t a_type) = 0;
+
+  /**
+  \brief Add geometry which primitives are intersected by user function; traversal calls 'a_intersect' only for rays that hit primitive bounding box
+  \param a_boxes     - bounding boxes of primitives, two float4 (min, max) per primitive; w is not used
+  \param a_primNum   - primitives number
+  \param a_intersect - intersection function
+  \param a_userData  - pointer which is passed to 'a_intersect'; should be alive while geometry is used
+  \return id of added geometry
+  */
+  virtual uint32_t AddGeom_User(const LiteMath::float4* a_boxes, size_t a_primNum, CRT_UserIntersectFunc a_intersect, void* a_userData) = 0;
+
   /**
   \brief Update geometry for triangle mesh to 'internal geometry library' of scene object and return geometry id
   \param a_geomId - geometry id that should be updated. Please refer to 'AddGeom_Triangles4f' for other parameters
@@ -50,6 +190,26 @@ struct ISceneObject
   */
   virtual void UpdateGeom_Triangles4f(uint32_t a_geomId, const LiteMath::float4* a_vpos4f, size_t a_vertNumber, const uint32_t* a_triIndices, size_t a_indNumber) = 0;
   
+  /**
+  \brief Add alpha mask for alpha-tested (cutout) geometry and return its id
+  \param a_alpha       - pointer to alpha of the first texel
+  \param a_width       - texture width
+  \param a_height      - texture height
+  \param a_pixelStride - distance in bytes between alpha values of neighbour texels (4 for RGBA8)
+  \param a_threshold   - texels with alpha >= a_threshold are opaque
+  \return id of added mask
+  */
+  virtual uint32_t AddAlphaMask(const uint8_t* a_alpha, uint32_t a_width, uint32_t a_height, uint32_t a_pixelStride, uint8_t a_threshold) = 0;
+
+  /**
+  \brief Enable alpha test for geometry; hits of transparent texels are rejected during traversal both for nearest and any hit queries
+  \param a_geomId     - geometry id returned by 'AddGeom_Triangles4f'
+  \param a_triMaskIds - alpha mask id for each triangle or 0xFFFF for opaque triangles
+  \param a_texCoords  - texture coordinates of geometry vertices
+  \param a_vertNumber - number of vertices, should be equal to one passed to 'AddGeom_Triangles4f'
+  */
+  virtual void SetGeomAlphaTest(uint32_t a_geomId, const uint16_t* a_triMaskIds, const LiteMath::float2* a_texCoords, size_t a_vertNumber) = 0;
+
   /**
   \brief Clear all instances, but don't touch geometry
   */
@@ -64,12 +224,14 @@ struct ISceneObject
   \brief Add instance to scene
   \param a_geomId     - input if of geometry that is supposed to be instanced
   \param a_matrixData - float4x4 matrix, default layout is column-major
-
+  \param a_mask       - visibility mask, instance is skipped during traversal by rays with (a_mask & rayMask) == 0
+  \param a_flags      - combination of CRT_INSTANCE_FLAGS
   */
-  virtual uint32_t AddInstance(uint32_t a_geomId, const LiteMath::float4x4& a_matrix) = 0;
+  virtual uint32_t AddInstance(uint32_t a_geomId, const LiteMath::float4x4& a_matrix, 
+                               uint32_t a_mask = CRT_RAY_MASK_ALL, uint32_t a_flags = CRT_INSTANCE_DEFAULT) = 0;
   
   /**
-  \brief Add instance to scene
+  \brief Move instance, the change takes effect on the next CommitScene
   \param a_instanceId
   \param a_matrixData - float4x4 matrix, the layout is column-major
   */
@@ -84,22 +246,30 @@ struct ISceneObject
   \brief Find nearest intersection of ray segment (Near,Far) and scene geometry
   \param posAndNear   - ray origin (x,y,z) and t_near (w)
   \param dirAndFar    - ray direction (x,y,z) and t_far (w)
+  \param a_rayMask    - ray class (CRT_RAY_MASK), instances which mask does not intersect it are skipped
   \return             - closest hit surface info
   */
-  virtual CRT_Hit RayQuery_NearestHit(LiteMath::float4 posAndNear, LiteMath::float4 dirAndFar) = 0;
+  virtual CRT_Hit RayQuery_NearestHit(LiteMath::float4 posAndNear, LiteMath::float4 dirAndFar, uint32_t a_rayMask = CRT_RAY_MASK_ALL) = 0;
 
   /**
   \brief Find any hit for ray segment (Near,Far). If none is found return false, else return true;
   \param posAndNear   - ray origin (x,y,z) and t_near (w)
   \param dirAndFar    - ray direction (x,y,z) and t_far (w)
+  \param a_rayMask    - ray class (CRT_RAY_MASK), instances which mask does not intersect it are skipped
   \return             - true if a hit is found, false otherwaise
   */
-  virtual bool    RayQuery_AnyHit(LiteMath::float4 posAndNear, LiteMath::float4 dirAndFar) = 0;
+  virtual bool    RayQuery_AnyHit(LiteMath::float4 posAndNear, LiteMath::float4 dirAndFar, uint32_t a_rayMask = CRT_RAY_MASK_ALL) = 0;
 
 };
 
 ISceneObject* CreateEmbreeRT();
+/**
+\brief Create the in-repo BVH; BLAS are cached on disk in 'a_cacheDir'.
+\param a_cacheDir - cache directory; empty string disables the cache, nullptr selects the default:
+                    $CROSSRT_BVH_CACHE_DIR if set, else '<executable dir>/../cache/bvh'
+*/
+ISceneObject* CreateBVH2FlatRT(const char* a_cacheDir = nullptr);
 //ISceneObject* CreateVulkanRTX(VkDevice a_device, VkPhysicalDevice a_physDevice, uint32_t a_transferQId, uint32_t a_graphicsQId);
 
-ISceneObject* CreateSceneRT(const char* a_impleName); 
+ISceneObject* CreateSceneRT(const char* a_impleName, const char* a_cacheDir = nullptr); ///< 'a_cacheDir' is passed to CreateBVH2FlatRT
 void          DeleteSceneRT(ISceneObject* a_pScene);
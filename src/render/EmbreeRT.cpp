@@ -2,8 +2,11 @@
 #include <vector>
 #include <unordered_map>
 #include <cassert>
+#include <string>
+#include <limits>
 
 #include "CrossRT.h"
+#include "alpha_mask.h"
 #include "embree3/rtcore.h"
 
 class EmbreeRT : public ISceneObject
@@ -14,24 +17,63 @@ public:
   void ClearGeom() override;
   
   uint32_t AddGeom_Triangles4f(const LiteMath::float4* a_vpos4f, size_t a_vertNumber, const uint32_t* a_triIndices, size_t a_indNumber) override;
+  uint32_t AddGeom_Triangles3fShared(const float* a_vpos3f, size_t a_vertNumber, size_t a_vertStride, const uint32_t* a_triIndices, size_t a_indNumber) override;
+  uint32_t AddGeom_Spheres(const LiteMath::float4* a_posAndRadius, size_t a_count) override;
+  uint32_t AddGeom_Points(const LiteMath::float4* a_posAndRadius, const LiteMath::float4* a_normals, size_t a_count) override;
+  uint32_t AddGeom_Curves(const LiteMath::float4* a_ctrlPoints, size_t a_pointNumber, const uint32_t* a_segmentStart, size_t a_segmentNum,
+                          uint32_t a_type) override;
+  uint32_t AddGeom_User(const LiteMath::float4* a_boxes, size_t a_primNum, CRT_UserIntersectFunc a_intersect, void* a_userData) override;
   void     UpdateGeom_Triangles4f(uint32_t a_geomId, const LiteMath::float4* a_vpos4f, size_t a_vertNumber, const uint32_t* a_triIndices, size_t a_indNumber) override;
 
+  uint32_t AddAlphaMask(const uint8_t* a_alpha, uint32_t a_width, uint32_t a_height, uint32_t a_pixelStride, uint8_t a_threshold) override;
+  void     SetGeomAlphaTest(uint32_t a_geomId, const uint16_t* a_triMaskIds, const LiteMath::float2* a_texCoords, size_t a_vertNumber) override;
+
   void ClearScene() override; 
   void CommitScene  () override; 
   
-  uint32_t AddInstance(uint32_t a_geomId, const LiteMath::float4x4& a_matrix) override;
+  uint32_t AddInstance(uint32_t a_geomId, const LiteMath::float4x4& a_matrix,
+                       uint32_t a_mask = CRT_RAY_MASK_ALL, uint32_t a_flags = CRT_INSTANCE_DEFAULT) override;
   void     UpdateInstance(uint32_t a_instanceId, const LiteMath::float4x4& a_matrix) override;
 
-  CRT_Hit  RayQuery_NearestHit(LiteMath::float4 posAndNear, LiteMath::float4 dirAndFar) override;
-  bool     RayQuery_AnyHit(LiteMath::float4 posAndNear, LiteMath::float4 dirAndFar) override;
+  CRT_Hit  RayQuery_NearestHit(LiteMath::float4 posAndNear, LiteMath::float4 dirAndFar, uint32_t a_rayMask = CRT_RAY_MASK_ALL) override;
+  bool     RayQuery_AnyHit(LiteMath::float4 posAndNear, LiteMath::float4 dirAndFar, uint32_t a_rayMask = CRT_RAY_MASK_ALL) override;
 
 protected:
   RTCDevice m_device = nullptr;
   RTCScene  m_scene  = nullptr;
 
   std::vector<RTCScene>    m_blas;
+  std::vector<uint32_t>    m_triNumByGeomId;
+  std::vector<uint32_t>    m_geomTypeByGeomId; ///< CRT_GEOM_TYPE
   std::vector<RTCGeometry> m_inst;
   std::vector<uint32_t>    m_geomIdByInstId;
+  std::vector<uint32_t>    m_instMask;
+  std::vector<uint32_t>    m_instFlags;
+
+  bool m_hwRayMask   = false; ///< Embree library was built with EMBREE_RAY_MASK, so masks are tested during traversal
+  bool m_needsFilter = false; ///< some instances are single-sided or masks have to be emulated in the context filter
+  bool m_instancesAdded = true;  ///< instance set changed since the last commit, so m_needsFilter has to be found again
+  bool m_dynamicScene   = false; ///< instances are moved between commits, top level is built by the fast builder from then on
+
+  std::vector<AlphaMaskBits>                    m_alphaMasks;
+  std::unordered_map<uint32_t, GeomAlphaTest>   m_alphaTestByGeomId; ///< node based container, filter functions keep pointers to its values
+
+  struct UserGeom
+  {
+    std::vector<LiteMath::float4> boxes;
+    CRT_UserIntersectFunc         intersect = nullptr;
+    void*                         userData  = nullptr;
+  };
+  std::unordered_map<uint32_t, UserGeom> m_userGeomByGeomId; ///< node based container, Embree callbacks keep pointers to its values
+
+  static void UserBounds(const RTCBoundsFunctionArguments* args);
+  static void UserIntersect(const RTCIntersectFunctionNArguments* args);
+  static void UserOccluded(const RTCOccludedFunctionNArguments* args);
+
+  uint32_t AddBLAS(RTCGeometry a_geom, uint32_t a_type, uint32_t a_triNum);
+  void InitContext(RTCIntersectContext* a_context) const;
+  static void AlphaTestFilter(const RTCFilterFunctionNArguments* args);
+  static void ContextFilter(const RTCFilterFunctionNArguments* args);
 };
 
 /////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
@@ -72,6 +114,12 @@ EmbreeRT::EmbreeRT()
   m_blas.reserve(1024);
   m_inst.reserve(2048);
   m_geomIdByInstId.reserve(m_inst.capacity());
+  m_instMask.reserve(m_inst.capacity());
+  m_instFlags.reserve(m_inst.capacity());
+
+  m_hwRayMask = (rtcGetDeviceProperty(m_device, RTC_DEVICE_PROPERTY_RAY_MASK_SUPPORTED) != 0);
+  if(!m_hwRayMask)
+    std::cout << "EmbreeRT: Embree is built without ray masks, instance masks are tested in filter function (slower)" << std::endl;
 }
 
 EmbreeRT::~EmbreeRT()
@@ -91,8 +139,15 @@ void EmbreeRT::ClearGeom()
   rtcSetSceneBuildQuality(m_scene, RTC_BUILD_QUALITY_HIGH);
 
   m_blas.resize(0);
+  m_triNumByGeomId.resize(0);
+  m_geomTypeByGeomId.resize(0);
   m_inst.resize(0);
   m_geomIdByInstId.resize(0);
+  m_instMask.resize(0);
+  m_instFlags.resize(0);
+  m_alphaMasks.clear();
+  m_alphaTestByGeomId.clear();
+  m_userGeomByGeomId.clear();
 }
   
 uint32_t EmbreeRT::AddGeom_Triangles4f(const LiteMath::float4* a_vpos4f, size_t a_vertNumber, const uint32_t* a_triIndices, size_t a_indNumber)
@@ -118,36 +173,315 @@ uint32_t EmbreeRT::AddGeom_Triangles4f(const LiteMath::float4* a_vpos4f, size_t
   memcpy(indices,  a_triIndices, a_indNumber*sizeof(unsigned));
 
   rtcCommitGeometry(geom);
+  return AddBLAS(geom, CRT_GEOM_TRIANGLES, uint32_t(a_indNumber/3));
+}
 
+uint32_t EmbreeRT::AddGeom_Triangles3fShared(const float* a_vpos3f, size_t a_vertNumber, size_t a_vertStride, const uint32_t* a_triIndices, size_t a_indNumber)
+{
+  if(a_vpos3f == nullptr || a_triIndices == nullptr)
+  {
+    std::cout << "EmbreeRT::AddGeom_Triangles3fShared, nullptr input" << std::endl;
+    return uint32_t(-1);
+  }
+
+  // Embree reads vertices with 16 byte loads, which the caller guarantees to be readable (see ISceneObject)
+  if(a_vertStride < 3 * sizeof(float) || a_vertStride % sizeof(float) != 0)
+    return ISceneObject::AddGeom_Triangles3fShared(a_vpos3f, a_vertNumber, a_vertStride, a_triIndices, a_indNumber);
+
+  RTCGeometry geom = rtcNewGeometry(m_device, RTC_GEOMETRY_TYPE_TRIANGLE);
+  rtcSetSharedGeometryBuffer(geom, RTC_BUFFER_TYPE_VERTEX, 0, RTC_FORMAT_FLOAT3, a_vpos3f, 0, a_vertStride, a_vertNumber);
+  rtcSetSharedGeometryBuffer(geom, RTC_BUFFER_TYPE_INDEX,  0, RTC_FORMAT_UINT3, a_triIndices, 0, 3*sizeof(unsigned), a_indNumber/3);
+
+  rtcCommitGeometry(geom);
+  return AddBLAS(geom, CRT_GEOM_TRIANGLES, uint32_t(a_indNumber/3));
+}
+
+uint32_t EmbreeRT::AddBLAS(RTCGeometry a_geom, uint32_t a_type, uint32_t a_triNum)
+{
   // attach 'geom' to 'meshScene' and then remember 'meshScene' in 'm_blas'
   //
   auto meshScene = rtcNewScene(m_device);
   rtcSetSceneBuildQuality(meshScene, RTC_BUILD_QUALITY_HIGH);
   
   /*uint32_t geomId = */
-  rtcAttachGeometry(meshScene, geom);
-  rtcReleaseGeometry(geom);
+  rtcAttachGeometry(meshScene, a_geom);
+  rtcReleaseGeometry(a_geom);
   m_blas.push_back(meshScene);
+  m_triNumByGeomId.push_back(a_triNum);
+  m_geomTypeByGeomId.push_back(a_type);
 
   rtcCommitScene(meshScene);
   return uint32_t(m_blas.size()-1);
 }
 
+uint32_t EmbreeRT::AddGeom_Spheres(const LiteMath::float4* a_posAndRadius, size_t a_count)
+{
+  if(a_posAndRadius == nullptr)
+  {
+    std::cout << "EmbreeRT::AddGeom_Spheres, nullptr input: a_posAndRadius" << std::endl;
+    return uint32_t(-1);
+  }
+
+  RTCGeometry geom = rtcNewGeometry(m_device, RTC_GEOMETRY_TYPE_SPHERE_POINT);
+  float* vertices  = (float*)rtcSetNewGeometryBuffer(geom, RTC_BUFFER_TYPE_VERTEX, 0, RTC_FORMAT_FLOAT4, 4*sizeof(float), a_count);
+  memcpy(vertices, a_posAndRadius, a_count*4*sizeof(float));
+  rtcCommitGeometry(geom);
+
+  return AddBLAS(geom, CRT_GEOM_SPHERES, 0);
+}
+
+uint32_t EmbreeRT::AddGeom_Points(const LiteMath::float4* a_posAndRadius, const LiteMath::float4* a_normals, size_t a_count)
+{
+  if(a_posAndRadius == nullptr)
+  {
+    std::cout << "EmbreeRT::AddGeom_Points, nullptr input: a_posAndRadius" << std::endl;
+    return uint32_t(-1);
+  }
+
+  RTCGeometry geom = rtcNewGeometry(m_device, a_normals != nullptr ? RTC_GEOMETRY_TYPE_ORIENTED_DISC_POINT : RTC_GEOMETRY_TYPE_DISC_POINT);
+  float* vertices  = (float*)rtcSetNewGeometryBuffer(geom, RTC_BUFFER_TYPE_VERTEX, 0, RTC_FORMAT_FLOAT4, 4*sizeof(float), a_count);
+  memcpy(vertices, a_posAndRadius, a_count*4*sizeof(float));
+  
+  if(a_normals != nullptr)
+  {
+    float* normals = (float*)rtcSetNewGeometryBuffer(geom, RTC_BUFFER_TYPE_NORMAL, 0, RTC_FORMAT_FLOAT3, 3*sizeof(float), a_count);
+    for(size_t i = 0; i < a_count; ++i)
+    {
+      normals[i*3+0] = a_normals[i].x;
+      normals[i*3+1] = a_normals[i].y;
+      normals[i*3+2] = a_normals[i].z;
+    }
+  }
+  rtcCommitGeometry(geom);
+
+  return AddBLAS(geom, CRT_GEOM_POINTS, 0);
+}
+
+uint32_t EmbreeRT::AddGeom_Curves(const LiteMath::float4* a_ctrlPoints, size_t a_pointNumber, const uint32_t* a_segmentStart, size_t a_segmentNum,
+                                  uint32_t a_type)
+{
+  if(a_ctrlPoints == nullptr || a_segmentStart == nullptr)
+  {
+    std::cout << "EmbreeRT::AddGeom_Curves, nullptr input: a_ctrlPoints or a_segmentStart" << std::endl;
+    return uint32_t(-1);
+  }
+
+  const auto curveType = (a_type == CRT_CURVE_BEZIER) ? RTC_GEOMETRY_TYPE_ROUND_BEZIER_CURVE : RTC_GEOMETRY_TYPE_ROUND_LINEAR_CURVE;
+  RTCGeometry geom = rtcNewGeometry(m_device, curveType);
+  
+  float* vertices   = (float*)   rtcSetNewGeometryBuffer(geom, RTC_BUFFER_TYPE_VERTEX, 0, RTC_FORMAT_FLOAT4, 4*sizeof(float),    a_pointNumber);
+  unsigned* indices = (unsigned*)rtcSetNewGeometryBuffer(geom, RTC_BUFFER_TYPE_INDEX,  0, RTC_FORMAT_UINT,   sizeof(unsigned),   a_segmentNum);
+  memcpy(vertices, a_ctrlPoints,   a_pointNumber*4*sizeof(float));
+  memcpy(indices,  a_segmentStart, a_segmentNum*sizeof(unsigned));
+  rtcCommitGeometry(geom);
+
+  return AddBLAS(geom, CRT_GEOM_CURVES, 0);
+}
+
+uint32_t EmbreeRT::AddGeom_User(const LiteMath::float4* a_boxes, size_t a_primNum, CRT_UserIntersectFunc a_intersect, void* a_userData)
+{
+  if(a_boxes == nullptr || a_intersect == nullptr)
+  {
+    std::cout << "EmbreeRT::AddGeom_User, nullptr input: a_boxes or a_intersect" << std::endl;
+    return uint32_t(-1);
+  }
+
+  const uint32_t geomId = uint32_t(m_blas.size());
+  UserGeom& userGeom = m_userGeomByGeomId[geomId];
+  userGeom.boxes.assign(a_boxes, a_boxes + a_primNum*2);
+  userGeom.intersect = a_intersect;
+  userGeom.userData  = a_userData;
+
+  RTCGeometry geom = rtcNewGeometry(m_device, RTC_GEOMETRY_TYPE_USER);
+  rtcSetGeometryUserPrimitiveCount(geom, unsigned(a_primNum));
+  rtcSetGeometryUserData(geom, &userGeom);
+  rtcSetGeometryBoundsFunction(geom, &EmbreeRT::UserBounds, nullptr);
+  rtcSetGeometryIntersectFunction(geom, &EmbreeRT::UserIntersect);
+  rtcSetGeometryOccludedFunction(geom, &EmbreeRT::UserOccluded);
+  rtcCommitGeometry(geom);
+
+  return AddBLAS(geom, CRT_GEOM_USER, 0);
+}
+
+void EmbreeRT::UserBounds(const RTCBoundsFunctionArguments* args)
+{
+  const UserGeom* pGeom = (const UserGeom*)args->geometryUserPtr;
+  const auto& boxMin    = pGeom->boxes[args->primID*2+0];
+  const auto& boxMax    = pGeom->boxes[args->primID*2+1];
+  args->bounds_o->lower_x = boxMin.x; args->bounds_o->lower_y = boxMin.y; args->bounds_o->lower_z = boxMin.z;
+  args->bounds_o->upper_x = boxMax.x; args->bounds_o->upper_y = boxMax.y; args->bounds_o->upper_z = boxMax.z;
+}
+
+// we only use rtcIntersect1/rtcOccluded1, so callbacks always get single ray (N == 1)
+//
+void EmbreeRT::UserIntersect(const RTCIntersectFunctionNArguments* args)
+{
+  assert(args->N == 1);
+  if(args->valid[0] == 0)
+    return;
+
+  const UserGeom* pGeom = (const UserGeom*)args->geometryUserPtr;
+  RTCRayHit* rayhit     = (RTCRayHit*)args->rayhit;
+  RTCRay&    ray        = rayhit->ray;
+
+  CRT_Hit hit;
+  if(!pGeom->intersect(pGeom->userData, args->primID, LiteMath::float4(ray.org_x, ray.org_y, ray.org_z, ray.tnear), 
+                                                       LiteMath::float4(ray.dir_x, ray.dir_y, ray.dir_z, ray.tfar), &hit))
+    return;
+
+  RTCHit potentialHit;
+  potentialHit.Ng_x      = hit.coords[0];
+  potentialHit.Ng_y      = hit.coords[1];
+  potentialHit.Ng_z      = hit.coords[2];
+  potentialHit.u         = hit.coords[3];
+  potentialHit.v         = 0.0f;
+  potentialHit.primID    = args->primID;
+  potentialHit.geomID    = args->geomID;
+  potentialHit.instID[0] = args->context->instID[0];
+
+  // let context filter (masks, single-sided instances) reject the hit
+  //
+  int imask = -1;
+  RTCFilterFunctionNArguments filterArgs;
+  filterArgs.valid           = &imask;
+  filterArgs.geometryUserPtr = args->geometryUserPtr;
+  filterArgs.context         = args->context;
+  filterArgs.ray             = (RTCRayN*)args->rayhit;
+  filterArgs.hit             = (RTCHitN*)&potentialHit;
+  filterArgs.N               = 1;
+
+  const float oldFar = ray.tfar;
+  ray.tfar = hit.t;
+  rtcFilterIntersection(args, &filterArgs);
+
+  if(imask == -1)
+    rayhit->hit = potentialHit;
+  else
+    ray.tfar = oldFar;
+}
+
+void EmbreeRT::UserOccluded(const RTCOccludedFunctionNArguments* args)
+{
+  assert(args->N == 1);
+  if(args->valid[0] == 0)
+    return;
+
+  const UserGeom* pGeom = (const UserGeom*)args->geometryUserPtr;
+  RTCRay* ray           = (RTCRay*)args->ray;
+
+  CRT_Hit hit;
+  if(!pGeom->intersect(pGeom->userData, args->primID, LiteMath::float4(ray->org_x, ray->org_y, ray->org_z, ray->tnear), 
+                                                       LiteMath::float4(ray->dir_x, ray->dir_y, ray->dir_z, ray->tfar), &hit))
+    return;
+
+  RTCHit potentialHit;
+  potentialHit.Ng_x      = hit.coords[0];
+  potentialHit.Ng_y      = hit.coords[1];
+  potentialHit.Ng_z      = hit.coords[2];
+  potentialHit.u         = hit.coords[3];
+  potentialHit.v         = 0.0f;
+  potentialHit.primID    = args->primID;
+  potentialHit.geomID    = args->geomID;
+  potentialHit.instID[0] = args->context->instID[0];
+
+  int imask = -1;
+  RTCFilterFunctionNArguments filterArgs;
+  filterArgs.valid           = &imask;
+  filterArgs.geometryUserPtr = args->geometryUserPtr;
+  filterArgs.context         = args->context;
+  filterArgs.ray             = args->ray;
+  filterArgs.hit             = (RTCHitN*)&potentialHit;
+  filterArgs.N               = 1;
+
+  const float oldFar = ray->tfar;
+  ray->tfar = hit.t;
+  rtcFilterOcclusion(args, &filterArgs);
+
+  ray->tfar = (imask == -1) ? -std::numeric_limits<float>::infinity() : oldFar;
+}
+
 void EmbreeRT::UpdateGeom_Triangles4f(uint32_t a_geomId, const LiteMath::float4* a_vpos4f, size_t a_vertNumber, const uint32_t* a_triIndices, size_t a_indNumber)
 {
   std::cout << "EmbreeRT::UpdateGeom_Triangles4f is not implemented yet!" << std::endl;  
 }
 
+uint32_t EmbreeRT::AddAlphaMask(const uint8_t* a_alpha, uint32_t a_width, uint32_t a_height, uint32_t a_pixelStride, uint8_t a_threshold)
+{
+  if(a_alpha == nullptr || a_width == 0 || a_height == 0)
+  {
+    std::cout << "EmbreeRT::AddAlphaMask, empty input" << std::endl;
+    return uint32_t(-1);
+  }
+
+  if(m_alphaMasks.size() >= GeomAlphaTest::NO_MASK)
+  {
+    std::cout << "EmbreeRT::AddAlphaMask, too many alpha masks" << std::endl;
+    return uint32_t(-1);
+  }
+
+  m_alphaMasks.emplace_back();
+  m_alphaMasks.back().Init(a_alpha, a_width, a_height, a_pixelStride, a_threshold);
+  return uint32_t(m_alphaMasks.size()-1);
+}
+
+void EmbreeRT::SetGeomAlphaTest(uint32_t a_geomId, const uint16_t* a_triMaskIds, const LiteMath::float2* a_texCoords, size_t a_vertNumber)
+{
+  if(a_geomId >= m_blas.size() || a_triMaskIds == nullptr || a_texCoords == nullptr || m_geomTypeByGeomId[a_geomId] != CRT_GEOM_TRIANGLES)
+  {
+    std::cout << "EmbreeRT::SetGeomAlphaTest, bad input" << std::endl;
+    return;
+  }
+
+  RTCGeometry geom     = rtcGetGeometry(m_blas[a_geomId], 0);
+  const size_t triNum  = m_triNumByGeomId[a_geomId];
+  const auto* pIndices = (const uint32_t*)rtcGetGeometryBufferData(geom, RTC_BUFFER_TYPE_INDEX, 0);
+
+  GeomAlphaTest& alphaTest = m_alphaTestByGeomId[a_geomId];
+  alphaTest.triMaskIds.assign(a_triMaskIds, a_triMaskIds + triNum);
+  alphaTest.indices.assign(pIndices, pIndices + triNum*3);
+  alphaTest.texCoords.assign(a_texCoords, a_texCoords + a_vertNumber);
+  alphaTest.pMasks = &m_alphaMasks;
+
+  // same filter is used for both queries: transparent hits are just ignored and traversal continues
+  //
+  rtcSetGeometryUserData(geom, &alphaTest);
+  rtcSetGeometryIntersectFilterFunction(geom, &EmbreeRT::AlphaTestFilter);
+  rtcSetGeometryOccludedFilterFunction(geom, &EmbreeRT::AlphaTestFilter);
+  rtcCommitGeometry(geom);
+  rtcCommitScene(m_blas[a_geomId]);
+}
+
+void EmbreeRT::AlphaTestFilter(const RTCFilterFunctionNArguments* args)
+{
+  const GeomAlphaTest* pAlphaTest = (const GeomAlphaTest*)args->geometryUserPtr;
+
+  for(unsigned int i = 0; i < args->N; ++i)
+  {
+    if(args->valid[i] == 0)
+      continue;
+
+    const uint32_t primId = RTCHitN_primID(args->hit, args->N, i);
+    const float    u      = RTCHitN_u(args->hit, args->N, i);
+    const float    v      = RTCHitN_v(args->hit, args->N, i);
+    if(!pAlphaTest->IsOpaque(primId, u, v))
+      args->valid[i] = 0;
+  }
+}
+
 void EmbreeRT::ClearScene()
 {
   m_inst.resize(0);
+  m_geomIdByInstId.resize(0);
+  m_instMask.resize(0);
+  m_instFlags.resize(0);
   if(m_scene != nullptr)
     rtcReleaseScene(m_scene);
   m_scene = rtcNewScene(m_device);
-  rtcSetSceneBuildQuality(m_scene, RTC_BUILD_QUALITY_HIGH);
+  rtcSetSceneBuildQuality(m_scene, m_dynamicScene ? RTC_BUILD_QUALITY_LOW : RTC_BUILD_QUALITY_HIGH);
+  m_instancesAdded = true;
 } 
 
-uint32_t EmbreeRT::AddInstance(uint32_t a_geomId, const LiteMath::float4x4& a_matrix)
+uint32_t EmbreeRT::AddInstance(uint32_t a_geomId, const LiteMath::float4x4& a_matrix, uint32_t a_mask, uint32_t a_flags)
 {
   if(a_geomId >= m_blas.size())
     return uint32_t(-1);
@@ -162,18 +496,90 @@ uint32_t EmbreeRT::AddInstance(uint32_t a_geomId, const LiteMath::float4x4& a_ma
   // update instance matrix
   //
   rtcSetGeometryTransform(instanceGeom, 0, RTC_FORMAT_FLOAT4X4_COLUMN_MAJOR, (const float*)&a_matrix);
+  
+  // instances with zero mask are culled by Embree during traversal (if ray masks are enabled in library)
+  //
+  const uint32_t mask = CRT_EffectiveInstanceMask(a_mask, a_flags);
+  rtcSetGeometryMask(instanceGeom, mask);
   rtcCommitGeometry(instanceGeom);
   
   m_inst.push_back(instanceGeom);
+  m_instancesAdded = true;
   m_geomIdByInstId.push_back(a_geomId);
+  m_instMask.push_back(mask);
+  m_instFlags.push_back(a_flags);
   return uint32_t(m_inst.size()-1);
 }
 
+// bottom levels are committed when geometry is added, so only the top level over instances is built here
 void EmbreeRT::CommitScene()
 {
+  if(m_instancesAdded)
+  {
+    m_needsFilter = false;
+    for(size_t i = 0; i < m_inst.size(); ++i)
+    {
+      const bool singleSided = (m_instFlags[i] & CRT_INSTANCE_DOUBLE_SIDED) == 0;
+      const bool softMask    = !m_hwRayMask && m_instMask[i] != uint32_t(CRT_RAY_MASK_ALL);
+      m_needsFilter = m_needsFilter || singleSided || softMask;
+    }
+    m_instancesAdded = false;
+  }
+
+  int flags = m_needsFilter ? RTC_SCENE_FLAG_CONTEXT_FILTER_FUNCTION : RTC_SCENE_FLAG_NONE;
+  if(m_dynamicScene)
+    flags |= RTC_SCENE_FLAG_DYNAMIC;
+  rtcSetSceneFlags(m_scene, RTCSceneFlags(flags));
   rtcCommitScene(m_scene);
 }  
 
+// we need access to instance data from filter function, so the context is extended; Embree passes the same pointer back to us
+//
+struct EmbreeRTContext
+{
+  RTCIntersectContext context;
+  const EmbreeRT*     pScene;
+};
+
+void EmbreeRT::InitContext(RTCIntersectContext* a_context) const
+{
+  rtcInitIntersectContext(a_context);
+  if(m_needsFilter)
+    a_context->filter = &EmbreeRT::ContextFilter;
+}
+
+void EmbreeRT::ContextFilter(const RTCFilterFunctionNArguments* args)
+{
+  const EmbreeRT* self = reinterpret_cast<const EmbreeRTContext*>(args->context)->pScene;
+
+  for(unsigned int i = 0; i < args->N; ++i)
+  {
+    if(args->valid[i] == 0)
+      continue;
+
+    const uint32_t instId = RTCHitN_instID(args->hit, args->N, i, 0);
+    if(instId >= self->m_inst.size())
+      continue;
+
+    if(!self->m_hwRayMask && (RTCRayN_mask(args->ray, args->N, i) & self->m_instMask[instId]) == 0)
+    {
+      args->valid[i] = 0;
+      continue;
+    }
+
+    // both ray and geometry normal are in object space of the instance here; Ng = cross(v1-v0, v2-v0)
+    //
+    if((self->m_instFlags[instId] & CRT_INSTANCE_DOUBLE_SIDED) == 0)
+    {
+      const float dotNgDir = RTCRayN_dir_x(args->ray, args->N, i) * RTCHitN_Ng_x(args->hit, args->N, i) + 
+                             RTCRayN_dir_y(args->ray, args->N, i) * RTCHitN_Ng_y(args->hit, args->N, i) + 
+                             RTCRayN_dir_z(args->ray, args->N, i) * RTCHitN_Ng_z(args->hit, args->N, i);
+      if(dotNgDir >= 0.0f)
+        args->valid[i] = 0;
+    }
+  }
+}
+
 
 void  EmbreeRT::UpdateInstance(uint32_t a_instanceId, const LiteMath::float4x4& a_matrix)
 {
@@ -182,16 +588,24 @@ void  EmbreeRT::UpdateInstance(uint32_t a_instanceId, const LiteMath::float4x4&
 
   rtcSetGeometryTransform(m_inst[a_instanceId], 0, RTC_FORMAT_FLOAT4X4_COLUMN_MAJOR, (const float*)&a_matrix);
   rtcCommitGeometry(m_inst[a_instanceId]);
+
+  // scene which is changed every frame is better served by quick top level builds than by the best one
+  if(!m_dynamicScene)
+  {
+    m_dynamicScene = true;
+    rtcSetSceneBuildQuality(m_scene, RTC_BUILD_QUALITY_LOW);
+  }
 }
 
-CRT_Hit  EmbreeRT::RayQuery_NearestHit(LiteMath::float4 posAndNear, LiteMath::float4 dirAndFar)
+CRT_Hit  EmbreeRT::RayQuery_NearestHit(LiteMath::float4 posAndNear, LiteMath::float4 dirAndFar, uint32_t a_rayMask)
 {    
   // The intersect context can be used to set intersection
   // filters or flags, and it also contains the instance ID stack
   // used in multi-level instancing.
   // 
-  struct RTCIntersectContext context;
-  rtcInitIntersectContext(&context);
+  EmbreeRTContext ctx;
+  ctx.pScene = this;
+  InitContext(&ctx.context);
 
   // The ray hit structure holds both the ray and the hit.
   // The user must initialize it properly -- see API documentation
@@ -208,25 +622,37 @@ CRT_Hit  EmbreeRT::RayQuery_NearestHit(LiteMath::float4 posAndNear, LiteMath::fl
   rayhit.ray.dir_z = dirAndFar.z;
   rayhit.ray.tfar  = dirAndFar.w; // std::numeric_limits<float>::infinity();
   
-  rayhit.ray.mask   = -1;
+  rayhit.ray.mask   = a_rayMask;
   rayhit.ray.flags  = 0;
   rayhit.hit.geomID    = RTC_INVALID_GEOMETRY_ID;
   rayhit.hit.instID[0] = RTC_INVALID_GEOMETRY_ID;
 
   // There are multiple variants of rtcIntersect. This one intersects a single ray with the scene.
   // 
-  rtcIntersect1(m_scene, &context, &rayhit);
+  rtcIntersect1(m_scene, &ctx.context, &rayhit);
 
   CRT_Hit result;
   if(rayhit.hit.geomID != RTC_INVALID_GEOMETRY_ID)
   {
+    const uint32_t geomId = m_geomIdByInstId[rayhit.hit.instID[0]];
+    const uint32_t type   = m_geomTypeByGeomId[geomId];
     result.t      = rayhit.ray.tfar;
-    result.geomId = m_geomIdByInstId[rayhit.hit.instID[0]];
+    result.geomId = geomId | (type << CRT_GEOM_TYPE_SHIFT);
     result.instId = rayhit.hit.instID[0];
     result.primId = rayhit.hit.primID;
-    result.coords[1] = rayhit.hit.u;
-    result.coords[0] = rayhit.hit.v;
-    result.coords[2] = 1.0f - rayhit.hit.v - rayhit.hit.u;
+    if(type == CRT_GEOM_TRIANGLES)
+    {
+      result.coords[1] = rayhit.hit.u;
+      result.coords[0] = rayhit.hit.v;
+      result.coords[2] = 1.0f - rayhit.hit.v - rayhit.hit.u;
+    }
+    else // Embree returns unnormalized geometry normal in object space
+    {
+      result.coords[0] = rayhit.hit.Ng_x;
+      result.coords[1] = rayhit.hit.Ng_y;
+      result.coords[2] = rayhit.hit.Ng_z;
+      result.coords[3] = rayhit.hit.u;
+    }
   }
   else
   {
@@ -239,14 +665,15 @@ CRT_Hit  EmbreeRT::RayQuery_NearestHit(LiteMath::float4 posAndNear, LiteMath::fl
   return result;
 }
 
-bool EmbreeRT::RayQuery_AnyHit(LiteMath::float4 posAndNear, LiteMath::float4 dirAndFar)
+bool EmbreeRT::RayQuery_AnyHit(LiteMath::float4 posAndNear, LiteMath::float4 dirAndFar, uint32_t a_rayMask)
 {
   // The intersect context can be used to set intersection
   // filters or flags, and it also contains the instance ID stack
   // used in multi-level instancing.
   // 
-  struct RTCIntersectContext context;
-  rtcInitIntersectContext(&context);
+  EmbreeRTContext ctx;
+  ctx.pScene = this;
+  InitContext(&ctx.context);
 
   // The ray hit structure holds both the ray and the hit.
   // The user must initialize it properly -- see API documentation
@@ -262,8 +689,10 @@ bool EmbreeRT::RayQuery_AnyHit(LiteMath::float4 posAndNear, LiteMath::float4 dir
   ray.dir_y = dirAndFar.y;
   ray.dir_z = dirAndFar.z;
   ray.tfar  = dirAndFar.w; // std::numeric_limits<float>::infinity();
+  ray.mask  = a_rayMask;
+  ray.flags = 0;
 
-  rtcOccluded1(m_scene, &context, &ray);  
+  rtcOccluded1(m_scene, &ctx.context, &ray);  
 
   return (ray.tfar < 0.0f);
 }
@@ -272,8 +701,10 @@ bool EmbreeRT::RayQuery_AnyHit(LiteMath::float4 posAndNear, LiteMath::float4 dir
 
 ISceneObject* CreateEmbreeRT() { return new EmbreeRT; }
 
-ISceneObject* CreateSceneRT(const char* a_impleName) 
+ISceneObject* CreateSceneRT(const char* a_impleName, const char* a_cacheDir) 
 { 
+  if(a_impleName != nullptr && std::string(a_impleName) == "BVH2Flat")
+    return CreateBVH2FlatRT(a_cacheDir);
   return CreateEmbreeRT();
 }
 
@@ -42,32 +42,69 @@ uint32_t VulkanRTX::AddGeom_Triangles4f(const LiteMath::float4* a_vpos4f, size_t
   return -1;
 }
 
+uint32_t VulkanRTX::AddGeom_Spheres(const LiteMath::float4* a_posAndRadius, size_t a_count)
+{
+  std::cout << "[VulkanRTX::AddGeom_Spheres]: not implemented" << std::endl;
+  return -1;
+}
+
+uint32_t VulkanRTX::AddGeom_Points(const LiteMath::float4* a_posAndRadius, const LiteMath::float4* a_normals, size_t a_count)
+{
+  std::cout << "[VulkanRTX::AddGeom_Points]: not implemented" << std::endl;
+  return -1;
+}
+
+uint32_t VulkanRTX::AddGeom_Curves(const LiteMath::float4* a_ctrlPoints, size_t a_pointNumber, const uint32_t* a_segmentStart, size_t a_segmentNum,
+                                  uint32_t a_type)
+{
+  std::cout << "[VulkanRTX::AddGeom_Curves]: not implemented" << std::endl;
+  return -1;
+}
+
+uint32_t VulkanRTX::AddGeom_User(const LiteMath::float4* a_boxes, size_t a_primNum, CRT_UserIntersectFunc a_intersect, void* a_userData)
+{
+  std::cout << "[VulkanRTX::AddGeom_User]: not implemented" << std::endl;
+  return -1;
+}
+
 void VulkanRTX::UpdateGeom_Triangles4f(uint32_t a_geomId, const LiteMath::float4* a_vpos4f, size_t a_vertNumber, const uint32_t* a_triIndices, size_t a_indNumber)
 {
   std::cout << "[VulkanRTX::UpdateGeom_Triangles4f]: not implemented" << std::endl;
 }
 
+uint32_t VulkanRTX::AddAlphaMask(const uint8_t* a_alpha, uint32_t a_width, uint32_t a_height, uint32_t a_pixelStride, uint8_t a_threshold)
+{
+  std::cout << "[VulkanRTX::AddAlphaMask]: not implemented" << std::endl;
+  return -1;
+}
+
+void VulkanRTX::SetGeomAlphaTest(uint32_t a_geomId, const uint16_t* a_triMaskIds, const LiteMath::float2* a_texCoords, size_t a_vertNumber)
+{
+  std::cout << "[VulkanRTX::SetGeomAlphaTest]: not implemented" << std::endl;
+}
+
 void VulkanRTX::ClearScene()
 {
  
 } 
 
-uint32_t VulkanRTX::AddInstance(uint32_t a_geomId, const LiteMath::float4x4& a_matrix)
+uint32_t VulkanRTX::AddInstance(uint32_t a_geomId, const LiteMath::float4x4& a_matrix, uint32_t a_mask, uint32_t a_flags)
 {
   return -1;
 }
 
 void VulkanRTX::CommitScene()
 {
+  m_pScnMgr->CommitInstanceTransforms();
   m_accel = m_pScnMgr->GetTLAS();
 }  
 
 void VulkanRTX::UpdateInstance(uint32_t a_instanceId, const LiteMath::float4x4& a_matrix)
 {
-  std::cout << "[VulkanRTX::UpdateInstance]: not implemented" << std::endl;
+  m_pScnMgr->SetInstanceMatrix(a_instanceId, a_matrix);
 }
 
-CRT_Hit VulkanRTX::RayQuery_NearestHit(LiteMath::float4 posAndNear, LiteMath::float4 dirAndFar)
+CRT_Hit VulkanRTX::RayQuery_NearestHit(LiteMath::float4 posAndNear, LiteMath::float4 dirAndFar, uint32_t a_rayMask)
 {    
   CRT_Hit result;
   result.t      = std::numeric_limits<float>::max();
@@ -77,7 +114,7 @@ CRT_Hit VulkanRTX::RayQuery_NearestHit(LiteMath::float4 posAndNear, LiteMath::fl
   return result;
 }
 
-bool VulkanRTX::RayQuery_AnyHit(LiteMath::float4 posAndNear, LiteMath::float4 dirAndFar)
+bool VulkanRTX::RayQuery_AnyHit(LiteMath::float4 posAndNear, LiteMath::float4 dirAndFar, uint32_t a_rayMask)
 {
   return false;
 }
@@ -17,16 +17,25 @@ public:
   void ClearGeom() override;
   
   uint32_t AddGeom_Triangles4f(const LiteMath::float4* a_vpos4f, size_t a_vertNumber, const uint32_t* a_triIndices, size_t a_indNumber) override;
+  uint32_t AddGeom_Spheres(const LiteMath::float4* a_posAndRadius, size_t a_count) override;
+  uint32_t AddGeom_Points(const LiteMath::float4* a_posAndRadius, const LiteMath::float4* a_normals, size_t a_count) override;
+  uint32_t AddGeom_Curves(const LiteMath::float4* a_ctrlPoints, size_t a_pointNumber, const uint32_t* a_segmentStart, size_t a_segmentNum,
+                          uint32_t a_type) override;
+  uint32_t AddGeom_User(const LiteMath::float4* a_boxes, size_t a_primNum, CRT_UserIntersectFunc a_intersect, void* a_userData) override;
   void     UpdateGeom_Triangles4f(uint32_t a_geomId, const LiteMath::float4* a_vpos4f, size_t a_vertNumber, const uint32_t* a_triIndices, size_t a_indNumber) override;
 
+  uint32_t AddAlphaMask(const uint8_t* a_alpha, uint32_t a_width, uint32_t a_height, uint32_t a_pixelStride, uint8_t a_threshold) override;
+  void     SetGeomAlphaTest(uint32_t a_geomId, const uint16_t* a_triMaskIds, const LiteMath::float2* a_texCoords, size_t a_vertNumber) override;
+
   void ClearScene() override; 
   void CommitScene  () override; 
   
-  uint32_t AddInstance(uint32_t a_geomId, const LiteMath::float4x4& a_matrix) override;
+  uint32_t AddInstance(uint32_t a_geomId, const LiteMath::float4x4& a_matrix,
+                       uint32_t a_mask = CRT_RAY_MASK_ALL, uint32_t a_flags = CRT_INSTANCE_DEFAULT) override;
   void     UpdateInstance(uint32_t a_instanceId, const LiteMath::float4x4& a_matrix) override;
 
-  CRT_Hit  RayQuery_NearestHit(LiteMath::float4 posAndNear, LiteMath::float4 dirAndFar) override;
-  bool     RayQuery_AnyHit(LiteMath::float4 posAndNear, LiteMath::float4 dirAndFar) override;
+  CRT_Hit  RayQuery_NearestHit(LiteMath::float4 posAndNear, LiteMath::float4 dirAndFar, uint32_t a_rayMask = CRT_RAY_MASK_ALL) override;
+  bool     RayQuery_AnyHit(LiteMath::float4 posAndNear, LiteMath::float4 dirAndFar, uint32_t a_rayMask = CRT_RAY_MASK_ALL) override;
 
   ////////////////////////////////////////////////////////////////////////////////////////////////
 
@@ -0,0 +1,68 @@
+#pragma once
+
+#include <cstdint>
+#include <cmath>
+#include <algorithm>
+#include <vector>
+#include "LiteMath.h"
+
+/**
+\brief Alpha texture reduced to 1 bit per texel (alpha >= cutoff); 32x smaller than RGBA8, so it fits into cache much better
+*/
+struct AlphaMaskBits
+{
+  uint32_t width  = 0;
+  uint32_t height = 0;
+  std::vector<uint64_t> bits;
+
+  void Init(const uint8_t* a_alpha, uint32_t a_width, uint32_t a_height, uint32_t a_pixelStride, uint8_t a_threshold)
+  {
+    width  = a_width;
+    height = a_height;
+    bits.assign((size_t(a_width) * a_height + 63) / 64, 0ull);
+    for(size_t i = 0; i < size_t(a_width) * a_height; ++i)
+      if(a_alpha[i * a_pixelStride] >= a_threshold)
+        bits[i / 64] |= (1ull << (i % 64));
+  }
+
+  /**
+  \brief nearest texel lookup with 'repeat' addressing
+  */
+  bool IsOpaque(LiteMath::float2 a_uv) const
+  {
+    const float u = a_uv.x - std::floor(a_uv.x);
+    const float v = a_uv.y - std::floor(a_uv.y);
+    const uint32_t x = std::min(uint32_t(u * float(width)),  width  - 1);
+    const uint32_t y = std::min(uint32_t(v * float(height)), height - 1);
+    const size_t   i = size_t(y) * width + x;
+    return (bits[i / 64] >> (i % 64)) & 1ull;
+  }
+};
+
+/**
+\brief Per-geometry data needed to evaluate alpha test for a hit: mask id of every triangle plus texture coordinates
+*/
+struct GeomAlphaTest
+{
+  static constexpr uint16_t NO_MASK = 0xFFFF; ///< triangle is opaque, test is skipped
+
+  std::vector<uint16_t>          triMaskIds;
+  std::vector<uint32_t>          indices;
+  std::vector<LiteMath::float2>  texCoords;
+  const std::vector<AlphaMaskBits>* pMasks = nullptr;
+
+  /**
+  \brief (u,v) are barycentrics of the second and the third vertices, as reported by Embree
+  */
+  bool IsOpaque(uint32_t a_primId, float a_u, float a_v) const
+  {
+    const uint16_t maskId = triMaskIds[a_primId];
+    if(maskId == NO_MASK)
+      return true;
+
+    const LiteMath::float2 t0 = texCoords[indices[a_primId * 3 + 0]];
+    const LiteMath::float2 t1 = texCoords[indices[a_primId * 3 + 1]];
+    const LiteMath::float2 t2 = texCoords[indices[a_primId * 3 + 2]];
+    return (*pMasks)[maskId].IsOpaque(t0 * (1.0f - a_u - a_v) + t1 * a_u + t2 * a_v);
+  }
+};
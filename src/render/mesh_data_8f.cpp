@@ -0,0 +1,131 @@
+#include "mesh_data_8f.h"
+
+MeshData8F::MeshData8F(bool a_hugePages) : m_vertices(GeometryAllocator<float>(a_hugePages)), m_indices(GeometryAllocator<uint32_t>(a_hugePages))
+{
+  m_inputBinding.binding   = 0;
+  m_inputBinding.stride    = uint32_t(FLOATS_PER_VERTEX * sizeof(float));
+  m_inputBinding.inputRate = VK_VERTEX_INPUT_RATE_VERTEX;
+
+  // location 0: position and encoded normal, location 1: texture coordinates and encoded tangent
+  for(uint32_t i = 0; i < 2; ++i)
+  {
+    m_attributes[i].location = i;
+    m_attributes[i].binding  = 0;
+    m_attributes[i].format   = VK_FORMAT_R32G32B32A32_SFLOAT;
+    m_attributes[i].offset   = uint32_t(i * 4 * sizeof(float));
+  }
+}
+
+VkPipelineVertexInputStateCreateInfo MeshData8F::VertexInputLayout()
+{
+  VkPipelineVertexInputStateCreateInfo vertexInputInfo = {};
+  vertexInputInfo.sType                           = VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO;
+  vertexInputInfo.vertexBindingDescriptionCount   = 1;
+  vertexInputInfo.vertexAttributeDescriptionCount = 2;
+  vertexInputInfo.pVertexBindingDescriptions      = &m_inputBinding;
+  vertexInputInfo.pVertexAttributeDescriptions    = m_attributes;
+  return vertexInputInfo;
+}
+
+void MeshData8F::Reserve(size_t a_vertNum, size_t a_indNum)
+{
+  Detach();
+  m_vertices.reserve(a_vertNum * FLOATS_PER_VERTEX);
+  m_indices.reserve(a_indNum);
+}
+
+void MeshData8F::Extend(size_t a_vertNum, size_t a_indNum)
+{
+  Detach();
+  m_vertices.resize(m_vertices.size() + a_vertNum * FLOATS_PER_VERTEX);
+  m_indices.resize(m_indices.size() + a_indNum);
+}
+
+void MeshData8F::Truncate(size_t a_vertNum, size_t a_indNum)
+{
+  Detach();
+  m_vertices.resize(std::min(m_vertices.size(), a_vertNum * FLOATS_PER_VERTEX));
+  m_indices.resize(std::min(m_indices.size(), a_indNum));
+}
+
+void MeshData8F::Attach(std::shared_ptr<const void> a_owner, const float* a_vertices, size_t a_vertNum, const uint32_t* a_indices, size_t a_indNum)
+{
+  m_vertices.clear();
+  m_indices.clear();
+  m_pOwner       = std::move(a_owner);
+  m_pExtVertices = a_vertices;
+  m_pExtIndices  = a_indices;
+  m_extVertNum   = a_vertNum;
+  m_extIndNum    = a_indNum;
+}
+
+void MeshData8F::Release()
+{
+  decltype(m_vertices)(m_vertices.get_allocator()).swap(m_vertices);
+  decltype(m_indices)(m_indices.get_allocator()).swap(m_indices);
+  m_pOwner       = nullptr;
+  m_pExtVertices = nullptr;
+  m_pExtIndices  = nullptr;
+  m_extVertNum   = 0;
+  m_extIndNum    = 0;
+}
+
+void MeshData8F::Detach()
+{
+  if(!m_pOwner)
+    return;
+  m_vertices.assign(m_pExtVertices, m_pExtVertices + m_extVertNum * FLOATS_PER_VERTEX);
+  m_indices.assign(m_pExtIndices, m_pExtIndices + m_extIndNum);
+  m_pOwner       = nullptr;
+  m_pExtVertices = nullptr;
+  m_pExtIndices  = nullptr;
+  m_extVertNum   = 0;
+  m_extIndNum    = 0;
+}
+
+void MeshData8F::AppendVertices(size_t a_vertNum, const float* a_pos4f, const float* a_norm4f, const float* a_tang4f, const float* a_texCoord2f)
+{
+  Detach();
+  static const float zero[4] = {0.0f, 0.0f, 0.0f, 0.0f};
+
+  const size_t first = m_vertices.size();
+  m_vertices.resize(first + a_vertNum * FLOATS_PER_VERTEX);
+  float* dst = m_vertices.data() + first;
+
+#pragma omp parallel for if(a_vertNum > 65536)
+  for(int64_t i = 0; i < int64_t(a_vertNum); ++i)
+  {
+    PackVertex(dst + i * FLOATS_PER_VERTEX, a_pos4f + i * 4, a_norm4f != nullptr ? a_norm4f + i * 4 : zero,
+      a_tang4f != nullptr ? a_tang4f + i * 4 : zero, a_texCoord2f + i * 2);
+  }
+}
+
+void MeshData8F::Write(const VSGFMeshView &a_mesh, size_t a_firstVertex, size_t a_firstIndex)
+{
+  static const float zero[4] = {0.0f, 0.0f, 0.0f, 0.0f};
+
+  // called by loader threads, so no nested parallel loop here
+  float* dst = m_vertices.data() + a_firstVertex * FLOATS_PER_VERTEX;
+  for(size_t i = 0; i < a_mesh.vertNum; ++i)
+  {
+    PackVertex(dst + i * FLOATS_PER_VERTEX, a_mesh.pos4f + i * 4, a_mesh.norm4f != nullptr ? a_mesh.norm4f + i * 4 : zero,
+      a_mesh.tang4f != nullptr ? a_mesh.tang4f + i * 4 : zero, a_mesh.texCoord2f + i * 2);
+  }
+  memcpy(m_indices.data() + a_firstIndex, a_mesh.indices, size_t(a_mesh.indNum) * sizeof(uint32_t));
+}
+
+void MeshData8F::Append(const cmesh::SimpleMesh &meshData)
+{
+  const size_t vertNum = meshData.VerticesNum();
+  AppendVertices(vertNum, meshData.vPos4f.data(),
+    meshData.vNorm4f.size() >= vertNum * 4 ? meshData.vNorm4f.data() : nullptr,
+    meshData.vTang4f.size() >= vertNum * 4 ? meshData.vTang4f.data() : nullptr,
+    meshData.vTexCoord2f.data());
+  m_indices.insert(m_indices.end(), meshData.indices.begin(), meshData.indices.end());
+}
+
+void MeshData8F::Append(const VSGFMeshView &a_mesh)
+{
+  AppendVertices(a_mesh.vertNum, a_mesh.pos4f, a_mesh.norm4f, a_mesh.tang4f, a_mesh.texCoord2f);
+  m_indices.insert(m_indices.end(), a_mesh.indices, a_mesh.indices + a_mesh.indNum);
+}
@@ -0,0 +1,122 @@
+#ifndef CHIMERA_MESH_DATA_8F_H
+#define CHIMERA_MESH_DATA_8F_H
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <memory>
+#include <vector>
+#include <geom/vk_mesh.h>
+#include "LiteMath.h"
+#include "../loader_utils/vsgf.h"
+#include "../utils/geometry_memory.h"
+
+/**
+\brief Interleaved vertex layout of Mesh8F (position and encoded normal, texture coordinates and encoded tangent), which can
+       be filled straight from file data: VSGF streams are converted into the final layout without intermediate cmesh::SimpleMesh,
+       and storage may be reserved for the whole scene up front, so it is not reallocated and copied while meshes are added
+*/
+struct MeshData8F : IMeshData
+{
+  explicit MeshData8F(bool a_hugePages = false); // see AllocateGeometryMemory
+
+  // attached data is read-only (e.g. a read-only file mapping): it's only read by uploads, pointers are non-const for IMeshData
+  float*    VertexData() override { return m_pOwner ? const_cast<float*>(m_pExtVertices) : m_vertices.data(); }
+  uint32_t* IndexData()  override { return m_pOwner ? const_cast<uint32_t*>(m_pExtIndices) : m_indices.data(); }
+
+  // in bytes
+  size_t VertexDataSize() override { return (m_pOwner ? m_extVertNum * FLOATS_PER_VERTEX : m_vertices.size()) * sizeof(float); }
+  size_t IndexDataSize()  override { return (m_pOwner ? m_extIndNum : m_indices.size()) * sizeof(uint32_t); }
+
+  size_t SingleVertexSize() override { return FLOATS_PER_VERTEX * sizeof(float); }
+  size_t SingleIndexSize()  override { return sizeof(uint32_t); }
+
+  VkPipelineVertexInputStateCreateInfo VertexInputLayout() override;
+
+  void Append(const cmesh::SimpleMesh &meshData) override;
+  void Append(const VSGFMeshView &a_mesh);
+  void Reserve(size_t a_vertNum, size_t a_indNum);
+
+  /**
+  \brief add zeroed storage for a_vertNum vertices and a_indNum indices to be written in place through VertexData()/IndexData()
+         (e.g. by loader threads converting straight to this layout), instead of converting to a temporary and appending it
+  */
+  void Extend(size_t a_vertNum, size_t a_indNum);
+  void Truncate(size_t a_vertNum, size_t a_indNum); // keep the first a_vertNum vertices and a_indNum indices
+
+  /**
+  \brief convert a_mesh into storage added by 'Extend' starting from vertex a_firstVertex and index a_firstIndex;
+         threads may write disjoint ranges concurrently. Indices are copied as they are, i.e. relative to the mesh
+  */
+  void Write(const VSGFMeshView &a_mesh, size_t a_firstVertex, size_t a_firstIndex);
+
+  /**
+  \brief use vertices and indices already in the final layout without copying them; 'a_owner' keeps them alive
+         (e.g. mapping of a scene cache file). Data is copied to own storage only if more meshes are appended later
+  */
+  void Attach(std::shared_ptr<const void> a_owner, const float* a_vertices, size_t a_vertNum, const uint32_t* a_indices, size_t a_indNum);
+
+  /**
+  \brief free vertices and indices when nothing reads them on CPU anymore (e.g. they are uploaded to GPU for rasterization only);
+         VertexData()/IndexData() are null after that
+  */
+  void Release();
+
+  static constexpr size_t FLOATS_PER_VERTEX = 8;
+
+  // inverse of 'DecodeNormal' from "resources/shaders/unpack_attributes.h": x and y in 16 bits each, sign of z in the lowest bit of x;
+  // branchless, so loops over vertices are vectorised
+  static inline float EncodeNormal(float a_x, float a_y, float a_z)
+  {
+    const int x = int(std::max(-1.0f, std::min(a_x, 1.0f)) * 32767.0f);
+    const int y = int(std::max(-1.0f, std::min(a_y, 1.0f)) * 32767.0f);
+
+    const uint32_t signZ = (a_z < 0.0f) ? 1u : 0u;
+    const uint32_t data  = (uint32_t(x) & 0x0000FFFEu) | signZ | ((uint32_t(y) & 0x0000FFFFu) << 16);
+
+    float res;
+    memcpy(&res, &data, sizeof(res));
+    return res;
+  }
+
+  static inline LiteMath::float3 DecodeNormal(float a_data)
+  {
+    uint32_t data;
+    memcpy(&data, &a_data, sizeof(data));
+
+    const float x = float(int16_t(data & 0x0000FFFEu)) * (1.0f / 32767.0f);
+    const float y = float(int16_t(data >> 16)) * (1.0f / 32767.0f);
+    const float z = std::sqrt(std::max(1.0f - x * x - y * y, 0.0f));
+    return LiteMath::float3(x, y, (data & 1u) != 0 ? -z : z);
+  }
+
+private:
+  void AppendVertices(size_t a_vertNum, const float* a_pos4f, const float* a_norm4f, const float* a_tang4f, const float* a_texCoord2f);
+  static inline void PackVertex(float* a_dst, const float* a_pos4f, const float* a_norm4f, const float* a_tang4f, const float* a_texCoord2f)
+  {
+    a_dst[0] = a_pos4f[0];
+    a_dst[1] = a_pos4f[1];
+    a_dst[2] = a_pos4f[2];
+    a_dst[3] = EncodeNormal(a_norm4f[0], a_norm4f[1], a_norm4f[2]);
+    a_dst[4] = a_texCoord2f[0];
+    a_dst[5] = a_texCoord2f[1];
+    a_dst[6] = EncodeNormal(a_tang4f[0], a_tang4f[1], a_tang4f[2]);
+    a_dst[7] = 0.0f;
+  }
+  void Detach();
+
+  // consumers reference slices of this storage in place (GPU upload, Embree shared buffers, CPU shading), so it's not copied
+  std::vector<float,    GeometryAllocator<float>>    m_vertices;
+  std::vector<uint32_t, GeometryAllocator<uint32_t>> m_indices;
+
+  std::shared_ptr<const void> m_pOwner = nullptr;
+  const float*    m_pExtVertices = nullptr;
+  const uint32_t* m_pExtIndices  = nullptr;
+  size_t          m_extVertNum   = 0;
+  size_t          m_extIndNum    = 0;
+
+  VkVertexInputBindingDescription   m_inputBinding  = {};
+  VkVertexInputAttributeDescription m_attributes[2] = {};
+};
+
+#endif// CHIMERA_MESH_DATA_8F_H
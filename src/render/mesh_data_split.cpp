@@ -0,0 +1,170 @@
+#include "mesh_data_split.h"
+#include "mesh_data_8f.h"
+
+MeshDataSplit::MeshDataSplit(bool a_quantisePositions, bool a_hugePages) : m_quantisePositions(a_quantisePositions),
+  m_positions(GeometryAllocator<float>(a_hugePages)), m_positionsQ(GeometryAllocator<uint16_t>(a_hugePages)),
+  m_normals(GeometryAllocator<uint32_t>(a_hugePages)), m_texCoords(GeometryAllocator<uint32_t>(a_hugePages)),
+  m_indices(GeometryAllocator<uint8_t>(a_hugePages)), m_matIds(GeometryAllocator<uint8_t>(a_hugePages))
+{
+}
+
+static inline size_t AlignUp4(size_t a_val) { return (a_val + 3) & ~size_t(3); }
+
+uint32_t MeshDataSplit::AddMesh(const float* a_vertices8f, uint32_t a_vertNum, const uint32_t* a_indices, uint32_t a_indNum, const uint32_t* a_matIds)
+{
+  constexpr size_t stride = MeshData8F::FLOATS_PER_VERTEX;
+
+  Mesh mesh;
+  mesh.vertNum     = a_vertNum;
+  mesh.indNum      = a_indNum;
+  mesh.firstVertex = m_totalVertices;
+  mesh.indexSize   = a_vertNum <= 65536 ? 2 : 4;
+
+  const uint32_t triNum = a_indNum / 3;
+  uint32_t maxMatId = 0;
+  for(uint32_t t = 0; t < triNum; ++t)
+    maxMatId = std::max(maxMatId, a_matIds[t]);
+  mesh.matIdSize = maxMatId < 256 ? 1 : (maxMatId < 65536 ? 2 : 4);
+
+  if(m_quantisePositions)
+  {
+    LiteMath::float3 boxMax(-INFINITY, -INFINITY, -INFINITY);
+    mesh.boxMin = LiteMath::float3(+INFINITY, +INFINITY, +INFINITY);
+    for(size_t v = 0; v < a_vertNum; ++v)
+    {
+      const LiteMath::float3 pos(a_vertices8f[v * stride + 0], a_vertices8f[v * stride + 1], a_vertices8f[v * stride + 2]);
+      mesh.boxMin = LiteMath::min(mesh.boxMin, pos);
+      boxMax      = LiteMath::max(boxMax, pos);
+    }
+    if(a_vertNum == 0)
+      mesh.boxMin = boxMax = LiteMath::float3(0.0f, 0.0f, 0.0f);
+    mesh.boxStep = (boxMax - mesh.boxMin) * (1.0f / 65535.0f);
+
+    m_positionsQ.resize((m_totalVertices + a_vertNum) * 3);
+    uint16_t* dst = m_positionsQ.data() + m_totalVertices * 3;
+    for(size_t v = 0; v < a_vertNum; ++v)
+    {
+      for(int c = 0; c < 3; ++c)
+      {
+        const float q = mesh.boxStep[c] > 0.0f ? (a_vertices8f[v * stride + c] - mesh.boxMin[c]) / mesh.boxStep[c] : 0.0f;
+        dst[v * 3 + c] = uint16_t(std::max(0.0f, std::min(std::round(q), 65535.0f)));
+      }
+    }
+  }
+  else
+  {
+    m_positions.resize((m_totalVertices + a_vertNum) * 3 + 1);
+    float* dst = m_positions.data() + m_totalVertices * 3;
+    for(size_t v = 0; v < a_vertNum; ++v)
+    {
+      dst[v * 3 + 0] = a_vertices8f[v * stride + 0];
+      dst[v * 3 + 1] = a_vertices8f[v * stride + 1];
+      dst[v * 3 + 2] = a_vertices8f[v * stride + 2];
+    }
+    dst[a_vertNum * 3] = 0.0f;
+  }
+
+  m_normals.resize(m_totalVertices + a_vertNum);
+  m_texCoords.resize(m_totalVertices + a_vertNum);
+  uint32_t* normals   = m_normals.data() + m_totalVertices;
+  uint32_t* texCoords = m_texCoords.data() + m_totalVertices;
+  for(size_t v = 0; v < a_vertNum; ++v)
+  {
+    const float* src = a_vertices8f + v * stride;
+    normals[v]   = EncodeOctNormal(MeshData8F::DecodeNormal(src[3]));
+    texCoords[v] = uint32_t(FloatToHalf(src[4])) | (uint32_t(FloatToHalf(src[5])) << 16);
+  }
+
+  mesh.indexOffset = AlignUp4(m_indices.size());
+  m_indices.resize(mesh.indexOffset + size_t(a_indNum) * mesh.indexSize);
+  if(mesh.indexSize == 4)
+    memcpy(m_indices.data() + mesh.indexOffset, a_indices, size_t(a_indNum) * sizeof(uint32_t));
+  else
+  {
+    uint16_t* dst = reinterpret_cast<uint16_t*>(m_indices.data() + mesh.indexOffset);
+    for(size_t i = 0; i < a_indNum; ++i)
+      dst[i] = uint16_t(a_indices[i]);
+  }
+
+  mesh.matIdOffset = AlignUp4(m_matIds.size());
+  m_matIds.resize(mesh.matIdOffset + size_t(triNum) * mesh.matIdSize);
+  uint8_t* matIds = m_matIds.data() + mesh.matIdOffset;
+  for(size_t t = 0; t < triNum; ++t)
+  {
+    if(mesh.matIdSize == 1)
+      matIds[t] = uint8_t(a_matIds[t]);
+    else if(mesh.matIdSize == 2)
+      reinterpret_cast<uint16_t*>(matIds)[t] = uint16_t(a_matIds[t]);
+    else
+      reinterpret_cast<uint32_t*>(matIds)[t] = a_matIds[t];
+  }
+
+  m_totalVertices += a_vertNum;
+  m_meshes.push_back(mesh);
+  return uint32_t(m_meshes.size() - 1);
+}
+
+LiteMath::float3 MeshDataSplit::Position(uint32_t a_meshId, uint32_t a_vertId) const
+{
+  const Mesh& mesh = m_meshes[a_meshId];
+  const size_t v = (mesh.firstVertex + a_vertId) * 3;
+  if(!m_quantisePositions)
+    return LiteMath::float3(m_positions[v + 0], m_positions[v + 1], m_positions[v + 2]);
+
+  const LiteMath::float3 q(float(m_positionsQ[v + 0]), float(m_positionsQ[v + 1]), float(m_positionsQ[v + 2]));
+  return mesh.boxMin + q * mesh.boxStep;
+}
+
+LiteMath::float2 MeshDataSplit::TexCoord(uint32_t a_meshId, uint32_t a_vertId) const
+{
+  const uint32_t data = m_texCoords[m_meshes[a_meshId].firstVertex + a_vertId];
+  return LiteMath::float2(HalfToFloat(uint16_t(data & 0x0000FFFFu)), HalfToFloat(uint16_t(data >> 16)));
+}
+
+uint32_t MeshDataSplit::Index(uint32_t a_meshId, uint32_t a_index) const
+{
+  const Mesh& mesh = m_meshes[a_meshId];
+  const uint8_t* src = m_indices.data() + mesh.indexOffset;
+  return mesh.indexSize == 2 ? reinterpret_cast<const uint16_t*>(src)[a_index] : reinterpret_cast<const uint32_t*>(src)[a_index];
+}
+
+uint32_t MeshDataSplit::MaterialId(uint32_t a_meshId, uint32_t a_triId) const
+{
+  const Mesh& mesh = m_meshes[a_meshId];
+  const uint8_t* src = m_matIds.data() + mesh.matIdOffset;
+  switch(mesh.matIdSize)
+  {
+    case 1:  return src[a_triId];
+    case 2:  return reinterpret_cast<const uint16_t*>(src)[a_triId];
+    default: return reinterpret_cast<const uint32_t*>(src)[a_triId];
+  }
+}
+
+const float* MeshDataSplit::PositionData(uint32_t a_meshId) const
+{
+  return m_quantisePositions ? nullptr : m_positions.data() + m_meshes[a_meshId].firstVertex * 3;
+}
+
+const uint32_t* MeshDataSplit::IndexData32(uint32_t a_meshId) const
+{
+  const Mesh& mesh = m_meshes[a_meshId];
+  return mesh.indexSize == 4 ? reinterpret_cast<const uint32_t*>(m_indices.data() + mesh.indexOffset) : nullptr;
+}
+
+void MeshDataSplit::DecodePositions(uint32_t a_meshId, LiteMath::float4* a_pos4f) const
+{
+  for(uint32_t v = 0; v < m_meshes[a_meshId].vertNum; ++v)
+    a_pos4f[v] = LiteMath::to_float4(Position(a_meshId, v), 1.0f);
+}
+
+void MeshDataSplit::DecodeIndices(uint32_t a_meshId, uint32_t* a_indices) const
+{
+  for(uint32_t i = 0; i < m_meshes[a_meshId].indNum; ++i)
+    a_indices[i] = Index(a_meshId, i);
+}
+
+size_t MeshDataSplit::MemorySize() const
+{
+  return m_positions.size() * sizeof(float) + m_positionsQ.size() * sizeof(uint16_t) + m_normals.size() * sizeof(uint32_t) +
+         m_texCoords.size() * sizeof(uint32_t) + m_indices.size() + m_matIds.size() + m_meshes.size() * sizeof(Mesh);
+}
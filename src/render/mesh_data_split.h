@@ -0,0 +1,140 @@
+#ifndef CHIMERA_MESH_DATA_SPLIT_H
+#define CHIMERA_MESH_DATA_SPLIT_H
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+#include "LiteMath.h"
+#include "../utils/geometry_memory.h"
+
+/**
+\brief CPU copy of scene geometry in separate compact streams (GPU keeps interleaved MeshData8F layout): positions are packed
+       tightly for traversal (3 floats or, optionally, 3 x 16 bits relative to mesh bounding box), normals are oct-encoded in 2 x 16 bits
+       and texture coordinates are 2 halves, so hit shading touches 8 bytes of a vertex. Indices of meshes with up to 65536 vertices
+       and material ids which fit are stored in 16 (8) bits
+*/
+struct MeshDataSplit
+{
+  explicit MeshDataSplit(bool a_quantisePositions = false, bool a_hugePages = false);
+
+  struct Mesh
+  {
+    uint32_t vertNum     = 0;
+    uint32_t indNum      = 0;
+    size_t   firstVertex = 0; // in position and attribute streams
+    size_t   indexOffset = 0; // in bytes
+    size_t   matIdOffset = 0; // in bytes
+    uint32_t indexSize   = 4; // 2 or 4 bytes
+    uint32_t matIdSize   = 4; // 1, 2 or 4 bytes
+    LiteMath::float3 boxMin  = {0.0f, 0.0f, 0.0f}; // quantised position is boxMin + q * boxStep
+    LiteMath::float3 boxStep = {0.0f, 0.0f, 0.0f};
+  };
+
+  // a_vertices8f are in MeshData8F layout, a_matIds are per triangle
+  uint32_t AddMesh(const float* a_vertices8f, uint32_t a_vertNum, const uint32_t* a_indices, uint32_t a_indNum, const uint32_t* a_matIds);
+
+  uint32_t MeshesNum() const { return uint32_t(m_meshes.size()); }
+  const Mesh& GetMesh(uint32_t a_meshId) const { return m_meshes[a_meshId]; }
+  bool QuantisedPositions() const { return m_quantisePositions; }
+
+  LiteMath::float3 Position(uint32_t a_meshId, uint32_t a_vertId) const;
+  LiteMath::float3 Normal(uint32_t a_meshId, uint32_t a_vertId) const { return DecodeOctNormal(m_normals[m_meshes[a_meshId].firstVertex + a_vertId]); }
+  LiteMath::float2 TexCoord(uint32_t a_meshId, uint32_t a_vertId) const;
+  uint32_t Index(uint32_t a_meshId, uint32_t a_index) const;
+  uint32_t MaterialId(uint32_t a_meshId, uint32_t a_triId) const;
+
+  // float positions of the mesh, 3 per vertex, readable with 16 byte loads (e.g. by Embree shared buffers); null if positions are quantised
+  const float* PositionData(uint32_t a_meshId) const;
+  // null if indices of the mesh are 16-bit
+  const uint32_t* IndexData32(uint32_t a_meshId) const;
+
+  // unpack the mesh for consumers which need plain arrays; a_pos4f has vertNum elements and a_indices indNum
+  void DecodePositions(uint32_t a_meshId, LiteMath::float4* a_pos4f) const;
+  void DecodeIndices(uint32_t a_meshId, uint32_t* a_indices) const;
+
+  // storage of streams, changes when they are reallocated
+  const void* PositionStorage() const { return m_quantisePositions ? (const void*)m_positionsQ.data() : (const void*)m_positions.data(); }
+  const void* IndexStorage()    const { return m_indices.data(); }
+
+  size_t MemorySize() const;
+
+  // octahedral mapping of unit vector to 2 x 16-bit snorm, x in the lower half
+  static inline uint32_t EncodeOctNormal(LiteMath::float3 a_n)
+  {
+    const float l1 = std::abs(a_n.x) + std::abs(a_n.y) + std::abs(a_n.z);
+    float x = l1 > 0.0f ? a_n.x / l1 : 0.0f;
+    float y = l1 > 0.0f ? a_n.y / l1 : 0.0f;
+    if(a_n.z < 0.0f)
+    {
+      const float fx = (1.0f - std::abs(y)) * (x >= 0.0f ? 1.0f : -1.0f);
+      const float fy = (1.0f - std::abs(x)) * (y >= 0.0f ? 1.0f : -1.0f);
+      x = fx;
+      y = fy;
+    }
+    const int sx = int(std::round(std::max(-1.0f, std::min(x, 1.0f)) * 32767.0f));
+    const int sy = int(std::round(std::max(-1.0f, std::min(y, 1.0f)) * 32767.0f));
+    return (uint32_t(sx) & 0x0000FFFFu) | ((uint32_t(sy) & 0x0000FFFFu) << 16);
+  }
+
+  static inline LiteMath::float3 DecodeOctNormal(uint32_t a_data)
+  {
+    const float x = float(int16_t(a_data & 0x0000FFFFu)) * (1.0f / 32767.0f);
+    const float y = float(int16_t(a_data >> 16)) * (1.0f / 32767.0f);
+    LiteMath::float3 n(x, y, 1.0f - std::abs(x) - std::abs(y));
+    const float t = std::max(-n.z, 0.0f);
+    n.x += n.x >= 0.0f ? -t : t;
+    n.y += n.y >= 0.0f ? -t : t;
+    return LiteMath::normalize(n);
+  }
+
+  // IEEE half, rounded to nearest even
+  static inline uint16_t FloatToHalf(float a_val)
+  {
+    uint32_t f;
+    memcpy(&f, &a_val, sizeof(f));
+    const uint32_t sign = (f >> 16) & 0x8000u;
+    const uint32_t absf = f & 0x7FFFFFFFu;
+    if(absf >= 0x47800000u) // overflow, inf or nan
+      return uint16_t(sign | (absf > 0x7F800000u ? 0x7E00u : 0x7C00u));
+    if(absf < 0x38800000u)  // subnormal, m * 2^-24
+      return uint16_t(sign | uint32_t(std::nearbyint(std::abs(a_val) * 16777216.0f)));
+
+    uint32_t h = (absf - 0x38000000u) >> 13;
+    const uint32_t rem = absf & 0x00001FFFu;
+    if(rem > 0x1000u || (rem == 0x1000u && (h & 1u)))
+      ++h; // carry to exponent gives the next power of two (or inf)
+    return uint16_t(sign | h);
+  }
+
+  static inline float HalfToFloat(uint16_t a_val)
+  {
+    const uint32_t sign = uint32_t(a_val & 0x8000u) << 16;
+    const uint32_t exp  = (a_val >> 10) & 0x1Fu;
+    const uint32_t mant = a_val & 0x03FFu;
+    if(exp == 0)
+      return (sign != 0 ? -1.0f : 1.0f) * float(mant) * (1.0f / 16777216.0f);
+
+    const uint32_t f = sign | (exp == 31 ? 0x7F800000u : (exp + 112) << 23) | (mant << 13);
+    float res;
+    memcpy(&res, &f, sizeof(res));
+    return res;
+  }
+
+private:
+  template<typename T> using Stream = std::vector<T, GeometryAllocator<T>>;
+
+  bool m_quantisePositions = false;
+  std::vector<Mesh> m_meshes;
+  size_t m_totalVertices = 0;
+
+  Stream<float>    m_positions;  // 3 per vertex and padding, so the last one is readable with a 16 byte load
+  Stream<uint16_t> m_positionsQ; // 3 per vertex
+  Stream<uint32_t> m_normals;
+  Stream<uint32_t> m_texCoords;  // 2 halves, u in the lower half
+  Stream<uint8_t>  m_indices;    // meshes start at 4 byte boundary
+  Stream<uint8_t>  m_matIds;
+};
+
+#endif// CHIMERA_MESH_DATA_SPLIT_H
@@ -1,8 +1,11 @@
 #include <map>
 #include <array>
+#include <algorithm>
+#include <cstring>
 #include "scene_mgr.h"
 #include "vk_utils.h"
 #include "vk_buffers.h"
+#include "../utils/mapped_file.h"
 
 VkTransformMatrixKHR transformMatrixFromFloat4x4(const LiteMath::float4x4 &m)
 {
@@ -17,6 +20,24 @@ VkTransformMatrixKHR transformMatrixFromFloat4x4(const LiteMath::float4x4 &m)
   return transformMatrix;
 }
 
+// TLAS is built so that it can be updated in place when instances move
+static constexpr VkBuildAccelerationStructureFlagsKHR TLAS_BUILD_FLAGS = VK_BUILD_ACCELERATION_STRUCTURE_PREFER_FAST_TRACE_BIT_KHR |
+                                                                         VK_BUILD_ACCELERATION_STRUCTURE_ALLOW_UPDATE_BIT_KHR;
+
+// calls a_func(first, count) for every run of consecutive ids in sorted 'a_ids'
+template<typename F>
+static void ForEachIdRun(const std::vector<uint32_t> &a_ids, F a_func)
+{
+  for(size_t i = 0; i < a_ids.size(); )
+  {
+    size_t j = i + 1;
+    while(j < a_ids.size() && a_ids[j] == a_ids[j - 1] + 1)
+      ++j;
+    a_func(a_ids[i], uint32_t(j - i));
+    i = j;
+  }
+}
+
 VkFormat formatFromImageInfo(const ImageFileInfo &info)
 {
   VkFormat res = VK_FORMAT_R8G8B8A8_UNORM;
@@ -158,12 +179,13 @@ VkPipelineVertexInputStateCreateInfo SceneManager::GetPipelineVertexInputStateCr
 uint32_t SceneManager::AddMeshFromFile(const std::string& meshPath)
 {
   //@TODO: other file formats
-  auto data = cmesh::LoadMeshFromVSGF(meshPath.c_str());
-
-  if(data.VerticesNum() == 0)
+  MappedFile file;
+  VSGFMeshView view;
+  if(!file.Open(meshPath) || !ParseVSGF(file.Data(), file.Size(), &view) || view.vertNum == 0)
     RUN_TIME_ERROR(("can't load mesh at " + meshPath).c_str());
 
-  return AddMeshFromData(data);
+  file.AdviseSequential();
+  return AddMeshFromVSGF(view);
 }
 
 uint32_t SceneManager::AddMeshFromData(cmesh::SimpleMesh &meshData)
@@ -172,13 +194,25 @@ uint32_t SceneManager::AddMeshFromData(cmesh::SimpleMesh &meshData)
   assert(meshData.IndicesNum() > 0);
 
   m_pMeshData->Append(meshData);
-  auto old_size = m_matIDs.size();
-  m_matIDs.resize(m_matIDs.size() + meshData.matIndices.size());
-  std::copy(meshData.matIndices.begin(), meshData.matIndices.end(), m_matIDs.begin() + old_size);
+  m_matIDs.insert(m_matIDs.end(), meshData.matIndices.begin(), meshData.matIndices.end());
+  return AddMeshInfo(meshData.VerticesNum(), meshData.IndicesNum());
+}
 
+uint32_t SceneManager::AddMeshFromVSGF(const VSGFMeshView &a_mesh)
+{
+  assert(a_mesh.vertNum > 0);
+  assert(a_mesh.indNum > 0);
+
+  m_pMeshData->Append(a_mesh);
+  m_matIDs.insert(m_matIDs.end(), a_mesh.matIndices, a_mesh.matIndices + a_mesh.indNum / 3);
+  return AddMeshInfo(a_mesh.vertNum, a_mesh.indNum);
+}
+
+uint32_t SceneManager::AddMeshInfo(uint32_t a_vertNum, uint32_t a_indNum)
+{
   MeshInfo info;
-  info.m_vertNum = meshData.VerticesNum();
-  info.m_indNum  = meshData.IndicesNum();
+  info.m_vertNum = a_vertNum;
+  info.m_indNum  = a_indNum;
 
   info.m_vertexOffset = m_totalVertices;
   info.m_indexOffset  = m_totalIndices;
@@ -186,14 +220,54 @@ uint32_t SceneManager::AddMeshFromData(cmesh::SimpleMesh &meshData)
   info.m_vertexBufOffset = info.m_vertexOffset * m_pMeshData->SingleVertexSize();
   info.m_indexBufOffset  = info.m_indexOffset  * m_pMeshData->SingleIndexSize();
 
-  m_totalVertices += meshData.VerticesNum();
-  m_totalIndices  += meshData.IndicesNum();
+  m_totalVertices += a_vertNum;
+  m_totalIndices  += a_indNum;
 
   m_meshInfos.push_back(info);
 
   return m_meshInfos.size() - 1;
 }
 
+void SceneManager::AddProceduralMesh(cmesh::SimpleMesh a_mesh, std::vector<MaterialData_pbrMR> a_materials, const LiteMath::float4x4 &a_matrix)
+{
+  if(a_mesh.VerticesNum() == 0 || a_mesh.IndicesNum() == 0)
+    return;
+  m_proceduralMeshes.push_back({std::move(a_mesh), std::move(a_materials), a_matrix});
+}
+
+void SceneManager::CountProceduralMeshes(uint32_t &a_maxVertexCount, uint32_t &a_maxPrimitiveCount, uint32_t &a_totalVertices,
+  uint32_t &a_totalPrimitives, uint32_t &a_totalMeshes) const
+{
+  for(const auto& proc : m_proceduralMeshes)
+  {
+    const uint32_t vertNum = uint32_t(proc.mesh.VerticesNum());
+    const uint32_t primNum = uint32_t(proc.mesh.IndicesNum() / 3);
+    a_maxVertexCount    = std::max(vertNum, a_maxVertexCount);
+    a_maxPrimitiveCount = std::max(primNum, a_maxPrimitiveCount);
+    a_totalVertices    += vertNum;
+    a_totalPrimitives  += primNum;
+    a_totalMeshes++;
+  }
+}
+
+// called by loaders after scene materials, so material ids of procedural meshes are moved past them
+void SceneManager::LoadProceduralMeshes()
+{
+  for(auto& proc : m_proceduralMeshes)
+  {
+    const uint32_t matOffset = uint32_t(m_materials.size());
+    if(m_config.load_materials != MATERIAL_LOAD_MODE::NONE)
+      m_materials.insert(m_materials.end(), proc.materials.begin(), proc.materials.end());
+    for(auto& matId : proc.mesh.matIndices)
+      matId += matOffset;
+
+    auto meshId = AddMeshFromData(proc.mesh);
+    UploadMesh(meshId);
+    InstanceMesh(meshId, proc.matrix);
+  }
+  m_proceduralMeshes.clear();
+}
+
 uint32_t SceneManager::InstanceMesh(const uint32_t meshId, const LiteMath::float4x4 &matrix, bool markForRender)
 {
   assert(meshId < m_meshInfos.size());
@@ -212,6 +286,69 @@ uint32_t SceneManager::InstanceMesh(const uint32_t meshId, const LiteMath::float
   return info.inst_id;
 }
 
+void SceneManager::SetInstanceMatrix(uint32_t instId, const LiteMath::float4x4 &matrix)
+{
+  assert(instId < m_instanceMatrices.size());
+  if(memcmp(&m_instanceMatrices[instId], &matrix, sizeof(matrix)) == 0)
+    return;
+
+  m_instanceMatrices[instId] = matrix;
+  if(m_instanceDirty.size() < m_instanceMatrices.size())
+    m_instanceDirty.resize(m_instanceMatrices.size(), false);
+  if(!m_instanceDirty[instId])
+  {
+    m_instanceDirty[instId] = true;
+    m_dirtyInstances.push_back(instId);
+  }
+}
+
+std::vector<uint32_t> SceneManager::CommitInstanceTransforms()
+{
+  std::vector<uint32_t> moved;
+  moved.swap(m_dirtyInstances);
+  if(moved.empty())
+    return moved;
+
+  std::sort(moved.begin(), moved.end());
+  for(auto instId : moved)
+    m_instanceDirty[instId] = false;
+
+  if(m_instMatricesBuf != VK_NULL_HANDLE)
+  {
+    if(m_instanceMatrices.size() > m_instMatricesCapacity)
+      UpdateInstanceDataOnGPU();
+    else
+    {
+      ForEachIdRun(moved, [this](uint32_t a_first, uint32_t a_count) {
+        m_pCopyHelper->UpdateBuffer(m_instMatricesBuf, a_first * sizeof(m_instanceMatrices[0]), &m_instanceMatrices[a_first],
+          a_count * sizeof(m_instanceMatrices[0]));
+      });
+    }
+  }
+
+  if(m_useRTX)
+    UpdateTLAS(moved);
+
+  return moved;
+}
+
+void SceneManager::Animate(uint32_t a_animId, float a_time)
+{
+  if(a_animId >= m_gltfAnimations.size())
+    return;
+
+  sampleGLTFAnimation(m_gltfAnimations[a_animId], a_time, m_gltfNodes.data());
+  for(int node : m_gltfNodeOrder)
+  {
+    const int parent = m_gltfNodeParents[node];
+    const auto local = matrixFromNodeTransform(m_gltfNodes[node]);
+    m_gltfNodeMatrices[node] = parent >= 0 ? m_gltfNodeMatrices[parent] * local : local;
+  }
+
+  for(const auto &inst : m_gltfNodeInstances)
+    SetInstanceMatrix(inst.instId, MeshCopyMatrix(m_gltfNodeMatrices[inst.node], inst.meshMatrix));
+}
+
 void SceneManager::MarkInstance(const uint32_t instId)
 {
   assert(instId < m_instanceInfos.size());
@@ -261,6 +398,66 @@ void SceneManager::InitGeoBuffersGPU(uint32_t a_meshNum, uint32_t a_totalVertNum
   }
 
   m_geoMemAlloc = vk_utils::allocateAndBindWithPadding(m_device, m_physDevice, all_buffers, allocFlags);
+
+  m_geoCapacityMeshes   = a_meshNum;
+  m_geoCapacityVertices = a_totalVertNum;
+  m_geoCapacityIndices  = a_totalIndicesNum;
+}
+
+// buffers grow by at least a half, so a stream of added meshes doesn't reallocate them every time;
+// meshes loaded so far are uploaded again from CPU storage
+void SceneManager::ReserveGeoBuffersGPU(uint32_t a_meshNum, uint32_t a_totalVertNum, uint32_t a_totalIndicesNum)
+{
+  if(a_meshNum <= m_geoCapacityMeshes && a_totalVertNum <= m_geoCapacityVertices && a_totalIndicesNum <= m_geoCapacityIndices)
+    return;
+
+  DestroyGeoBuffersGPU();
+  InitGeoBuffersGPU(std::max(a_meshNum, m_geoCapacityMeshes + m_geoCapacityMeshes / 2),
+                    std::max(a_totalVertNum, m_geoCapacityVertices + m_geoCapacityVertices / 2),
+                    std::max(a_totalIndicesNum, m_geoCapacityIndices + m_geoCapacityIndices / 2));
+
+  m_loadedVertices = 0;
+  m_loadedIndices  = 0;
+  for(uint32_t i = 0; i < m_meshInfos.size(); ++i)
+    LoadOneMeshOnGPU(i);
+  LoadCommonGeoDataOnGPU();
+}
+
+void SceneManager::DestroyGeoBuffersGPU()
+{
+  if(m_geoVertBuf != VK_NULL_HANDLE)
+  {
+    vkDestroyBuffer(m_device, m_geoVertBuf, nullptr);
+    m_geoVertBuf = VK_NULL_HANDLE;
+  }
+
+  if(m_geoIdxBuf != VK_NULL_HANDLE)
+  {
+    vkDestroyBuffer(m_device, m_geoIdxBuf, nullptr);
+    m_geoIdxBuf = VK_NULL_HANDLE;
+  }
+
+  if(m_meshInfoBuf != VK_NULL_HANDLE)
+  {
+    vkDestroyBuffer(m_device, m_meshInfoBuf, nullptr);
+    m_meshInfoBuf = VK_NULL_HANDLE;
+  }
+
+  if(m_matIdsBuf != VK_NULL_HANDLE)
+  {
+    vkDestroyBuffer(m_device, m_matIdsBuf, nullptr);
+    m_matIdsBuf = VK_NULL_HANDLE;
+  }
+
+  if(m_geoMemAlloc != VK_NULL_HANDLE)
+  {
+    vkFreeMemory(m_device, m_geoMemAlloc, nullptr);
+    m_geoMemAlloc = VK_NULL_HANDLE;
+  }
+
+  m_geoCapacityMeshes   = 0u;
+  m_geoCapacityVertices = 0u;
+  m_geoCapacityIndices  = 0u;
 }
 
 void SceneManager::LoadOneMeshOnGPU(uint32_t meshIdx)
@@ -311,6 +508,39 @@ void SceneManager::LoadCommonGeoDataOnGPU()
   {
     m_pCopyHelper->UpdateBuffer(m_meshInfoBuf, 0, mesh_info_tmp.data(), mesh_info_tmp.size() * sizeof(mesh_info_tmp[0]));
   }
+
+  if(m_config.split_vertex_streams)
+    SplitVertexStreams();
+
+  // all meshes are uploaded at this point, copy helper waits for transfers to finish
+  if(!m_config.keep_geometry_on_cpu)
+    m_pMeshData->Release();
+}
+
+// adds meshes which are not in split streams yet, so it's called again when meshes are added
+void SceneManager::SplitVertexStreams()
+{
+  if(m_pSplitData == nullptr)
+    m_pSplitData = std::make_shared<MeshDataSplit>(m_config.quantise_positions, m_config.geometry_huge_pages);
+
+  if(m_pSplitData->MeshesNum() < m_meshInfos.size() && m_pMeshData->VertexData() == nullptr)
+  {
+    std::cout << "[SceneManager::SplitVertexStreams]: vertices are already released, meshes from "
+              << m_pSplitData->MeshesNum() << " are not split" << std::endl;
+    return;
+  }
+
+  for(uint32_t i = m_pSplitData->MeshesNum(); i < m_meshInfos.size(); ++i)
+  {
+    const auto& info = m_meshInfos[i];
+    m_pSplitData->AddMesh(m_pMeshData->VertexData() + size_t(info.m_vertexOffset) * MeshData8F::FLOATS_PER_VERTEX, info.m_vertNum,
+      m_pMeshData->IndexData() + info.m_indexOffset, info.m_indNum, m_matIDs.data() + info.m_indexOffset / 3);
+  }
+
+  if(m_config.debug_output)
+    std::cout << "[SceneManager::SplitVertexStreams]: " << m_pSplitData->MemorySize() << " bytes in split streams, "
+              << m_pMeshData->VertexDataSize() + m_pMeshData->IndexDataSize() + m_matIDs.size() * sizeof(m_matIDs[0])
+              << " bytes interleaved" << std::endl;
 }
 
 void SceneManager::LoadInstanceDataOnGPU()
@@ -320,10 +550,49 @@ void SceneManager::LoadInstanceDataOnGPU()
 
   m_instMatricesBuf = vk_utils::createBuffer(m_device, instMatBufSize, flags);
   m_instMemAlloc    = vk_utils::allocateAndBindWithPadding(m_device, m_physDevice, {m_instMatricesBuf});
+  m_instMatricesCapacity = m_instanceMatrices.size();
 
   m_pCopyHelper->UpdateBuffer(m_instMatricesBuf, 0, m_instanceMatrices.data(), instMatBufSize);
 }
 
+void SceneManager::UpdateInstanceDataOnGPU()
+{
+  if(m_instanceMatrices.size() <= m_instMatricesCapacity && m_instMatricesBuf != VK_NULL_HANDLE)
+  {
+    m_pCopyHelper->UpdateBuffer(m_instMatricesBuf, 0, m_instanceMatrices.data(), m_instanceMatrices.size() * sizeof(m_instanceMatrices[0]));
+    return;
+  }
+
+  if(m_instMatricesBuf != VK_NULL_HANDLE)
+    vkDestroyBuffer(m_device, m_instMatricesBuf, nullptr);
+  if(m_instMemAlloc != VK_NULL_HANDLE)
+    vkFreeMemory(m_device, m_instMemAlloc, nullptr);
+  LoadInstanceDataOnGPU();
+}
+
+// edited materials are written in place, new ones (ids past the loaded materials) make the buffer to be allocated again
+void SceneManager::UpdateMaterialDataOnGPU(const std::vector<uint32_t> &a_materialIds)
+{
+  if(m_materialBuf == VK_NULL_HANDLE)
+    return;
+
+  if(m_materials.size() <= m_materialsCapacity)
+  {
+    for(auto matId : a_materialIds)
+      m_pCopyHelper->UpdateBuffer(m_materialBuf, matId * sizeof(m_materials[0]), &m_materials[matId], sizeof(m_materials[0]));
+    return;
+  }
+
+  vkDestroyBuffer(m_device, m_materialBuf, nullptr);
+  vkFreeMemory(m_device, m_matMemAlloc, nullptr);
+
+  VkDeviceSize materialBufSize = m_materials.size() * sizeof(m_materials[0]);
+  m_materialBuf = vk_utils::createBuffer(m_device, materialBufSize, VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT);
+  m_matMemAlloc = vk_utils::allocateAndBindWithPadding(m_device, m_physDevice, {m_materialBuf});
+  m_materialsCapacity = m_materials.size();
+  m_pCopyHelper->UpdateBuffer(m_materialBuf, 0, m_materials.data(), materialBufSize);
+}
+
 vk_utils::VulkanImageMem SceneManager::LoadSpecialTexture()
 {
   ImageFileInfo texInfo = getImageInfo(missingTextureImgPath);
@@ -349,6 +618,7 @@ void SceneManager::LoadMaterialDataOnGPU()
 
   m_materialBuf = vk_utils::createBuffer(m_device, materialBufSize, matFlags);
   m_matMemAlloc = vk_utils::allocateAndBindWithPadding(m_device, m_physDevice, {m_materialBuf});
+  m_materialsCapacity = m_materials.size();
 
   m_pCopyHelper->UpdateBuffer(m_materialBuf, 0, m_materials.data(), materialBufSize);
 
@@ -433,35 +703,7 @@ SceneManager::~SceneManager()
 
 void SceneManager::DestroyScene()
 {
-  if(m_geoVertBuf != VK_NULL_HANDLE)
-  {
-    vkDestroyBuffer(m_device, m_geoVertBuf, nullptr);
-    m_geoVertBuf = VK_NULL_HANDLE;
-  }
-
-  if(m_geoIdxBuf != VK_NULL_HANDLE)
-  {
-    vkDestroyBuffer(m_device, m_geoIdxBuf, nullptr);
-    m_geoIdxBuf = VK_NULL_HANDLE;
-  }
-
-  if(m_meshInfoBuf != VK_NULL_HANDLE)
-  {
-    vkDestroyBuffer(m_device, m_meshInfoBuf, nullptr);
-    m_meshInfoBuf = VK_NULL_HANDLE;
-  }
-
-  if(m_matIdsBuf != VK_NULL_HANDLE)
-  {
-    vkDestroyBuffer(m_device, m_matIdsBuf, nullptr);
-    m_matIdsBuf = VK_NULL_HANDLE;
-  }
-
-  if(m_geoMemAlloc != VK_NULL_HANDLE)
-  {
-    vkFreeMemory(m_device, m_geoMemAlloc, nullptr);
-    m_geoMemAlloc = VK_NULL_HANDLE;
-  }
+  DestroyGeoBuffersGPU();
 
   if(m_instMatricesBuf != VK_NULL_HANDLE)
   {
@@ -474,6 +716,7 @@ void SceneManager::DestroyScene()
     vkFreeMemory(m_device, m_instMemAlloc, nullptr);
     m_instMemAlloc = VK_NULL_HANDLE;
   }
+  m_instMatricesCapacity = 0;
 
   if(m_materialBuf != VK_NULL_HANDLE)
   {
@@ -485,6 +728,7 @@ void SceneManager::DestroyScene()
     vkFreeMemory(m_device, m_matMemAlloc, nullptr);
     m_matMemAlloc = VK_NULL_HANDLE;
   }
+  m_materialsCapacity = 0;
 
   for(auto& [_, tex] : m_texturesById)
   {
@@ -513,6 +757,7 @@ void SceneManager::DestroyScene()
     }
   }
 
+  DestroyTLASInstances();
   if(m_config.build_acc_structs)
   {
     m_pBuilderV2->Destroy();
@@ -524,8 +769,20 @@ void SceneManager::DestroyScene()
   m_totalIndices  = 0u;
   m_meshInfos.clear();
   m_pMeshData = nullptr;
+  m_pSplitData = nullptr;
   m_instanceInfos.clear();
   m_instanceMatrices.clear();
+  m_dirtyInstances.clear();
+  m_instanceDirty.clear();
+  m_gltfAnimations.clear();
+  m_gltfNodes.clear();
+  m_gltfNodeParents.clear();
+  m_gltfNodeOrder.clear();
+  m_gltfNodeMatrices.clear();
+  m_gltfNodeInstances.clear();
+  m_meshBySourceId.clear();
+  m_instIdBySourceId.clear();
+  m_dedupMeshes.clear();
   m_matIDs.clear();
 
   m_materials.clear();
@@ -559,8 +816,8 @@ void SceneManager::BuildTLAS()
 {
   BuildAllBLAS();
 
-  std::vector<VkAccelerationStructureInstanceKHR> geometryInstances;
-  geometryInstances.reserve(m_instanceInfos.size());
+  m_tlasInstances.clear();
+  m_tlasInstances.reserve(m_instanceInfos.size());
 
 #ifdef USE_MANY_HIT_SHADERS
   std::map<uint32_t, uint32_t> materialMap = { {0, LAMBERT_MTL}, {1, GGX_MTL}, {2, MIRROR_MTL}, {3, BLEND_MTL}, {4, MIRROR_MTL}, {5, EMISSION_MTL} };
@@ -581,42 +838,81 @@ void SceneManager::BuildTLAS()
     instance.flags = VK_GEOMETRY_INSTANCE_TRIANGLE_FACING_CULL_DISABLE_BIT_KHR;
     instance.accelerationStructureReference = m_pBuilderV2->GetBLASDeviceAddress(inst.mesh_id);//m_blas[inst.mesh_id].deviceAddress;
 
-    geometryInstances.push_back(instance);
+    m_tlasInstances.push_back(instance);
+  }
+
+  if(m_tlasInstances.size() > m_tlasInstCapacity)
+  {
+    DestroyTLASInstances();
+    m_tlasInstCapacity = std::max<size_t>(m_tlasInstances.size(), 1);
+
+    VkMemoryRequirements memReqs {};
+    m_tlasInstBuf = vk_utils::createBuffer(m_device, sizeof(VkAccelerationStructureInstanceKHR) * m_tlasInstCapacity,
+      VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT | VK_BUFFER_USAGE_ACCELERATION_STRUCTURE_BUILD_INPUT_READ_ONLY_BIT_KHR | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+      &memReqs);
+
+    VkMemoryAllocateFlagsInfo memoryAllocateFlagsInfo{};
+    memoryAllocateFlagsInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_FLAGS_INFO;
+    memoryAllocateFlagsInfo.flags = VK_MEMORY_ALLOCATE_DEVICE_ADDRESS_BIT_KHR;
+
+    VkMemoryAllocateInfo allocateInfo = {};
+    allocateInfo.sType           = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+    allocateInfo.pNext           = &memoryAllocateFlagsInfo;
+    allocateInfo.allocationSize  = memReqs.size;
+    allocateInfo.memoryTypeIndex = vk_utils::findMemoryType(memReqs.memoryTypeBits, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, m_physDevice);
+    VK_CHECK_RESULT(vkAllocateMemory(m_device, &allocateInfo, nullptr, &m_tlasInstMem));
+
+    VK_CHECK_RESULT(vkBindBufferMemory(m_device, m_tlasInstBuf, m_tlasInstMem, 0));
+  }
+
+  if(!m_tlasInstances.empty())
+  {
+    m_pCopyHelper->UpdateBuffer(m_tlasInstBuf, 0, m_tlasInstances.data(),
+      sizeof(VkAccelerationStructureInstanceKHR) * m_tlasInstances.size());
   }
 
-  VkBuffer instancesBuffer = VK_NULL_HANDLE;
+  VkDeviceOrHostAddressConstKHR instBufferDeviceAddress{};
+  instBufferDeviceAddress.deviceAddress = vk_rt_utils::getBufferDeviceAddress(m_device, m_tlasInstBuf);
+  m_pBuilderV2->BuildTLAS(uint32_t(m_tlasInstances.size()), instBufferDeviceAddress, TLAS_BUILD_FLAGS);
+}
 
-  VkMemoryRequirements memReqs {};
-  instancesBuffer = vk_utils::createBuffer(m_device, sizeof(VkAccelerationStructureInstanceKHR) * geometryInstances.size(),
-    VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT | VK_BUFFER_USAGE_ACCELERATION_STRUCTURE_BUILD_INPUT_READ_ONLY_BIT_KHR | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
-    &memReqs);
+// only transforms of moved instances are written, TLAS is refit instead of being built again
+void SceneManager::UpdateTLAS(const std::vector<uint32_t> &a_instIds)
+{
+  if(m_tlasInstBuf == VK_NULL_HANDLE) // TLAS isn't built yet, BuildTLAS will take current matrices
+    return;
 
-  VkMemoryAllocateFlagsInfo memoryAllocateFlagsInfo{};
-  memoryAllocateFlagsInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_FLAGS_INFO;
-  memoryAllocateFlagsInfo.flags = VK_MEMORY_ALLOCATE_DEVICE_ADDRESS_BIT_KHR;
+  if(m_tlasInstances.size() != m_instanceInfos.size())
+  {
+    BuildTLAS();
+    return;
+  }
 
-  VkDeviceMemory instancesAlloc;
-  VkMemoryAllocateInfo allocateInfo = {};
-  allocateInfo.sType           = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
-  allocateInfo.pNext           = &memoryAllocateFlagsInfo;
-  allocateInfo.allocationSize  = memReqs.size;
-  allocateInfo.memoryTypeIndex = vk_utils::findMemoryType(memReqs.memoryTypeBits, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, m_physDevice);
-  VK_CHECK_RESULT(vkAllocateMemory(m_device, &allocateInfo, nullptr, &instancesAlloc));
+  for(auto instId : a_instIds)
+    m_tlasInstances[instId].transform = transformMatrixFromFloat4x4(m_instanceMatrices[instId]);
 
-  VK_CHECK_RESULT(vkBindBufferMemory(m_device, instancesBuffer, instancesAlloc, 0));
-  m_pCopyHelper->UpdateBuffer(instancesBuffer, 0, geometryInstances.data(),
-    sizeof(VkAccelerationStructureInstanceKHR) * geometryInstances.size());
+  ForEachIdRun(a_instIds, [this](uint32_t a_first, uint32_t a_count) {
+    m_pCopyHelper->UpdateBuffer(m_tlasInstBuf, a_first * sizeof(VkAccelerationStructureInstanceKHR), &m_tlasInstances[a_first],
+      a_count * sizeof(VkAccelerationStructureInstanceKHR));
+  });
 
   VkDeviceOrHostAddressConstKHR instBufferDeviceAddress{};
-  instBufferDeviceAddress.deviceAddress = vk_rt_utils::getBufferDeviceAddress(m_device, instancesBuffer);
-  m_pBuilderV2->BuildTLAS(geometryInstances.size(), instBufferDeviceAddress);
+  instBufferDeviceAddress.deviceAddress = vk_rt_utils::getBufferDeviceAddress(m_device, m_tlasInstBuf);
+  m_pBuilderV2->BuildTLAS(uint32_t(m_tlasInstances.size()), instBufferDeviceAddress, TLAS_BUILD_FLAGS, true);
+}
 
-  if (instancesAlloc != VK_NULL_HANDLE)
+void SceneManager::DestroyTLASInstances()
+{
+  if(m_tlasInstBuf != VK_NULL_HANDLE)
   {
-    vkFreeMemory(m_device, instancesAlloc, nullptr);
+    vkDestroyBuffer(m_device, m_tlasInstBuf, nullptr);
+    m_tlasInstBuf = VK_NULL_HANDLE;
   }
-  if (instancesBuffer != VK_NULL_HANDLE)
+  if(m_tlasInstMem != VK_NULL_HANDLE)
   {
-    vkDestroyBuffer(m_device, instancesBuffer, nullptr);
+    vkFreeMemory(m_device, m_tlasInstMem, nullptr);
+    m_tlasInstMem = VK_NULL_HANDLE;
   }
+  m_tlasInstCapacity = 0;
+  m_tlasInstances.clear();
 }
@@ -2,6 +2,7 @@
 #define CHIMERA_SCENE_MGR_H
 
 #include <vector>
+#include <unordered_map>
 
 #include <geom/vk_mesh.h>
 #include <ray_tracing/vk_rt_utils.h>
@@ -11,6 +12,10 @@
 
 #include "../loader_utils/hydraxml.h"
 #include "../loader_utils/image_loader.h"
+#include "../loader_utils/vsgf.h"
+#include "../loader_utils/gltf_utils.h"
+#include "mesh_data_8f.h"
+#include "mesh_data_split.h"
 #include "tiny_gltf.h"
 #include "../resources/shaders/common.h"
 
@@ -23,6 +28,16 @@ struct InstanceInfo
   bool renderMark = false;
 };
 
+// what SceneManager::ApplySceneDelta has changed, so structures built from the scene elsewhere (e.g. CPU ray tracing scene)
+// are updated without setting them up again
+struct SceneDelta
+{
+  std::vector<uint32_t> addedMeshes;     // new meshes, including new versions of changed ones (previous versions are kept)
+  std::vector<uint32_t> movedInstances;  // instances which only got a new matrix
+  std::vector<uint32_t> editedMaterials;
+  bool instancesChanged = false;         // instances were added, removed or got another mesh, so instance ids have changed
+};
+
 enum class BVH_BUILDER_TYPE
 {
   RTX,
@@ -38,6 +53,14 @@ enum class MATERIAL_FORMAT
   // etc.
 };
 
+// meshes with the same content which are loaded under different names or from different files are stored once
+enum class MESH_DEDUP
+{
+  NONE,
+  IDENTICAL, // same vertices within LoaderConfig::mesh_dedup_tolerance, indices and material ids
+  RIGID      // also moved and rotated copies, their instances get the transform in their matrices
+};
+
 enum class MATERIAL_LOAD_MODE
 {
   NONE,
@@ -53,6 +76,14 @@ struct LoaderConfig
   bool build_acc_structs_while_loading_scene = false;
   bool instance_matrix_as_vertex_attribute = false;
   bool debug_output = false;
+  uint32_t loader_threads = 0; // threads decoding meshes while scene is loaded, 0 - all hardware threads
+  std::string scene_cache_dir = ""; // binary snapshots of loaded scenes are written here and used instead of the sources while they are unchanged, empty - no cache
+  bool geometry_huge_pages = false;  // back large vertex and index arrays with transparent huge pages (Linux)
+  bool keep_geometry_on_cpu = true;  // false - vertices and indices are freed once uploaded to GPU (mesh changes need them, CPU ray tracing needs them or split streams)
+  bool split_vertex_streams = false; // keep compact split copy of geometry for CPU ray tracing and shading (see MeshDataSplit), with keep_geometry_on_cpu = false it's the only CPU copy
+  bool quantise_positions   = false; // 16-bit positions relative to mesh bounding box in split streams
+  MESH_DEDUP mesh_dedup = MESH_DEDUP::NONE; // Hydra XML and glTF scenes
+  float mesh_dedup_tolerance = 1e-5f;       // distance at which vertices of mesh copies are the same, in mesh units
   BVH_BUILDER_TYPE builder_type = BVH_BUILDER_TYPE::RTX;
   MATERIAL_FORMAT material_format = MATERIAL_FORMAT::METALLIC_ROUGHNESS;
 };
@@ -67,15 +98,40 @@ struct SceneManager
   bool LoadSceneXML(const std::string &scenePath, bool transpose = true);
   bool LoadSceneGLTF(const std::string &scenePath);
   bool LoadScene(const std::string &scenePath); // guess scene type by extension
+
+  // Applies Hydra change file to the scene loaded by LoadSceneXML. Meshes are loaded again only if their files have changed,
+  // instances, materials and cameras are updated by their ids in the scene. GPU buffers and TLAS are updated in place
+  // (buffers are reallocated if new meshes don't fit), so call it while GPU doesn't use them.
+  // A changed mesh is added as a new mesh: the previous version keeps its CPU storage, GPU buffer range and BLAS, as do meshes
+  // left without instances, because mesh ids index BLAS and geometry of other acceleration structures. So geometry memory
+  // grows with every mesh edit until the scene is loaded again.
+  // 'transpose' should be the same as the scene was loaded with (LoadScene doesn't transpose).
+  bool ApplySceneDelta(const std::string &a_path, bool transpose = false, SceneDelta* a_pDelta = nullptr);
 //  void LoadSingleTriangle(); // TODO: rework
 
   bool InitEmptyScene(uint32_t maxMeshes, uint32_t maxTotalVertices, uint32_t maxTotalPrimitives, uint32_t maxPrimitivesPerMesh);
 
   uint32_t AddMeshFromFile(const std::string& meshPath);
   uint32_t AddMeshFromData(cmesh::SimpleMesh &meshData);
+  uint32_t AddMeshFromVSGF(const VSGFMeshView &a_mesh); // converts streams straight into interleaved vertex storage
+
+  // mesh made by application (e.g. polygonised SDF) which is added to the scene by the next LoadScene*,
+  // together with its materials: material ids of the mesh index 'a_materials'
+  void AddProceduralMesh(cmesh::SimpleMesh a_mesh, std::vector<MaterialData_pbrMR> a_materials, const LiteMath::float4x4 &a_matrix);
 
   uint32_t InstanceMesh(uint32_t meshId, const LiteMath::float4x4 &matrix, bool markForRender = true);
 
+  // moves an instance of the loaded scene; moved instances are collected until CommitInstanceTransforms
+  void SetInstanceMatrix(uint32_t instId, const LiteMath::float4x4 &matrix);
+  // writes matrices of moved instances to GPU buffers and updates TLAS in place (no rebuild and reallocation),
+  // returns ids of these instances, so other copies of the scene (e.g. CPU ray tracing one) are updated by them
+  std::vector<uint32_t> CommitInstanceTransforms();
+
+  // node animations of the loaded glTF scene, 'a_time' is in seconds
+  uint32_t AnimationsNum() const { return uint32_t(m_gltfAnimations.size()); }
+  float AnimationDuration(uint32_t a_animId) const { return a_animId < m_gltfAnimations.size() ? m_gltfAnimations[a_animId].duration : 0.0f; }
+  void Animate(uint32_t a_animId, float a_time); // moves instances of animated nodes with SetInstanceMatrix
+
   void MarkInstance(uint32_t instId);
   void UnmarkInstance(uint32_t instId);
 
@@ -96,6 +152,7 @@ struct SceneManager
   std::vector<VkImageView>  GetTextureViews() const { return m_textureViews; }
 
   std::shared_ptr<IMeshData> GetMeshData() {return m_pMeshData; }
+  std::shared_ptr<const MeshDataSplit> GetSplitMeshData() const { return m_pSplitData; } // null unless LoaderConfig::split_vertex_streams
 
   uint32_t MeshesNum()    const {return m_meshInfos.size();}
   uint32_t InstancesNum() const {return m_instanceInfos.size();}
@@ -105,6 +162,10 @@ struct SceneManager
   InstanceInfo GetInstanceInfo(uint32_t instId) const {assert(instId < m_instanceInfos.size()); return m_instanceInfos[instId];}
   LiteMath::float4x4 GetInstanceMatrix(uint32_t instId) const {assert(instId < m_instanceMatrices.size()); return m_instanceMatrices[instId];}
 
+  const std::vector<MaterialData_pbrMR>& GetMaterials()    const { return m_materials; }
+  const std::vector<uint32_t>&           GetMaterialIDs()  const { return m_matIDs; }
+  const std::vector<ImageFileInfo>&      GetTextureInfos() const { return m_textureInfos; }
+
 //  void DestroyAS();
 
   VkAccelerationStructureKHR GetTLAS() const { return m_pBuilderV2->GetTLAS(); }
@@ -112,28 +173,94 @@ struct SceneManager
   void BuildTLAS();
 
 private:
+  void UpdateTLAS(const std::vector<uint32_t> &a_instIds);
+  void DestroyTLASInstances();
   const std::string missingTextureImgPath = "../resources/data/missing_texture.png";
 
   vk_utils::VulkanImageMem LoadSpecialTexture();
   void InitGeoBuffersGPU(uint32_t a_meshNum, uint32_t a_totalVertNum, uint32_t a_totalIndicesNum);
+  void ReserveGeoBuffersGPU(uint32_t a_meshNum, uint32_t a_totalVertNum, uint32_t a_totalIndicesNum);
+  void DestroyGeoBuffersGPU();
   void LoadOneMeshOnGPU(uint32_t meshIdx);
   void LoadCommonGeoDataOnGPU();
+  void SplitVertexStreams();
   void LoadInstanceDataOnGPU();
   void LoadMaterialDataOnGPU();
+  void UpdateInstanceDataOnGPU();
+  void UpdateMaterialDataOnGPU(const std::vector<uint32_t> &a_materialIds);
 
   void AddBLAS(uint32_t meshIdx);
 
-  void LoadGLTFNodesRecursive(const tinygltf::Model &a_model, const tinygltf::Node& a_node, const LiteMath::float4x4& a_parentMatrix,
-    std::unordered_map<int, uint32_t> &a_loadedMeshesToMeshId);
+  void CountProceduralMeshes(uint32_t &a_maxVertexCount, uint32_t &a_maxPrimitiveCount, uint32_t &a_totalVertices,
+    uint32_t &a_totalPrimitives, uint32_t &a_totalMeshes) const;
+  void LoadProceduralMeshes();
+
+  std::string SceneCachePath(const std::string &a_scenePath, bool a_transpose) const;
+  bool LoadSceneCache(const std::string &a_scenePath, bool a_transpose);
+  void SaveSceneCache(const std::string &a_scenePath, bool a_transpose, const std::vector<std::string> &a_sourceFiles) const;
+
+  struct GLTFInstance
+  {
+    int mesh;
+    int node;
+    LiteMath::float4x4 matrix;
+  };
+  void CollectGLTFNodesRecursive(const tinygltf::Model &a_model, int a_nodeId, int a_parentId, const LiteMath::float4x4& a_parentMatrix,
+    std::vector<GLTFInstance> &a_instances);
+  uint32_t AddMeshInfo(uint32_t a_vertNum, uint32_t a_indNum); // for vertices, indices and material ids already added to storage
+  // for a mesh in storage at the given offsets (at or after the end of the previous mesh): returns id of a mesh with the same content
+  // (see LoaderConfig::mesh_dedup) and transform from it to this one, or adds and uploads the mesh moving it to the end of the previous one;
+  // storage after the last mesh isn't used after that
+  uint32_t AddMeshDeduplicated(uint32_t a_firstVertex, uint32_t a_firstIndex, uint32_t a_vertNum, uint32_t a_indNum,
+    LiteMath::float4x4* a_pMeshMatrix);
+  // instance matrix of a mesh copy found by AddMeshDeduplicated; a_matrix is returned as is if there is no transform
+  static LiteMath::float4x4 MeshCopyMatrix(const LiteMath::float4x4 &a_matrix, const LiteMath::float4x4 &a_meshMatrix);
+  void UploadMesh(uint32_t a_meshId);
 
   std::vector<MeshInfo> m_meshInfos = {};
-  std::shared_ptr<IMeshData> m_pMeshData = nullptr;
+  std::shared_ptr<MeshData8F> m_pMeshData = nullptr;
+  std::shared_ptr<MeshDataSplit> m_pSplitData = nullptr;
 
   std::vector<InstanceInfo> m_instanceInfos = {};
   std::vector<LiteMath::float4x4> m_instanceMatrices = {};
+  std::vector<uint32_t> m_dirtyInstances = {}; // moved since the last CommitInstanceTransforms
+  std::vector<bool>     m_instanceDirty  = {};
+
+  // glTF node hierarchy, kept only if the scene has animations
+  std::vector<GLTFAnimation>      m_gltfAnimations;
+  std::vector<GLTFNodeTransform>  m_gltfNodes;          // local transforms, changed by animations
+  std::vector<int>                m_gltfNodeParents;
+  std::vector<int>                m_gltfNodeOrder;      // parents go before children
+  std::vector<LiteMath::float4x4> m_gltfNodeMatrices;   // world matrices
+  struct GLTFNodeInstance
+  {
+    int node;
+    uint32_t instId;
+    LiteMath::float4x4 meshMatrix; // transform of the mesh if it is a moved copy of another one, see MESH_DEDUP::RIGID
+  };
+  std::vector<GLTFNodeInstance> m_gltfNodeInstances;
 
   std::vector<hydra_xml::Camera> m_sceneCameras = {};
 
+  // meshes and instances by their ids in the Hydra scene they were loaded from, so scene deltas can refer to them
+  struct SourceMesh
+  {
+    uint32_t meshId;
+    uint64_t fileStamp; // size and modification time of the mesh file
+    LiteMath::float4x4 meshMatrix; // transform from mesh 'meshId' to this one if it was loaded as a moved copy, see MESH_DEDUP::RIGID
+  };
+  std::unordered_map<uint32_t, SourceMesh> m_meshBySourceId;
+  std::unordered_map<uint32_t, uint32_t>   m_instIdBySourceId;
+  std::unordered_multimap<uint64_t, uint32_t> m_dedupMeshes; // meshes by content key, while the scene is loaded
+
+  struct ProceduralMesh
+  {
+    cmesh::SimpleMesh mesh;
+    std::vector<MaterialData_pbrMR> materials;
+    LiteMath::float4x4 matrix;
+  };
+  std::vector<ProceduralMesh> m_proceduralMeshes;
+
   uint32_t m_totalVertices = 0u;
   uint32_t m_totalIndices  = 0u;
 
@@ -142,9 +269,13 @@ private:
   VkBuffer m_meshInfoBuf       = VK_NULL_HANDLE;
   VkBuffer m_matIdsBuf         = VK_NULL_HANDLE;
   VkDeviceMemory m_geoMemAlloc = VK_NULL_HANDLE;
+  uint32_t m_geoCapacityMeshes   = 0u;
+  uint32_t m_geoCapacityVertices = 0u;
+  uint32_t m_geoCapacityIndices  = 0u;
 
   VkBuffer m_instMatricesBuf    = VK_NULL_HANDLE;
   VkDeviceMemory m_instMemAlloc = VK_NULL_HANDLE;
+  size_t m_instMatricesCapacity = 0;
 
   VkDeviceSize m_loadedVertices = 0;
   VkDeviceSize m_loadedIndices  = 0;
@@ -155,6 +286,7 @@ private:
   std::vector<ImageFileInfo> m_textureInfos;
   VkBuffer m_materialBuf  = VK_NULL_HANDLE;
   VkDeviceMemory m_matMemAlloc = VK_NULL_HANDLE;
+  size_t m_materialsCapacity = 0;
   std::vector<vk_utils::VulkanImageMem> m_textures;
   std::unordered_map<uint32_t, vk_utils::VulkanImageMem&> m_texturesById;
   VkDeviceMemory m_texturesMemAlloc = VK_NULL_HANDLE;
@@ -170,6 +302,11 @@ private:
   std::shared_ptr<vk_utils::ICopyEngine> m_pCopyHelper;
 
   std::unique_ptr<vk_rt_utils::AccelStructureBuilderV2> m_pBuilderV2;
+  // TLAS instances are kept between builds, so moved instances are updated in place
+  std::vector<VkAccelerationStructureInstanceKHR> m_tlasInstances;
+  VkBuffer       m_tlasInstBuf      = VK_NULL_HANDLE;
+  VkDeviceMemory m_tlasInstMem      = VK_NULL_HANDLE;
+  size_t         m_tlasInstCapacity = 0;
 
   std::vector<vk_rt_utils::BLASBuildInput> m_blasData;
 
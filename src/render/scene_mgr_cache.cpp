@@ -0,0 +1,435 @@
+#include "scene_mgr.h"
+#include "vk_utils.h"
+#include "../utils/mapped_file.h"
+#include "../utils/content_hash.h"
+
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+
+// Scene cache is one file: a header followed by sections aligned to 64 bytes. Vertices and indices are stored in the
+// final MeshData8F layout, so a valid cache is mapped and uploaded as is, without parsing or converting anything.
+enum SceneCacheSection : uint32_t
+{
+  CACHE_MESHES = 0,  // CachedMesh per mesh
+  CACHE_VERTICES,    // MeshData8F vertices of all meshes
+  CACHE_INDICES,
+  CACHE_MAT_IDS,     // per triangle
+  CACHE_INSTANCES,   // CachedInstance per instance
+  CACHE_MATERIALS,   // MaterialData_pbrMR
+  CACHE_TEXTURES,    // CachedTexture
+  CACHE_CAMERAS,     // hydra_xml::Camera
+  CACHE_SOURCES,     // CachedString per source file, the scene file goes first
+  CACHE_STRINGS,     // characters of all paths
+  CACHE_MESH_SOURCES, // CachedMeshSource per Hydra scene mesh
+  CACHE_SECTION_COUNT
+};
+
+struct SceneCacheHeader
+{
+  uint32_t magic;
+  uint32_t version;
+  uint64_t key;
+  uint64_t sourceHash;
+  uint64_t fileSize;
+  struct
+  {
+    uint64_t offset;
+    uint64_t size;
+  } sections[CACHE_SECTION_COUNT];
+};
+
+static_assert(sizeof(SceneCacheHeader) == 208, "SceneCacheHeader layout is a part of the cache file format");
+
+struct CachedMesh
+{
+  uint32_t vertNum;
+  uint32_t indNum;
+};
+
+// source ids are the ones of Hydra scene nodes, so change files can be applied to a cached scene; -1 if there is none.
+// Meshes deduplicated at load time have several sources
+struct CachedMeshSource
+{
+  LiteMath::float4x4 meshMatrix;
+  uint32_t sourceId;
+  uint32_t meshId;
+  uint64_t sourceStamp;
+};
+
+struct CachedInstance
+{
+  LiteMath::float4x4 matrix;
+  uint32_t meshId;
+  uint32_t renderMark;
+  uint32_t sourceId;
+  uint32_t reserved;
+};
+
+struct CachedString
+{
+  uint32_t offset;
+  uint32_t length;
+};
+
+struct CachedTexture
+{
+  CachedString path;
+  int32_t isOk;
+  int32_t isNormalMap;
+  int32_t width;
+  int32_t height;
+  int32_t channels;
+  int32_t bytesPerChannel;
+};
+
+static constexpr uint32_t SCENE_CACHE_MAGIC   = 0x4E435353; // "SSCN"
+static constexpr uint32_t SCENE_CACHE_VERSION = 5;
+
+static inline uint64_t AlignUp64(uint64_t a_offset) { return (a_offset + 63ull) & ~63ull; }
+
+template<typename T>
+static const T* SectionData(const MappedFile &a_file, const SceneCacheHeader &a_header, SceneCacheSection a_section)
+{
+  return reinterpret_cast<const T*>(a_file.Data() + a_header.sections[a_section].offset);
+}
+
+template<typename T>
+static size_t SectionCount(const SceneCacheHeader &a_header, SceneCacheSection a_section)
+{
+  return size_t(a_header.sections[a_section].size / sizeof(T));
+}
+
+// Big source files (meshes, buffers, textures) are identified by size and modification time, so checking the cache
+// doesn't read them. The scene file itself is small and is hashed by content as well.
+static bool HashSceneSources(const std::vector<std::string> &a_paths, uint64_t* a_pHash)
+{
+  ContentHash64 hash;
+  for(size_t i = 0; i < a_paths.size(); ++i)
+  {
+    std::error_code ec;
+    const auto size = std::filesystem::file_size(a_paths[i], ec);
+    if(ec)
+      return false;
+    const auto time = std::filesystem::last_write_time(a_paths[i], ec);
+    if(ec)
+      return false;
+
+    hash.AddString(a_paths[i]);
+    hash.AddValue(uint64_t(size));
+    hash.AddValue(int64_t(time.time_since_epoch().count()));
+    if(i == 0)
+    {
+      MappedFile file;
+      if(!file.Open(a_paths[i]))
+        return false;
+      hash.Add(file.Data(), file.Size());
+    }
+  }
+  *a_pHash = hash.Get();
+  return true;
+}
+
+std::string SceneManager::SceneCachePath(const std::string &a_scenePath, bool a_transpose) const
+{
+  std::error_code ec;
+  auto absPath = std::filesystem::absolute(a_scenePath, ec);
+
+  // everything that changes the loaded data is a part of the key
+  ContentHash64 key;
+  key.AddValue(SCENE_CACHE_VERSION);
+  key.AddString(ec ? a_scenePath : absPath.lexically_normal().string());
+  key.AddValue(a_transpose);
+  key.AddValue(m_config.load_geometry);
+  key.AddValue(uint32_t(m_config.load_materials));
+  key.AddValue(uint32_t(MeshData8F::FLOATS_PER_VERTEX));
+  key.AddValue(uint32_t(sizeof(MaterialData_pbrMR)));
+  key.AddValue(uint32_t(m_config.mesh_dedup));
+  key.AddValue(m_config.mesh_dedup_tolerance);
+  return m_config.scene_cache_dir + "/" + key.GetHex() + ".scene";
+}
+
+void SceneManager::SaveSceneCache(const std::string &a_scenePath, bool a_transpose, const std::vector<std::string> &a_sourceFiles) const
+{
+  if(m_config.scene_cache_dir.empty())
+    return;
+
+  std::vector<std::string> sources;
+  sources.reserve(a_sourceFiles.size() + 1);
+  sources.push_back(a_scenePath);
+  sources.insert(sources.end(), a_sourceFiles.begin(), a_sourceFiles.end());
+
+  SceneCacheHeader header = {};
+  if(!HashSceneSources(sources, &header.sourceHash))
+    return;
+
+  std::error_code ec;
+  std::filesystem::create_directories(m_config.scene_cache_dir, ec);
+  if(ec)
+  {
+    std::cout << "[SceneManager::SaveSceneCache]: can't create cache directory " << m_config.scene_cache_dir << std::endl;
+    return;
+  }
+
+  std::string strings;
+  auto addString = [&strings](const std::string &a_str) {
+    CachedString res = {uint32_t(strings.size()), uint32_t(a_str.size())};
+    strings += a_str;
+    return res;
+  };
+
+  std::vector<CachedMesh> meshes(m_meshInfos.size());
+  for(size_t i = 0; i < meshes.size(); ++i)
+    meshes[i] = {m_meshInfos[i].m_vertNum, m_meshInfos[i].m_indNum};
+
+  std::vector<CachedMeshSource> meshSources;
+  meshSources.reserve(m_meshBySourceId.size());
+  for(const auto &mesh : m_meshBySourceId)
+    meshSources.push_back({mesh.second.meshMatrix, mesh.first, mesh.second.meshId, mesh.second.fileStamp});
+
+  std::vector<CachedInstance> instances(m_instanceInfos.size());
+  for(size_t i = 0; i < instances.size(); ++i)
+  {
+    instances[i].matrix     = m_instanceMatrices[i];
+    instances[i].meshId     = m_instanceInfos[i].mesh_id;
+    instances[i].renderMark = m_instanceInfos[i].renderMark ? 1u : 0u;
+    instances[i].sourceId   = uint32_t(-1);
+    instances[i].reserved   = 0u;
+  }
+  for(const auto &inst : m_instIdBySourceId)
+    instances[inst.second].sourceId = inst.first;
+
+  std::vector<CachedTexture> textures(m_textureInfos.size());
+  for(size_t i = 0; i < textures.size(); ++i)
+  {
+    const auto &info = m_textureInfos[i];
+    textures[i] = {addString(info.path), info.is_ok, info.is_normal_map, info.width, info.height, info.channels, info.bytesPerChannel};
+  }
+
+  std::vector<CachedString> sourceStrings;
+  sourceStrings.reserve(sources.size());
+  for(const auto &path : sources)
+    sourceStrings.push_back(addString(path));
+
+  const void* data[CACHE_SECTION_COUNT] = {};
+  size_t sizes[CACHE_SECTION_COUNT]     = {};
+  data[CACHE_MESHES]    = meshes.data();               sizes[CACHE_MESHES]    = meshes.size() * sizeof(meshes[0]);
+  data[CACHE_VERTICES]  = m_pMeshData->VertexData();   sizes[CACHE_VERTICES]  = m_pMeshData->VertexDataSize();
+  data[CACHE_INDICES]   = m_pMeshData->IndexData();    sizes[CACHE_INDICES]   = m_pMeshData->IndexDataSize();
+  data[CACHE_MAT_IDS]   = m_matIDs.data();             sizes[CACHE_MAT_IDS]   = m_matIDs.size() * sizeof(m_matIDs[0]);
+  data[CACHE_INSTANCES] = instances.data();            sizes[CACHE_INSTANCES] = instances.size() * sizeof(instances[0]);
+  data[CACHE_MATERIALS] = m_materials.data();          sizes[CACHE_MATERIALS] = m_materials.size() * sizeof(m_materials[0]);
+  data[CACHE_TEXTURES]  = textures.data();             sizes[CACHE_TEXTURES]  = textures.size() * sizeof(textures[0]);
+  data[CACHE_CAMERAS]   = m_sceneCameras.data();       sizes[CACHE_CAMERAS]   = m_sceneCameras.size() * sizeof(m_sceneCameras[0]);
+  data[CACHE_SOURCES]   = sourceStrings.data();        sizes[CACHE_SOURCES]   = sourceStrings.size() * sizeof(sourceStrings[0]);
+  data[CACHE_STRINGS]   = strings.data();              sizes[CACHE_STRINGS]   = strings.size();
+  data[CACHE_MESH_SOURCES] = meshSources.data();       sizes[CACHE_MESH_SOURCES] = meshSources.size() * sizeof(meshSources[0]);
+
+  // file name is the key, it's repeated in the header in case the file is renamed
+  const std::string path = SceneCachePath(a_scenePath, a_transpose);
+  ContentHash64 key;
+  key.AddString(path);
+
+  header.magic   = SCENE_CACHE_MAGIC;
+  header.version = SCENE_CACHE_VERSION;
+  header.key     = key.Get();
+  uint64_t offset = AlignUp64(sizeof(SceneCacheHeader));
+  for(uint32_t s = 0; s < CACHE_SECTION_COUNT; ++s)
+  {
+    header.sections[s].offset = offset;
+    header.sections[s].size   = sizes[s];
+    offset = AlignUp64(offset + sizes[s]);
+  }
+  header.fileSize = offset;
+
+  // write to a temporary file first, so that a concurrent or interrupted run never sees a partial cache file
+  const std::string tmpPath = path + ".tmp";
+  {
+    std::ofstream out(tmpPath, std::ios::binary | std::ios::trunc);
+    if(!out.is_open())
+      return;
+
+    const char zeros[64] = {};
+    out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    for(uint32_t s = 0; s < CACHE_SECTION_COUNT; ++s)
+    {
+      const auto pos = uint64_t(out.tellp());
+      out.write(zeros, std::streamsize(header.sections[s].offset - pos));
+      if(sizes[s] > 0)
+        out.write(static_cast<const char*>(data[s]), std::streamsize(sizes[s]));
+    }
+    const auto pos = uint64_t(out.tellp());
+    out.write(zeros, std::streamsize(header.fileSize - pos));
+    if(!out.good())
+      return;
+  }
+
+  std::filesystem::rename(tmpPath, path, ec);
+  if(ec)
+    std::filesystem::remove(tmpPath, ec);
+}
+
+bool SceneManager::LoadSceneCache(const std::string &a_scenePath, bool a_transpose)
+{
+  if(m_config.scene_cache_dir.empty())
+    return false;
+
+  const std::string path = SceneCachePath(a_scenePath, a_transpose);
+  auto file = std::make_shared<MappedFile>();
+  if(!file->Open(path) || file->Size() < sizeof(SceneCacheHeader))
+    return false;
+
+  SceneCacheHeader header;
+  memcpy(&header, file->Data(), sizeof(header));
+
+  ContentHash64 key;
+  key.AddString(path);
+  bool valid = header.magic == SCENE_CACHE_MAGIC && header.version == SCENE_CACHE_VERSION && header.key == key.Get() &&
+               header.fileSize == file->Size();
+  for(uint32_t s = 0; s < CACHE_SECTION_COUNT && valid; ++s)
+  {
+    valid = header.sections[s].offset % 64 == 0 && header.sections[s].offset >= sizeof(SceneCacheHeader) &&
+            header.sections[s].size <= file->Size() && header.sections[s].offset <= file->Size() - header.sections[s].size;
+  }
+  if(!valid)
+    return false;
+
+  const auto* meshes  = SectionData<CachedMesh>(*file, header, CACHE_MESHES);
+  const size_t meshNum = SectionCount<CachedMesh>(header, CACHE_MESHES);
+  uint64_t totalVertices = 0;
+  uint64_t totalIndices  = 0;
+  for(size_t i = 0; i < meshNum; ++i)
+  {
+    totalVertices += meshes[i].vertNum;
+    totalIndices  += meshes[i].indNum;
+    valid = valid && meshes[i].indNum % 3 == 0;
+  }
+
+  const auto* instances  = SectionData<CachedInstance>(*file, header, CACHE_INSTANCES);
+  const size_t instNum   = SectionCount<CachedInstance>(header, CACHE_INSTANCES);
+  for(size_t i = 0; i < instNum && valid; ++i)
+    valid = instances[i].meshId < meshNum;
+
+  const auto* meshSources  = SectionData<CachedMeshSource>(*file, header, CACHE_MESH_SOURCES);
+  const size_t meshSourceNum = SectionCount<CachedMeshSource>(header, CACHE_MESH_SOURCES);
+  for(size_t i = 0; i < meshSourceNum && valid; ++i)
+    valid = meshSources[i].meshId < meshNum;
+
+  const char* strings     = SectionData<char>(*file, header, CACHE_STRINGS);
+  const size_t stringsSize = header.sections[CACHE_STRINGS].size;
+  auto getString = [&](const CachedString &a_str, std::string* a_pOut) {
+    if(uint64_t(a_str.offset) + a_str.length > stringsSize)
+      return false;
+    a_pOut->assign(strings + a_str.offset, a_str.length);
+    return true;
+  };
+
+  const auto* sourceStrings = SectionData<CachedString>(*file, header, CACHE_SOURCES);
+  std::vector<std::string> sources(SectionCount<CachedString>(header, CACHE_SOURCES));
+  for(size_t i = 0; i < sources.size() && valid; ++i)
+    valid = getString(sourceStrings[i], &sources[i]);
+
+  const auto* textures = SectionData<CachedTexture>(*file, header, CACHE_TEXTURES);
+  std::vector<std::string> texturePaths(SectionCount<CachedTexture>(header, CACHE_TEXTURES));
+  for(size_t i = 0; i < texturePaths.size() && valid; ++i)
+    valid = getString(textures[i].path, &texturePaths[i]);
+
+  uint64_t sourceHash = 0;
+  valid = valid && !sources.empty() && sources[0] == a_scenePath && HashSceneSources(sources, &sourceHash) &&
+          sourceHash == header.sourceHash;
+
+  const size_t vertexSize = MeshData8F::FLOATS_PER_VERTEX * sizeof(float);
+  valid = valid && header.sections[CACHE_VERTICES].size == totalVertices * vertexSize &&
+                   header.sections[CACHE_INDICES].size  == totalIndices * sizeof(uint32_t) &&
+                   header.sections[CACHE_MAT_IDS].size  == (totalIndices / 3) * sizeof(uint32_t) &&
+                   SectionCount<CachedMesh>(header, CACHE_MESHES) * sizeof(CachedMesh) == header.sections[CACHE_MESHES].size &&
+                   meshSourceNum * sizeof(CachedMeshSource) == header.sections[CACHE_MESH_SOURCES].size;
+  if(!valid)
+    return false;
+
+  if(m_config.debug_output)
+    std::cout << "[SceneManager::LoadSceneCache]: loading " << a_scenePath << " from " << path << std::endl;
+
+  m_pMeshData = std::make_shared<MeshData8F>(m_config.geometry_huge_pages);
+  m_pSplitData = nullptr;
+
+  uint32_t maxVertexCountPerMesh    = 0u;
+  uint32_t maxPrimitiveCountPerMesh = 0u;
+  uint32_t totalPrimitiveCount      = uint32_t(totalIndices / 3);
+  uint32_t totalVerticesCount       = uint32_t(totalVertices);
+  uint32_t totalMeshes              = uint32_t(meshNum);
+  if(m_config.load_geometry)
+  {
+    for(size_t i = 0; i < meshNum; ++i)
+    {
+      maxVertexCountPerMesh    = std::max(meshes[i].vertNum, maxVertexCountPerMesh);
+      maxPrimitiveCountPerMesh = std::max(meshes[i].indNum / 3, maxPrimitiveCountPerMesh);
+    }
+    CountProceduralMeshes(maxVertexCountPerMesh, maxPrimitiveCountPerMesh, totalVerticesCount, totalPrimitiveCount, totalMeshes);
+
+    InitGeoBuffersGPU(totalMeshes, totalVerticesCount, totalPrimitiveCount * 3);
+    m_pMeshData->Attach(file, SectionData<float>(*file, header, CACHE_VERTICES), totalVertices,
+      SectionData<uint32_t>(*file, header, CACHE_INDICES), totalIndices);
+    m_matIDs.reserve(totalPrimitiveCount);
+    const auto* matIds = SectionData<uint32_t>(*file, header, CACHE_MAT_IDS);
+    m_matIDs.assign(matIds, matIds + totalIndices / 3);
+    if(m_config.build_acc_structs)
+    {
+      m_pBuilderV2->Init(maxVertexCountPerMesh, maxPrimitiveCountPerMesh, totalPrimitiveCount, m_pMeshData->SingleVertexSize(),
+        m_config.build_acc_structs_while_loading_scene);
+    }
+
+    for(size_t i = 0; i < meshNum; ++i)
+    {
+      auto meshId = AddMeshInfo(meshes[i].vertNum, meshes[i].indNum);
+      UploadMesh(meshId);
+    }
+    for(size_t i = 0; i < meshSourceNum; ++i)
+      m_meshBySourceId[meshSources[i].sourceId] = {meshSources[i].meshId, meshSources[i].sourceStamp, meshSources[i].meshMatrix};
+
+    for(size_t i = 0; i < instNum; ++i)
+    {
+      auto instId = InstanceMesh(instances[i].meshId, instances[i].matrix, instances[i].renderMark != 0);
+      if(instances[i].sourceId != uint32_t(-1))
+        m_instIdBySourceId[instances[i].sourceId] = instId;
+    }
+  }
+
+  const auto* cameras = SectionData<hydra_xml::Camera>(*file, header, CACHE_CAMERAS);
+  m_sceneCameras.assign(cameras, cameras + SectionCount<hydra_xml::Camera>(header, CACHE_CAMERAS));
+
+  const auto* materials = SectionData<MaterialData_pbrMR>(*file, header, CACHE_MATERIALS);
+  m_materials.assign(materials, materials + SectionCount<MaterialData_pbrMR>(header, CACHE_MATERIALS));
+
+  m_textureInfos.resize(texturePaths.size());
+  for(size_t i = 0; i < m_textureInfos.size(); ++i)
+  {
+    auto &info = m_textureInfos[i];
+    info.path            = std::move(texturePaths[i]);
+    info.is_ok           = textures[i].isOk != 0;
+    info.is_normal_map   = textures[i].isNormalMap != 0;
+    info.width           = textures[i].width;
+    info.height          = textures[i].height;
+    info.channels        = textures[i].channels;
+    info.bytesPerChannel = textures[i].bytesPerChannel;
+  }
+
+  if(m_config.load_geometry)
+  {
+    LoadProceduralMeshes();
+    LoadCommonGeoDataOnGPU();
+  }
+
+  if(m_config.instance_matrix_as_vertex_attribute)
+  {
+    LoadInstanceDataOnGPU();
+  }
+
+  if(m_config.load_materials != MATERIAL_LOAD_MODE::NONE)
+  {
+    LoadMaterialDataOnGPU();
+  }
+
+  return true;
+}
@@ -0,0 +1,240 @@
+#include "scene_mgr.h"
+#include "../utils/content_hash.h"
+
+#include <cfloat>
+#include <cmath>
+#include <cstring>
+#include <iostream>
+
+// Load-time mesh deduplication. Meshes are keyed by topology (indices), material ids and a few averaged values of positions
+// snapped to a grid of 16 tolerances: averages are barely moved by per vertex noise, so copies rarely fall into different
+// cells, as they would with every position hashed. Meshes with the same key are compared vertex by vertex with the tolerance.
+// For MESH_DEDUP::RIGID the averages don't change with translation and rotation, and a copy is compared with the mesh moved by
+// the transform between their frames: both are built on the same triangle (the first one of at least half of the largest area).
+
+struct DedupVec3
+{
+  double x, y, z;
+};
+
+static inline DedupVec3 operator-(const DedupVec3 &a, const DedupVec3 &b) { return {a.x - b.x, a.y - b.y, a.z - b.z}; }
+static inline double Dot(const DedupVec3 &a, const DedupVec3 &b) { return a.x * b.x + a.y * b.y + a.z * b.z; }
+static inline DedupVec3 Cross(const DedupVec3 &a, const DedupVec3 &b) { return {a.y * b.z - a.z * b.y, a.z * b.x - a.x * b.z, a.x * b.y - a.y * b.x}; }
+static inline DedupVec3 Scale(const DedupVec3 &a, double s) { return {a.x * s, a.y * s, a.z * s}; }
+
+// vertices are in MeshData8F layout, material ids are per triangle
+struct DedupMesh
+{
+  const float*    vertices;
+  const uint32_t* indices;
+  const uint32_t* matIds;
+  uint32_t vertNum;
+  uint32_t indNum;
+
+  const float* Vertex(uint32_t a_id) const { return vertices + size_t(a_id) * MeshData8F::FLOATS_PER_VERTEX; }
+  DedupVec3 Position(uint32_t a_id) const { const float* v = Vertex(a_id); return {v[0], v[1], v[2]}; }
+};
+
+// rotation (columns) and origin, mesh coordinates are 'origin + rot * local'
+struct DedupFrame
+{
+  DedupVec3 rot[3];
+  DedupVec3 origin;
+
+  DedupVec3 Rotate(const DedupVec3 &a_v) const { return {rot[0].x * a_v.x + rot[1].x * a_v.y + rot[2].x * a_v.z,
+                                                         rot[0].y * a_v.x + rot[1].y * a_v.y + rot[2].y * a_v.z,
+                                                         rot[0].z * a_v.x + rot[1].z * a_v.y + rot[2].z * a_v.z}; }
+  DedupVec3 Apply(const DedupVec3 &a_v) const { DedupVec3 r = Rotate(a_v); return {r.x + origin.x, r.y + origin.y, r.z + origin.z}; }
+};
+
+static bool MeshFrame(const DedupMesh &a_mesh, DedupFrame* a_pFrame)
+{
+  auto triangleNormal = [&a_mesh](uint32_t t) {
+    const DedupVec3 a = a_mesh.Position(a_mesh.indices[t * 3 + 0]);
+    return Cross(a_mesh.Position(a_mesh.indices[t * 3 + 1]) - a, a_mesh.Position(a_mesh.indices[t * 3 + 2]) - a);
+  };
+
+  const uint32_t triNum = a_mesh.indNum / 3;
+  double maxArea = 0.0;
+  for(uint32_t t = 0; t < triNum; ++t)
+    maxArea = std::max(maxArea, std::sqrt(Dot(triangleNormal(t), triangleNormal(t))));
+  if(maxArea <= 0.0)
+    return false;
+
+  for(uint32_t t = 0; t < triNum; ++t)
+  {
+    const DedupVec3 n = triangleNormal(t);
+    const double area = std::sqrt(Dot(n, n));
+    if(area < 0.5 * maxArea)
+      continue;
+    const DedupVec3 a  = a_mesh.Position(a_mesh.indices[t * 3 + 0]);
+    const DedupVec3 e1 = a_mesh.Position(a_mesh.indices[t * 3 + 1]) - a;
+    a_pFrame->rot[0] = Scale(e1, 1.0 / std::sqrt(Dot(e1, e1)));
+    a_pFrame->rot[2] = Scale(n, 1.0 / area);
+    a_pFrame->rot[1] = Cross(a_pFrame->rot[2], a_pFrame->rot[0]);
+    a_pFrame->origin = a;
+    return true;
+  }
+  return false;
+}
+
+static uint64_t MeshDedupKey(const DedupMesh &a_mesh, MESH_DEDUP a_mode, float a_tolerance)
+{
+  DedupVec3 centroid = {0.0, 0.0, 0.0};
+  for(uint32_t v = 0; v < a_mesh.vertNum; ++v)
+  {
+    const DedupVec3 p = a_mesh.Position(v);
+    centroid = {centroid.x + p.x, centroid.y + p.y, centroid.z + p.z};
+  }
+  centroid = Scale(centroid, a_mesh.vertNum > 0 ? 1.0 / a_mesh.vertNum : 0.0);
+
+  double radius = 0.0; // root mean square distance to centroid
+  for(uint32_t v = 0; v < a_mesh.vertNum; ++v)
+  {
+    const DedupVec3 d = a_mesh.Position(v) - centroid;
+    radius += Dot(d, d);
+  }
+  radius = std::sqrt(radius / std::max(a_mesh.vertNum, 1u));
+
+  const double cell = 16.0 * std::max(double(a_tolerance), 1e-30);
+  ContentHash64 key;
+  key.AddValue(a_mesh.vertNum);
+  key.AddValue(a_mesh.indNum);
+  key.Add(a_mesh.indices, size_t(a_mesh.indNum) * sizeof(uint32_t));
+  key.Add(a_mesh.matIds, size_t(a_mesh.indNum / 3) * sizeof(uint32_t));
+  key.AddValue(int64_t(std::floor(radius / cell)));
+  if(a_mode == MESH_DEDUP::IDENTICAL)
+  {
+    key.AddValue(int64_t(std::floor(centroid.x / cell)));
+    key.AddValue(int64_t(std::floor(centroid.y / cell)));
+    key.AddValue(int64_t(std::floor(centroid.z / cell)));
+  }
+  return key.Get();
+}
+
+// a_b equals a_a moved by a_frameB * inverse(a_frameA) within a_tolerance (plus float rounding of the moved coordinates);
+// normals and tangents are compared with the same rotation, texture coordinates as they are
+static bool SameMesh(const DedupMesh &a_a, const DedupMesh &a_b, const DedupFrame* a_frameA, const DedupFrame* a_frameB, float a_tolerance)
+{
+  if(a_a.vertNum != a_b.vertNum || a_a.indNum != a_b.indNum ||
+     memcmp(a_a.indices, a_b.indices, size_t(a_a.indNum) * sizeof(uint32_t)) != 0 ||
+     memcmp(a_a.matIds, a_b.matIds, size_t(a_a.indNum / 3) * sizeof(uint32_t)) != 0)
+    return false;
+
+  auto toLocal = [a_frameA](const DedupVec3 &p) {
+    const DedupVec3 d = p - a_frameA->origin;
+    return DedupVec3{Dot(a_frameA->rot[0], d), Dot(a_frameA->rot[1], d), Dot(a_frameA->rot[2], d)};
+  };
+  auto rotate = [a_frameA, a_frameB](const DedupVec3 &n) {
+    return a_frameB->Rotate({Dot(a_frameA->rot[0], n), Dot(a_frameA->rot[1], n), Dot(a_frameA->rot[2], n)});
+  };
+  auto sameDirection = [&](float a_encA, float a_encB) {
+    const LiteMath::float3 na = MeshData8F::DecodeNormal(a_encA);
+    const LiteMath::float3 nb = MeshData8F::DecodeNormal(a_encB);
+    const DedupVec3 ra = a_frameA != nullptr ? rotate({na.x, na.y, na.z}) : DedupVec3{na.x, na.y, na.z};
+    return Dot(ra, {nb.x, nb.y, nb.z}) >= 0.999 * std::sqrt(Dot(ra, ra) * double(LiteMath::dot(nb, nb)));
+  };
+
+  // moved copy was rounded to float by whatever has moved it
+  const double moveError = a_frameB != nullptr ? 4.0 * FLT_EPSILON * std::sqrt(Dot(a_frameB->origin, a_frameB->origin)) : 0.0;
+  for(uint32_t v = 0; v < a_a.vertNum; ++v)
+  {
+    const float* va = a_a.Vertex(v);
+    const float* vb = a_b.Vertex(v);
+    const DedupVec3 pb = a_b.Position(v);
+    const DedupVec3 pa = a_frameA != nullptr ? a_frameB->Apply(toLocal(a_a.Position(v))) : a_a.Position(v);
+    const DedupVec3 d  = pa - pb;
+    const double allowed = a_tolerance + moveError + (a_frameB != nullptr ? 4.0 * FLT_EPSILON * std::sqrt(Dot(pb, pb)) : 0.0);
+    if(Dot(d, d) > allowed * allowed)
+      return false;
+    if(std::abs(va[4] - vb[4]) > 1e-5f * std::max(1.0f, std::abs(va[4])) || std::abs(va[5] - vb[5]) > 1e-5f * std::max(1.0f, std::abs(va[5])))
+      return false;
+    if(!sameDirection(va[3], vb[3]) || !sameDirection(va[6], vb[6]))
+      return false;
+  }
+  return true;
+}
+
+static LiteMath::float4x4 FrameTransform(const DedupFrame &a_from, const DedupFrame &a_to)
+{
+  // a_to * inverse(a_from): rotation is to.rot * transpose(from.rot)
+  LiteMath::float4x4 res;
+  for(int c = 0; c < 3; ++c)
+  {
+    const DedupVec3 axis = {c == 0 ? 1.0 : 0.0, c == 1 ? 1.0 : 0.0, c == 2 ? 1.0 : 0.0};
+    const DedupVec3 col  = a_to.Rotate({Dot(a_from.rot[0], axis), Dot(a_from.rot[1], axis), Dot(a_from.rot[2], axis)});
+    res.set_col(c, LiteMath::float4(float(col.x), float(col.y), float(col.z), 0.0f));
+  }
+  const DedupVec3 origin = a_to.Apply({-Dot(a_from.rot[0], a_from.origin), -Dot(a_from.rot[1], a_from.origin), -Dot(a_from.rot[2], a_from.origin)});
+  res.set_col(3, LiteMath::float4(float(origin.x), float(origin.y), float(origin.z), 1.0f));
+  return res;
+}
+
+LiteMath::float4x4 SceneManager::MeshCopyMatrix(const LiteMath::float4x4 &a_matrix, const LiteMath::float4x4 &a_meshMatrix)
+{
+  const LiteMath::float4x4 identity;
+  return memcmp(&a_meshMatrix, &identity, sizeof(identity)) == 0 ? a_matrix : a_matrix * a_meshMatrix;
+}
+
+uint32_t SceneManager::AddMeshDeduplicated(uint32_t a_firstVertex, uint32_t a_firstIndex, uint32_t a_vertNum, uint32_t a_indNum,
+  LiteMath::float4x4* a_pMeshMatrix)
+{
+  *a_pMeshMatrix = LiteMath::float4x4();
+  const DedupMesh mesh = {m_pMeshData->VertexData() + size_t(a_firstVertex) * MeshData8F::FLOATS_PER_VERTEX,
+                          m_pMeshData->IndexData() + a_firstIndex, m_matIDs.data() + a_firstIndex / 3, a_vertNum, a_indNum};
+
+  uint64_t key = 0;
+  if(m_config.mesh_dedup != MESH_DEDUP::NONE)
+  {
+    key = MeshDedupKey(mesh, m_config.mesh_dedup, m_config.mesh_dedup_tolerance);
+    DedupFrame frame;
+    bool hasFrame = false, frameDone = false;
+    auto range = m_dedupMeshes.equal_range(key);
+    for(auto it = range.first; it != range.second; ++it)
+    {
+      const auto &info = m_meshInfos[it->second];
+      const DedupMesh other = {m_pMeshData->VertexData() + size_t(info.m_vertexOffset) * MeshData8F::FLOATS_PER_VERTEX,
+                               m_pMeshData->IndexData() + info.m_indexOffset, m_matIDs.data() + info.m_indexOffset / 3,
+                               info.m_vertNum, info.m_indNum};
+      bool same = SameMesh(other, mesh, nullptr, nullptr, m_config.mesh_dedup_tolerance);
+      if(!same && m_config.mesh_dedup == MESH_DEDUP::RIGID)
+      {
+        if(!frameDone)
+        {
+          hasFrame  = MeshFrame(mesh, &frame);
+          frameDone = true;
+        }
+        DedupFrame otherFrame;
+        if(hasFrame && MeshFrame(other, &otherFrame) && SameMesh(other, mesh, &otherFrame, &frame, m_config.mesh_dedup_tolerance))
+        {
+          same = true;
+          *a_pMeshMatrix = FrameTransform(otherFrame, frame);
+        }
+      }
+      if(same)
+      {
+        if(m_config.debug_output)
+          std::cout << "[SceneManager::AddMeshDeduplicated]: mesh is a copy of mesh # " << it->second << std::endl;
+        return it->second;
+      }
+    }
+  }
+
+  // meshes are stored one after another, so the data is moved to the end of the previous mesh if some were dropped before it
+  if(a_firstVertex != m_totalVertices)
+  {
+    memmove(m_pMeshData->VertexData() + size_t(m_totalVertices) * MeshData8F::FLOATS_PER_VERTEX, mesh.vertices,
+      size_t(a_vertNum) * m_pMeshData->SingleVertexSize());
+  }
+  if(a_firstIndex != m_totalIndices)
+  {
+    memmove(m_pMeshData->IndexData() + m_totalIndices, mesh.indices, size_t(a_indNum) * sizeof(uint32_t));
+    memmove(m_matIDs.data() + m_totalIndices / 3, mesh.matIds, size_t(a_indNum / 3) * sizeof(uint32_t));
+  }
+
+  const uint32_t meshId = AddMeshInfo(a_vertNum, a_indNum);
+  UploadMesh(meshId);
+  if(m_config.mesh_dedup != MESH_DEDUP::NONE)
+    m_dedupMeshes.emplace(key, meshId);
+  return meshId;
+}
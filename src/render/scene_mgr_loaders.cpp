@@ -1,6 +1,8 @@
 #include "scene_mgr.h"
 #include "vk_utils.h"
 #include "../loader_utils/gltf_utils.h"
+#include "../utils/mapped_file.h"
+#include "../utils/content_hash.h"
 
 #define TINYGLTF_IMPLEMENTATION
 //#define TINYGLTF_NO_STB_IMAGE_WRITE
@@ -11,10 +13,185 @@
 #define TINYGLTF_USE_CPP14
 #include "tiny_gltf.h"
 
+#include <atomic>
+#include <condition_variable>
+#include <cstring>
+#include <exception>
+#include <filesystem>
+#include <functional>
+#include <limits>
+#include <mutex>
+#include <thread>
+
+// Meshes are read and decoded by worker threads into a ring of slots, while the calling thread takes them strictly
+// in order: buffer offsets stay the same as with serial loading, and GPU uploads and BLAS builds stay on one thread.
+// Workers run at most 'slotNum' meshes ahead of the consumer, so memory for decoded meshes is bounded.
+template<typename Slot>
+static void LoadMeshesPipelined(size_t a_meshNum, uint32_t a_threadNum, const std::function<Slot(size_t)> &a_decode,
+  const std::function<void(size_t, Slot&)> &a_consume)
+{
+  if(a_threadNum == 0)
+    a_threadNum = std::max(std::thread::hardware_concurrency(), 1u);
+  a_threadNum = uint32_t(std::min(size_t(a_threadNum), a_meshNum));
+  if(a_threadNum <= 1)
+  {
+    for(size_t i = 0; i < a_meshNum; ++i)
+    {
+      auto mesh = a_decode(i);
+      a_consume(i, mesh);
+    }
+    return;
+  }
+
+  const size_t slotNum = 2 * size_t(a_threadNum);
+  std::vector<Slot> slots(slotNum);
+  std::vector<uint8_t> ready(slotNum, 0);
+  size_t consumed = 0;
+  bool cancel     = false;
+  std::exception_ptr error = nullptr;
+  std::atomic<size_t> next(0);
+  std::mutex mtx;
+  std::condition_variable slotFree, slotReady;
+
+  auto worker = [&]()
+  {
+    for(size_t i = next++; i < a_meshNum; i = next++)
+    {
+      {
+        std::unique_lock<std::mutex> lock(mtx);
+        slotFree.wait(lock, [&]() { return cancel || i < consumed + slotNum; });
+        if(cancel)
+          return;
+      }
+      Slot mesh;
+      std::exception_ptr decodeError = nullptr;
+      try
+      {
+        mesh = a_decode(i);
+      }
+      catch(...)
+      {
+        decodeError = std::current_exception();
+      }
+      {
+        std::lock_guard<std::mutex> lock(mtx);
+        slots[i % slotNum] = std::move(mesh);
+        ready[i % slotNum] = 1;
+        if(decodeError && !error)
+          error = decodeError;
+      }
+      slotReady.notify_all();
+    }
+  };
+
+  std::vector<std::thread> workers;
+  workers.reserve(a_threadNum);
+  for(uint32_t t = 0; t < a_threadNum; ++t)
+    workers.emplace_back(worker);
+
+  bool failed = false;
+  for(size_t i = 0; i < a_meshNum && !failed; ++i)
+  {
+    Slot mesh;
+    {
+      std::unique_lock<std::mutex> lock(mtx);
+      slotReady.wait(lock, [&]() { return ready[i % slotNum] != 0; });
+      mesh = std::move(slots[i % slotNum]);
+      ready[i % slotNum] = 0;
+      consumed = i + 1;
+      failed   = (error != nullptr);
+    }
+    slotFree.notify_all();
+    if(failed)
+      break;
+    try
+    {
+      a_consume(i, mesh);
+    }
+    catch(...)
+    {
+      std::lock_guard<std::mutex> lock(mtx);
+      error  = std::current_exception();
+      failed = true;
+    }
+  }
+
+  {
+    std::lock_guard<std::mutex> lock(mtx);
+    cancel = true;
+  }
+  slotFree.notify_all();
+  for(auto &w : workers)
+    w.join();
+
+  if(error)
+    std::rethrow_exception(error);
+}
+
+// mesh file mapped for reading, its streams are located in the mapping
+struct MappedVSGF
+{
+  MappedFile   file;
+  VSGFMeshView view = {};
+  bool         ok   = false;
+};
+
+static MappedVSGF MapVSGF(const std::string &a_path)
+{
+  MappedVSGF mesh;
+  if(mesh.file.Open(a_path))
+  {
+    mesh.file.AdviseSequential();
+    mesh.ok = ParseVSGF(mesh.file.Data(), mesh.file.Size(), &mesh.view) && mesh.view.vertNum > 0;
+  }
+  return mesh;
+}
+
+// size and modification time of a mesh file: a scene delta loads the mesh again only if they have changed
+static uint64_t SourceFileStamp(const std::string &a_path)
+{
+  std::error_code ec;
+  const auto size = std::filesystem::file_size(a_path, ec);
+  if(ec)
+    return 0;
+  const auto time = std::filesystem::last_write_time(a_path, ec);
+  if(ec)
+    return 0;
+
+  ContentHash64 hash;
+  hash.AddValue(uint64_t(size));
+  hash.AddValue(int64_t(time.time_since_epoch().count()));
+  return hash.Get();
+}
+
+static MaterialData_pbrMR MaterialFromHydra(const hydra_xml::gltfMaterialData &a_gltfMat)
+{
+  MaterialData_pbrMR mat = {};
+  mat.baseColor   = LiteMath::float4(a_gltfMat.metRoughnessData.baseColor);
+  mat.alphaCutoff = a_gltfMat.alphaCutoff;
+  mat.alphaMode   = a_gltfMat.alphaMode;
+  mat.metallic    = a_gltfMat.metRoughnessData.metallic;
+  mat.roughness   = a_gltfMat.metRoughnessData.roughness;
+  mat.emissionColor  = LiteMath::float3(a_gltfMat.emissionColor);
+  mat.emissionTexId  = a_gltfMat.emissionTexId;
+  mat.normalTexId    = a_gltfMat.normalTexId;
+  mat.occlusionTexId = a_gltfMat.occlusionTexId;
+  mat.baseColorTexId = a_gltfMat.metRoughnessData.baseColorTexId;
+  mat.metallicRoughnessTexId = a_gltfMat.metRoughnessData.metallicRoughnessTexId;
+  return mat;
+}
+
+// mesh converted by a worker thread in place, in the storage extended for all meshes beforehand
+struct ConvertedMesh
+{
+  bool ok = false;
+};
+
 
 bool SceneManager::InitEmptyScene(uint32_t maxMeshes, uint32_t maxTotalVertices, uint32_t maxTotalPrimitives, uint32_t maxPrimitivesPerMesh)
 {
-  m_pMeshData = std::make_shared<Mesh8F>();
+  m_pMeshData = std::make_shared<MeshData8F>(m_config.geometry_huge_pages);
+  m_pSplitData = nullptr;
   InitGeoBuffersGPU(maxMeshes, maxTotalVertices, maxTotalPrimitives * 3);
   if(m_config.build_acc_structs)
   {
@@ -34,7 +211,7 @@ bool SceneManager::LoadScene(const std::string &scenePath)
 
   std::string ext = scenePath.substr(scenePath.find_last_of('.'), scenePath.size());
 
-  if(ext == ".gltf")
+  if(ext == ".gltf" || ext == ".glb")
     return LoadSceneGLTF(scenePath);
   else if(ext == ".xml")
     return LoadSceneXML(scenePath, false);
@@ -44,6 +221,9 @@ bool SceneManager::LoadScene(const std::string &scenePath)
 
 bool SceneManager::LoadSceneXML(const std::string &scenePath, bool transpose)
 {
+  if(LoadSceneCache(scenePath, transpose))
+    return true;
+
   auto hscene_main = std::make_shared<hydra_xml::HydraScene>();
   auto res         = hscene_main->LoadState(scenePath);
 
@@ -53,7 +233,9 @@ bool SceneManager::LoadSceneXML(const std::string &scenePath, bool transpose)
     return false;
   }
 
-  m_pMeshData = std::make_shared<Mesh8F>();
+  m_pMeshData = std::make_shared<MeshData8F>(m_config.geometry_huge_pages);
+  m_pSplitData = nullptr;
+  std::vector<std::string> sourceFiles; // the scene cache is valid while these files are unchanged
 
   uint32_t maxVertexCountPerMesh    = 0u;
   uint32_t maxPrimitiveCountPerMesh = 0u;
@@ -62,46 +244,79 @@ bool SceneManager::LoadSceneXML(const std::string &scenePath, bool transpose)
   uint32_t totalMeshes              = 0u;
   if(m_config.load_geometry)
   {
+    std::vector<uint32_t> meshIds; // instances refer to meshes by these ids, in the order of MeshFiles()
+    std::vector<uint32_t> vsgfVertexStart(1, 0), vsgfIndexStart(1, 0);
     for(auto mesh_node : hscene_main->GeomNodes())
     {
-      uint32_t vertNum = mesh_node.attribute(L"vertNum").as_int();
-      uint32_t primNum = mesh_node.attribute(L"triNum").as_int();
+      meshIds.push_back(mesh_node.attribute("id").as_uint());
+      uint32_t vertNum = mesh_node.attribute("vertNum").as_int();
+      uint32_t primNum = mesh_node.attribute("triNum").as_int();
       maxVertexCountPerMesh    = std::max(vertNum, maxVertexCountPerMesh);
       maxPrimitiveCountPerMesh = std::max(primNum, maxPrimitiveCountPerMesh);
       totalVerticesCount      += vertNum;
       totalPrimitiveCount     += primNum;
       totalMeshes++;
+      vsgfVertexStart.push_back(vsgfVertexStart.back() + vertNum);
+      vsgfIndexStart.push_back(vsgfIndexStart.back() + primNum * 3);
     }
+    CountProceduralMeshes(maxVertexCountPerMesh, maxPrimitiveCountPerMesh, totalVerticesCount, totalPrimitiveCount, totalMeshes);
 
     InitGeoBuffersGPU(totalMeshes, totalVerticesCount, totalPrimitiveCount * 3);
+    m_pMeshData->Reserve(totalVerticesCount, totalPrimitiveCount * 3);
+    m_matIDs.reserve(totalPrimitiveCount);
     if(m_config.build_acc_structs)
     {
       m_pBuilderV2->Init(maxVertexCountPerMesh, maxPrimitiveCountPerMesh, totalPrimitiveCount, m_pMeshData->SingleVertexSize(),
         m_config.build_acc_structs_while_loading_scene);
     }
 
+    std::vector<std::string> meshFiles;
     for(auto loc : hscene_main->MeshFiles())
-    {
-      auto meshId = AddMeshFromFile(loc);
-
-      if(m_config.debug_output)
-        std::cout << "Loading mesh # " << meshId << std::endl;
-
-      LoadOneMeshOnGPU(meshId);
-      if(m_config.build_acc_structs)
+      meshFiles.push_back(loc);
+    sourceFiles.insert(sourceFiles.end(), meshFiles.begin(), meshFiles.end());
+
+    // sizes from the scene description give every mesh its place in the storage, so workers convert meshes straight there
+    // and the consumer only registers and uploads them
+    m_pMeshData->Extend(vsgfVertexStart.back(), vsgfIndexStart.back());
+    m_matIDs.resize(m_matIDs.size() + vsgfIndexStart.back() / 3);
+    const uint32_t firstVertex = m_totalVertices;
+    const uint32_t firstIndex  = m_totalIndices;
+
+    LoadMeshesPipelined<ConvertedMesh>(meshFiles.size(), m_config.loader_threads,
+      [&](size_t i)
       {
-        AddBLAS(meshId);
-      }
-
-      auto instances = hscene_main->GetAllInstancesOfMeshLoc(loc);
-      for(size_t j = 0; j < instances.size(); ++j)
+        ConvertedMesh mesh;
+        MappedVSGF file = MapVSGF(meshFiles[i]);
+        mesh.ok = file.ok && file.view.vertNum == vsgfVertexStart[i + 1] - vsgfVertexStart[i] &&
+                  file.view.indNum == vsgfIndexStart[i + 1] - vsgfIndexStart[i];
+        if(mesh.ok)
+        {
+          m_pMeshData->Write(file.view, firstVertex + vsgfVertexStart[i], firstIndex + vsgfIndexStart[i]);
+          memcpy(m_matIDs.data() + (firstIndex + vsgfIndexStart[i]) / 3, file.view.matIndices, size_t(file.view.indNum / 3) * sizeof(uint32_t));
+        }
+        return mesh;
+      },
+      [&](size_t i, ConvertedMesh &mesh)
       {
-        if(transpose)
-          InstanceMesh(meshId, LiteMath::transpose(instances[j]));
-        else
-          InstanceMesh(meshId, instances[j]);
-      }
-    }
+        if(!mesh.ok)
+          RUN_TIME_ERROR(("can't load mesh at " + meshFiles[i] + " or its size differs from the scene description").c_str());
+
+        // workers write ahead of this mesh only, so it's safe to move it back over copies dropped before it
+        LiteMath::float4x4 meshMatrix;
+        auto meshId = AddMeshDeduplicated(firstVertex + vsgfVertexStart[i], firstIndex + vsgfIndexStart[i],
+          vsgfVertexStart[i + 1] - vsgfVertexStart[i], vsgfIndexStart[i + 1] - vsgfIndexStart[i], &meshMatrix);
+        m_meshBySourceId[meshIds[i]] = {meshId, SourceFileStamp(meshFiles[i]), meshMatrix};
+
+        const uint32_t* instIds = hscene_main->InstanceIdsOfMesh(meshIds[i]).begin();
+        for(const auto &matrix : hscene_main->InstancesOfMesh(meshIds[i]))
+        {
+          const uint32_t instId = InstanceMesh(meshId, MeshCopyMatrix(transpose ? LiteMath::transpose(matrix) : matrix, meshMatrix));
+          m_instIdBySourceId[*instIds++] = instId;
+        }
+      });
+    m_pMeshData->Truncate(m_totalVertices, m_totalIndices);
+    m_matIDs.resize(m_totalIndices / 3);
+    m_dedupMeshes.clear();
   }
 
   for(auto cam : hscene_main->Cameras())
@@ -113,22 +328,7 @@ bool SceneManager::LoadSceneXML(const std::string &scenePath, bool transpose)
   {
     m_materials.reserve(32);
     for(auto gltfMat : hscene_main->MaterialsGLTF())
-    {
-
-      MaterialData_pbrMR mat = {};
-      mat.baseColor   = LiteMath::float4(gltfMat.metRoughnessData.baseColor);
-      mat.alphaCutoff = gltfMat.alphaCutoff;
-      mat.alphaMode   = gltfMat.alphaMode;
-      mat.metallic    = gltfMat.metRoughnessData.metallic;
-      mat.roughness   = gltfMat.metRoughnessData.roughness;
-      mat.emissionColor  = LiteMath::float3(gltfMat.emissionColor);
-      mat.emissionTexId  = gltfMat.emissionTexId;
-      mat.normalTexId    = gltfMat.normalTexId;
-      mat.occlusionTexId = gltfMat.occlusionTexId;
-      mat.baseColorTexId = gltfMat.metRoughnessData.baseColorTexId;
-      mat.metallicRoughnessTexId = gltfMat.metRoughnessData.metallicRoughnessTexId;
-      m_materials.push_back(mat);
-    }
+      m_materials.push_back(MaterialFromHydra(gltfMat));
   }
 
   if(m_config.load_materials == MATERIAL_LOAD_MODE::MATERIALS_AND_TEXTURES)
@@ -143,12 +343,17 @@ bool SceneManager::LoadSceneXML(const std::string &scenePath, bool transpose)
         ss << "Texture at \"" << tex << "\" is absent or corrupted." ;
         vk_utils::logWarning(ss.str());
       }
+      else
+        sourceFiles.push_back(tex);
       m_textureInfos.push_back(texInfo);
     }
   }
 
+  SaveSceneCache(scenePath, transpose, sourceFiles);
+
   if(m_config.load_geometry)
   {
+    LoadProceduralMeshes();
     LoadCommonGeoDataOnGPU();
   }
 
@@ -167,8 +372,228 @@ bool SceneManager::LoadSceneXML(const std::string &scenePath, bool transpose)
   return true;
 }
 
+bool SceneManager::ApplySceneDelta(const std::string &a_path, bool transpose, SceneDelta* a_pDelta)
+{
+  hydra_xml::HydraScene changes;
+  if(changes.LoadChanges(a_path) < 0)
+    return false;
+
+  SceneDelta delta;
+
+  // meshes: Hydra writes a changed mesh to a new file, so a mesh listed in the change is loaded only if its file differs
+  // previous mesh id -> id of the new version and transform of instances (new versions are not deduplicated)
+  std::unordered_map<uint32_t, std::pair<uint32_t, LiteMath::float4x4>> replacedMeshes;
+  if(m_config.load_geometry)
+  {
+    std::vector<uint32_t> sourceIds;
+    std::vector<std::string> meshFiles;
+    std::vector<uint64_t> fileStamps;
+    auto loc = changes.MeshFiles().begin();
+    for(auto mesh_node : changes.GeomNodes())
+    {
+      const std::string meshPath = *loc;
+      ++loc;
+      const uint32_t sourceId = mesh_node.attribute("id").as_uint();
+      const uint64_t stamp    = SourceFileStamp(meshPath);
+      auto pFound = m_meshBySourceId.find(sourceId);
+      if(pFound != m_meshBySourceId.end() && pFound->second.fileStamp == stamp)
+        continue;
+      sourceIds.push_back(sourceId);
+      meshFiles.push_back(meshPath);
+      fileStamps.push_back(stamp);
+    }
+
+    // GPU buffers are filled again from CPU copy when they grow
+    if(!m_config.keep_geometry_on_cpu && !meshFiles.empty())
+    {
+      std::cout << "[SceneManager::ApplySceneDelta]: geometry isn't kept on CPU, changed meshes are not loaded" << std::endl;
+      meshFiles.clear();
+    }
+
+    std::vector<MappedVSGF> meshes(meshFiles.size());
+    uint64_t totalVertices = m_totalVertices;
+    uint64_t totalIndices  = m_totalIndices;
+    for(size_t i = 0; i < meshFiles.size(); ++i)
+    {
+      meshes[i] = MapVSGF(meshFiles[i]);
+      if(!meshes[i].ok)
+      {
+        std::cout << "[SceneManager::ApplySceneDelta]: can't load mesh at " << meshFiles[i] << std::endl;
+        continue;
+      }
+      totalVertices += meshes[i].view.vertNum;
+      totalIndices  += meshes[i].view.indNum;
+    }
+    ReserveGeoBuffersGPU(uint32_t(m_meshInfos.size() + meshFiles.size()), uint32_t(totalVertices), uint32_t(totalIndices));
+
+    for(size_t i = 0; i < meshes.size(); ++i)
+    {
+      if(!meshes[i].ok)
+        continue;
+      auto meshId = AddMeshFromVSGF(meshes[i].view);
+      UploadMesh(meshId);
+      // a mesh deduplicated at load time can be shared with other source meshes, then its instances are updated only if listed
+      auto pFound = m_meshBySourceId.find(sourceIds[i]);
+      if(pFound != m_meshBySourceId.end())
+      {
+        const uint32_t prevId = pFound->second.meshId;
+        const bool shared = std::count_if(m_meshBySourceId.begin(), m_meshBySourceId.end(),
+          [prevId](const auto &a_mesh) { return a_mesh.second.meshId == prevId; }) > 1;
+        const LiteMath::float4x4 identity;
+        const LiteMath::float4x4 &prevMatrix = pFound->second.meshMatrix;
+        if(!shared)
+          replacedMeshes[prevId] = {meshId, memcmp(&prevMatrix, &identity, sizeof(identity)) != 0 ? LiteMath::inverse4x4(prevMatrix) : identity};
+      }
+      m_meshBySourceId[sourceIds[i]] = {meshId, fileStamps[i], LiteMath::float4x4()};
+      delta.addedMeshes.push_back(meshId);
+    }
+    if(!delta.addedMeshes.empty())
+      LoadCommonGeoDataOnGPU();
+  }
+
+  // instances: listed ones are added or updated; the rest are removed only if the change discards previous instances
+  const bool discard = changes.DiscardsInstances() && changes.InstancesGeom().begin() != changes.InstancesGeom().end();
+  std::vector<uint8_t> keep;
+  if(discard)
+  {
+    keep.assign(m_instanceInfos.size(), 1); // instances added not from the scene (e.g. procedural meshes) always stay
+    for(const auto &inst : m_instIdBySourceId)
+      keep[inst.second] = 0;
+  }
+
+  for(auto inst : changes.InstancesGeom())
+  {
+    auto pMesh = m_meshBySourceId.find(inst.geomId);
+    if(pMesh == m_meshBySourceId.end())
+      continue;
+    const LiteMath::float4x4 matrix = MeshCopyMatrix(transpose ? LiteMath::transpose(inst.matrix) : inst.matrix, pMesh->second.meshMatrix);
+
+    auto pInst = m_instIdBySourceId.find(inst.instId);
+    if(pInst == m_instIdBySourceId.end())
+    {
+      m_instIdBySourceId[inst.instId] = InstanceMesh(pMesh->second.meshId, matrix);
+      if(discard)
+        keep.push_back(1);
+      delta.instancesChanged = true;
+      continue;
+    }
+
+    const uint32_t instId = pInst->second;
+    if(discard)
+      keep[instId] = 1;
+    if(m_instanceInfos[instId].mesh_id != pMesh->second.meshId)
+    {
+      m_instanceInfos[instId].mesh_id = pMesh->second.meshId;
+      delta.instancesChanged = true;
+    }
+    if(memcmp(&m_instanceMatrices[instId], &matrix, sizeof(matrix)) != 0)
+    {
+      SetInstanceMatrix(instId, matrix);
+      delta.movedInstances.push_back(instId);
+    }
+  }
+
+  // instances of changed meshes which are not listed in the change get the new versions too
+  if(!replacedMeshes.empty())
+  {
+    for(auto &info : m_instanceInfos)
+    {
+      auto pFound = replacedMeshes.find(info.mesh_id);
+      if(pFound != replacedMeshes.end())
+      {
+        info.mesh_id = pFound->second.first;
+        m_instanceMatrices[info.inst_id] = MeshCopyMatrix(m_instanceMatrices[info.inst_id], pFound->second.second);
+        delta.instancesChanged = true;
+      }
+    }
+  }
+
+  if(discard && std::find(keep.begin(), keep.end(), 0) != keep.end())
+  {
+    std::vector<uint32_t> newIds(m_instanceInfos.size(), uint32_t(-1));
+    uint32_t instNum = 0;
+    for(uint32_t i = 0; i < m_instanceInfos.size(); ++i)
+    {
+      if(!keep[i])
+        continue;
+      newIds[i] = instNum;
+      m_instanceInfos[instNum]               = m_instanceInfos[i];
+      m_instanceInfos[instNum].inst_id       = instNum;
+      m_instanceInfos[instNum].instBufOffset = instNum * sizeof(LiteMath::float4x4);
+      m_instanceMatrices[instNum]            = m_instanceMatrices[i];
+      ++instNum;
+    }
+    m_instanceInfos.resize(instNum);
+    m_instanceMatrices.resize(instNum);
+
+    for(auto it = m_instIdBySourceId.begin(); it != m_instIdBySourceId.end(); )
+    {
+      if(newIds[it->second] == uint32_t(-1))
+        it = m_instIdBySourceId.erase(it);
+      else
+      {
+        it->second = newIds[it->second];
+        ++it;
+      }
+    }
+    for(auto &instId : delta.movedInstances)
+      instId = newIds[instId];
+    delta.instancesChanged = true;
+  }
+
+  if(m_config.load_materials != MATERIAL_LOAD_MODE::NONE)
+  {
+    auto materialNodes = changes.MaterialNodes();
+    for(auto it = materialNodes.begin(); it != materialNodes.end(); ++it)
+    {
+      const uint32_t matId = it->attribute("id").as_uint();
+      if(matId >= m_materials.size())
+        m_materials.resize(matId + 1);
+      m_materials[matId] = MaterialFromHydra(*hydra_xml::MaterialIteratorGLTF(it));
+      delta.editedMaterials.push_back(matId);
+    }
+    if(!delta.editedMaterials.empty())
+      UpdateMaterialDataOnGPU(delta.editedMaterials);
+  }
+
+  auto cameraNodes = changes.CameraNodes();
+  for(auto it = cameraNodes.begin(); it != cameraNodes.end(); ++it)
+  {
+    const uint32_t camId = it->attribute("id").as_uint();
+    if(camId >= m_sceneCameras.size())
+      m_sceneCameras.resize(camId + 1);
+    m_sceneCameras[camId] = *hydra_xml::CamIterator(it);
+  }
+
+  // moved instances are updated in place, anything else needs the instance data and TLAS to be set up again
+  if(delta.instancesChanged || !delta.addedMeshes.empty())
+  {
+    m_dirtyInstances.clear();
+    m_instanceDirty.clear();
+    if(m_config.instance_matrix_as_vertex_attribute)
+      UpdateInstanceDataOnGPU();
+    if(m_useRTX)
+      BuildTLAS();
+  }
+  else
+    CommitInstanceTransforms();
+
+  if(m_config.debug_output)
+  {
+    std::cout << "[SceneManager::ApplySceneDelta]: " << delta.addedMeshes.size() << " meshes added, " << delta.movedInstances.size()
+              << " instances moved, " << delta.editedMaterials.size() << " materials edited" << std::endl;
+  }
+
+  if(a_pDelta != nullptr)
+    *a_pDelta = std::move(delta);
+  return true;
+}
+
 bool SceneManager::LoadSceneGLTF(const std::string &scenePath)
 {
+  if(LoadSceneCache(scenePath, false))
+    return true;
+
   tinygltf::Model gltfModel;
   tinygltf::TinyGLTF gltfContext;
   std::string error, warning;
@@ -180,7 +605,21 @@ bool SceneManager::LoadSceneGLTF(const std::string &scenePath)
   else
     sceneFolder = "./";
 
-  bool loaded = gltfContext.LoadASCIIFromFile(&gltfModel, &error, &warning, scenePath);
+  // binary glTF is parsed from a mapping of the file: LoadBinaryFromFile reads all of it to a temporary vector first
+  // (tinygltf still copies the binary chunk to the model buffer, accessors are read from there in place)
+  bool loaded = false;
+  const bool binary = scenePath.size() >= 4 && scenePath.compare(scenePath.size() - 4, 4, ".glb") == 0;
+  if(binary)
+  {
+    MappedFile glbFile;
+    if(glbFile.Open(scenePath) && glbFile.Size() <= size_t(std::numeric_limits<unsigned int>::max()))
+    {
+      glbFile.AdviseSequential();
+      loaded = gltfContext.LoadBinaryFromMemory(&gltfModel, &error, &warning, glbFile.Data(), (unsigned int)glbFile.Size(), sceneFolder);
+    }
+  }
+  else
+    loaded = gltfContext.LoadASCIIFromFile(&gltfModel, &error, &warning, scenePath);
 
   if(!loaded)
   {
@@ -214,7 +653,14 @@ bool SceneManager::LoadSceneGLTF(const std::string &scenePath)
 //
 //  }
 
-  m_pMeshData = std::make_shared<Mesh8F>();
+  m_pMeshData = std::make_shared<MeshData8F>(m_config.geometry_huge_pages);
+  m_pSplitData = nullptr;
+  std::vector<std::string> sourceFiles; // the scene cache is valid while these files are unchanged
+  for(const auto &buffer : gltfModel.buffers)
+  {
+    if(!buffer.uri.empty() && buffer.uri.compare(0, 5, "data:") != 0)
+      sourceFiles.push_back(sceneFolder + buffer.uri);
+  }
 
   uint32_t maxVertexCountPerMesh    = 0u;
   uint32_t maxPrimitiveCountPerMesh = 0u;
@@ -234,20 +680,105 @@ bool SceneManager::LoadSceneGLTF(const std::string &scenePath)
       totalPrimitiveCount     += indexNum / 3;
       totalMeshes++;
     }
+    CountProceduralMeshes(maxVertexCountPerMesh, maxPrimitiveCountPerMesh, totalVerticesCount, totalPrimitiveCount, totalMeshes);
 
     InitGeoBuffersGPU(totalMeshes, totalVerticesCount, totalPrimitiveCount * 3);
+    m_pMeshData->Reserve(totalVerticesCount, totalPrimitiveCount * 3);
+    m_matIDs.reserve(totalPrimitiveCount);
     if(m_config.build_acc_structs)
     {
       m_pBuilderV2->Init(maxVertexCountPerMesh, maxPrimitiveCountPerMesh, totalPrimitiveCount,
         m_pMeshData->SingleVertexSize(), m_config.build_acc_structs_while_loading_scene);
     }
 
-    std::unordered_map<int, uint32_t> loaded_meshes_to_meshId;
+    m_gltfAnimations = animationsFromGLTF(gltfModel);
+    m_gltfNodeParents.assign(gltfModel.nodes.size(), -1);
+    std::vector<GLTFInstance> instances;
     for(size_t i = 0; i < scene.nodes.size(); ++i)
     {
-      const tinygltf::Node node = gltfModel.nodes[scene.nodes[i]];
       auto identity = LiteMath::float4x4();
-      LoadGLTFNodesRecursive(gltfModel, node, identity, loaded_meshes_to_meshId);
+      CollectGLTFNodesRecursive(gltfModel, scene.nodes[i], -1, identity, instances);
+    }
+
+    // meshes get ids in the order of their first instance, as if they were loaded during traversal
+    std::vector<int> gltfMeshes;
+    std::vector<uint32_t> gltfVertexStart(1, 0), gltfIndexStart(1, 0);
+    std::unordered_map<int, uint32_t> loaded_meshes_to_meshId;
+    for(const auto &inst : instances)
+    {
+      if(!loaded_meshes_to_meshId.emplace(inst.mesh, uint32_t(-1)).second)
+        continue;
+      uint32_t vertNum = 0;
+      uint32_t indexNum = 0;
+      getNumVerticesAndIndicesFromGLTFMesh(gltfModel, gltfModel.meshes[inst.mesh], vertNum, indexNum);
+      if(vertNum == 0 || indexNum == 0)
+        continue;
+      gltfMeshes.push_back(inst.mesh);
+      gltfVertexStart.push_back(gltfVertexStart.back() + vertNum);
+      gltfIndexStart.push_back(gltfIndexStart.back() + indexNum);
+    }
+
+    // workers convert meshes straight to their place in the storage, the consumer only registers and uploads them
+    m_pMeshData->Extend(gltfVertexStart.back(), gltfIndexStart.back());
+    m_matIDs.resize(m_matIDs.size() + gltfIndexStart.back() / 3);
+    const uint32_t firstVertex = m_totalVertices;
+    const uint32_t firstIndex  = m_totalIndices;
+    float*    vertices   = m_pMeshData->VertexData() + size_t(firstVertex) * MeshData8F::FLOATS_PER_VERTEX;
+    uint32_t* indices    = m_pMeshData->IndexData() + firstIndex;
+    uint32_t* matIndices = m_matIDs.data() + firstIndex / 3;
+    std::unordered_map<int, LiteMath::float4x4> meshMatrices; // of glTF meshes which are moved copies of others
+
+    LoadMeshesPipelined<ConvertedMesh>(gltfMeshes.size(), m_config.loader_threads,
+      [&](size_t i)
+      {
+        ConvertedMesh mesh;
+        mesh.ok = convertGLTFMesh8F(gltfModel, gltfModel.meshes[gltfMeshes[i]],
+          vertices + size_t(gltfVertexStart[i]) * MeshData8F::FLOATS_PER_VERTEX, indices + gltfIndexStart[i],
+          matIndices + gltfIndexStart[i] / 3);
+        return mesh;
+      },
+      [&](size_t i, ConvertedMesh &mesh)
+      {
+        // workers write ahead of this mesh only, so it's safe to move it back over copies dropped before it
+        LiteMath::float4x4 meshMatrix;
+        auto meshId = AddMeshDeduplicated(firstVertex + gltfVertexStart[i], firstIndex + gltfIndexStart[i],
+          gltfVertexStart[i + 1] - gltfVertexStart[i], gltfIndexStart[i + 1] - gltfIndexStart[i], &meshMatrix);
+        if(mesh.ok)
+        {
+          loaded_meshes_to_meshId[gltfMeshes[i]] = meshId;
+          meshMatrices[gltfMeshes[i]] = meshMatrix;
+        }
+        else
+          std::cout << "[LoadSceneGLTF]: mesh " << gltfMeshes[i] << " has invalid data and won't be instanced" << std::endl;
+      });
+    m_pMeshData->Truncate(m_totalVertices, m_totalIndices);
+    m_matIDs.resize(m_totalIndices / 3);
+    m_dedupMeshes.clear();
+
+    for(const auto &inst : instances)
+    {
+      const uint32_t meshId = loaded_meshes_to_meshId[inst.mesh];
+      if(meshId != uint32_t(-1))
+      {
+        const LiteMath::float4x4 &meshMatrix = meshMatrices[inst.mesh];
+        const uint32_t instId = InstanceMesh(meshId, MeshCopyMatrix(inst.matrix, meshMatrix));
+        if(!m_gltfAnimations.empty())
+          m_gltfNodeInstances.push_back({inst.node, instId, meshMatrix});
+      }
+    }
+
+    // node hierarchy is needed only to play animations
+    if(m_gltfAnimations.empty())
+    {
+      m_gltfNodeParents.clear();
+      m_gltfNodeOrder.clear();
+    }
+    else
+    {
+      m_gltfNodes.resize(gltfModel.nodes.size());
+      for(size_t i = 0; i < gltfModel.nodes.size(); ++i)
+        m_gltfNodes[i] = nodeTransformFromGLTF(gltfModel.nodes[i]);
+      m_gltfNodeMatrices.resize(gltfModel.nodes.size());
     }
   }
 
@@ -274,12 +805,18 @@ bool SceneManager::LoadSceneGLTF(const std::string &scenePath)
         ss << "Texture at \"" << texturePath << "\" is absent or corrupted." ;
         vk_utils::logWarning(ss.str());
       }
+      else
+        sourceFiles.push_back(texturePath);
       m_textureInfos.push_back(texInfo);
     }
   }
 
+  if(m_gltfAnimations.empty()) // the cache has no node hierarchy to play animations
+    SaveSceneCache(scenePath, false, sourceFiles);
+
   if(m_config.load_geometry)
   {
+    LoadProceduralMeshes();
     LoadCommonGeoDataOnGPU();
   }
 
@@ -304,40 +841,33 @@ bool SceneManager::LoadSceneGLTF(const std::string &scenePath)
   return true;
 }
 
-void SceneManager::LoadGLTFNodesRecursive(const tinygltf::Model &a_model, const tinygltf::Node& a_node, const LiteMath::float4x4& a_parentMatrix,
-  std::unordered_map<int, uint32_t> &a_loadedMeshesToMeshId)
+void SceneManager::CollectGLTFNodesRecursive(const tinygltf::Model &a_model, int a_nodeId, int a_parentId, const LiteMath::float4x4& a_parentMatrix,
+  std::vector<GLTFInstance> &a_instances)
 {
-  auto nodeMatrix = a_parentMatrix * transformMatrixFromGLTFNode(a_node);
+  const tinygltf::Node &node = a_model.nodes[a_nodeId];
+  auto nodeMatrix = a_parentMatrix * transformMatrixFromGLTFNode(node);
+  m_gltfNodeParents[a_nodeId] = a_parentId;
+  m_gltfNodeOrder.push_back(a_nodeId);
 
-  for (size_t i = 0; i < a_node.children.size(); i++)
+  for (size_t i = 0; i < node.children.size(); i++)
   {
-    LoadGLTFNodesRecursive(a_model, a_model.nodes[a_node.children[i]], nodeMatrix, a_loadedMeshesToMeshId);
+    CollectGLTFNodesRecursive(a_model, node.children[i], a_nodeId, nodeMatrix, a_instances);
   }
 
-  if(a_node.mesh > -1)
+  if(node.mesh > -1)
   {
-    if(!a_loadedMeshesToMeshId.count(a_node.mesh))
-    {
-      const tinygltf::Mesh mesh = a_model.meshes[a_node.mesh];
-      auto simpleMesh           = simpleMeshFromGLTFMesh(a_model, mesh);
-
-      if(simpleMesh.VerticesNum() > 0)
-      {
-        auto meshId                         = AddMeshFromData(simpleMesh);
-        a_loadedMeshesToMeshId[a_node.mesh] = meshId;
-
-        if(m_config.debug_output)
-          std::cout << "Loading mesh # " << meshId << std::endl;
-
-        LoadOneMeshOnGPU(meshId);
+    a_instances.push_back({node.mesh, a_nodeId, nodeMatrix});
+  }
+}
 
-        if(m_config.build_acc_structs)
-        {
-          AddBLAS(meshId);
-        }
-      }
-    }
+void SceneManager::UploadMesh(uint32_t a_meshId)
+{
+  if(m_config.debug_output)
+    std::cout << "Loading mesh # " << a_meshId << std::endl;
 
-    InstanceMesh(a_loadedMeshesToMeshId[a_node.mesh], nodeMatrix);
+  LoadOneMeshOnGPU(a_meshId);
+  if(m_config.build_acc_structs)
+  {
+    AddBLAS(a_meshId);
   }
-}
\ No newline at end of file
+}
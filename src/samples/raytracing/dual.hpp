@@ -0,0 +1,79 @@
+#pragma once
+
+#include <LiteMath.h>
+#include <cmath>
+
+// Forward mode automatic differentiation for SDF gradients. 'dual' is a value together with its partial derivatives
+// by x, y and z of the point where SDF is evaluated, so one evaluation of an SDF templated on position type gives
+// both distance and normal. Comparisons use values only, derivatives follow the selected branch.
+namespace autodiff {
+    using LiteMath::float3;
+
+    struct dual {
+        float v;  // value
+        float3 d; // gradient
+
+        dual() = default;
+        dual(float a_value) : v(a_value), d(0.0f, 0.0f, 0.0f) {}
+        dual(float a_value, float3 a_grad) : v(a_value), d(a_grad) {}
+    };
+
+    inline dual operator+(dual a, dual b) { return {a.v + b.v, a.d + b.d}; }
+    inline dual operator-(dual a, dual b) { return {a.v - b.v, a.d - b.d}; }
+    inline dual operator*(dual a, dual b) { return {a.v * b.v, a.d * b.v + b.d * a.v}; }
+    inline dual operator/(dual a, dual b) { return {a.v / b.v, (a.d * b.v - b.d * a.v) / (b.v * b.v)}; }
+    inline dual operator-(dual a) { return {-a.v, float3(0.0f, 0.0f, 0.0f) - a.d}; }
+    inline dual& operator+=(dual& a, dual b) { a = a + b; return a; }
+    inline dual& operator-=(dual& a, dual b) { a = a - b; return a; }
+    inline dual& operator*=(dual& a, dual b) { a = a * b; return a; }
+
+    inline bool operator<(dual a, dual b)  { return a.v < b.v; }
+    inline bool operator>(dual a, dual b)  { return a.v > b.v; }
+    inline bool operator<=(dual a, dual b) { return a.v <= b.v; }
+    inline bool operator>=(dual a, dual b) { return a.v >= b.v; }
+
+    inline dual sqrt(dual a) {
+        const float s = std::sqrt(a.v);
+        return {s, s > 0.0f ? a.d * (0.5f / s) : float3(0.0f, 0.0f, 0.0f)};
+    }
+    inline dual abs(dual a) { return a.v < 0.0f ? -a : a; }
+    inline dual min(dual a, dual b) { return b.v < a.v ? b : a; }
+    inline dual max(dual a, dual b) { return b.v > a.v ? b : a; }
+    inline dual clamp(dual a, dual lo, dual hi) { return min(max(a, lo), hi); }
+    inline dual round(dual a) { return dual(std::round(a.v)); } // piecewise constant
+
+    // float3 of duals
+    struct dual3 {
+        dual x, y, z;
+
+        dual3() = default;
+        dual3(dual a_x, dual a_y, dual a_z) : x(a_x), y(a_y), z(a_z) {}
+        dual3(float3 a) : x(a.x), y(a.y), z(a.z) {}
+
+        dual& operator[](int i) { return i == 0 ? x : (i == 1 ? y : z); }
+        const dual& operator[](int i) const { return i == 0 ? x : (i == 1 ? y : z); }
+
+        // point where gradient is computed: derivatives are unit vectors
+        static dual3 variable(float3 p) {
+            return {dual(p.x, float3(1.0f, 0.0f, 0.0f)), dual(p.y, float3(0.0f, 1.0f, 0.0f)), dual(p.z, float3(0.0f, 0.0f, 1.0f))};
+        }
+        float3 value() const { return float3(x.v, y.v, z.v); }
+    };
+
+    inline dual3 operator+(const dual3& a, const dual3& b) { return {a.x + b.x, a.y + b.y, a.z + b.z}; }
+    inline dual3 operator-(const dual3& a, const dual3& b) { return {a.x - b.x, a.y - b.y, a.z - b.z}; }
+    inline dual3 operator*(const dual3& a, dual b) { return {a.x * b, a.y * b, a.z * b}; }
+    inline dual3 operator*(dual a, const dual3& b) { return {a * b.x, a * b.y, a * b.z}; }
+    inline dual3 operator/(const dual3& a, dual b) { return {a.x / b, a.y / b, a.z / b}; }
+    inline dual3& operator*=(dual3& a, dual b) { a = a * b; return a; }
+    inline dual3& operator-=(dual3& a, dual b) { a = {a.x - b, a.y - b, a.z - b}; return a; }
+
+    inline dual3 abs(const dual3& a) { return {abs(a.x), abs(a.y), abs(a.z)}; }
+    inline dual3 max(const dual3& a, const dual3& b) { return {max(a.x, b.x), max(a.y, b.y), max(a.z, b.z)}; }
+    inline dual3 min(const dual3& a, const dual3& b) { return {min(a.x, b.x), min(a.y, b.y), min(a.z, b.z)}; }
+    inline dual3 clamp(const dual3& a, const dual3& lo, const dual3& hi) { return min(max(a, lo), hi); }
+    inline dual3 clamp(const dual3& a, float lo, float hi) { return clamp(a, dual3(float3(lo, lo, lo)), dual3(float3(hi, hi, hi))); }
+
+    inline dual dot(const dual3& a, const dual3& b) { return a.x * b.x + a.y * b.y + a.z * b.z; }
+    inline dual length(const dual3& a) { return sqrt(dot(a, a)); }
+}
@@ -1,11 +1,21 @@
 #include "raytracing.h"
 #include "float.h"
 #include "fractals.hpp"
+#include "sdf_program.hpp"
+#include "sdf_brick_map.hpp"
+#include "sdf_bvh.hpp"
+#include "sdf_mesher.hpp"
+#include "sdf_mesh_baker.hpp"
+#include "sdf_packet.hpp"
 
 #include <cmath>
 #include <limits>
 #include <list>
 
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
 using namespace fractals;
 
 
@@ -14,110 +24,542 @@ static bool is_correct_hit(float3 hit) {
     return hit[0] != incorrect_val;
 }
 
-static std::vector<SDF_base*>& get_sdfs() {
-    static std::vector<SDF_base*> sdfs = {
-        //make_plane(0.0f, {{0.4f, 0.4f, 0.4f}, 0.2f}),
-        //make_fractal1({{1.0f, 0.5f, 0.2f}, 0.5f}),
-        make_fractal2({{1.0f, 0.5f, 0.2f}, 0.0f}),
-        //make_sphere({0.0f, 20.0f, 0.0f}, 8.0f, {{1.0f, 0.5f, 0.1f}, 0.1f}),
-        //make_repeating(7.0f, {3.0f, 5.0f, 5.0f}, make_sphere({0.0f, 0.0f, 0.0f}, 5.0f, {{0.0f, 1.0f, 0.2f}, 0.1f})),
-        //make_pyramid(0.1f, {{1.0f, 1.0f, 1.0f}, 0.2f}),
-        //make_octahedron({0.0f, -40.0f, 20.0f}, 5.0f, {{1.0f, 1.0f, 1.0f}, 0.1f}),
-        //make_octahedron_e({0.0f, -40.0f, -20.0f}, 5.0f, {{1.0f, 0.0f, 0.0f}, 0.9f})
+// scene objects; every object is compiled separately for acceleration structure and all of them together for ray marching
+static std::vector<sdf_node_ptr> make_sdf_scene() {
+    return {
+        //plane(0.0f, {{0.4f, 0.4f, 0.4f}, 0.2f}),
+        //sphere_grid({{1.0f, 0.5f, 0.2f}, 0.5f}),
+        // active object of the original sample: its make_fractal2 was this Sierpinski tetrahedron (fractal5),
+        // the Mandelbox (fractal2) was make_fractal3 and was not in the scene
+        sierpinski(30, 2.0f, {{1.0f, 0.5f, 0.2f}, 0.0f}),
+        //mandelbox({{1.0f, 0.5f, 0.2f}, 0.0f}),
+        //sphere({0.0f, 20.0f, 0.0f}, 8.0f, {{1.0f, 0.5f, 0.1f}, 0.1f}),
+        //repeat_limited(7.0f, {3.0f, 5.0f, 5.0f}, sphere({0.0f, 0.0f, 0.0f}, 5.0f, {{0.0f, 1.0f, 0.2f}, 0.1f})),
+        //pyramid(0.1f, {{1.0f, 1.0f, 1.0f}, 0.2f}),
+        //octahedron({0.0f, 40.0f, -20.0f}, 5.0f, {{1.0f, 1.0f, 1.0f}, 0.1f}),
+        //octahedron({0.0f, 40.0f, 20.0f}, 5.0f, {{1.0f, 0.0f, 0.0f}, 0.9f}, true),
+        //op_smooth_union(sphere({0.0f, 0.0f, 0.0f}, 1.0f, {{0.0f, 0.5f, 1.0f}, 0.0f}), box({1.0f, 0.0f, 0.0f}, {0.5f, 0.5f, 0.5f}, {{1.0f, 1.0f, 1.0f}, 0.0f}), 0.5f),
     };
+}
+
+struct sdf_scene {
+    std::vector<sdf_program> objects;
+    sdf_program combined; // union of all objects for the brick map
+    sdf_bvh bvh;          // over 'objects', for marching
+};
+
+static const sdf_scene& get_sdf_scene() {
+    static const sdf_scene scene = [] {
+        sdf_scene result;
+        sdf_node_ptr root;
+        for (auto& node : make_sdf_scene()) {
+            result.objects.push_back(compile(node));
+            root = root ? op_union(root, node) : node;
+        }
+        if (root) {
+            result.combined = compile(root);
+        }
+        // moving the vector out of the lambda keeps its storage, so BVH may refer to it
+        result.bvh.build(result.objects.data(), uint32_t(result.objects.size()));
+        return result;
+    }();
+    return scene;
+}
 
+// brick map of the combined scene, rebuilt by 'prepare_marching' when 'm_marching_cache' is set
+static sdf_brick_map& get_sdf_cache() {
+    static sdf_brick_map cache;
+    return cache;
+}
+
+// SDFs baked from scene manager meshes by 'bake_mesh_sdfs'; they occlude light in soft shadows and AO of marching mode
+struct mesh_sdf_instance {
+    uint32_t mesh_id;
+    float4x4 world_to_local;
+    float scale; // local distance to world distance, exact for rotation and uniform scale
+};
+
+struct mesh_sdf_set {
+    std::vector<sdf_brick_map> meshes;
+    std::vector<mesh_sdf_instance> instances;
+
+    float eval(float3 position) const {
+        float dist = INFINITY;
+        for (const auto& inst : instances) {
+            dist = std::min(dist, meshes[inst.mesh_id].eval(inst.world_to_local * position) * inst.scale);
+        }
+        return dist;
+    }
+};
+
+static mesh_sdf_set& get_mesh_sdfs() {
+    static mesh_sdf_set sdfs;
     return sdfs;
 }
 
-static std::pair<float, material> sdf_request(float3 position) {
-    material mat;
-    float dist = incorrect_val;
+// everything that blocks light: fractal objects and baked meshes
+static float occluder_distance(float3 position, float detail) {
+    return std::min(get_sdf_scene().bvh.eval(position, detail), get_mesh_sdfs().eval(position));
+}
+
+// penumbra from the closest approach of the shadow ray to occluders relative to the distance travelled,
+// one SDF lookup per step instead of many shadow rays to an area light; 'k' is the shadow sharpness
+static float soft_shadow(float3 pos, float3 dir, float t_start, float t_far, int steps, float min_dist, float detail, float k) {
+    float shadow = 1.0f;
+    float t = t_start;
+    for (int step = 0; step < steps && t < t_far; ++step) {
+        const float dist = occluder_distance(pos + dir * t, detail);
+        if (dist < min_dist) {
+            return 0.0f;
+        }
+        shadow = std::min(shadow, k * dist / t);
+        t += dist;
+    }
+    return shadow;
+}
+
+// a few samples along the normal: occluders closer than the sample distance darken the point
+static float ambient_occlusion(float3 pos, float3 normal, float radius, float detail) {
+    constexpr int samples = 5;
+    float occlusion = 0.0f;
+    float max_occlusion = 0.0f;
+    float weight = 1.0f;
+    for (int i = 1; i <= samples; ++i) {
+        const float h = radius * float(i) / float(samples);
+        occlusion += weight * std::max(h - occluder_distance(pos + normal * h, detail), 0.0f);
+        max_occlusion += weight * h;
+        weight *= 0.5f;
+    }
+    return 1.0f - std::min(occlusion / max_occlusion, 1.0f);
+}
+
+// distance used by marching: cached one while it is far from surface, exact SDF near surface (8-wide version is in sdf_packet.cpp)
+struct sdf_distance {
+    const sdf_bvh& sdf;
+    const sdf_brick_map* cache = nullptr;
 
-    auto& sdfs = get_sdfs();
-    for (auto& sdf : sdfs) {
-        float cur_dist = sdf->calc_distance(position);
-        if (cur_dist < dist) {
-            mat = sdf->get_material(position);
-            dist = cur_dist;
+    float eval(float3 position, float detail) const {
+        if (cache != nullptr) {
+            const float dist = cache->eval(position);
+            if (dist > cache->refine_distance()) {
+                return dist;
+            }
         }
+        return sdf.eval(position, detail);
     }
+};
 
+// pixel footprint along the ray is 'width + t * angle'; it is the detail size for fractals and the hit distance,
+// so distant surfaces are evaluated with fewer iterations and marching stops earlier
+struct pixel_cone {
+    float width = 0.0f;
+    float angle = 0.0f;
+};
 
-    return {dist, mat};
+static sdf_distance marching_distance(bool use_cache) {
+    const auto& cache = get_sdf_cache();
+    return {get_sdf_scene().bvh, use_cache && cache.is_valid() ? &cache : nullptr};
 }
 
-static float distance_at(float3 position) {
-    auto [dist, _] = sdf_request(position);
-    return dist;
+#if defined(RAYTRACING_AVX2)
+static bool cpu_has_avx2_fma() {
+#if defined(_MSC_VER)
+    int info[4];
+    __cpuid(info, 0);
+    if (info[0] < 7) {
+        return false;
+    }
+    __cpuid(info, 1);
+    const bool fma = (info[2] & (1 << 12)) != 0;
+    const bool os_saves_ymm = (info[2] & (1 << 27)) != 0 && (_xgetbv(0) & 6) == 6;
+    __cpuidex(info, 7, 0);
+    return fma && os_saves_ymm && (info[1] & (1 << 5)) != 0;
+#else
+    return __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+#endif
 }
+#endif
 
+// packet marching built with AVX2 runs only on CPUs which support it, others use the baseline build
+static march_packet8_func* select_march_packet8() {
+#if defined(RAYTRACING_AVX2)
+    if (cpu_has_avx2_fma()) {
+        return avx2::march_packet8;
+    }
+#endif
+    return SIMD8_ISA::march_packet8;
+}
 
-// from the doc
-static float3 EstimateNormal(float3 z, float eps = 0.00001f)
+// normal from the gradient of distance computed with dual numbers; the same evaluation gives material of the closest
+// primitive. Where gradient degenerates (e.g. inside of a fractal) it falls back to tetrahedral finite differences.
+static float3 EstimateNormal(const sdf_program& sdf, float3 z, uint32_t* out_material_id, float detail = 0.0f, float eps = 0.00001f)
 {
-        float3 z1 = z + float3(eps, 0, 0);
-        float3 z2 = z - float3(eps, 0, 0);
-        float3 z3 = z + float3(0, eps, 0);
-        float3 z4 = z - float3(0, eps, 0);
-        float3 z5 = z + float3(0, 0, eps);
-        float3 z6 = z - float3(0, 0, eps);
-        float dx = distance_at(z1) - distance_at(z2);
-        float dy = distance_at(z3) - distance_at(z4);
-        float dz = distance_at(z5) - distance_at(z6);
-        return normalize(float3(dx, dy, dz) / (2.0*eps));
+        float3 gradient;
+        sdf.eval_gradient(z, &gradient, out_material_id, detail);
+        const float grad_len = length(gradient);
+        if (std::isfinite(grad_len) && grad_len > 0.0f) {
+            return gradient / grad_len;
+        }
+
+        alignas(32) float x[simd::WIDTH] = {z.x + eps, z.x - eps, z.x - eps, z.x + eps, z.x, z.x, z.x, z.x};
+        alignas(32) float y[simd::WIDTH] = {z.y - eps, z.y - eps, z.y + eps, z.y + eps, z.y, z.y, z.y, z.y};
+        alignas(32) float w[simd::WIDTH] = {z.z - eps, z.z + eps, z.z - eps, z.z + eps, z.z, z.z, z.z, z.z};
+        alignas(32) float d[simd::WIDTH];
+        sdf.eval8({simd::float8::load(x), simd::float8::load(y), simd::float8::load(w)}, detail).store(d);
+        return normalize(float3(1.0f, -1.0f, -1.0f) * d[0] + float3(-1.0f, -1.0f, 1.0f) * d[1] +
+                         float3(-1.0f, 1.0f, -1.0f) * d[2] + float3(1.0f, 1.0f, 1.0f) * d[3]);
+}
+
+// enhanced sphere tracing: steps are 'relaxation' times longer than the safe distance while unbounding spheres
+// of consecutive points overlap; if they don't, the step may have jumped over surface, so it is taken back and
+// marching falls back to plain sphere tracing
+static bool march_ray(const sdf_distance& sdf, float3 ray_pos, float3 ray_dir, float t_start, float t_far, int steps, float min_dist, float relaxation,
+                      pixel_cone cone, float* out_t) {
+    float t = t_start;
+    float dist = sdf.eval(ray_pos + ray_dir * t, cone.width + t * cone.angle);
+    float omega = relaxation;
+    float step_len = dist * omega;
+    for (int step = 0; step < steps; ++step) {
+        t += step_len;
+        const float footprint = cone.width + t * cone.angle;
+        float next_dist = sdf.eval(ray_pos + ray_dir * t, footprint);
+        if (omega > 1.0f && next_dist + dist < step_len) {
+            t -= step_len;
+            omega = 1.0f;
+            step_len = dist;
+            continue;
+        }
+        dist = next_dist;
+        if (dist <= std::max(min_dist, footprint)) {
+            *out_t = t;
+            return true;
+        }
+        if (t >= t_far) {
+            return false;
+        }
+        step_len = dist * omega;
+    }
+    return false;
 }
 
-float3 RayTracer::trace_marching_pos(float3 ray_pos, float3 ray_dir, int steps, float min_dist) {
-    if (steps == 0) {
-        return {incorrect_val, incorrect_val, incorrect_val};
+// SDF objects registered in acceleration structure as user geometry; primitive id is an index in 'objects'
+struct sdf_geometry {
+    std::vector<const sdf_program*> objects;
+    int steps = 128;
+    float min_dist = 1.0e-3f;
+};
+
+static sdf_geometry& get_sdf_geometry() {
+    static sdf_geometry geometry;
+    return geometry;
+}
+
+// sphere tracing is limited to the part of the ray inside object bounding box
+static bool intersect_sdf(void* user_data, uint32_t prim_id, float4 pos_and_near, float4 dir_and_far, CRT_Hit* hit) {
+    auto* geometry = static_cast<sdf_geometry*>(user_data);
+    const sdf_program* sdf = geometry->objects[prim_id];
+
+    float3 pos = to_float3(pos_and_near);
+    float3 dir = to_float3(dir_and_far);
+    float t_enter = pos_and_near.w;
+    float t_exit = dir_and_far.w;
+    for (int i = 0; i < 3; ++i) {
+        float inv_dir = 1.0f / dir[i];
+        float t0 = (sdf->box_min[i] - geometry->min_dist - pos[i]) * inv_dir;
+        float t1 = (sdf->box_max[i] + geometry->min_dist - pos[i]) * inv_dir;
+        t_enter = std::max(t_enter, std::min(t0, t1));
+        t_exit = std::min(t_exit, std::max(t0, t1));
     }
-    auto [current_distance, _] = sdf_request(ray_pos);
-    auto new_pos = ray_pos + ray_dir * current_distance;
-    float new_distance = distance_at(new_pos);
-    if (new_distance <= min_dist) {
-        return new_pos;
+    if (t_enter > t_exit) {
+        return false;
     }
-    return trace_marching_pos(new_pos, ray_dir, steps - 1, min_dist);
+
+    float inv_dir_len = 1.0f / length(dir);
+    float t = t_enter;
+    for (int step = 0; step < geometry->steps && t <= t_exit; ++step) {
+        float3 p = pos + dir * t;
+        float dist = sdf->eval(p);
+        if (dist <= geometry->min_dist) {
+            uint32_t material_id = 0;
+            float3 normal = EstimateNormal(*sdf, p, &material_id);
+            hit->t = t;
+            hit->coords[0] = normal.x;
+            hit->coords[1] = normal.y;
+            hit->coords[2] = normal.z;
+            hit->coords[3] = float(material_id);
+            return true;
+        }
+        t += dist * inv_dir_len;
+    }
+    return false;
 }
 
-float3 RayTracer::trace_marching(float3 ray_pos, float3 ray_dir, float3 background_color, int steps, float min_dist, int depth) {
-    auto final_pos = trace_marching_pos(ray_pos, ray_dir, steps, min_dist);
-    if (!is_correct_hit(final_pos)) { 
-        int index = 1;
-        float u;
-        float v;
-        convert_xyz_to_cube_uv(ray_dir.x, ray_dir.y, ray_dir.z, &index, &u, &v);
-        if (index == -1) {
-            return background_color;
+uint32_t RayTracer::add_sdf_geometry(ISceneObject* a_pAccelStruct) {
+    auto& geometry = get_sdf_geometry();
+    geometry.objects.clear();
+
+    std::vector<float4> boxes;
+    for (auto& sdf : get_sdf_scene().objects) {
+        if (!sdf.is_bounded()) {
+            std::cout << "[RayTracer::add_sdf_geometry]: unbounded SDF is skipped, it is available only in ray marching mode" << std::endl;
+            continue;
+        }
+        geometry.objects.push_back(&sdf);
+        boxes.push_back(to_float4(sdf.box_min, 1.0f));
+        boxes.push_back(to_float4(sdf.box_max, 1.0f));
+    }
+
+    if (geometry.objects.empty()) {
+        return uint32_t(-1);
+    }
+    return a_pAccelStruct->AddGeom_User(boxes.data(), geometry.objects.size(), &intersect_sdf, &geometry);
+}
+
+bool RayTracer::polygonize_sdf_scene(int resolution, cmesh::SimpleMesh* out_mesh, std::vector<MaterialData_pbrMR>* out_materials) {
+    std::vector<sdf_mesh> meshes;
+    size_t vertices = 0;
+    size_t indices = 0;
+    out_materials->clear();
+    for (auto& sdf : get_sdf_scene().objects) {
+        if (!sdf.is_bounded()) {
+            std::cout << "[RayTracer::polygonize_sdf_scene]: unbounded SDF is skipped, it is available only in ray marching mode" << std::endl;
+            continue;
         }
-        return sample_from_image({u, v}, m_cubemap[index].first, m_cubemap[index].second);
+        // distance estimators of fractals are not signed, surface is taken one cell away from them
+        meshes.push_back(polygonize(sdf, resolution, 1.0f));
+        for (uint32_t& id : meshes.back().material_ids) {
+            id += uint32_t(out_materials->size());
+        }
+        for (auto& mat : sdf.materials) {
+            MaterialData_pbrMR data = {};
+            data.baseColor = to_float4(mat.color, 1.0f);
+            data.metallic = mat.metallic;
+            out_materials->push_back(data);
+        }
+        vertices += meshes.back().positions.size();
+        indices += meshes.back().indices.size();
+    }
+    if (indices == 0) {
+        return false;
+    }
+
+    *out_mesh = cmesh::SimpleMesh(int(vertices), int(indices));
+    size_t vertex_offset = 0;
+    size_t index_offset = 0;
+    for (auto& mesh : meshes) {
+        for (size_t i = 0; i < mesh.positions.size(); ++i) {
+            const size_t v = vertex_offset + i;
+            const float4 pos = to_float4(mesh.positions[i], 1.0f);
+            const float4 norm = to_float4(mesh.normals[i], 1.0f);
+            for (int k = 0; k < 4; ++k) {
+                out_mesh->vPos4f[v * 4 + k] = pos[k];
+                out_mesh->vNorm4f[v * 4 + k] = norm[k];
+                out_mesh->vTang4f[v * 4 + k] = 0.0f;
+            }
+            out_mesh->vTexCoord2f[v * 2 + 0] = 0.0f;
+            out_mesh->vTexCoord2f[v * 2 + 1] = 0.0f;
+        }
+        for (size_t i = 0; i < mesh.indices.size(); ++i) {
+            out_mesh->indices[index_offset + i] = uint32_t(vertex_offset + mesh.indices[i]);
+        }
+        for (size_t i = 0; i < mesh.material_ids.size(); ++i) {
+            out_mesh->matIndices[index_offset / 3 + i] = mesh.material_ids[i];
+        }
+        vertex_offset += mesh.positions.size();
+        index_offset += mesh.indices.size();
+    }
+    return true;
+}
+
+void RayTracer::bake_mesh_sdfs(int resolution) {
+    auto& sdfs = get_mesh_sdfs();
+    sdfs.meshes.clear();
+    sdfs.instances.clear();
+    if (!m_scene_manager) {
+        return;
+    }
+
+    auto mesh_data = m_scene_manager->GetMeshData();
+    auto split_data = m_scene_manager->GetSplitMeshData();
+    const size_t stride = mesh_data->SingleVertexSize() / sizeof(float);
+    sdfs.meshes.resize(m_scene_manager->MeshesNum());
+    std::vector<uint8_t> baked(sdfs.meshes.size(), 0);
+    for (uint32_t i = 0; i < m_scene_manager->MeshesNum(); ++i) {
+        const auto& info = m_scene_manager->GetMeshInfo(i);
+        std::vector<float4> positions(info.m_vertNum);
+        std::vector<uint32_t> indices;
+        const uint32_t* mesh_indices = nullptr;
+        if (split_data != nullptr && i < split_data->MeshesNum()) {
+            indices.resize(info.m_indNum);
+            split_data->DecodePositions(i, positions.data());
+            split_data->DecodeIndices(i, indices.data());
+            mesh_indices = indices.data();
+        } else {
+            auto vertices = reinterpret_cast<const float*>((const char*)mesh_data->VertexData() + info.m_vertexOffset * mesh_data->SingleVertexSize());
+            for (size_t v = 0; v < info.m_vertNum; ++v) {
+                positions[v] = float4(vertices[v * stride + 0], vertices[v * stride + 1], vertices[v * stride + 2], 1.0f);
+            }
+            mesh_indices = mesh_data->IndexData() + info.m_indexOffset;
+        }
+        baked[i] = bake_mesh_sdf(positions.data(), positions.size(), mesh_indices, info.m_indNum, resolution, &sdfs.meshes[i]);
+        if (!baked[i]) {
+            std::cout << "[RayTracer::bake_mesh_sdfs]: mesh " << i << " is skipped, it can't be baked" << std::endl;
+        }
+    }
+
+    for (uint32_t i = 0; i < m_scene_manager->InstancesNum(); ++i) {
+        const auto& info = m_scene_manager->GetInstanceInfo(i);
+        if (info.mesh_id >= baked.size() || !baked[info.mesh_id]) {
+            continue;
+        }
+        const float4x4 local_to_world = m_scene_manager->GetInstanceMatrix(info.inst_id);
+        const float scale = std::min(length(to_float3(local_to_world.get_col(0))),
+                                     std::min(length(to_float3(local_to_world.get_col(1))), length(to_float3(local_to_world.get_col(2)))));
+        sdfs.instances.push_back({info.mesh_id, LiteMath::inverse4x4(local_to_world), scale});
+    }
+}
+
+void RayTracer::update_sdf_geometry() {
+    auto& geometry = get_sdf_geometry();
+    geometry.steps = std::max(m_marching_steps, 1);
+    geometry.min_dist = m_min_matching_distance;
+}
+
+MaterialData_pbrMR RayTracer::get_sdf_material_data(const CRT_Hit& hit) {
+    MaterialData_pbrMR result = {};
+    auto& geometry = get_sdf_geometry();
+    if (hit.primId < geometry.objects.size()) {
+        auto& materials = geometry.objects[hit.primId]->materials;
+        auto mat = materials[std::min(size_t(hit.coords[3]), materials.size() - 1)];
+        result.baseColor = to_float4(mat.color, 1.0f);
+        result.metallic = mat.metallic;
+    }
+    return result;
+}
+
+float3 RayTracer::trace_marching_pos(float3 ray_pos, float3 ray_dir, int steps, float min_dist, float footprint) {
+    float t;
+    const pixel_cone cone = {footprint, m_pixel_angle * m_marching_lod};
+    if (march_ray(marching_distance(m_marching_cache), ray_pos, ray_dir, 0.0f, m_marching_max_distance, steps, min_dist, m_marching_relaxation, cone, &t)) {
+        return ray_pos + ray_dir * t;
+    }
+    return {incorrect_val, incorrect_val, incorrect_val};
+}
+
+void RayTracer::prepare_marching() {
+    const uint32_t tiles_x = (m_width + MARCHING_TILE_SIZE - 1) / MARCHING_TILE_SIZE;
+    const uint32_t tiles_y = (m_height + MARCHING_TILE_SIZE - 1) / MARCHING_TILE_SIZE;
+    m_marching_start.assign(size_t(tiles_x) * tiles_y, 0.0f);
+
+    // angle between eye rays of neighbour pixels at the center of the screen
+    LiteMath::float4 ray_pos, ray_dir0, ray_dir1;
+    kernel_InitEyeRay(m_width / 2, m_height / 2, &ray_pos, &ray_dir0, 0.5f, 0.5f);
+    kernel_InitEyeRay(m_width / 2, m_height / 2, &ray_pos, &ray_dir1, 1.5f, 0.5f);
+    m_pixel_angle = length(to_float3(ray_dir1) - to_float3(ray_dir0));
+    const float lod_angle = m_pixel_angle * m_marching_lod;
+
+    if (!m_marching_cache) {
+        get_sdf_cache().clear();
+    } else if (!get_sdf_cache().update(get_sdf_scene().objects, get_sdf_scene().combined, m_marching_cache_resolution)) {
+        std::cout << "[RayTracer::prepare_marching]: unbounded SDF scene can't be cached, brick map is disabled" << std::endl;
+        m_marching_cache = false;
+    }
+
+    if (!m_marching_prepass) {
+        return;
+    }
+
+    // one cone per tile contains all eye rays of its pixels (AA offsets move rays up to one pixel);
+    // cone is marched while unbounding spheres along its axis cover the whole cross section
+    const auto& sdf = get_sdf_scene().bvh;
+    const float3 cam_pos = to_float3(m_camPos);
+#pragma omp parallel for
+    for (int tile = 0; tile < int(m_marching_start.size()); ++tile) {
+        const uint32_t x0 = (uint32_t(tile) % tiles_x) * MARCHING_TILE_SIZE;
+        const uint32_t y0 = (uint32_t(tile) / tiles_x) * MARCHING_TILE_SIZE;
+        const float size = float(MARCHING_TILE_SIZE);
+
+        LiteMath::float4 ray_pos, ray_dir;
+        kernel_InitEyeRay(x0, y0, &ray_pos, &ray_dir, 0.5f * size, 0.5f * size);
+        const float3 axis = to_float3(ray_dir);
+        float cos_angle = 1.0f;
+        for (int corner = 0; corner < 4; ++corner) {
+            kernel_InitEyeRay(x0, y0, &ray_pos, &ray_dir, (corner & 1) ? size + 0.5f : -0.5f, (corner & 2) ? size + 0.5f : -0.5f);
+            cos_angle = std::min(cos_angle, dot(axis, to_float3(ray_dir)));
+        }
+        const float tan_angle = std::sqrt(std::max(1.0f - cos_angle * cos_angle, 0.0f)) / cos_angle;
+
+        float t = 0.0f;
+        for (int step = 0; step < m_marching_steps; ++step) {
+            // with LOD, rays stop up to one footprint before the exact surface, and coarse fractal levels differ from it
+            // by up to one more footprint
+            float clearance = sdf.eval(cam_pos + axis * t) - t * (tan_angle + 2.0f * lod_angle) - m_min_matching_distance;
+            if (clearance <= 0.0f || t >= m_marching_max_distance) {
+                break;
+            }
+            t += clearance / (1.0f + tan_angle);
+        }
+        // a point at distance 't' along any ray of the tile is inside the cleared part of the cone
+        m_marching_start[tile] = std::isfinite(t) ? t : 0.0f;
+    }
+}
+
+float3 RayTracer::marching_miss_color(float3 ray_dir, float3 background_color) {
+    int index = 1;
+    float u;
+    float v;
+    convert_xyz_to_cube_uv(ray_dir.x, ray_dir.y, ray_dir.z, &index, &u, &v);
+    if (index == -1) {
+        return background_color;
+    }
+    return sample_from_image({u, v}, m_cubemap[index].first, m_cubemap[index].second);
+}
+
+float3 RayTracer::trace_marching(float3 ray_pos, float3 ray_dir, float3 background_color, int steps, float min_dist, int depth, float footprint) {
+    auto final_pos = trace_marching_pos(ray_pos, ray_dir, steps, min_dist, footprint);
+    if (!is_correct_hit(final_pos)) { 
+        return marching_miss_color(ray_dir, background_color);
     }
 
     auto& hit_pos = final_pos;
-    auto normal = EstimateNormal(hit_pos);
+    // secondary rays continue the cone of the pixel
+    const float hit_footprint = footprint + LiteMath::length(hit_pos - ray_pos) * m_pixel_angle * m_marching_lod;
+    const auto& scene = get_sdf_scene();
+    const auto& sdf = scene.objects[scene.bvh.nearest(hit_pos, hit_footprint)];
+    uint32_t material_id = 0;
+    auto normal = EstimateNormal(sdf, hit_pos, &material_id, hit_footprint);
     auto reflection_dir = LiteMath::normalize(LiteMath::reflect(ray_dir, normal));
-    auto [distance, mat] = sdf_request(hit_pos);
+    auto mat = sdf.materials[material_id];
     auto base_color = mat.color;
     float3 result_color(0.0f, 0.0f, 0.0f);
 
     if (mat.metallic > 0.0f && depth > 0) {
-        result_color += mat.metallic * trace_marching(hit_pos, reflection_dir, background_color, steps, min_dist, depth - 1);
+        result_color += mat.metallic * trace_marching(hit_pos, reflection_dir, background_color, steps, min_dist, depth - 1, hit_footprint);
     }
 
     if (mat.metallic >= 1.0f) {
         return result_color;
     }
 
+    const float ao = m_marching_ao ? ambient_occlusion(hit_pos, normal, m_ao_radius, hit_footprint) : 1.0f;
     for (auto& light : m_lights) {
         auto dir_to_light = light->getDirectionFrom(hit_pos);
         auto dist_to_light = light->getDistanceFrom(hit_pos);
-        auto light_position = hit_pos + dist_to_light * dir_to_light;
-        auto light_hit_pos = trace_marching_pos(hit_pos, dir_to_light, steps, min_dist);
-        auto light_hit_distance = LiteMath::length(light_hit_pos - hit_pos);
-        // dist to directional is always at inf distance
-        if (!is_correct_hit(light_hit_pos) || light_hit_distance >= dist_to_light) {
+        float shadow = 1.0f;
+        if (m_marching_soft_shadows) {
+            // start above the surface, where the surface itself doesn't count as an occluder
+            const float offset = 2.0f * std::max(min_dist, hit_footprint);
+            shadow = soft_shadow(hit_pos + normal * offset, dir_to_light, offset, std::min(dist_to_light, m_marching_max_distance),
+                                 steps, min_dist, hit_footprint, m_soft_shadow_sharpness);
+        } else {
+            auto light_hit_pos = trace_marching_pos(hit_pos, dir_to_light, steps, min_dist, hit_footprint);
+            auto light_hit_distance = LiteMath::length(light_hit_pos - hit_pos);
+            // dist to directional is always at inf distance
+            shadow = !is_correct_hit(light_hit_pos) || light_hit_distance >= dist_to_light ? 1.0f : 0.0f;
+        }
+        if (shadow > 0.0f) {
             auto light_color = light->getColor();
-            result_color += calc_light_impact(
+            result_color += shadow * ao * calc_light_impact(
                 dir_to_light, 
                 dist_to_light,
                 reflection_dir,
@@ -135,4 +577,107 @@ float3 RayTracer::trace_marching(float3 ray_pos, float3 ray_dir, float3 backgrou
     return result_color;
 }
 
+void RayTracer::trace_marching8(const float3* ray_pos, const float3* ray_dir, float t_start, float3 background_color, int steps, float min_dist, int depth, float3* out_color) {
+    using simd::WIDTH;
+    static march_packet8_func* const march_packet8 = select_march_packet8();
+    const auto& scene = get_sdf_scene();
+    const sdf_distance distance = marching_distance(m_marching_cache);
+
+    const float lod_angle = m_pixel_angle * m_marching_lod;
+    const packet_march params = {&distance.sdf, distance.cache, steps, min_dist, m_marching_relaxation, lod_angle};
 
+    float t_near[WIDTH], t_far[WIDTH], cone_width[WIDTH], t[WIDTH];
+    for (int i = 0; i < WIDTH; ++i) {
+        t_near[i] = t_start;
+        t_far[i] = m_marching_max_distance;
+        cone_width[i] = 0.0f;
+    }
+    const int hit_bits = march_packet8(params, ray_pos, ray_dir, t_near, t_far, cone_width, (1 << WIDTH) - 1, t);
+
+    // shading and reflections are scalar; shadow rays of all lanes are marched as one more packet
+    LightInfo* light = m_lights.empty() ? nullptr : m_lights.front(); // same as 'trace_marching': only the first light for now
+    float3 hit_pos[WIDTH], normal[WIDTH], reflection_dir[WIDTH], dir_to_light[WIDTH];
+    float dist_to_light[WIDTH], shadow_far[WIDTH], hit_footprint[WIDTH], ao[WIDTH];
+    material mat[WIDTH];
+    int shadow_bits = 0;
+    for (int i = 0; i < WIDTH; ++i) {
+        // lanes without shadow ray still go through shadow packet, so keep their data finite
+        hit_pos[i] = ray_pos[i];
+        dir_to_light[i] = ray_dir[i];
+        dist_to_light[i] = 0.0f;
+        shadow_far[i] = 0.0f;
+        hit_footprint[i] = 0.0f;
+        ao[i] = 1.0f;
+        if (((hit_bits >> i) & 1) == 0) {
+            out_color[i] = marching_miss_color(ray_dir[i], background_color);
+            continue;
+        }
+
+        hit_pos[i] = ray_pos[i] + ray_dir[i] * t[i];
+        hit_footprint[i] = t[i] * lod_angle;
+        const auto& sdf = scene.objects[scene.bvh.nearest(hit_pos[i], hit_footprint[i])];
+        uint32_t material_id = 0;
+        normal[i] = EstimateNormal(sdf, hit_pos[i], &material_id, hit_footprint[i]);
+        reflection_dir[i] = LiteMath::normalize(LiteMath::reflect(ray_dir[i], normal[i]));
+        mat[i] = sdf.materials[material_id];
+        out_color[i] = float3(0.0f, 0.0f, 0.0f);
+
+        if (mat[i].metallic > 0.0f && depth > 0) {
+            out_color[i] += mat[i].metallic * trace_marching(hit_pos[i], reflection_dir[i], background_color, steps, min_dist, depth - 1, hit_footprint[i]);
+        }
+        if (mat[i].metallic >= 1.0f || light == nullptr) {
+            continue;
+        }
+        if (m_marching_ao) {
+            ao[i] = ambient_occlusion(hit_pos[i], normal[i], m_ao_radius, hit_footprint[i]);
+        }
+        dir_to_light[i] = light->getDirectionFrom(hit_pos[i]);
+        dist_to_light[i] = light->getDistanceFrom(hit_pos[i]);
+        shadow_far[i] = std::min(dist_to_light[i], m_marching_max_distance);
+        if (!m_marching_soft_shadows) {
+            shadow_bits |= 1 << i;
+            continue;
+        }
+        // soft shadows are scalar: their marching doesn't stop at the first hit, so lanes diverge anyway
+        const float offset = 2.0f * std::max(min_dist, hit_footprint[i]);
+        const float shadow = soft_shadow(hit_pos[i] + normal[i] * offset, dir_to_light[i], offset, shadow_far[i], steps, min_dist,
+                                         hit_footprint[i], m_soft_shadow_sharpness);
+        if (shadow > 0.0f) {
+            out_color[i] += shadow * ao[i] * calc_light_impact(
+                dir_to_light[i],
+                dist_to_light[i],
+                reflection_dir[i],
+                normal[i],
+                ray_dir[i],
+                mat[i].color,
+                light->getColor(),
+                mat[i].metallic
+            );
+        }
+    }
+
+    if (shadow_bits == 0) {
+        return;
+    }
+
+    float shadow_near[WIDTH] = {}, t_light[WIDTH];
+    const int blocked_bits = march_packet8(params, hit_pos, dir_to_light, shadow_near, shadow_far, hit_footprint, shadow_bits, t_light);
+    for (int i = 0; i < WIDTH; ++i) {
+        if (((shadow_bits >> i) & 1) == 0) {
+            continue;
+        }
+        // dist to directional is always at inf distance
+        if (((blocked_bits >> i) & 1) == 0 || t_light[i] >= dist_to_light[i]) {
+            out_color[i] += ao[i] * calc_light_impact(
+                dir_to_light[i],
+                dist_to_light[i],
+                reflection_dir[i],
+                normal[i],
+                ray_dir[i],
+                mat[i].color,
+                light->getColor(),
+                mat[i].metallic
+            );
+        }
+    }
+}
@@ -1,57 +1,29 @@
 #pragma once
 
 #include <LiteMath.h>
+#include <cmath>
 
 
+// distance functions which are templates on position type are evaluated both with float3 and with dual3 (see dual.hpp)
 namespace fractals {
+    using namespace LiteMath;
+
     struct material {
         float3 color = {0.0f, 0.0f, 0.0f};
         float metallic = 0.0f;
     };
 
-    struct SDF_base {
-        virtual float calc_distance(float3 position) = 0;
-        virtual material get_material(float3 position) = 0;
-        virtual ~SDF_base() = default;
-    };
-
-    template<typename Functor>
-    struct SDF: public SDF_base {
-        SDF(Functor f, material m): m_dist_impl(std::move(f)), m_material(std::move(m)) {}
-
-        float calc_distance(float3 position) override {
-            return m_dist_impl(position);
-        }
-        material get_material(float3 position) override {
-            return m_material;
-        }
-
-        Functor m_dist_impl;
-        material m_material;
-    };
-
-    
-    float sdPlane(float3 position, float height) {
+    template<typename V>
+    inline auto sdPlane(V position, float height) {
         return abs(position.y);
     }
 
-    SDF_base* make_plane(float height, material mat) {
-        auto this_sdf = [=](float3 position) {
-            return sdPlane(position, height);
-        };
-        return new SDF<decltype(this_sdf)>( this_sdf, mat );
-    }
-
-    float sdSphere(float3 position, float3 sphere_pos, float sphere_radius) {
-        return LiteMath::length(sphere_pos - position) -  sphere_radius;
-    }
-
-    SDF_base* make_sphere(float3 sphere_pos, float sphere_radius, material mat) {
-        auto this_sphere = [=](float3 position) { return sdSphere(position, sphere_pos, sphere_radius); };
-        return new SDF<decltype(this_sphere)>( this_sphere, mat );
+    template<typename V, typename C>
+    inline auto sdSphere(V position, C sphere_pos, float sphere_radius) {
+        return length(sphere_pos - position) -  sphere_radius;
     }
 
-    float sdPyramid( float3 p, float h) {
+    inline float sdPyramid( float3 p, float h) {
       float m2 = h*h + 0.25f;
        
       float2 pxz = {p.x, p.z};
@@ -73,18 +45,14 @@ namespace fractals {
       return sqrt( (d2+q.z*q.z)/m2 ) * sign(max(q.z,-p.y));
     }
 
-    SDF_base* make_pyramid(float h, material mat) {
-        auto this_sdf = [=](float3 position) { return sdPyramid(position, h); };
-        return new SDF<decltype(this_sdf)>( this_sdf, mat );
-    }
-
-    float sdOctahedron( float3 p, float s)
+    template<typename V>
+    inline auto sdOctahedron( V p, float s)
     {
         p = abs(p);
-        return (p.x+p.y+p.z-s)*0.57735027;
+        return (p.x+p.y+p.z-s)*0.57735027f;
     }
 
-    float sdOctahedron_exact( float3 p, float s)
+    inline float sdOctahedron_exact( float3 p, float s)
     {
       p = abs(p);
       float m = p.x+p.y+p.z-s;
@@ -98,29 +66,31 @@ namespace fractals {
       return length(float3(q.x,q.y-s+k,q.z-k));
     }
 
-    SDF_base* make_octahedron(float3 oct_pos, float s, material mat) {
-        auto this_sdf = [=](float3 position) { return sdOctahedron(position + oct_pos, s); };
-        return new SDF<decltype(this_sdf)>( this_sdf, mat );
-    }
-    SDF_base* make_octahedron_e(float3 oct_pos, float s, material mat, bool exact=false) {
-        auto this_sdf_e = [=](float3 position) { return sdOctahedron_exact(position + oct_pos, s); };
-        return new SDF<decltype(this_sdf_e)>( this_sdf_e, mat );
+    template<typename V>
+    inline auto sdBox(V p, float3 half_size)
+    {
+        V q = abs(p) - half_size;
+        return length(max(q, V(float3(0.0f, 0.0f, 0.0f)))) + min(max(q.x, max(q.y, q.z)), decltype(q.x)(0.0f));
     }
 
-    float opRepLim( float3 p, float c, float3 l, SDF_base* sdf )
+    // domain repetition: returns position inside the cell; 'l' limits number of repetitions in each direction
+    template<typename V>
+    inline V opRepLim( V p, float c, float3 l )
     {
-        float3 div = p / c;
+        V div = p / c;
         for (int i = 0; i < 3; ++i) div[i] = round(div[i]);
-        float3 q = p-c*clamp(div,float3(0.0f, 0.0f, 0.0f)-l,l);
-        return sdf->calc_distance( q );
+        return p-c*clamp(div,V(float3(0.0f, 0.0f, 0.0f)-l),V(l));
     }
 
-    SDF_base* make_repeating(float distance, float3 repetitions, SDF_base* sdf) {
-        auto this_sdf = [=](float3 position) { return opRepLim(position, distance, repetitions, sdf); };
-        return new SDF<decltype(this_sdf)>( this_sdf, sdf->get_material({0.0f, 0.0f, 0.0f}) );
+    template<typename V>
+    inline V opRep( V p, float c )
+    {
+        V div = p / c;
+        for (int i = 0; i < 3; ++i) div[i] = round(div[i]);
+        return p-c*div;
     }
 
-    float fractal1( float3 p ) {
+    inline float fractal1( float3 p ) {
         float x3 = p.x*p.x*p.x;
         float x2 = p.x*p.x;
         float x = p.x;
@@ -141,13 +111,14 @@ namespace fractals {
         return v1*v1 + v2*v2 + v3*v3 - v4*v4*v4;
     }
 
-    void sphereFold(float3& z, float& dz) {
+    template<typename V, typename S>
+    inline void sphereFold(V& z, S& dz) {
         float r = 1.0f;
         float minRadius2 = 1.0f;
         float fixedRadius2 = 1.0f;
         
 
-        float r2 = dot(z,z);
+        S r2 = dot(z,z);
         if (r<minRadius2) { 
             // linear inner scaling
             float temp = (fixedRadius2/minRadius2);
@@ -155,21 +126,32 @@ namespace fractals {
             dz*= temp;
         } else if (r2<fixedRadius2) { 
             // this is the actual sphere inversion
-            float temp =(fixedRadius2/r2);
+            S temp =(fixedRadius2/r2);
             z *= temp;
             dz*= temp;
         }
     }
 
-    void boxFold(float3& z, float& dz) {
+    template<typename V, typename S>
+    inline void boxFold(V& z, S& dz) {
         float foldingLimit = 10.0f;
-        z = clamp(z, -foldingLimit, foldingLimit) * 2.0 - z;
+        z = clamp(z, -foldingLimit, foldingLimit) * 2.0f - z;
     }
 
-    float fractal2 (float3 z) {
-        float3 offset = z;
-        float dr = 1.0f;
-        int Iterations = 30;
+    // number of iterations after which details of a fractal (of 'size' at the first iteration, 'scale' times smaller
+    // at every next one) become smaller than 'detail'; further iterations change distance less than the detail size
+    inline int lod_iterations(int max_iterations, float scale, float size, float detail) {
+        if (!(detail > 0.0f) || scale <= 1.0f) {
+            return max_iterations;
+        }
+        int n = int(std::ceil(std::log(size / detail) / std::log(scale)));
+        return n < 1 ? 1 : (n > max_iterations ? max_iterations : n);
+    }
+
+    template<typename V>
+    inline auto fractal2 (V z, int Iterations = 30) {
+        V offset = z;
+        decltype(dot(z, z)) dr = 1.0f;
         float Scale = 2.0f;
         for (int n = 0; n < Iterations; n++) {
             boxFold(z,dr);       // Reflect
@@ -178,12 +160,12 @@ namespace fractals {
                     z=Scale*z + offset;  // Scale & Translate
                     dr = dr*abs(Scale)+1.0f;
         }
-        float r = length(z);
+        auto r = length(z);
         return r/abs(dr);
     
     }
 
-    float fractal3 (float3 pos) {
+    inline float fractal3 (float3 pos) {
         float scale = 1.0f;
         float DEfactor = scale;
 
@@ -234,11 +216,12 @@ namespace fractals {
         return sqrt(x*x+y*y+z*z)/abs(DEfactor);
     }
 
-    float fractal4(float3 p, int iterations = 3) {
+    inline float fractal4(float3 p, int iterations = 3) {
         return sdPyramid( p, 1.0f);
     }
 
-    float fractal5 (float3 z, int Iterations = 30, float Scale = 2.0f) {
+    template<typename V>
+    inline auto fractal5 (V z, int Iterations = 30, float Scale = 2.0f) {
         // create a simple tetrahedron
         float3 a1 = float3(1.0f, 1.0f, 1.0f);
         float3 a2 = float3(-1.0f, -1.0f, 1.0f);
@@ -246,7 +229,7 @@ namespace fractals {
         float3 a4 = float3(-1.0f,1.0f,-1.0f);
         float3 c;
         int n = 0;
-        float dist, d;
+        decltype(length(z)) dist, d;
         while (n < Iterations) {
              // choose point, closest to the position
              c = a1; dist = length(z-a1);
@@ -261,7 +244,8 @@ namespace fractals {
 
     }
 
-    float infinite_spheres(float3 z)
+    template<typename V>
+    inline auto infinite_spheres(V z)
     {
       auto copy = z;
       copy.x = round(z.x);
@@ -270,17 +254,4 @@ namespace fractals {
       return sdSphere(z, copy, 0.3f);
     }
 
-    SDF_base* make_fractal1(material mat) {
-        auto this_sdf = [](float3 position) { return infinite_spheres(position); };
-        return new SDF<decltype(this_sdf)>( this_sdf, mat );
-    }
-    SDF_base* make_fractal2(material mat) {
-        auto this_sdf = [](float3 position) { return fractal5(position); };
-        return new SDF<decltype(this_sdf)>( this_sdf, mat );
-    }
-    SDF_base* make_fractal3(material mat) {
-        auto this_sdf = [](float3 position) { return fractal2(position); };
-        return new SDF<decltype(this_sdf)>( this_sdf, mat );
-    }
-
 }
@@ -1,5 +1,6 @@
 #include "raytracing.h"
 #include "float.h"
+#include "simd8.hpp"
 
 #include <iostream>
 #include <cmath>
@@ -110,6 +111,37 @@ void RayTracer::CastAARays(uint32_t tidX, uint32_t tidY, uint32_t* out_color, in
   out_color[color_index] = create_color(final_color[0], final_color[1], final_color[2]);
 }
 
+void RayTracer::CastAARays8(uint32_t tidX, uint32_t tidY, uint32_t* out_color, int num_aa_rays) {
+  // pixels past the right border repeat the last one, their results are dropped
+  const uint32_t lanes = std::min(uint32_t(simd::WIDTH), m_width - tidX);
+  float3 ray_pos[simd::WIDTH], ray_dir[simd::WIDTH], color[simd::WIDTH];
+  float3 final_color[simd::WIDTH];
+  const size_t tile = (tidY / MARCHING_TILE_SIZE) * ((m_width + MARCHING_TILE_SIZE - 1) / MARCHING_TILE_SIZE) + tidX / MARCHING_TILE_SIZE;
+  const float t_start = tile < m_marching_start.size() ? m_marching_start[tile] : 0.0f;
+  for (uint32_t lane = 0; lane < simd::WIDTH; ++lane) {
+      final_color[lane] = {0.0f, 0.0f, 0.0f};
+  }
+  for (int i = 0; i < num_aa_rays; ++i) {
+      for (uint32_t lane = 0; lane < simd::WIDTH; ++lane) {
+          float offset_x = random_double();
+          float offset_y = random_double();
+          LiteMath::float4 rayPosAndNear, rayDirAndFar;
+          kernel_InitEyeRay(tidX + std::min(lane, lanes - 1), tidY, &rayPosAndNear, &rayDirAndFar, offset_x, offset_y);
+          ray_pos[lane] = to_float3(rayPosAndNear);
+          ray_dir[lane] = to_float3(rayDirAndFar);
+      }
+      trace_marching8(ray_pos, ray_dir, t_start, m_background_color, m_marching_steps, m_min_matching_distance, m_reflection_depth, color);
+      // same quantization and channel order as 'kernel_RayTrace' followed by averaging in 'CastAARays'
+      for (uint32_t lane = 0; lane < lanes; ++lane) {
+          final_color[lane] += destruct_color(create_color(color[lane][2], color[lane][1], color[lane][0]));
+      }
+  }
+  for (uint32_t lane = 0; lane < lanes; ++lane) {
+      final_color[lane] /= float(num_aa_rays);
+      out_color[tidY * m_width + tidX + lane] = create_color(final_color[lane][0], final_color[lane][1], final_color[lane][2]);
+  }
+}
+
 void RayTracer::kernel_InitEyeRay(uint32_t tidX, uint32_t tidY, LiteMath::float4* rayPosAndNear, LiteMath::float4* rayDirAndFar, float offset_x, float offset_y)
 {
   *rayPosAndNear = m_camPos; // to_float4(m_camPos, 1.0f);
@@ -120,10 +152,15 @@ void RayTracer::kernel_InitEyeRay(uint32_t tidX, uint32_t tidY, LiteMath::float4
 
 const MaterialData_pbrMR& RayTracer::get_material_data(const CRT_Hit& hit) {
 
-    if (m_scene_manager->m_materials.empty()) {
+    // only triangle meshes have materials in scene manager
+    if (m_scene_manager->m_materials.empty() || CRT_GeomType(hit.geomId) != CRT_GEOM_TRIANGLES) {
         static MaterialData_pbrMR fake_material = {};
         return fake_material;
     }
+    auto split_data = m_scene_manager->GetSplitMeshData();
+    if (split_data != nullptr && hit.geomId < split_data->MeshesNum()) {
+        return m_scene_manager->m_materials[split_data->MaterialId(hit.geomId, hit.primId)];
+    }
     auto mesh_info = m_scene_manager->GetMeshInfo(hit.geomId);
     uint32_t mat_id = m_scene_manager->m_matIDs[mesh_info.m_indexOffset / 3 + hit.primId];
 
@@ -157,42 +194,39 @@ float3 RayTracer::calc_light_impact(
     return result_color;
 }
 
-// from "resources/shaders/unpack_attributes.h"
-float3 DecodeNormal(uint32_t a_data)
-{
-  const uint32_t a_enc_x = (a_data  & 0x0000FFFFu);
-  const uint32_t a_enc_y = ((a_data & 0xFFFF0000u) >> 16);
-  const float sign   = (a_enc_x & 0x0001u) != 0 ? -1.0f : 1.0f;
-
-  const int usX = int(a_enc_x & 0x0000FFFEu);
-  const int usY = int(a_enc_y & 0x0000FFFFu);
-
-  const int sX  = (usX <= 32767) ? usX : usX - 65536;
-  const int sY  = (usY <= 32767) ? usY : usY - 65536;
-
-  const float x = sX*(1.0f / 32767.0f);
-  const float y = sY*(1.0f / 32767.0f);
-  const float z = sign*sqrt(max(1.0f - x*x - y*y, 0.0f));
-
-  return float3(x, y, z);
-}
-
-//TODO: test
 float3 RayTracer::get_normal_from_hit(const CRT_Hit& hit) {
 
     using namespace LiteMath;
-    const auto& mesh_info = m_scene_manager->GetMeshInfo(hit.geomId);
-
-    auto mesh_data = m_scene_manager->GetMeshData();
-    auto offset = 3 * hit.primId + mesh_info.m_indexOffset;
+    if (CRT_GeomType(hit.geomId) != CRT_GEOM_TRIANGLES) {
+        // analytic primitives store object space geometry normal in coords; instances added outside of scene manager have identity matrix
+        float3 object_normal = float3(hit.coords[0], hit.coords[1], hit.coords[2]);
+        if (hit.instId >= m_scene_manager->InstancesNum()) {
+            return normalize(object_normal);
+        }
+        auto instance_matrix = m_scene_manager->GetInstanceMatrix(hit.instId);
+        auto inversed = transpose(inverse4x4(instance_matrix));
+        return normalize(to_float3(inversed * to_float4(object_normal, 0.0f)));
+    }
 
     float3 final_normal = {0.0f, 0.0f, 0.0f};
 
-    for (size_t i = 0; i < 3; ++i) {
-        uint32_t ii = mesh_data->IndexData()[offset + i];
-        float* v = &(mesh_data->VertexData()[(mesh_info.m_vertexOffset + ii) * 8]);
-        float3 normal = DecodeNormal(v[3]);
-        final_normal += normal * hit.coords[3 - i];   
+    // split streams are read when scene manager keeps them: 4 bytes of normal per vertex instead of whole interleaved vertex
+    auto split_data = m_scene_manager->GetSplitMeshData();
+    if (split_data != nullptr && hit.geomId < split_data->MeshesNum()) {
+        for (uint32_t i = 0; i < 3; ++i) {
+            uint32_t ii = split_data->Index(hit.geomId, 3 * hit.primId + i);
+            final_normal += split_data->Normal(hit.geomId, ii) * hit.coords[3 - i];
+        }
+    } else {
+        const auto& mesh_info = m_scene_manager->GetMeshInfo(hit.geomId);
+        auto mesh_data = m_scene_manager->GetMeshData();
+        auto offset = 3 * hit.primId + mesh_info.m_indexOffset;
+        for (size_t i = 0; i < 3; ++i) {
+            uint32_t ii = mesh_data->IndexData()[offset + i];
+            float* v = &(mesh_data->VertexData()[(mesh_info.m_vertexOffset + ii) * MeshData8F::FLOATS_PER_VERTEX]);
+            float3 normal = MeshData8F::DecodeNormal(v[3]);
+            final_normal += normal * hit.coords[3 - i];
+        }
     }
     auto instance_matrix = m_scene_manager->GetInstanceMatrix(hit.instId);
     auto inversed = transpose(inverse4x4(instance_matrix));
@@ -203,8 +237,8 @@ float3 RayTracer::get_normal_from_hit(const CRT_Hit& hit) {
 }
 
 
-float3 RayTracer::trace(float4 rayPos, float4 rayDir, float3 background_color, int depth, int diffuse_spread) {
-    CRT_Hit hit = m_pAccelStruct->RayQuery_NearestHit(rayPos, rayDir);
+float3 RayTracer::trace(float4 rayPos, float4 rayDir, float3 background_color, int depth, int diffuse_spread, uint32_t ray_mask) {
+    CRT_Hit hit = m_pAccelStruct->RayQuery_NearestHit(rayPos, rayDir, ray_mask);
 
     if (hit.instId == uint32_t(-1)) {
         int index = 1;
@@ -222,20 +256,25 @@ float3 RayTracer::trace(float4 rayPos, float4 rayDir, float3 background_color, i
     auto material = get_material_data(hit);
     auto result_color = LiteMath::float3{0.0f, 0.0f, 0.0f};
     auto base_color = destruct_color(m_palette[hit.instId % palette_size]);
-    int glass_id = 2;
-    int metal_id = 1;
-    bool is_glass = hit.instId == glass_id;
-    bool is_metal = hit.instId == metal_id;
+    bool is_glass = is_transparent_material(material);
+    bool is_metal = is_mirror_material(material);
     float refraction = is_glass ? 0.9f : 0.01f;
-    material.metallic = 0.5f * random_double() * random_double(); //hit.instId % 3 == 0 ? 1.0f : 0.0f;
-    if (is_metal) {
-        material.metallic = 1.0f;
-    }
+    material.metallic = is_metal ? 1.0f : 0.5f * random_double() * random_double();
     //auto base_color = LiteMath::float3(material.baseColor[0],material.baseColor[1],material.baseColor[2]);
     LiteMath::float3 hit_point = to_float3(rayPos) + normalize(to_float3(rayDir)) * hit.t;
+    
+    if (CRT_GeomType(hit.geomId) == CRT_GEOM_USER) {
+        // SDF user geometry: marching stops at 'm_min_matching_distance' from surface, so move secondary rays out of it
+        auto sdf_material = get_sdf_material_data(hit);
+        base_color = to_float3(sdf_material.baseColor);
+        material.metallic = sdf_material.metallic;
+        is_glass = false;
+        refraction = 0.01f;
+        hit_point += to_float3(normal) * (2.0f * m_min_matching_distance);
+    }
 
     if (material.metallic > 0.0f && depth > 0) {
-          result_color += material.metallic * trace(to_float4(hit_point, 0.0001f), to_float4(reflection_dir, FLT_MAX), background_color, depth - 1, diffuse_spread);
+          result_color += material.metallic * trace(to_float4(hit_point, 0.0001f), to_float4(reflection_dir, FLT_MAX), background_color, depth - 1, diffuse_spread, CRT_RAY_MASK_REFLECTION);
     }
 
     if (material.metallic >= 1.0f) {
@@ -246,12 +285,11 @@ float3 RayTracer::trace(float4 rayPos, float4 rayDir, float3 background_color, i
         auto dir_to_light = light->getDirectionFrom(hit_point);
         auto dist_to_light = light->getDistanceFrom(hit_point);
         auto light_position = hit_point + dist_to_light * dir_to_light;
-        auto light_hit = m_pAccelStruct->RayQuery_NearestHit(to_float4(hit_point, 0.0001f), LiteMath::to_float4(dir_to_light, FLT_MAX));
-        // dist to directional is always at inf distance
-        if (light_hit.instId == uint32_t(-1) || light_hit.t >= dist_to_light || light_hit.instId == glass_id) {
-            float k = light_hit.instId == glass_id ? refraction : 1.0f;
+        // dist to directional is always at inf distance; glass and light meshes do not cast shadows, see SimpleRender::AddRTInstances
+        bool occluded = m_pAccelStruct->RayQuery_AnyHit(to_float4(hit_point, 0.0001f), LiteMath::to_float4(dir_to_light, std::min(dist_to_light, FLT_MAX)), CRT_RAY_MASK_SHADOW);
+        if (!occluded) {
             auto light_color = light->getColor();
-            result_color += k * calc_light_impact(
+            result_color += calc_light_impact(
                 dir_to_light, 
                 dist_to_light, 
                 reflection_dir, 
@@ -284,7 +322,7 @@ float3 RayTracer::trace(float4 rayPos, float4 rayDir, float3 background_color, i
     if (is_glass) {
         result_color *= (1-refraction);
         float3 refracted = refract(to_float3(rayDir), to_float3(normal), refraction); 
-        result_color += refraction * trace(to_float4(hit_point, 0.0001f), to_float4(refracted, FLT_MAX), background_color, depth - 1, diffuse_spread);
+        result_color += refraction * trace(to_float4(hit_point, 0.0001f), to_float4(refracted, FLT_MAX), background_color, depth - 1, diffuse_spread, CRT_RAY_MASK_REFLECTION);
     }
     return result_color;
 }
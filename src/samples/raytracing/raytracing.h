@@ -30,14 +30,51 @@ public:
 
   void CastSingleRay(uint32_t tidX, uint32_t tidY, uint32_t* out_color);
   void CastAARays(uint32_t tidX, uint32_t tidY, uint32_t* out_color, int num_aa_rays);
+  void CastAARays8(uint32_t tidX, uint32_t tidY, uint32_t* out_color, int num_aa_rays); // ray marching of 8 pixels in a row starting from tidX
   void kernel_InitEyeRay(uint32_t tidX, uint32_t tidY, LiteMath::float4* rayPosAndNear, LiteMath::float4* rayDirAndFar, float offset_x = 0.0f, float offset_y = 0.0f);
   void kernel_RayTrace(uint32_t tidX, uint32_t tidY, const LiteMath::float4* rayPosAndNear, const LiteMath::float4* rayDirAndFar, uint32_t* out_color);
   void load_cubemap(const std::array<std::string, 6>& paths);
   void AddLight(LightInfo* light) { m_lights.push_back(light); }
 
+  // register bounded SDF objects in acceleration structure as user geometry, so they mix with triangle meshes in 'trace'
+  static uint32_t add_sdf_geometry(ISceneObject* a_pAccelStruct);
+  void update_sdf_geometry(); // pass marching settings to SDF user geometry; call before tracing
+  // polygonise bounded SDF objects into one triangle mesh with 'resolution' cells along the longest side of each object;
+  // material ids of the mesh index 'out_materials'. Returns false if there is nothing to polygonise
+  static bool polygonize_sdf_scene(int resolution, cmesh::SimpleMesh* out_mesh, std::vector<MaterialData_pbrMR>* out_materials);
+  // bake signed distance to every mesh of the scene manager with 'resolution' samples along the longest side of the mesh;
+  // baked meshes occlude light in soft shadows and AO of marching mode
+  void bake_mesh_sdfs(int resolution);
+  void prepare_marching();    // per frame pre-pass for ray marching; call after UpdateView
+
+  // glass-like material: blended and not fully opaque; it refracts rays and does not stop shadow rays
+  static bool is_transparent_material(const MaterialData_pbrMR& mat) { return mat.alphaMode == 2 && mat.baseColor.w < 1.0f; }
+  // mirror-like metal: reflects everything it does not absorb. Untextured, glossy and (almost) fully metallic, so glTF defaults
+  // (metallic = roughness = 1) and texture driven metalness are not mirrors; Hydra materials store Fresnel reflectance of
+  // their IOR in 'metallic', which passes the threshold for conductors (IOR >> 1)
+  static bool is_mirror_material(const MaterialData_pbrMR& mat)
+  {
+    return mat.metallic >= 0.9f && mat.roughness <= 0.5f && mat.metallicRoughnessTexId < 0;
+  }
+  // geometry which never occludes lights: glass and light source meshes (emissive materials)
+  static bool is_non_occluding_material(const MaterialData_pbrMR& mat)
+  {
+    return is_transparent_material(mat) || mat.emissionColor.x > 0.0f || mat.emissionColor.y > 0.0f || mat.emissionColor.z > 0.0f;
+  }
+
   float3 m_background_color = {0.15f, 0.15f, 0.15f};
   float m_min_matching_distance = 1.0e-3f;
   int m_marching_steps = 30;
+  float m_marching_relaxation = 1.4f; // step multiplier of enhanced sphere tracing, 1 is plain sphere tracing
+  float m_marching_max_distance = 1000.0f; // rays which go further are misses
+  bool m_marching_prepass = true;     // cone marching at tile resolution to find where eye rays may start
+  bool m_marching_cache = false;      // march far from surface through a brick map of SDF samples
+  int m_marching_cache_resolution = 256; // brick map samples along the longest side of the scene bounding box
+  float m_marching_lod = 1.0f;        // fractal detail and hit distance in pixel footprints, 0 is full detail everywhere
+  bool m_marching_soft_shadows = false; // penumbra from SDF distances along shadow rays instead of hard shadows
+  float m_soft_shadow_sharpness = 8.0f;
+  bool m_marching_ao = false;         // ambient occlusion from a few SDF samples along the normal
+  float m_ao_radius = 0.5f;
   int m_reflection_depth = 1;
   int m_diffuse_spread = 3;
   int m_aa_rays = 4;
@@ -53,6 +90,10 @@ protected:
   std::vector<LightInfo*> m_lights;
   std::shared_ptr<SceneManager> m_scene_manager;
 
+  static constexpr uint32_t MARCHING_TILE_SIZE = 8;
+  std::vector<float> m_marching_start; // safe distance to start eye rays from, per tile of 'prepare_marching'
+  float m_pixel_angle = 0.0f;          // angle between eye rays of neighbour pixels, from 'prepare_marching'
+
   std::array<std::pair<std::vector<unsigned char>, ImageFileInfo>, 6> m_cubemap = {};
   int m_cubemap_width = 0;
   int m_cubemap_height = 0;
@@ -70,10 +111,15 @@ protected:
 
 
   const MaterialData_pbrMR& get_material_data(const CRT_Hit& hit);
+  static MaterialData_pbrMR get_sdf_material_data(const CRT_Hit& hit);
   // returns color
-  float3 trace(float4 rayPos, float4 rayDir, float3 background_color, int depth, int diffuse_spread);
-  float3 trace_marching(float3 rayPos, float3 rayDir, float3 background_color, int steps, float min_dist, int depth);
-  static float3 trace_marching_pos(float3 ray_pos, float3 ray_dir, int steps, float min_dist);
+  float3 trace(float4 rayPos, float4 rayDir, float3 background_color, int depth, int diffuse_spread, uint32_t ray_mask = CRT_RAY_MASK_CAMERA);
+  // 'footprint' is the width of the pixel cone at the ray origin, for secondary rays
+  float3 trace_marching(float3 rayPos, float3 rayDir, float3 background_color, int steps, float min_dist, int depth, float footprint = 0.0f);
+  float3 trace_marching_pos(float3 ray_pos, float3 ray_dir, int steps, float min_dist, float footprint = 0.0f);
+  // same as 'trace_marching' for 8 rays that start marching at 't_start'; primary and shadow rays are marched as SIMD packets
+  void trace_marching8(const float3* ray_pos, const float3* ray_dir, float t_start, float3 background_color, int steps, float min_dist, int depth, float3* out_color);
+  float3 marching_miss_color(float3 ray_dir, float3 background_color);
 
   float3 get_normal_from_hit(const CRT_Hit& hit);
   static float3 calc_light_impact(
@@ -0,0 +1,263 @@
+#include "sdf_brick_map.hpp"
+#include "utils/content_hash.h"
+
+#include <algorithm>
+#include <cmath>
+
+namespace fractals {
+
+    static uint64_t program_hash(const sdf_program& program) {
+        ContentHash64 hash;
+        for (const sdf_instr& instr : program.code) {
+            hash.AddValue(instr.op);
+            hash.AddValue(instr.material_id);
+            hash.AddValue(instr.param_offset);
+        }
+        hash.Add(program.params.data(), program.params.size() * sizeof(float));
+        return hash.Get();
+    }
+
+    static float box_distance(float3 p, float3 box_min, float3 box_max) {
+        return length(max(max(box_min - p, p - box_max), float3(0.0f, 0.0f, 0.0f)));
+    }
+
+    void sdf_brick_map::clear() {
+        m_bricks.clear();
+        m_samples.clear();
+        m_free_offsets.clear();
+        m_object_hashes.clear();
+        m_object_boxes.clear();
+        m_resolution = 0;
+    }
+
+    bool sdf_brick_map::update(const std::vector<sdf_program>& objects, const sdf_program& combined, int resolution) {
+        if (!combined.is_bounded() || combined.code.empty() || resolution < BRICK_CELLS) {
+            clear();
+            return false;
+        }
+
+        const float3 size = combined.box_max - combined.box_min;
+        const float voxel_size = std::max(size.x, std::max(size.y, size.z)) / float(resolution);
+        const float3 box_min = combined.box_min - 2.0f * voxel_size;
+
+        std::vector<uint64_t> hashes(objects.size());
+        for (size_t i = 0; i < objects.size(); ++i) {
+            hashes[i] = program_hash(objects[i]);
+        }
+
+        const bool full_rebuild = m_bricks.empty() || m_resolution != resolution || m_voxel_size != voxel_size ||
+                                  m_box_min.x != box_min.x || m_box_min.y != box_min.y || m_box_min.z != box_min.z ||
+                                  m_object_hashes.size() != hashes.size();
+
+        std::vector<uint32_t> dirty;
+        if (full_rebuild) {
+            init_grid(combined.box_min, combined.box_max, resolution);
+            dirty.resize(m_bricks.size());
+            for (size_t i = 0; i < dirty.size(); ++i) {
+                dirty[i] = uint32_t(i);
+            }
+        } else {
+            // distance may change only inside old and new bounding boxes of changed objects; far from them it may only
+            // decrease, which keeps cached distance a lower bound while it is not larger than distance to the new box.
+            // Outside of surface, empty brick returns 'center_dist - r' at distance r from its center; other bricks return
+            // at most 'center_dist + half_diagonal' at points up to 'half_diagonal' closer to the box than the center
+            const float brick_size = voxel_size * BRICK_CELLS;
+            const float margin = 2.0f * voxel_size + brick_size;
+            const float half_diagonal = 0.5f * std::sqrt(3.0f) * brick_size;
+            std::vector<uint8_t> is_dirty(m_bricks.size(), 0);
+            for (size_t obj = 0; obj < objects.size(); ++obj) {
+                if (hashes[obj] == m_object_hashes[obj]) {
+                    continue;
+                }
+                const float3 dirty_min = min(m_object_boxes[obj * 2 + 0], objects[obj].box_min) - margin;
+                const float3 dirty_max = max(m_object_boxes[obj * 2 + 1], objects[obj].box_max) + margin;
+                if (!std::isfinite(dirty_min.x + dirty_min.y + dirty_min.z + dirty_max.x + dirty_max.y + dirty_max.z)) {
+                    std::fill(is_dirty.begin(), is_dirty.end(), uint8_t(1));
+                    break;
+                }
+                for (uint32_t z = 0; z < m_bricks_z; ++z) {
+                    for (uint32_t y = 0; y < m_bricks_y; ++y) {
+                        for (uint32_t x = 0; x < m_bricks_x; ++x) {
+                            const uint32_t brick_id = (z * m_bricks_y + y) * m_bricks_x + x;
+                            const float3 center = brick_center(brick_id);
+                            if (center.x >= dirty_min.x && center.y >= dirty_min.y && center.z >= dirty_min.z &&
+                                center.x <= dirty_max.x && center.y <= dirty_max.y && center.z <= dirty_max.z) {
+                                is_dirty[brick_id] = 1;
+                                continue;
+                            }
+                            const brick& b = m_bricks[brick_id];
+                            const bool cone = b.samples_offset == EMPTY_BRICK && b.center_dist >= 0.0f;
+                            const float cached_max = cone ? b.center_dist : b.center_dist + 2.0f * half_diagonal;
+                            if (cached_max > box_distance(center, objects[obj].box_min, objects[obj].box_max)) {
+                                is_dirty[brick_id] = 1;
+                            }
+                        }
+                    }
+                }
+            }
+            for (size_t i = 0; i < is_dirty.size(); ++i) {
+                if (is_dirty[i]) {
+                    dirty.push_back(uint32_t(i));
+                }
+            }
+        }
+
+        m_object_hashes = hashes;
+        m_object_boxes.resize(objects.size() * 2);
+        for (size_t i = 0; i < objects.size(); ++i) {
+            m_object_boxes[i * 2 + 0] = objects[i].box_min;
+            m_object_boxes[i * 2 + 1] = objects[i].box_max;
+        }
+
+        if (!dirty.empty()) {
+            bake_bricks([&combined](const simd::float3_8& positions) { return combined.eval8(positions); }, dirty);
+        }
+        return true;
+    }
+
+    void sdf_brick_map::bake(float3 box_min, float3 box_max, int resolution, const sampler& distance) {
+        clear();
+        if (resolution < BRICK_CELLS) {
+            return;
+        }
+        init_grid(box_min, box_max, resolution);
+        std::vector<uint32_t> all(m_bricks.size());
+        for (size_t i = 0; i < all.size(); ++i) {
+            all[i] = uint32_t(i);
+        }
+        bake_bricks(distance, all);
+    }
+
+    void sdf_brick_map::init_grid(float3 box_min, float3 box_max, int resolution) {
+        const float3 size = box_max - box_min;
+        const float voxel_size = std::max(size.x, std::max(size.y, size.z)) / float(resolution);
+        // surface is at least two voxels away from the borders of the map
+        const float3 bricks = ceil((size + 4.0f * voxel_size) / (voxel_size * BRICK_CELLS));
+        m_resolution = resolution;
+        m_voxel_size = voxel_size;
+        m_error = std::sqrt(3.0f) * voxel_size;
+        m_box_min = box_min - 2.0f * voxel_size;
+        m_bricks_x = uint32_t(bricks.x);
+        m_bricks_y = uint32_t(bricks.y);
+        m_bricks_z = uint32_t(bricks.z);
+        m_box_max = m_box_min + float3(float(m_bricks_x), float(m_bricks_y), float(m_bricks_z)) * (voxel_size * BRICK_CELLS);
+        m_bricks.assign(size_t(m_bricks_x) * m_bricks_y * m_bricks_z, brick());
+        m_samples.clear();
+        m_free_offsets.clear();
+    }
+
+    float3 sdf_brick_map::brick_center(uint32_t brick_id) const {
+        const uint32_t x = brick_id % m_bricks_x;
+        const uint32_t y = (brick_id / m_bricks_x) % m_bricks_y;
+        const uint32_t z = brick_id / (m_bricks_x * m_bricks_y);
+        return m_box_min + (float3(float(x), float(y), float(z)) + 0.5f) * (m_voxel_size * BRICK_CELLS);
+    }
+
+    void sdf_brick_map::bake_bricks(const sampler& distance, const std::vector<uint32_t>& brick_ids) {
+        // brick may contain surface if distance at its center is smaller than its half diagonal;
+        // centers of 8 bricks are evaluated at once
+        const float half_diagonal = 0.5f * std::sqrt(3.0f) * m_voxel_size * BRICK_CELLS;
+        std::vector<uint8_t> near_surface(brick_ids.size());
+#pragma omp parallel for schedule(dynamic, 8)
+        for (int first = 0; first < int(brick_ids.size()); first += simd::WIDTH) {
+            const int count = std::min(simd::WIDTH, int(brick_ids.size()) - first);
+            alignas(32) float x[simd::WIDTH], y[simd::WIDTH], z[simd::WIDTH], dist[simd::WIDTH];
+            for (int i = 0; i < simd::WIDTH; ++i) {
+                const float3 center = brick_center(brick_ids[first + std::min(i, count - 1)]);
+                x[i] = center.x;
+                y[i] = center.y;
+                z[i] = center.z;
+            }
+            distance({simd::float8::load(x), simd::float8::load(y), simd::float8::load(z)}).store(dist);
+            for (int i = 0; i < count; ++i) {
+                m_bricks[brick_ids[first + i]].center_dist = dist[i];
+                near_surface[first + i] = std::abs(dist[i]) <= half_diagonal + 2.0f * m_voxel_size;
+            }
+        }
+
+        const uint32_t brick_floats = BRICK_SAMPLES * BRICK_SAMPLES * BRICK_SAMPLES;
+        for (size_t i = 0; i < brick_ids.size(); ++i) {
+            brick& b = m_bricks[brick_ids[i]];
+            if (near_surface[i] && b.samples_offset == EMPTY_BRICK) {
+                if (!m_free_offsets.empty()) {
+                    b.samples_offset = m_free_offsets.back();
+                    m_free_offsets.pop_back();
+                } else {
+                    b.samples_offset = uint32_t(m_samples.size());
+                    m_samples.resize(m_samples.size() + brick_floats);
+                }
+            } else if (!near_surface[i] && b.samples_offset != EMPTY_BRICK) {
+                m_free_offsets.push_back(b.samples_offset);
+                b.samples_offset = EMPTY_BRICK;
+            }
+        }
+
+        // one row of a brick is one 8-wide evaluation
+        static_assert(BRICK_SAMPLES == simd::WIDTH, "brick row is evaluated with one SIMD call");
+        alignas(32) float row_x[simd::WIDTH];
+        for (int x = 0; x < simd::WIDTH; ++x) {
+            row_x[x] = float(x) * m_voxel_size;
+        }
+        const simd::float8 offsets_x = simd::float8::load(row_x);
+
+#pragma omp parallel for schedule(dynamic, 8)
+        for (int i = 0; i < int(brick_ids.size()); ++i) {
+            if (!near_surface[i]) {
+                continue;
+            }
+            const uint32_t brick_id = brick_ids[i];
+            const float3 origin = brick_center(brick_id) - 0.5f * m_voxel_size * BRICK_CELLS;
+            float* samples = m_samples.data() + m_bricks[brick_id].samples_offset;
+            for (int z = 0; z < BRICK_SAMPLES; ++z) {
+                for (int y = 0; y < BRICK_SAMPLES; ++y) {
+                    const simd::float3_8 row = {offsets_x + origin.x, origin.y + float(y) * m_voxel_size, origin.z + float(z) * m_voxel_size};
+                    distance(row).store(samples + (z * BRICK_SAMPLES + y) * BRICK_SAMPLES);
+                }
+            }
+        }
+    }
+
+    float sdf_brick_map::eval(float3 position) const {
+        // surface is inside of the map, so distance to the map box is a lower bound
+        const float3 outside = max(max(m_box_min - position, position - m_box_max), float3(0.0f, 0.0f, 0.0f));
+        if (outside.x > 0.0f || outside.y > 0.0f || outside.z > 0.0f) {
+            return length(outside) + 2.0f * m_voxel_size;
+        }
+
+        const float3 grid = (position - m_box_min) / m_voxel_size;
+        const uint32_t bx = std::min(uint32_t(grid.x / BRICK_CELLS), m_bricks_x - 1);
+        const uint32_t by = std::min(uint32_t(grid.y / BRICK_CELLS), m_bricks_y - 1);
+        const uint32_t bz = std::min(uint32_t(grid.z / BRICK_CELLS), m_bricks_z - 1);
+        const uint32_t brick_id = (bz * m_bricks_y + by) * m_bricks_x + bx;
+        const brick& b = m_bricks[brick_id];
+
+        if (b.samples_offset == EMPTY_BRICK) {
+            // distance function changes not faster than distance from the center
+            const float r = length(position - brick_center(brick_id));
+            return b.center_dist >= 0.0f ? b.center_dist - r : b.center_dist + r;
+        }
+
+        const float3 local = clamp(grid - float3(float(bx), float(by), float(bz)) * float(BRICK_CELLS), 0.0f, float(BRICK_CELLS));
+        const int x = std::min(int(local.x), BRICK_CELLS - 1);
+        const int y = std::min(int(local.y), BRICK_CELLS - 1);
+        const int z = std::min(int(local.z), BRICK_CELLS - 1);
+        const float fx = local.x - float(x);
+        const float fy = local.y - float(y);
+        const float fz = local.z - float(z);
+
+        const float* s = m_samples.data() + b.samples_offset + (z * BRICK_SAMPLES + y) * BRICK_SAMPLES + x;
+        const int dy = BRICK_SAMPLES;
+        const int dz = BRICK_SAMPLES * BRICK_SAMPLES;
+        const float c00 = s[0]       + (s[1]           - s[0])       * fx;
+        const float c10 = s[dy]      + (s[dy + 1]      - s[dy])      * fx;
+        const float c01 = s[dz]      + (s[dz + 1]      - s[dz])      * fx;
+        const float c11 = s[dz + dy] + (s[dz + dy + 1] - s[dz + dy]) * fx;
+        const float c0 = c00 + (c10 - c00) * fy;
+        const float c1 = c01 + (c11 - c01) * fy;
+        return c0 + (c1 - c0) * fz - m_error;
+    }
+
+    size_t sdf_brick_map::memory_size() const {
+        return m_bricks.size() * sizeof(brick) + m_samples.size() * sizeof(float);
+    }
+}
@@ -0,0 +1,69 @@
+#pragma once
+
+#include <LiteMath.h>
+#include <cstdint>
+#include <functional>
+#include <vector>
+
+#include "sdf_program.hpp"
+
+namespace fractals {
+
+    // Sparse cache of SDF samples: bounding box of the scene is split into bricks of 8x8x8 samples (7x7x7 cells),
+    // only bricks which may contain surface store samples, other bricks keep one distance at their center.
+    // Cached distance is a conservative estimate, so it is used to march far from surface; rays switch to the
+    // exact SDF when cached distance becomes smaller than 'refine_distance()'.
+    class sdf_brick_map {
+    public:
+        static constexpr int BRICK_SAMPLES = 8;
+        static constexpr int BRICK_CELLS = BRICK_SAMPLES - 1;
+
+        // distances at 8 positions at once
+        using sampler = std::function<simd::float8(const simd::float3_8& positions)>;
+
+        // bakes 'combined' with 'resolution' samples along the longest side of its bounding box; if only some of the
+        // 'objects' changed since the previous call, only bricks overlapping their old and new bounding boxes are rebaked.
+        // Returns false for unbounded scenes, which can't be cached.
+        bool update(const std::vector<sdf_program>& objects, const sdf_program& combined, int resolution);
+        // bakes any distance function whose surface is inside of the box (e.g. distance to a triangle mesh)
+        void bake(float3 box_min, float3 box_max, int resolution, const sampler& distance);
+        void clear();
+
+        bool is_valid() const { return !m_bricks.empty(); }
+        float refine_distance() const { return 2.0f * m_voxel_size; }
+
+        float eval(float3 position) const;
+        simd::float8 eval8(const simd::float3_8& positions) const; // see sdf_packet.cpp
+
+        size_t memory_size() const;
+
+    private:
+        static constexpr uint32_t EMPTY_BRICK = 0xFFFFFFFF;
+
+        struct brick {
+            uint32_t samples_offset = EMPTY_BRICK; // index in 'm_samples' of the first sample of allocated brick
+            float center_dist = 0.0f;              // exact distance at the center of the brick
+        };
+
+        void init_grid(float3 box_min, float3 box_max, int resolution);
+        void bake_bricks(const sampler& distance, const std::vector<uint32_t>& brick_ids);
+        float3 brick_center(uint32_t brick_id) const;
+
+        float3 m_box_min = float3(0.0f, 0.0f, 0.0f);
+        float3 m_box_max = float3(0.0f, 0.0f, 0.0f);
+        float m_voxel_size = 0.0f;
+        float m_error = 0.0f; // bound of trilinear interpolation error, subtracted from cached distance
+        int m_resolution = 0;
+        uint32_t m_bricks_x = 0;
+        uint32_t m_bricks_y = 0;
+        uint32_t m_bricks_z = 0;
+
+        std::vector<brick> m_bricks;
+        std::vector<float> m_samples;
+        std::vector<uint32_t> m_free_offsets; // slots of bricks which became empty after incremental update
+
+        // to find out which objects changed between updates
+        std::vector<uint64_t> m_object_hashes;
+        std::vector<float3> m_object_boxes; // min, max per object
+    };
+}
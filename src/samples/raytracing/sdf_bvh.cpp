@@ -0,0 +1,126 @@
+#include "sdf_bvh.hpp"
+
+#include <algorithm>
+
+namespace fractals {
+
+    static float box_distance(float3 p, float3 box_min, float3 box_max) {
+        return length(max(max(box_min - p, p - box_max), float3(0.0f, 0.0f, 0.0f)));
+    }
+
+    void sdf_bvh::build(const sdf_program* objects, uint32_t count) {
+        m_objects = objects;
+        m_nodes.clear();
+        m_bounded.clear();
+        m_unbounded.clear();
+        for (uint32_t i = 0; i < count; ++i) {
+            if (objects[i].code.empty()) {
+                continue;
+            }
+            (objects[i].is_bounded() ? m_bounded : m_unbounded).push_back(i);
+        }
+        if (!m_bounded.empty()) {
+            m_nodes.reserve(2 * m_bounded.size());
+            build_node(0, uint32_t(m_bounded.size()), 0);
+        }
+    }
+
+    // median split by the longest axis of box centers
+    uint32_t sdf_bvh::build_node(uint32_t first, uint32_t count, int depth) {
+        const uint32_t node_id = uint32_t(m_nodes.size());
+        m_nodes.push_back({float3(+INFINITY, +INFINITY, +INFINITY), float3(-INFINITY, -INFINITY, -INFINITY), first, count});
+
+        float3 box_min = m_nodes[node_id].box_min;
+        float3 box_max = m_nodes[node_id].box_max;
+        float3 center_min = box_min;
+        float3 center_max = box_max;
+        for (uint32_t i = first; i < first + count; ++i) {
+            const sdf_program& obj = m_objects[m_bounded[i]];
+            box_min = min(box_min, obj.box_min);
+            box_max = max(box_max, obj.box_max);
+            center_min = min(center_min, 0.5f * (obj.box_min + obj.box_max));
+            center_max = max(center_max, 0.5f * (obj.box_min + obj.box_max));
+        }
+        m_nodes[node_id].box_min = box_min;
+        m_nodes[node_id].box_max = box_max;
+
+        if (count <= LEAF_SIZE || depth + 1 >= MAX_DEPTH) {
+            return node_id;
+        }
+
+        const float3 extent = center_max - center_min;
+        const int axis = extent.x > extent.y ? (extent.x > extent.z ? 0 : 2) : (extent.y > extent.z ? 1 : 2);
+        const uint32_t half = count / 2;
+        std::nth_element(m_bounded.begin() + first, m_bounded.begin() + first + half, m_bounded.begin() + first + count,
+                         [&](uint32_t a, uint32_t b) {
+                             return m_objects[a].box_min[axis] + m_objects[a].box_max[axis] < m_objects[b].box_min[axis] + m_objects[b].box_max[axis];
+                         });
+
+        build_node(first, half, depth + 1);
+        const uint32_t right = build_node(first + half, count - half, depth + 1);
+        m_nodes[node_id].first = right;
+        m_nodes[node_id].count = 0;
+        return node_id;
+    }
+
+    uint32_t sdf_bvh::nearest(float3 position, float detail, float* out_dist) const {
+        float best = INFINITY;
+        uint32_t best_id = uint32_t(-1);
+        for (uint32_t id : m_unbounded) {
+            const float d = m_objects[id].eval_lod(position, detail);
+            if (d < best) {
+                best = d;
+                best_id = id;
+            }
+        }
+
+        if (!m_nodes.empty() && box_distance(position, m_nodes[0].box_min, m_nodes[0].box_max) < best) {
+            uint32_t stack[MAX_DEPTH + 1];
+            int top = 0;
+            stack[top++] = 0;
+            while (top > 0) {
+                const node& n = m_nodes[stack[--top]];
+                if (n.count > 0) {
+                    for (uint32_t i = n.first; i < n.first + n.count; ++i) {
+                        const uint32_t id = m_bounded[i];
+                        if (box_distance(position, m_objects[id].box_min, m_objects[id].box_max) >= best) {
+                            continue;
+                        }
+                        const float d = m_objects[id].eval_lod(position, detail);
+                        if (d < best) {
+                            best = d;
+                            best_id = id;
+                        }
+                    }
+                    continue;
+                }
+
+                // closer child is visited first, so it tightens 'best' before the other one is checked
+                const uint32_t left_id = uint32_t(&n - m_nodes.data()) + 1;
+                const uint32_t right_id = n.first;
+                const float d_left = box_distance(position, m_nodes[left_id].box_min, m_nodes[left_id].box_max);
+                const float d_right = box_distance(position, m_nodes[right_id].box_min, m_nodes[right_id].box_max);
+                const bool left_first = d_left <= d_right;
+                const float d_far = left_first ? d_right : d_left;
+                const float d_near = left_first ? d_left : d_right;
+                if (d_far < best) {
+                    stack[top++] = left_first ? right_id : left_id;
+                }
+                if (d_near < best) {
+                    stack[top++] = left_first ? left_id : right_id;
+                }
+            }
+        }
+
+        if (out_dist != nullptr) {
+            *out_dist = best;
+        }
+        return best_id;
+    }
+
+    float sdf_bvh::eval(float3 position, float detail) const {
+        float dist;
+        nearest(position, detail, &dist);
+        return dist;
+    }
+}
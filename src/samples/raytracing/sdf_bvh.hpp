@@ -0,0 +1,45 @@
+#pragma once
+
+#include <LiteMath.h>
+#include <cstdint>
+#include <vector>
+
+#include "sdf_program.hpp"
+
+namespace fractals {
+
+    // BVH over bounding boxes of separately compiled SDF objects. Distance to a box is a lower bound of distance to
+    // the object inside it, so objects with boxes further than the best distance found so far are not evaluated and
+    // scenes of many objects cost about log(n) evaluations per step. Unbounded objects (planes, infinite repetitions)
+    // are kept aside and evaluated always.
+    class sdf_bvh {
+    public:
+        // 'objects' are referenced, not copied: the array must stay alive and in place while BVH is used
+        void build(const sdf_program* objects, uint32_t count);
+
+        bool empty() const { return m_objects == nullptr || (m_nodes.empty() && m_unbounded.empty()); }
+
+        float eval(float3 position, float detail = 0.0f) const;
+        simd::float8 eval8(const simd::float3_8& positions, float detail = 0.0f) const; // see sdf_packet.cpp
+        // index of the closest object, uint32_t(-1) for an empty scene
+        uint32_t nearest(float3 position, float detail, float* out_dist = nullptr) const;
+
+    private:
+        static constexpr uint32_t LEAF_SIZE = 2;
+        static constexpr int MAX_DEPTH = 64;
+
+        struct node {
+            float3 box_min;
+            float3 box_max;
+            uint32_t first; // first object in 'm_bounded' for a leaf, right child for an inner node (left one is next)
+            uint32_t count; // number of objects in a leaf, 0 for an inner node
+        };
+
+        uint32_t build_node(uint32_t first, uint32_t count, int depth);
+
+        const sdf_program* m_objects = nullptr;
+        std::vector<node> m_nodes;
+        std::vector<uint32_t> m_bounded;   // object ids in leaf order
+        std::vector<uint32_t> m_unbounded; // object ids
+    };
+}
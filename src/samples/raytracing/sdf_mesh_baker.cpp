@@ -0,0 +1,174 @@
+#include "sdf_mesh_baker.hpp"
+#include "embree3/rtcore.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <iostream>
+#include <vector>
+
+namespace fractals {
+
+    // closest point on triangle (a, b, c) to p, by the Voronoi region of p (Ericson, Real-Time Collision Detection 5.1.5)
+    static float3 closest_on_triangle(float3 p, float3 a, float3 b, float3 c) {
+        const float3 ab = b - a;
+        const float3 ac = c - a;
+        const float3 ap = p - a;
+        const float d1 = dot(ab, ap);
+        const float d2 = dot(ac, ap);
+        if (d1 <= 0.0f && d2 <= 0.0f) {
+            return a;
+        }
+        const float3 bp = p - b;
+        const float d3 = dot(ab, bp);
+        const float d4 = dot(ac, bp);
+        if (d3 >= 0.0f && d4 <= d3) {
+            return b;
+        }
+        const float vc = d1 * d4 - d3 * d2;
+        if (vc <= 0.0f && d1 >= 0.0f && d3 <= 0.0f) {
+            return a + ab * (d1 / (d1 - d3));
+        }
+        const float3 cp = p - c;
+        const float d5 = dot(ab, cp);
+        const float d6 = dot(ac, cp);
+        if (d6 >= 0.0f && d5 <= d6) {
+            return c;
+        }
+        const float vb = d5 * d2 - d1 * d6;
+        if (vb <= 0.0f && d2 >= 0.0f && d6 <= 0.0f) {
+            return a + ac * (d2 / (d2 - d6));
+        }
+        const float va = d3 * d6 - d5 * d4;
+        if (va <= 0.0f && (d4 - d3) >= 0.0f && (d5 - d6) >= 0.0f) {
+            return b + (c - b) * ((d4 - d3) / ((d4 - d3) + (d5 - d6)));
+        }
+        const float denom = 1.0f / (va + vb + vc);
+        return a + ab * (vb * denom) + ac * (vc * denom);
+    }
+
+    struct mesh_distance {
+        RTCScene scene = nullptr;
+        std::vector<float3> positions;
+        const uint32_t* indices = nullptr;
+        float crossing_eps = 0.0f; // step over a crossing, so the next ray segment doesn't hit the same triangle
+
+        // query radius shrinks to the closest distance found so far, so Embree culls farther BVH nodes
+        static bool closest_triangle(RTCPointQueryFunctionArguments* args) {
+            const mesh_distance* mesh = static_cast<const mesh_distance*>(args->userPtr);
+            const uint32_t* tri = mesh->indices + size_t(args->primID) * 3;
+            const float3 p(args->query->x, args->query->y, args->query->z);
+            const float3 closest = closest_on_triangle(p, mesh->positions[tri[0]], mesh->positions[tri[1]], mesh->positions[tri[2]]);
+            const float dist = length(closest - p);
+            if (dist < args->query->radius) {
+                args->query->radius = dist;
+                return true;
+            }
+            return false;
+        }
+
+        int crossings(float3 p, float3 dir) const {
+            RTCIntersectContext context;
+            rtcInitIntersectContext(&context);
+            int count = 0;
+            float t_near = 0.0f;
+            for (int i = 0; i < MAX_CROSSINGS; ++i) {
+                RTCRayHit rayhit;
+                rayhit.ray.org_x = p.x;
+                rayhit.ray.org_y = p.y;
+                rayhit.ray.org_z = p.z;
+                rayhit.ray.tnear = t_near;
+                rayhit.ray.dir_x = dir.x;
+                rayhit.ray.dir_y = dir.y;
+                rayhit.ray.dir_z = dir.z;
+                rayhit.ray.tfar = INFINITY;
+                rayhit.ray.time = 0.0f;
+                rayhit.ray.mask = 0xFFFFFFFF;
+                rayhit.ray.id = 0;
+                rayhit.ray.flags = 0;
+                rayhit.hit.geomID = RTC_INVALID_GEOMETRY_ID;
+                rayhit.hit.instID[0] = RTC_INVALID_GEOMETRY_ID;
+                rtcIntersect1(scene, &context, &rayhit);
+                if (rayhit.hit.geomID == RTC_INVALID_GEOMETRY_ID) {
+                    break;
+                }
+                ++count;
+                t_near = rayhit.ray.tfar + crossing_eps;
+            }
+            return count;
+        }
+
+        float eval(float3 p) const {
+            RTCPointQuery query;
+            query.x = p.x;
+            query.y = p.y;
+            query.z = p.z;
+            query.time = 0.0f;
+            query.radius = INFINITY;
+            RTCPointQueryContext context;
+            rtcInitPointQueryContext(&context);
+            rtcPointQuery(scene, &query, &context, &closest_triangle, const_cast<mesh_distance*>(this));
+
+            const int inside_votes = (crossings(p, float3(1.0f, 0.0f, 0.0f)) & 1) +
+                                     (crossings(p, float3(0.0f, 1.0f, 0.0f)) & 1) +
+                                     (crossings(p, float3(0.0f, 0.0f, 1.0f)) & 1);
+            return inside_votes >= 2 ? -query.radius : query.radius;
+        }
+
+        static constexpr int MAX_CROSSINGS = 256;
+    };
+
+    bool bake_mesh_sdf(const float4* vertices, size_t vertex_count, const uint32_t* indices, size_t index_count, int resolution,
+                       sdf_brick_map* out_map) {
+        out_map->clear();
+        if (vertices == nullptr || indices == nullptr || vertex_count == 0 || index_count < 3) {
+            return false;
+        }
+
+        mesh_distance mesh;
+        mesh.indices = indices;
+        mesh.positions.resize(vertex_count);
+        float3 box_min(+INFINITY, +INFINITY, +INFINITY);
+        float3 box_max(-INFINITY, -INFINITY, -INFINITY);
+        for (size_t i = 0; i < vertex_count; ++i) {
+            mesh.positions[i] = to_float3(vertices[i]);
+            box_min = min(box_min, mesh.positions[i]);
+            box_max = max(box_max, mesh.positions[i]);
+        }
+        const float3 size = box_max - box_min;
+        mesh.crossing_eps = 1.0e-5f * std::max(size.x, std::max(size.y, size.z));
+
+        RTCDevice device = rtcNewDevice(nullptr);
+        if (device == nullptr) {
+            std::cout << "[fractals::bake_mesh_sdf]: can't create Embree device" << std::endl;
+            return false;
+        }
+        mesh.scene = rtcNewScene(device);
+        rtcSetSceneBuildQuality(mesh.scene, RTC_BUILD_QUALITY_HIGH);
+        RTCGeometry geom = rtcNewGeometry(device, RTC_GEOMETRY_TYPE_TRIANGLE);
+        float* geom_vertices = (float*)rtcSetNewGeometryBuffer(geom, RTC_BUFFER_TYPE_VERTEX, 0, RTC_FORMAT_FLOAT3, 4 * sizeof(float), vertex_count);
+        unsigned* geom_indices = (unsigned*)rtcSetNewGeometryBuffer(geom, RTC_BUFFER_TYPE_INDEX, 0, RTC_FORMAT_UINT3, 3 * sizeof(unsigned), index_count / 3);
+        memcpy(geom_vertices, vertices, vertex_count * 4 * sizeof(float));
+        memcpy(geom_indices, indices, (index_count / 3) * 3 * sizeof(unsigned));
+        rtcCommitGeometry(geom);
+        rtcAttachGeometry(mesh.scene, geom);
+        rtcReleaseGeometry(geom);
+        rtcCommitScene(mesh.scene);
+
+        // sampler is called from several threads; point queries and ray casts only read the scene
+        out_map->bake(box_min, box_max, resolution, [&mesh](const simd::float3_8& positions) {
+            alignas(32) float x[simd::WIDTH], y[simd::WIDTH], z[simd::WIDTH], dist[simd::WIDTH];
+            positions.x.store(x);
+            positions.y.store(y);
+            positions.z.store(z);
+            for (int i = 0; i < simd::WIDTH; ++i) {
+                dist[i] = mesh.eval(float3(x[i], y[i], z[i]));
+            }
+            return simd::float8::load(dist);
+        });
+
+        rtcReleaseScene(mesh.scene);
+        rtcReleaseDevice(device);
+        return out_map->is_valid();
+    }
+}
@@ -0,0 +1,18 @@
+#pragma once
+
+#include <LiteMath.h>
+#include <cstddef>
+#include <cstdint>
+
+#include "sdf_brick_map.hpp"
+
+namespace fractals {
+
+    // Bakes signed distance to a triangle mesh into a sparse brick map with 'resolution' samples along the longest side
+    // of the mesh bounding box. Unsigned distance is the radius of an Embree point query (closest point on triangles),
+    // sign is the parity of ray crossings along three axes (majority vote, so small holes and seams don't flip it).
+    // Mesh is expected to be closed; for open meshes inside is where most axis rays cross the surface an odd number of times.
+    // Returns false if the mesh is empty or Embree can't be initialised.
+    bool bake_mesh_sdf(const float4* vertices, size_t vertex_count, const uint32_t* indices, size_t index_count, int resolution,
+                       sdf_brick_map* out_map);
+}
@@ -0,0 +1,283 @@
+#include "sdf_mesher.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+#include <unordered_map>
+
+namespace fractals {
+
+    static constexpr int BLOCK_CELLS = 8;
+    static constexpr int BLOCK_CORNERS = BLOCK_CELLS + 1;
+    static constexpr int SOLVER_ITERATIONS = 8;
+
+    namespace {
+        struct octree_node {
+            uint32_t x, y, z; // in blocks
+            uint32_t size;    // in blocks, power of two
+        };
+
+        struct block_vertex {
+            uint64_t cell;
+            float3 position;
+            float3 normal;
+            uint32_t material_id;
+        };
+
+        struct grid {
+            float3 origin;
+            float cell_size;
+            float iso;         // distance of the contoured surface
+                               // distance is evaluated with details of cell size (see 'sdf_program::eval_lod')
+            uint32_t cells[3]; // multiple of BLOCK_CELLS
+
+            uint64_t cell_key(uint32_t x, uint32_t y, uint32_t z) const {
+                return (uint64_t(z) * cells[1] + y) * cells[0] + x;
+            }
+            float3 corner(uint32_t x, uint32_t y, uint32_t z) const {
+                return origin + float3(float(x), float(y), float(z)) * cell_size;
+            }
+        };
+    }
+
+    static int corner_index(int x, int y, int z) {
+        return (z * BLOCK_CORNERS + y) * BLOCK_CORNERS + x;
+    }
+
+    // finds blocks which may contain surface, level by level from the root of the octree
+    static std::vector<octree_node> find_surface_blocks(const sdf_program& sdf, const grid& g) {
+        const uint32_t blocks_max = std::max(g.cells[0], std::max(g.cells[1], g.cells[2])) / BLOCK_CELLS;
+        uint32_t root_size = 1;
+        while (root_size < blocks_max) {
+            root_size *= 2;
+        }
+
+        std::vector<octree_node> level = {{0, 0, 0, root_size}};
+        std::vector<octree_node> leaves;
+        while (!level.empty()) {
+            std::vector<uint8_t> keep(level.size());
+#pragma omp parallel for schedule(dynamic, 16)
+            for (int i = 0; i < int(level.size()); ++i) {
+                const octree_node& n = level[i];
+                const float size = float(n.size * BLOCK_CELLS) * g.cell_size;
+                const float3 center = g.origin + float3(float(n.x), float(n.y), float(n.z)) * (BLOCK_CELLS * g.cell_size) + 0.5f * size;
+                // margin of one cell keeps blocks whose border edges are crossed by surface
+                keep[i] = std::abs(sdf.eval_lod(center, g.cell_size) - g.iso) <= 0.5f * std::sqrt(3.0f) * size + g.cell_size;
+            }
+
+            std::vector<octree_node> next;
+            for (size_t i = 0; i < level.size(); ++i) {
+                const octree_node& n = level[i];
+                if (!keep[i]) {
+                    continue;
+                }
+                if (n.size == 1) {
+                    leaves.push_back(n);
+                    continue;
+                }
+                const uint32_t half = n.size / 2;
+                for (uint32_t child = 0; child < 8; ++child) {
+                    octree_node c = {n.x + ((child & 1) ? half : 0), n.y + ((child & 2) ? half : 0), n.z + ((child & 4) ? half : 0), half};
+                    if (c.x * BLOCK_CELLS < g.cells[0] && c.y * BLOCK_CELLS < g.cells[1] && c.z * BLOCK_CELLS < g.cells[2]) {
+                        next.push_back(c);
+                    }
+                }
+            }
+            level = std::move(next);
+        }
+        return leaves;
+    }
+
+    static void sample_block(const sdf_program& sdf, const grid& g, const octree_node& block, float* out_dist) {
+        alignas(32) float offsets[simd::WIDTH];
+        for (int x = 0; x < simd::WIDTH; ++x) {
+            offsets[x] = float(x) * g.cell_size;
+        }
+        const simd::float8 offsets_x = simd::float8::load(offsets);
+        for (int z = 0; z < BLOCK_CORNERS; ++z) {
+            for (int y = 0; y < BLOCK_CORNERS; ++y) {
+                const float3 row = g.corner(block.x * BLOCK_CELLS, block.y * BLOCK_CELLS + y, block.z * BLOCK_CELLS + z);
+                float* dst = out_dist + corner_index(0, y, z);
+                (sdf.eval8({offsets_x + row.x, row.y, row.z}, g.cell_size) - simd::float8(g.iso)).store(dst);
+                dst[BLOCK_CELLS] = sdf.eval_lod(row + float3(float(BLOCK_CELLS) * g.cell_size, 0.0f, 0.0f), g.cell_size) - g.iso;
+            }
+        }
+    }
+
+    // vertex of a cell crossed by surface: minimum of squared distances to tangent planes at edge crossings,
+    // found with a few relaxation steps from their mass point and kept inside the cell
+    static block_vertex cell_vertex(const sdf_program& sdf, const grid& g, uint32_t gx, uint32_t gy, uint32_t gz, const float* corner_dist) {
+        static const int edges[12][2] = {{0, 1}, {2, 3}, {4, 5}, {6, 7}, {0, 2}, {1, 3}, {4, 6}, {5, 7}, {0, 4}, {1, 5}, {2, 6}, {3, 7}};
+        const float3 cell_min = g.corner(gx, gy, gz);
+        const float3 cell_max = cell_min + g.cell_size;
+
+        float3 points[12];
+        float3 normals[12];
+        int count = 0;
+        float3 mass_point(0.0f, 0.0f, 0.0f);
+        for (const auto& edge : edges) {
+            const float d0 = corner_dist[edge[0]];
+            const float d1 = corner_dist[edge[1]];
+            if ((d0 < 0.0f) == (d1 < 0.0f)) {
+                continue;
+            }
+            const float3 p0 = cell_min + float3(float(edge[0] & 1), float((edge[0] >> 1) & 1), float(edge[0] >> 2)) * g.cell_size;
+            const float3 p1 = cell_min + float3(float(edge[1] & 1), float((edge[1] >> 1) & 1), float(edge[1] >> 2)) * g.cell_size;
+            const float3 p = p0 + (p1 - p0) * (d0 / (d0 - d1));
+            float3 gradient;
+            sdf.eval_gradient(p, &gradient, nullptr, g.cell_size);
+            const float len = length(gradient);
+            points[count] = p;
+            normals[count] = (std::isfinite(len) && len > 0.0f) ? gradient / len : float3(0.0f, 0.0f, 0.0f);
+            mass_point += p;
+            ++count;
+        }
+        mass_point = mass_point / float(std::max(count, 1));
+
+        float3 v = mass_point;
+        for (int iter = 0; iter < SOLVER_ITERATIONS; ++iter) {
+            float3 correction(0.0f, 0.0f, 0.0f);
+            for (int i = 0; i < count; ++i) {
+                correction += normals[i] * dot(normals[i], points[i] - v);
+            }
+            v = clamp(v + correction / float(std::max(count, 1)), cell_min, cell_max);
+        }
+
+        block_vertex result;
+        result.cell = g.cell_key(gx, gy, gz);
+        result.position = v;
+        float3 gradient;
+        sdf.eval_gradient(v, &gradient, &result.material_id, g.cell_size);
+        const float len = length(gradient);
+        result.normal = (std::isfinite(len) && len > 0.0f) ? gradient / len : float3(0.0f, 1.0f, 0.0f);
+        return result;
+    }
+
+    sdf_mesh polygonize(const sdf_program& sdf, int resolution, float iso_cells) {
+        sdf_mesh mesh;
+        if (!sdf.is_bounded() || sdf.code.empty() || resolution < 1) {
+            std::cout << "[fractals::polygonize]: SDF is unbounded or empty, it can't be polygonised" << std::endl;
+            return mesh;
+        }
+
+        grid g;
+        const float3 size = sdf.box_max - sdf.box_min;
+        g.cell_size = std::max(size.x, std::max(size.y, size.z)) / float(resolution);
+        g.iso = iso_cells * g.cell_size;
+        const float margin = g.cell_size + std::max(g.iso, 0.0f);
+        g.origin = sdf.box_min - margin;
+        for (int axis = 0; axis < 3; ++axis) {
+            const uint32_t cells = uint32_t(std::ceil((size[axis] + 2.0f * margin) / g.cell_size));
+            g.cells[axis] = (cells + BLOCK_CELLS - 1) / BLOCK_CELLS * BLOCK_CELLS;
+        }
+
+        const std::vector<octree_node> blocks = find_surface_blocks(sdf, g);
+
+        // 1. vertices of crossed cells, block by block
+        std::vector<std::vector<float>> block_dist(blocks.size());
+        std::vector<std::vector<block_vertex>> block_vertices(blocks.size());
+#pragma omp parallel for schedule(dynamic)
+        for (int b = 0; b < int(blocks.size()); ++b) {
+            const octree_node& block = blocks[b];
+            auto& dist = block_dist[b];
+            dist.resize(BLOCK_CORNERS * BLOCK_CORNERS * BLOCK_CORNERS);
+            sample_block(sdf, g, block, dist.data());
+
+            for (int z = 0; z < BLOCK_CELLS; ++z) {
+                for (int y = 0; y < BLOCK_CELLS; ++y) {
+                    for (int x = 0; x < BLOCK_CELLS; ++x) {
+                        float corner_dist[8];
+                        int inside = 0;
+                        for (int c = 0; c < 8; ++c) {
+                            corner_dist[c] = dist[corner_index(x + (c & 1), y + ((c >> 1) & 1), z + (c >> 2))];
+                            inside += corner_dist[c] < 0.0f;
+                        }
+                        if (inside == 0 || inside == 8) {
+                            continue;
+                        }
+                        block_vertices[b].push_back(cell_vertex(sdf, g, block.x * BLOCK_CELLS + x, block.y * BLOCK_CELLS + y,
+                                                                block.z * BLOCK_CELLS + z, corner_dist));
+                    }
+                }
+            }
+        }
+
+        // 2. global vertex ids
+        std::unordered_map<uint64_t, uint32_t> cell_to_vertex;
+        for (const auto& vertices : block_vertices) {
+            for (const block_vertex& v : vertices) {
+                cell_to_vertex[v.cell] = uint32_t(mesh.positions.size());
+                mesh.positions.push_back(v.position);
+                mesh.normals.push_back(v.normal);
+            }
+        }
+
+        // 3. a quad for every crossed edge, connecting vertices of four cells around it; block owns edges starting at its corners
+        std::vector<std::vector<uint32_t>> block_indices(blocks.size());
+        std::vector<std::vector<uint32_t>> block_materials(blocks.size());
+#pragma omp parallel for schedule(dynamic)
+        for (int b = 0; b < int(blocks.size()); ++b) {
+            const octree_node& block = blocks[b];
+            const auto& dist = block_dist[b];
+            const auto& vertices = block_vertices[b];
+            std::unordered_map<uint64_t, uint32_t> material_of_cell;
+            for (const block_vertex& v : vertices) {
+                material_of_cell[v.cell] = v.material_id;
+            }
+
+            for (int z = 0; z < BLOCK_CELLS; ++z) {
+                for (int y = 0; y < BLOCK_CELLS; ++y) {
+                    for (int x = 0; x < BLOCK_CELLS; ++x) {
+                        const int local[3] = {x, y, z};
+                        const uint32_t global[3] = {block.x * BLOCK_CELLS + x, block.y * BLOCK_CELLS + y, block.z * BLOCK_CELLS + z};
+                        const float d0 = dist[corner_index(x, y, z)];
+                        for (int axis = 0; axis < 3; ++axis) {
+                            int end[3] = {local[0], local[1], local[2]};
+                            ++end[axis];
+                            const float d1 = dist[corner_index(end[0], end[1], end[2])];
+                            if ((d0 < 0.0f) == (d1 < 0.0f)) {
+                                continue;
+                            }
+                            const int u = (axis + 1) % 3;
+                            const int v = (axis + 2) % 3;
+                            if (global[u] == 0 || global[v] == 0) {
+                                continue;
+                            }
+
+                            // cells around the edge in counter-clockwise order looking along the axis
+                            uint32_t quad[4];
+                            bool complete = true;
+                            for (int k = 0; k < 4 && complete; ++k) {
+                                uint32_t cell[3] = {global[0], global[1], global[2]};
+                                cell[u] -= (k == 0 || k == 3) ? 1 : 0;
+                                cell[v] -= (k == 0 || k == 1) ? 1 : 0;
+                                auto found = cell_to_vertex.find(g.cell_key(cell[0], cell[1], cell[2]));
+                                complete = found != cell_to_vertex.end();
+                                quad[k] = complete ? found->second : 0;
+                            }
+                            if (!complete) {
+                                continue;
+                            }
+                            // faces look outside, i.e. towards positive distance
+                            if (d0 >= 0.0f) {
+                                std::swap(quad[1], quad[3]);
+                            }
+
+                            auto& indices = block_indices[b];
+                            indices.insert(indices.end(), {quad[0], quad[1], quad[2], quad[0], quad[2], quad[3]});
+                            auto mat = material_of_cell.find(g.cell_key(global[0], global[1], global[2]));
+                            const uint32_t material_id = mat != material_of_cell.end() ? mat->second : 0;
+                            block_materials[b].insert(block_materials[b].end(), {material_id, material_id});
+                        }
+                    }
+                }
+            }
+        }
+
+        for (size_t b = 0; b < blocks.size(); ++b) {
+            mesh.indices.insert(mesh.indices.end(), block_indices[b].begin(), block_indices[b].end());
+            mesh.material_ids.insert(mesh.material_ids.end(), block_materials[b].begin(), block_materials[b].end());
+        }
+        return mesh;
+    }
+}
@@ -0,0 +1,25 @@
+#pragma once
+
+#include <LiteMath.h>
+#include <cstdint>
+#include <vector>
+
+#include "sdf_program.hpp"
+
+namespace fractals {
+
+    struct sdf_mesh {
+        std::vector<float3> positions;
+        std::vector<float3> normals;
+        std::vector<uint32_t> indices;
+        std::vector<uint32_t> material_ids; // per triangle, index in 'sdf_program::materials'
+    };
+
+    // Dual contouring of a bounded SDF with 'resolution' cells along the longest side of its bounding box.
+    // Space is culled with an octree down to blocks of 8x8x8 cells: a node is dropped when its unbounding sphere
+    // doesn't reach the surface. Blocks are contoured in parallel; one vertex is placed per cell crossed by surface
+    // (minimizing distance to tangent planes at edge crossings) and every crossed edge gives a quad.
+    // Surface is taken at distance 'iso_cells' (in cells) from the zero level: distance estimators of fractals are
+    // never negative, so they need a positive level to have inside and outside. Returns empty mesh for unbounded SDF.
+    sdf_mesh polygonize(const sdf_program& sdf, int resolution, float iso_cells = 0.0f);
+}
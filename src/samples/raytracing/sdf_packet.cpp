@@ -0,0 +1,280 @@
+// 8-wide (packet) evaluation of SDF programs and ray marching. This file is compiled for the baseline instruction set and,
+// with RAYTRACING_AVX2 option, once more with AVX2 and FMA (see CMakeLists.txt): SIMD types live in an instruction set
+// namespace, so both builds link into one program and 'march_packet8' is picked at run time.
+#include "sdf_packet.hpp"
+#include "fractals.hpp"
+#include "simd8.hpp"
+
+namespace fractals {
+
+    using simd::float8;
+    using simd::float3_8;
+    using simd::mask8;
+
+    // primitives without 8-wide implementation are evaluated lane by lane
+    template<typename Func>
+    static float8 eval_lanes(const float3_8& p, Func func) {
+        alignas(32) float x[simd::WIDTH], y[simd::WIDTH], z[simd::WIDTH], result[simd::WIDTH];
+        p.x.store(x);
+        p.y.store(y);
+        p.z.store(z);
+        for (int i = 0; i < simd::WIDTH; ++i) {
+            result[i] = func(float3(x[i], y[i], z[i]));
+        }
+        return float8::load(result);
+    }
+
+    static float8 sd_box8(const float3_8& p, float3 half_size) {
+        float3_8 q = abs(p) - float3_8(half_size);
+        float3_8 outside = {max(q.x, 0.0f), max(q.y, 0.0f), max(q.z, 0.0f)};
+        return length(outside) + min(max(q.x, max(q.y, q.z)), 0.0f);
+    }
+
+    // same as fractal5
+    static float8 sierpinski8(float3_8 z, int iterations, float scale) {
+        const float3_8 a1(float3(1.0f, 1.0f, 1.0f));
+        const float3_8 a2(float3(-1.0f, -1.0f, 1.0f));
+        const float3_8 a3(float3(1.0f, -1.0f, -1.0f));
+        const float3_8 a4(float3(-1.0f, 1.0f, -1.0f));
+        for (int n = 0; n < iterations; ++n) {
+            float3_8 c = a1;
+            float8 dist = length(z - a1);
+            float8 d = length(z - a2);
+            mask8 closer = d < dist;
+            c = select(closer, c, a2);
+            dist = min(d, dist);
+            d = length(z - a3);
+            closer = d < dist;
+            c = select(closer, c, a3);
+            dist = min(d, dist);
+            d = length(z - a4);
+            c = select(d < dist, c, a4);
+            z = float8(scale) * z - c * float8(scale - 1.0f);
+        }
+        return length(z) * float8(std::pow(scale, float(-iterations)));
+    }
+
+    // same as fractal2; inner scaling branch of sphereFold is never taken there (r == minRadius2), so it is omitted
+    static float8 mandelbox8(float3_8 z, int iterations) {
+        const float3_8 offset = z;
+        float8 dr = 1.0f;
+        for (int n = 0; n < iterations; ++n) {
+            z = float3_8(clamp(z.x, -10.0f, 10.0f), clamp(z.y, -10.0f, 10.0f), clamp(z.z, -10.0f, 10.0f)) * float8(2.0f) - z;
+            float8 r2 = dot(z, z);
+            float8 temp = select(r2 < float8(1.0f), float8(1.0f), float8(1.0f) / r2);
+            z = z * temp;
+            dr = dr * temp;
+            z = float8(2.0f) * z + offset;
+            dr = dr * 2.0f + 1.0f;
+        }
+        return length(z) / abs(dr);
+    }
+
+    static float3_8 rep8(const float3_8& p, float c) {
+        return {p.x - c * round(p.x / c), p.y - c * round(p.y / c), p.z - c * round(p.z / c)};
+    }
+
+    static float3_8 rep_lim8(const float3_8& p, float c, float3 l) {
+        return {p.x - c * clamp(round(p.x / c), -l.x, l.x),
+                p.y - c * clamp(round(p.y / c), -l.y, l.y),
+                p.z - c * clamp(round(p.z / c), -l.z, l.z)};
+    }
+
+    float8 sdf_program::eval8(const float3_8& positions, float detail) const {
+        float8   dist[MAX_STACK];
+        float3_8 pos[MAX_STACK];
+        float    details[MAX_STACK];
+        int top = 0;
+        int pos_top = 0;
+        float3_8 p = positions;
+
+        for (const sdf_instr& instr : code) {
+            const float* k = params.data() + instr.param_offset;
+            float8 d;
+            switch (instr.op) {
+            case sdf_op::sphere:      d = length(p - float3_8(float3(k[0], k[1], k[2]))) - k[3]; break;
+            case sdf_op::box:         d = sd_box8(p - float3_8(float3(k[0], k[1], k[2])), float3(k[3], k[4], k[5])); break;
+            case sdf_op::plane:       d = abs(p.y - k[0]); break;
+            case sdf_op::octahedron: {
+                float3_8 q = abs(p - float3_8(float3(k[0], k[1], k[2])));
+                d = (q.x + q.y + q.z - k[3]) * 0.57735027f;
+                break;
+            }
+            case sdf_op::octahedron_exact: {
+                const float3 center = float3(k[0], k[1], k[2]);
+                const float size = k[3];
+                d = eval_lanes(p, [&](float3 x) { return sdOctahedron_exact(x - center, size); });
+                break;
+            }
+            case sdf_op::pyramid: {
+                const float height = k[0];
+                d = eval_lanes(p, [&](float3 x) { return sdPyramid(x, height); });
+                break;
+            }
+            case sdf_op::sierpinski:  d = sierpinski8(p, lod_iterations(int(k[0]), k[1], SIERPINSKI_SIZE, detail), k[1]); break;
+            case sdf_op::mandelbox:   d = mandelbox8(p, lod_iterations(30, 2.0f, MANDELBOX_SIZE, detail)); break;
+            case sdf_op::sphere_grid: {
+                float3_8 center = {round(p.x), round(p.y), 0.0f};
+                d = length(center - p) - 0.3f;
+                break;
+            }
+
+            case sdf_op::op_union:
+                --top;
+                dist[top - 1] = min(dist[top - 1], dist[top]);
+                continue;
+            case sdf_op::op_smooth_union: {
+                --top;
+                const float8 a = dist[top - 1];
+                const float8 b = dist[top];
+                const float8 h = clamp(0.5f + 0.5f * (b - a) / k[0], 0.0f, 1.0f);
+                dist[top - 1] = b + (a - b) * h - k[0] * h * (1.0f - h);
+                continue;
+            }
+            case sdf_op::op_subtraction:
+                --top;
+                dist[top - 1] = max(dist[top - 1], -dist[top]);
+                continue;
+            case sdf_op::op_intersection:
+                --top;
+                dist[top - 1] = max(dist[top - 1], dist[top]);
+                continue;
+
+            case sdf_op::translate:
+                details[pos_top] = detail;
+                pos[pos_top++] = p;
+                p = p - float3_8(float3(k[0], k[1], k[2]));
+                continue;
+            case sdf_op::transform:
+                details[pos_top] = detail;
+                detail = transform_detail(k, detail);
+                pos[pos_top++] = p;
+                p = float3_8(k[0] * p.x + k[1] * p.y + k[2]  * p.z + k[3],
+                             k[4] * p.x + k[5] * p.y + k[6]  * p.z + k[7],
+                             k[8] * p.x + k[9] * p.y + k[10] * p.z + k[11]);
+                continue;
+            case sdf_op::repeat:
+                details[pos_top] = detail;
+                pos[pos_top++] = p;
+                p = rep8(p, k[0]);
+                continue;
+            case sdf_op::repeat_limited:
+                details[pos_top] = detail;
+                pos[pos_top++] = p;
+                p = rep_lim8(p, k[0], float3(k[1], k[2], k[3]));
+                continue;
+            case sdf_op::pop_position:
+                p = pos[--pos_top];
+                detail = details[pos_top];
+                continue;
+            }
+
+            // only primitives get here
+            dist[top++] = d;
+        }
+
+        return top == 0 ? float8(INFINITY) : dist[0];
+    }
+
+    static float8 box_distance8(const float3_8& p, float3 box_min, float3 box_max) {
+        const float3_8 q = {max(max(float8(box_min.x) - p.x, p.x - float8(box_max.x)), float8(0.0f)),
+                            max(max(float8(box_min.y) - p.y, p.y - float8(box_max.y)), float8(0.0f)),
+                            max(max(float8(box_min.z) - p.z, p.z - float8(box_max.z)), float8(0.0f))};
+        return length(q);
+    }
+
+    // the whole packet goes down the tree while at least one lane may find a closer object there
+    float8 sdf_bvh::eval8(const float3_8& positions, float detail) const {
+        float8 best = INFINITY;
+        for (uint32_t id : m_unbounded) {
+            best = min(best, m_objects[id].eval8(positions, detail));
+        }
+        if (m_nodes.empty()) {
+            return best;
+        }
+
+        uint32_t stack[MAX_DEPTH + 1];
+        int top = 0;
+        stack[top++] = 0;
+        while (top > 0) {
+            const uint32_t node_id = stack[--top];
+            const node& n = m_nodes[node_id];
+            if (simd::none(box_distance8(positions, n.box_min, n.box_max) < best)) {
+                continue;
+            }
+            if (n.count > 0) {
+                for (uint32_t i = n.first; i < n.first + n.count; ++i) {
+                    const sdf_program& obj = m_objects[m_bounded[i]];
+                    if (n.count > 1 && simd::none(box_distance8(positions, obj.box_min, obj.box_max) < best)) {
+                        continue;
+                    }
+                    best = min(best, obj.eval8(positions, detail));
+                }
+                continue;
+            }
+            stack[top++] = n.first;
+            stack[top++] = node_id + 1;
+        }
+        return best;
+    }
+
+    float8 sdf_brick_map::eval8(const float3_8& positions) const {
+        alignas(32) float x[simd::WIDTH], y[simd::WIDTH], z[simd::WIDTH], result[simd::WIDTH];
+        positions.x.store(x);
+        positions.y.store(y);
+        positions.z.store(z);
+        for (int i = 0; i < simd::WIDTH; ++i) {
+            result[i] = eval(float3(x[i], y[i], z[i]));
+        }
+        return float8::load(result);
+    }
+
+    // cached distance while it is far from surface, exact SDF near surface
+    static float8 marching_distance8(const packet_march& params, const float3_8& positions, float detail) {
+        if (params.cache == nullptr) {
+            return params.sdf->eval8(positions, detail);
+        }
+        const float8 dist = params.cache->eval8(positions);
+        const mask8 near = dist <= float8(params.cache->refine_distance());
+        return simd::any(near) ? simd::select(near, dist, params.sdf->eval8(positions, detail)) : dist;
+    }
+
+    namespace SIMD8_ISA {
+
+        int march_packet8(const packet_march& params, const float3* ray_pos, const float3* ray_dir, const float* t_start,
+                          const float* t_far, const float* cone_width, int active_bits, float* out_t) {
+            using namespace simd;
+            const float3_8 pos = float3_8::load(ray_pos);
+            const float3_8 dir = float3_8::load(ray_dir);
+            const float8 far = float8::load(t_far);
+            const float8 width = float8::load(cone_width);
+            const float8 angle = params.cone_angle;
+            const float8 min_dist = params.min_dist;
+            mask8 active = mask_from_bits(active_bits);
+
+            // fractal iterations are the same for all lanes, so the smallest footprint of the packet is used for them
+            float8 t = float8::load(t_start);
+            float8 footprint = width + t * angle;
+            float8 dist = marching_distance8(params, pos + dir * t, reduce_min(footprint));
+            float8 omega = params.relaxation;
+            float8 step_len = dist * omega;
+            mask8 hit = mask_none();
+            for (int step = 0; step < params.steps && any(active); ++step) {
+                t = select(active, t, t + step_len);
+                footprint = width + t * angle;
+                float8 next_dist = marching_distance8(params, pos + dir * t, reduce_min(footprint));
+                mask8 failed = active & (omega > float8(1.0f)) & (next_dist + dist < step_len);
+                t = select(failed, t, t - step_len);
+                omega = select(failed, omega, float8(1.0f));
+                dist = select(failed, next_dist, dist);
+                step_len = select(failed, dist * omega, dist);
+
+                mask8 converged = and_not(active, failed) & (dist <= max(footprint, min_dist));
+                hit = hit | converged;
+                active = and_not(active, converged | (t >= far));
+            }
+            t.store(out_t);
+            return bits(hit);
+        }
+    }
+}
@@ -0,0 +1,32 @@
+#pragma once
+
+#include <LiteMath.h>
+#include <cstdint>
+
+#include "sdf_bvh.hpp"
+#include "sdf_brick_map.hpp"
+
+namespace fractals {
+
+    // settings of 'march_packet8' shared by all lanes
+    struct packet_march {
+        const sdf_bvh* sdf = nullptr;
+        const sdf_brick_map* cache = nullptr; // distance used far from surface, exact SDF is evaluated near it; may be null
+        int steps = 0;
+        float min_dist = 0.0f;
+        float relaxation = 1.0f;
+        float cone_angle = 0.0f;              // pixel footprint along the ray is 'cone_width + t * cone_angle'
+    };
+
+    // 'march_ray' for 8 rays at once: lanes set in 'active_bits' are marched and retire when they come closer than
+    // 'min_dist' (or their footprint) to the surface or go further than 't_far'. Returns bits of lanes which hit the
+    // surface, 'out_t' gets distances along all rays. Arguments are plain arrays, so callers don't depend on the
+    // instruction set the packet code is built for.
+    using march_packet8_func = int(const packet_march& params, const float3* ray_pos, const float3* ray_dir, const float* t_start,
+                                   const float* t_far, const float* cone_width, int active_bits, float* out_t);
+
+    // sdf_packet.cpp is built for the baseline instruction set and, with RAYTRACING_AVX2 option, once more with AVX2
+    // and FMA; the latter may be called only if CPU supports them
+    namespace generic { march_packet8_func march_packet8; }
+    namespace avx2    { march_packet8_func march_packet8; }
+}
@@ -0,0 +1,365 @@
+#include "sdf_program.hpp"
+#include "dual.hpp"
+
+#include <algorithm>
+#include <iostream>
+
+namespace fractals {
+
+    static bool is_finite(float3 v) {
+        return std::isfinite(v.x) && std::isfinite(v.y) && std::isfinite(v.z);
+    }
+
+    static sdf_node_ptr make_primitive(sdf_op op, std::vector<float> params, material mat) {
+        auto node = std::make_shared<sdf_node>();
+        node->op = op;
+        node->params = std::move(params);
+        node->mat = mat;
+        return node;
+    }
+
+    static sdf_node_ptr make_bounded_primitive(sdf_op op, std::vector<float> params, material mat, float3 box_min, float3 box_max) {
+        auto node = std::make_shared<sdf_node>();
+        node->op = op;
+        node->params = std::move(params);
+        node->mat = mat;
+        node->box_min = box_min;
+        node->box_max = box_max;
+        return node;
+    }
+
+    static std::shared_ptr<sdf_node> make_operation(sdf_op op, std::vector<float> params, sdf_node_ptr a, sdf_node_ptr b = nullptr) {
+        auto node = std::make_shared<sdf_node>();
+        node->op = op;
+        node->params = std::move(params);
+        node->a = std::move(a);
+        node->b = std::move(b);
+        return node;
+    }
+
+    sdf_node_ptr sphere(float3 center, float radius, material mat) {
+        return make_bounded_primitive(sdf_op::sphere, {center.x, center.y, center.z, radius}, mat,
+                                      center - radius, center + radius);
+    }
+
+    sdf_node_ptr box(float3 center, float3 half_size, material mat) {
+        return make_bounded_primitive(sdf_op::box, {center.x, center.y, center.z, half_size.x, half_size.y, half_size.z}, mat,
+                                      center - half_size, center + half_size);
+    }
+
+    sdf_node_ptr plane(float height, material mat) {
+        return make_primitive(sdf_op::plane, {height}, mat);
+    }
+
+    sdf_node_ptr octahedron(float3 center, float size, material mat, bool exact) {
+        return make_bounded_primitive(exact ? sdf_op::octahedron_exact : sdf_op::octahedron, {center.x, center.y, center.z, size}, mat,
+                                      center - size, center + size);
+    }
+
+    sdf_node_ptr pyramid(float height, material mat) {
+        return make_bounded_primitive(sdf_op::pyramid, {height}, mat, float3(-0.5f, 0.0f, -0.5f), float3(0.5f, height, 0.5f));
+    }
+
+    sdf_node_ptr sierpinski(int iterations, float scale, material mat) {
+        return make_bounded_primitive(sdf_op::sierpinski, {float(iterations), scale}, mat,
+                                      float3(-1.0f, -1.0f, -1.0f), float3(1.0f, 1.0f, 1.0f));
+    }
+
+    sdf_node_ptr mandelbox(material mat) {
+        return make_primitive(sdf_op::mandelbox, {}, mat);
+    }
+
+    sdf_node_ptr sphere_grid(material mat) {
+        return make_primitive(sdf_op::sphere_grid, {}, mat);
+    }
+
+    sdf_node_ptr op_union(sdf_node_ptr a, sdf_node_ptr b) {
+        auto node = make_operation(sdf_op::op_union, {}, a, b);
+        node->box_min = min(a->box_min, b->box_min);
+        node->box_max = max(a->box_max, b->box_max);
+        return node;
+    }
+
+    sdf_node_ptr op_smooth_union(sdf_node_ptr a, sdf_node_ptr b, float k) {
+        // polynomial smooth minimum lowers the distance by at most k/4
+        auto node = make_operation(sdf_op::op_smooth_union, {k}, a, b);
+        node->box_min = min(a->box_min, b->box_min) - 0.25f * k;
+        node->box_max = max(a->box_max, b->box_max) + 0.25f * k;
+        return node;
+    }
+
+    sdf_node_ptr op_subtraction(sdf_node_ptr a, sdf_node_ptr b) {
+        auto node = make_operation(sdf_op::op_subtraction, {}, a, b);
+        node->box_min = a->box_min;
+        node->box_max = a->box_max;
+        return node;
+    }
+
+    sdf_node_ptr op_intersection(sdf_node_ptr a, sdf_node_ptr b) {
+        auto node = make_operation(sdf_op::op_intersection, {}, a, b);
+        node->box_min = max(a->box_min, b->box_min);
+        node->box_max = min(a->box_max, b->box_max);
+        return node;
+    }
+
+    sdf_node_ptr translate(float3 offset, sdf_node_ptr child) {
+        auto node = make_operation(sdf_op::translate, {offset.x, offset.y, offset.z}, child);
+        node->box_min = child->box_min + offset;
+        node->box_max = child->box_max + offset;
+        return node;
+    }
+
+    // only rigid transformations (rotation and translation) keep distance field exact
+    sdf_node_ptr transform(const float4x4& local_to_world, sdf_node_ptr child) {
+        const float4x4 world_to_local = inverse4x4(local_to_world);
+        std::vector<float> params;
+        for (int row = 0; row < 3; ++row) {
+            for (int col = 0; col < 4; ++col) {
+                params.push_back(world_to_local(row, col));
+            }
+        }
+
+        auto node = make_operation(sdf_op::transform, std::move(params), child);
+        if (is_finite(child->box_min) && is_finite(child->box_max)) {
+            node->box_min = float3(+INFINITY, +INFINITY, +INFINITY);
+            node->box_max = float3(-INFINITY, -INFINITY, -INFINITY);
+            for (int corner = 0; corner < 8; ++corner) {
+                float3 p = float3((corner & 1) ? child->box_max.x : child->box_min.x,
+                                  (corner & 2) ? child->box_max.y : child->box_min.y,
+                                  (corner & 4) ? child->box_max.z : child->box_min.z);
+                p = local_to_world * p;
+                node->box_min = min(node->box_min, p);
+                node->box_max = max(node->box_max, p);
+            }
+        }
+        return node;
+    }
+
+    sdf_node_ptr repeat(float period, sdf_node_ptr child) {
+        return make_operation(sdf_op::repeat, {period}, child);
+    }
+
+    sdf_node_ptr repeat_limited(float period, float3 limits, sdf_node_ptr child) {
+        auto node = make_operation(sdf_op::repeat_limited, {period, limits.x, limits.y, limits.z}, child);
+        node->box_min = child->box_min - period * limits;
+        node->box_max = child->box_max + period * limits;
+        return node;
+    }
+
+    namespace {
+        struct sdf_compiler {
+            sdf_program& program;
+            int dist_depth = 0;
+            int pos_depth = 0;
+            bool overflow = false;
+
+            void emit_instr(sdf_op op, uint16_t material_id, const std::vector<float>& params) {
+                program.code.push_back({op, material_id, uint32_t(program.params.size())});
+                program.params.insert(program.params.end(), params.begin(), params.end());
+            }
+
+            void emit(const sdf_node& node) {
+                switch (node.op) {
+                case sdf_op::op_union:
+                case sdf_op::op_smooth_union:
+                case sdf_op::op_subtraction:
+                case sdf_op::op_intersection:
+                    emit(*node.a);
+                    emit(*node.b);
+                    emit_instr(node.op, 0, node.params);
+                    --dist_depth;
+                    return;
+
+                case sdf_op::translate:
+                case sdf_op::transform:
+                case sdf_op::repeat:
+                case sdf_op::repeat_limited:
+                    emit_instr(node.op, 0, node.params);
+                    overflow |= (++pos_depth > sdf_program::MAX_STACK);
+                    emit(*node.a);
+                    emit_instr(sdf_op::pop_position, 0, {});
+                    --pos_depth;
+                    return;
+
+                default:
+                    emit_instr(node.op, uint16_t(program.materials.size()), node.params);
+                    program.materials.push_back(node.mat);
+                    overflow |= (++dist_depth > sdf_program::MAX_STACK);
+                    return;
+                }
+            }
+        };
+    }
+
+    sdf_program compile(const sdf_node_ptr& root) {
+        sdf_program program;
+        sdf_compiler compiler = {program};
+        compiler.emit(*root);
+        if (compiler.overflow || program.materials.size() > 0xFFFF) {
+            std::cout << "[fractals::compile]: SDF tree is too deep or too large for the interpreter" << std::endl;
+            return sdf_program();
+        }
+        program.box_min = root->box_min;
+        program.box_max = root->box_max;
+        return program;
+    }
+
+    using autodiff::dual;
+    using autodiff::dual3;
+
+    template<typename Func>
+    static float eval_primitive(float3 p, Func func) {
+        return func(p);
+    }
+
+    // primitives which are not templates on position type get their gradient from tetrahedral finite differences
+    template<typename Func>
+    static dual eval_primitive(const dual3& p, Func func) {
+        const float eps = 1.0e-4f;
+        const float3 k0 = float3(1.0f, -1.0f, -1.0f);
+        const float3 k1 = float3(-1.0f, -1.0f, 1.0f);
+        const float3 k2 = float3(-1.0f, 1.0f, -1.0f);
+        const float3 k3 = float3(1.0f, 1.0f, 1.0f);
+        const float3 x = p.value();
+        const float3 grad = (k0 * func(x + k0 * eps) + k1 * func(x + k1 * eps) + k2 * func(x + k2 * eps) + k3 * func(x + k3 * eps)) / (4.0f * eps);
+        return dual(func(x), p.x.d * grad.x + p.y.d * grad.y + p.z.d * grad.z);
+    }
+
+    // 'V' is float3 for distance only or dual3 for distance and gradient
+    template<typename V, bool WITH_MATERIAL>
+    static auto run_program(const sdf_program& program, V p, float detail, uint16_t* out_material_id) {
+        using S = decltype(length(p));
+        S        dist[sdf_program::MAX_STACK];
+        uint16_t mat[sdf_program::MAX_STACK];
+        V        pos[sdf_program::MAX_STACK];
+        float    details[sdf_program::MAX_STACK];
+        int top = 0;
+        int pos_top = 0;
+
+        const float* params = program.params.data();
+        for (const sdf_instr& instr : program.code) {
+            const float* k = params + instr.param_offset;
+            S d = 0.0f;
+            switch (instr.op) {
+            case sdf_op::sphere:           d = length(p - float3(k[0], k[1], k[2])) - k[3]; break;
+            case sdf_op::box:              d = sdBox(p - float3(k[0], k[1], k[2]), float3(k[3], k[4], k[5])); break;
+            case sdf_op::plane:            d = sdPlane(p - float3(0.0f, k[0], 0.0f), k[0]); break;
+            case sdf_op::octahedron:       d = sdOctahedron(p - float3(k[0], k[1], k[2]), k[3]); break;
+            case sdf_op::octahedron_exact: {
+                const float3 center = float3(k[0], k[1], k[2]);
+                const float size = k[3];
+                d = eval_primitive(p, [&](float3 x) { return sdOctahedron_exact(x - center, size); });
+                break;
+            }
+            case sdf_op::pyramid: {
+                const float height = k[0];
+                d = eval_primitive(p, [&](float3 x) { return sdPyramid(x, height); });
+                break;
+            }
+            case sdf_op::sierpinski:       d = fractal5(p, lod_iterations(int(k[0]), k[1], SIERPINSKI_SIZE, detail), k[1]); break;
+            case sdf_op::mandelbox:        d = fractal2(p, lod_iterations(30, 2.0f, MANDELBOX_SIZE, detail)); break;
+            case sdf_op::sphere_grid:      d = infinite_spheres(p); break;
+
+            case sdf_op::op_union:
+                --top;
+                if (dist[top] < dist[top - 1]) {
+                    dist[top - 1] = dist[top];
+                    if (WITH_MATERIAL) mat[top - 1] = mat[top];
+                }
+                continue;
+            case sdf_op::op_smooth_union: {
+                --top;
+                const S a = dist[top - 1];
+                const S b = dist[top];
+                const S h = clamp(0.5f + 0.5f * (b - a) / k[0], S(0.0f), S(1.0f));
+                dist[top - 1] = b + (a - b) * h - k[0] * h * (1.0f - h);
+                if (WITH_MATERIAL && b < a) mat[top - 1] = mat[top];
+                continue;
+            }
+            case sdf_op::op_subtraction:
+                --top;
+                dist[top - 1] = max(dist[top - 1], -dist[top]);
+                continue;
+            case sdf_op::op_intersection:
+                --top;
+                if (dist[top] > dist[top - 1]) {
+                    dist[top - 1] = dist[top];
+                    if (WITH_MATERIAL) mat[top - 1] = mat[top];
+                }
+                continue;
+
+            case sdf_op::translate:
+                details[pos_top] = detail;
+                pos[pos_top++] = p;
+                p = p - float3(k[0], k[1], k[2]);
+                continue;
+            case sdf_op::transform:
+                details[pos_top] = detail;
+                detail = transform_detail(k, detail);
+                pos[pos_top++] = p;
+                p = V(k[0] * p.x + k[1] * p.y + k[2]  * p.z + k[3],
+                      k[4] * p.x + k[5] * p.y + k[6]  * p.z + k[7],
+                      k[8] * p.x + k[9] * p.y + k[10] * p.z + k[11]);
+                continue;
+            case sdf_op::repeat:
+                details[pos_top] = detail;
+                pos[pos_top++] = p;
+                p = opRep(p, k[0]);
+                continue;
+            case sdf_op::repeat_limited:
+                details[pos_top] = detail;
+                pos[pos_top++] = p;
+                p = opRepLim(p, k[0], float3(k[1], k[2], k[3]));
+                continue;
+            case sdf_op::pop_position:
+                p = pos[--pos_top];
+                detail = details[pos_top];
+                continue;
+            }
+
+            // only primitives get here
+            dist[top] = d;
+            if (WITH_MATERIAL) mat[top] = instr.material_id;
+            ++top;
+        }
+
+        if (top == 0) {
+            return S(INFINITY);
+        }
+        if (WITH_MATERIAL) *out_material_id = mat[0];
+        return dist[0];
+    }
+
+    float sdf_program::eval(float3 position) const {
+        return run_program<float3, false>(*this, position, 0.0f, nullptr);
+    }
+
+    float sdf_program::eval(float3 position, material* out_material) const {
+        uint16_t material_id = 0;
+        float dist = run_program<float3, true>(*this, position, 0.0f, &material_id);
+        if (out_material != nullptr && !materials.empty()) {
+            *out_material = materials[material_id];
+        }
+        return dist;
+    }
+
+    uint32_t sdf_program::eval_material_id(float3 position) const {
+        uint16_t material_id = 0;
+        run_program<float3, true>(*this, position, 0.0f, &material_id);
+        return material_id;
+    }
+
+    float sdf_program::eval_lod(float3 position, float detail) const {
+        return run_program<float3, false>(*this, position, detail, nullptr);
+    }
+
+    float sdf_program::eval_gradient(float3 position, float3* out_gradient, uint32_t* out_material_id, float detail) const {
+        uint16_t material_id = 0;
+        dual dist = run_program<dual3, true>(*this, dual3::variable(position), detail, &material_id);
+        *out_gradient = dist.d;
+        if (out_material_id != nullptr) {
+            *out_material_id = material_id;
+        }
+        return dist.v;
+    }
+}
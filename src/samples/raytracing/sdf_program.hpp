@@ -0,0 +1,125 @@
+#pragma once
+
+#include <LiteMath.h>
+#include <cmath>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include "fractals.hpp"
+#include "simd8.hpp"
+
+namespace fractals {
+
+    // SDF scene is described by a tree of nodes (see builder functions below) and then compiled into a flat
+    // postfix program. Interpreter keeps distances and positions on small fixed size stacks, so evaluating
+    // the whole scene is one loop over a contiguous array without virtual calls or heap allocations.
+    enum class sdf_op : uint8_t {
+        // primitives: push distance to the surface at the current position
+        sphere,            // center.xyz, radius
+        box,               // center.xyz, half_size.xyz
+        plane,             // height
+        octahedron,        // center.xyz, size
+        octahedron_exact,  // center.xyz, size
+        pyramid,           // height
+        sierpinski,        // iterations, scale
+        mandelbox,         //
+        sphere_grid,       //
+
+        // CSG: pop two distances (a, then b on top), push the result
+        op_union,          //
+        op_smooth_union,   // k
+        op_subtraction,    // a minus b
+        op_intersection,   //
+
+        // domain: save the current position and replace it; pop_position restores the saved one
+        translate,         // offset.xyz
+        transform,         // world to local 3x4 matrix, row major
+        repeat,            // period
+        repeat_limited,    // period, limits.xyz
+        pop_position,      //
+    };
+
+    struct sdf_instr {
+        sdf_op   op;
+        uint16_t material_id;  // primitives only
+        uint32_t param_offset; // index of the first parameter in sdf_program::params
+    };
+
+    struct sdf_node;
+    using sdf_node_ptr = std::shared_ptr<const sdf_node>;
+
+    struct sdf_node {
+        sdf_op op;
+        std::vector<float> params;
+        material mat;
+        sdf_node_ptr a; // CSG operand or child of domain operation
+        sdf_node_ptr b; // CSG operand
+
+        // conservative bounding box of the surface; unbounded (infinite) objects can't be put to acceleration structure
+        float3 box_min = float3(-INFINITY, -INFINITY, -INFINITY);
+        float3 box_max = float3(+INFINITY, +INFINITY, +INFINITY);
+    };
+
+    sdf_node_ptr sphere(float3 center, float radius, material mat);
+    sdf_node_ptr box(float3 center, float3 half_size, material mat);
+    sdf_node_ptr plane(float height, material mat);
+    sdf_node_ptr octahedron(float3 center, float size, material mat, bool exact = false);
+    sdf_node_ptr pyramid(float height, material mat);
+    sdf_node_ptr sierpinski(int iterations, float scale, material mat); // tetrahedron with vertices at (+-1, +-1, +-1)
+    sdf_node_ptr mandelbox(material mat);
+    sdf_node_ptr sphere_grid(material mat);
+
+    sdf_node_ptr op_union(sdf_node_ptr a, sdf_node_ptr b);
+    sdf_node_ptr op_smooth_union(sdf_node_ptr a, sdf_node_ptr b, float k);
+    sdf_node_ptr op_subtraction(sdf_node_ptr a, sdf_node_ptr b);
+    sdf_node_ptr op_intersection(sdf_node_ptr a, sdf_node_ptr b);
+
+    sdf_node_ptr translate(float3 offset, sdf_node_ptr child);
+    sdf_node_ptr transform(const float4x4& local_to_world, sdf_node_ptr child);
+    sdf_node_ptr repeat(float period, sdf_node_ptr child);
+    sdf_node_ptr repeat_limited(float period, float3 limits, sdf_node_ptr child);
+
+    struct sdf_program {
+        static constexpr int MAX_STACK = 32;
+
+        std::vector<sdf_instr> code;
+        std::vector<float>     params;
+        std::vector<material>  materials;
+
+        float3 box_min = float3(-INFINITY, -INFINITY, -INFINITY);
+        float3 box_max = float3(+INFINITY, +INFINITY, +INFINITY);
+
+        bool is_bounded() const {
+            return std::isfinite(box_min.x) && std::isfinite(box_min.y) && std::isfinite(box_min.z) &&
+                   std::isfinite(box_max.x) && std::isfinite(box_max.y) && std::isfinite(box_max.z);
+        }
+
+        float eval(float3 position) const;
+        float eval(float3 position, material* out_material) const;
+        uint32_t eval_material_id(float3 position) const; // index in 'materials' of the closest primitive
+        // 'detail' is the size of the smallest feature worth resolving (e.g. pixel footprint): fractals stop iterating
+        // when their details become smaller; 0 is full detail
+        float eval_lod(float3 position, float detail) const;
+        // distance, its gradient (not normalized) and material from one evaluation with dual numbers
+        float eval_gradient(float3 position, float3* out_gradient, uint32_t* out_material_id = nullptr, float detail = 0.0f) const;
+        simd::float8 eval8(const simd::float3_8& positions, float detail = 0.0f) const; // distances for 8 positions at once, see sdf_packet.cpp
+    };
+
+    // returns empty program (infinite distance everywhere) if the tree is too deep for interpreter stacks
+    sdf_program compile(const sdf_node_ptr& root);
+
+    // size of the first iteration details for 'lod_iterations' (scalar and packet interpreters): circumradius of the
+    // sierpinski tetrahedron and folding limit of the mandelbox
+    static constexpr float SIERPINSKI_SIZE = 1.7320508f;
+    static constexpr float MANDELBOX_SIZE = 10.0f;
+
+    // 'transform' may scale space, so detail size is scaled too (uniform scale is assumed)
+    static inline float transform_detail(const float* k, float detail) {
+        if (!(detail > 0.0f)) {
+            return detail;
+        }
+        const float det = k[0] * (k[5] * k[10] - k[6] * k[9]) - k[1] * (k[4] * k[10] - k[6] * k[8]) + k[2] * (k[4] * k[9] - k[5] * k[8]);
+        return detail * std::cbrt(std::abs(det));
+    }
+}
@@ -0,0 +1,179 @@
+#pragma once
+
+#include <LiteMath.h>
+#include <cmath>
+#include <cstdint>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#endif
+
+// 8-wide float vectors for packet ray marching: AVX2 when it is enabled for compiler (sdf_packet.cpp with RAYTRACING_AVX2
+// option), plain arrays otherwise; compiler usually vectorizes fallback loops with SSE.
+// Instruction set is a part of mangled names (inline namespace), so code using these types may be built for both
+// instruction sets in one program without clashes; see 'select_march_packet8'.
+#if defined(__AVX2__)
+#define SIMD8_ISA avx2
+#else
+#define SIMD8_ISA generic
+#endif
+
+namespace simd {
+inline namespace SIMD8_ISA {
+
+    static constexpr int WIDTH = 8;
+
+#if defined(__AVX2__)
+
+    struct mask8 {
+        __m256 v;
+    };
+
+    struct float8 {
+        __m256 v;
+
+        float8() = default;
+        float8(__m256 a) : v(a) {}
+        float8(float a) : v(_mm256_set1_ps(a)) {}
+
+        static float8 load(const float* p) { return _mm256_loadu_ps(p); }
+        void store(float* p) const { _mm256_storeu_ps(p, v); }
+    };
+
+    inline float8 operator+(float8 a, float8 b) { return _mm256_add_ps(a.v, b.v); }
+    inline float8 operator-(float8 a, float8 b) { return _mm256_sub_ps(a.v, b.v); }
+    inline float8 operator*(float8 a, float8 b) { return _mm256_mul_ps(a.v, b.v); }
+    inline float8 operator/(float8 a, float8 b) { return _mm256_div_ps(a.v, b.v); }
+
+    inline float8 min(float8 a, float8 b) { return _mm256_min_ps(a.v, b.v); }
+    inline float8 max(float8 a, float8 b) { return _mm256_max_ps(a.v, b.v); }
+    inline float8 abs(float8 a) { return _mm256_andnot_ps(_mm256_set1_ps(-0.0f), a.v); }
+    inline float8 sqrt(float8 a) { return _mm256_sqrt_ps(a.v); }
+    inline float8 trunc(float8 a) { return _mm256_round_ps(a.v, _MM_FROUND_TO_ZERO | _MM_FROUND_NO_EXC); }
+
+    inline mask8 operator<(float8 a, float8 b)  { return {_mm256_cmp_ps(a.v, b.v, _CMP_LT_OQ)}; }
+    inline mask8 operator<=(float8 a, float8 b) { return {_mm256_cmp_ps(a.v, b.v, _CMP_LE_OQ)}; }
+    inline mask8 operator>(float8 a, float8 b)  { return {_mm256_cmp_ps(a.v, b.v, _CMP_GT_OQ)}; }
+    inline mask8 operator>=(float8 a, float8 b) { return {_mm256_cmp_ps(a.v, b.v, _CMP_GE_OQ)}; }
+
+    inline mask8 operator&(mask8 a, mask8 b) { return {_mm256_and_ps(a.v, b.v)}; }
+    inline mask8 operator|(mask8 a, mask8 b) { return {_mm256_or_ps(a.v, b.v)}; }
+    inline mask8 and_not(mask8 a, mask8 b)   { return {_mm256_andnot_ps(b.v, a.v)}; } // a & ~b
+
+    inline mask8 mask_all()  { return {_mm256_castsi256_ps(_mm256_set1_epi32(-1))}; }
+    inline mask8 mask_none() { return {_mm256_setzero_ps()}; }
+    inline int   bits(mask8 m) { return _mm256_movemask_ps(m.v); }
+    inline mask8 mask_from_bits(int b) {
+        const __m256i lane_bits = _mm256_setr_epi32(1, 2, 4, 8, 16, 32, 64, 128);
+        return {_mm256_castsi256_ps(_mm256_cmpeq_epi32(_mm256_and_si256(_mm256_set1_epi32(b), lane_bits), lane_bits))};
+    }
+
+    // b where mask is set, a otherwise
+    inline float8 select(mask8 m, float8 a, float8 b) { return _mm256_blendv_ps(a.v, b.v, m.v); }
+
+#else
+
+    struct mask8 {
+        bool v[WIDTH];
+    };
+
+    struct float8 {
+        float v[WIDTH];
+
+        float8() = default;
+        float8(float a) { for (int i = 0; i < WIDTH; ++i) v[i] = a; }
+
+        static float8 load(const float* p) { float8 r; for (int i = 0; i < WIDTH; ++i) r.v[i] = p[i]; return r; }
+        void store(float* p) const { for (int i = 0; i < WIDTH; ++i) p[i] = v[i]; }
+    };
+
+#define SIMD8_BINARY(result_type, name, expr) \
+    inline result_type name(float8 a, float8 b) { result_type r; for (int i = 0; i < WIDTH; ++i) r.v[i] = (expr); return r; }
+
+    SIMD8_BINARY(float8, operator+, a.v[i] + b.v[i])
+    SIMD8_BINARY(float8, operator-, a.v[i] - b.v[i])
+    SIMD8_BINARY(float8, operator*, a.v[i] * b.v[i])
+    SIMD8_BINARY(float8, operator/, a.v[i] / b.v[i])
+    SIMD8_BINARY(float8, min, a.v[i] < b.v[i] ? a.v[i] : b.v[i])
+    SIMD8_BINARY(float8, max, a.v[i] > b.v[i] ? a.v[i] : b.v[i])
+    SIMD8_BINARY(mask8, operator<, a.v[i] < b.v[i])
+    SIMD8_BINARY(mask8, operator<=, a.v[i] <= b.v[i])
+    SIMD8_BINARY(mask8, operator>, a.v[i] > b.v[i])
+    SIMD8_BINARY(mask8, operator>=, a.v[i] >= b.v[i])
+
+#undef SIMD8_BINARY
+
+    inline float8 abs(float8 a)   { float8 r; for (int i = 0; i < WIDTH; ++i) r.v[i] = std::fabs(a.v[i]); return r; }
+    inline float8 sqrt(float8 a)  { float8 r; for (int i = 0; i < WIDTH; ++i) r.v[i] = std::sqrt(a.v[i]); return r; }
+    inline float8 trunc(float8 a) { float8 r; for (int i = 0; i < WIDTH; ++i) r.v[i] = std::trunc(a.v[i]); return r; }
+
+    inline mask8 operator&(mask8 a, mask8 b) { mask8 r; for (int i = 0; i < WIDTH; ++i) r.v[i] = a.v[i] && b.v[i]; return r; }
+    inline mask8 operator|(mask8 a, mask8 b) { mask8 r; for (int i = 0; i < WIDTH; ++i) r.v[i] = a.v[i] || b.v[i]; return r; }
+    inline mask8 and_not(mask8 a, mask8 b)   { mask8 r; for (int i = 0; i < WIDTH; ++i) r.v[i] = a.v[i] && !b.v[i]; return r; }
+
+    inline mask8 mask_all()  { mask8 r; for (int i = 0; i < WIDTH; ++i) r.v[i] = true;  return r; }
+    inline mask8 mask_none() { mask8 r; for (int i = 0; i < WIDTH; ++i) r.v[i] = false; return r; }
+    inline int   bits(mask8 m) { int r = 0; for (int i = 0; i < WIDTH; ++i) r |= int(m.v[i]) << i; return r; }
+    inline mask8 mask_from_bits(int b) { mask8 r; for (int i = 0; i < WIDTH; ++i) r.v[i] = (b >> i) & 1; return r; }
+
+    inline float8 select(mask8 m, float8 a, float8 b) { float8 r; for (int i = 0; i < WIDTH; ++i) r.v[i] = m.v[i] ? b.v[i] : a.v[i]; return r; }
+
+#endif
+
+    inline bool any(mask8 m)  { return bits(m) != 0; }
+    inline bool none(mask8 m) { return bits(m) == 0; }
+
+    inline float8 operator-(float8 a) { return float8(0.0f) - a; }
+    inline float8 clamp(float8 a, float8 lo, float8 hi) { return min(max(a, lo), hi); }
+
+    // rounds half away from zero, same as std::round
+    inline float8 round(float8 a) {
+        float8 t = trunc(a);
+        float8 frac = a - t;
+        t = select(frac >= float8(0.5f), t, t + float8(1.0f));
+        return select(frac <= float8(-0.5f), t, t - float8(1.0f));
+    }
+
+    inline float lane(float8 a, int i) {
+        alignas(32) float tmp[WIDTH];
+        a.store(tmp);
+        return tmp[i];
+    }
+
+    inline float reduce_min(float8 a) {
+        alignas(32) float tmp[WIDTH];
+        a.store(tmp);
+        float result = tmp[0];
+        for (int i = 1; i < WIDTH; ++i) result = tmp[i] < result ? tmp[i] : result;
+        return result;
+    }
+
+    // structure of arrays: 8 points or directions
+    struct float3_8 {
+        float8 x, y, z;
+
+        float3_8() = default;
+        float3_8(float8 a_x, float8 a_y, float8 a_z) : x(a_x), y(a_y), z(a_z) {}
+        float3_8(LiteMath::float3 a) : x(a.x), y(a.y), z(a.z) {}
+
+        static float3_8 load(const LiteMath::float3* p) {
+            alignas(32) float tx[WIDTH], ty[WIDTH], tz[WIDTH];
+            for (int i = 0; i < WIDTH; ++i) { tx[i] = p[i].x; ty[i] = p[i].y; tz[i] = p[i].z; }
+            return {float8::load(tx), float8::load(ty), float8::load(tz)};
+        }
+        LiteMath::float3 get(int i) const { return LiteMath::float3(lane(x, i), lane(y, i), lane(z, i)); }
+    };
+
+    inline float3_8 operator+(const float3_8& a, const float3_8& b) { return {a.x + b.x, a.y + b.y, a.z + b.z}; }
+    inline float3_8 operator-(const float3_8& a, const float3_8& b) { return {a.x - b.x, a.y - b.y, a.z - b.z}; }
+    inline float3_8 operator*(const float3_8& a, float8 b) { return {a.x * b, a.y * b, a.z * b}; }
+    inline float3_8 operator*(float8 a, const float3_8& b) { return {a * b.x, a * b.y, a * b.z}; }
+    inline float3_8 abs(const float3_8& a) { return {abs(a.x), abs(a.y), abs(a.z)}; }
+    inline float3_8 select(mask8 m, const float3_8& a, const float3_8& b) {
+        return {select(m, a.x, b.x), select(m, a.y, b.y), select(m, a.z, b.z)};
+    }
+
+    inline float8 dot(const float3_8& a, const float3_8& b) { return a.x * b.x + a.y * b.y + a.z * b.z; }
+    inline float8 length(const float3_8& a) { return sqrt(dot(a, a)); }
+}
+}
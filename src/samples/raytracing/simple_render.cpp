@@ -4,6 +4,7 @@
 #include <geom/vk_mesh.h>
 #include <vk_pipeline.h>
 #include <vk_buffers.h>
+#include <cmath>
 
 SimpleRender::SimpleRender(uint32_t a_width, uint32_t a_height) : m_width(a_width), m_height(a_height)
 {
@@ -113,6 +114,11 @@ void SimpleRender::InitVulkan(const char** a_instanceExtensions, uint32_t a_inst
   LoaderConfig conf = {};
   conf.load_geometry = true;
   conf.load_materials = MATERIAL_LOAD_MODE::MATERIALS_ONLY;
+  conf.scene_cache_dir = "../cache/scenes";
+  // CPU ray tracer traverses and shades compact streams, and they are the only CPU copy of geometry: interleaved vertices
+  // are freed after upload, so Hydra change files update instances, materials and cameras but not meshes
+  conf.split_vertex_streams = !ENABLE_HARDWARE_RT;
+  conf.keep_geometry_on_cpu = ENABLE_HARDWARE_RT;
   if(ENABLE_HARDWARE_RT)
   {
     conf.build_acc_structs = true;
@@ -470,6 +476,14 @@ void SimpleRender::LoadScene(const char* path)
   m_light_info = std::make_unique<PointLight>(float3{1.0f, 1.0f, 1.0f}, float3{0.0f, 0.0f, 0.0f});
   m_light_info2 = std::make_unique<DirectionalLight>(float3{1.0f, 1.0f, 1.0f}, float3{sin(3.1415f / 4.0f), cos(3.1415f / 4.0f), 0.0f});
 
+  if(ENABLE_SDF_MESH)
+  {
+    cmesh::SimpleMesh sdfMesh;
+    std::vector<MaterialData_pbrMR> sdfMaterials;
+    if(RayTracer::polygonize_sdf_scene(SDF_MESH_RESOLUTION, &sdfMesh, &sdfMaterials))
+      m_pScnMgr->AddProceduralMesh(std::move(sdfMesh), std::move(sdfMaterials), LiteMath::float4x4());
+  }
+
   m_pScnMgr->LoadScene(path);
   if(ENABLE_HARDWARE_RT)
   {
@@ -564,9 +578,27 @@ void SimpleRender::DrawFrameSimple()
   vkQueueWaitIdle(m_presentationResources.queue);
 }
 
+// plays the first animation of the scene in a loop
+void SimpleRender::UpdateAnimation(float a_time)
+{
+  if(m_pScnMgr->AnimationsNum() == 0)
+    return;
+
+  const float duration = m_pScnMgr->AnimationDuration(0);
+  m_pScnMgr->Animate(0, duration > 0.0f ? std::fmod(a_time, duration) : 0.0f);
+  const auto moved = m_pScnMgr->CommitInstanceTransforms();
+  if(moved.empty() || !m_pAccelStruct)
+    return;
+
+  for(auto instId : moved)
+    m_pAccelStruct->UpdateInstance(instId, m_pScnMgr->GetInstanceMatrix(instId));
+  m_pAccelStruct->CommitScene();
+}
+
 void SimpleRender::DrawFrame(float a_time, DrawMode a_mode)
 {
   UpdateUniformBuffer(a_time);
+  UpdateAnimation(a_time);
 
   switch (a_mode)
   {
@@ -709,6 +741,18 @@ void SimpleRender::SetupGUIElements()
         ImGui::Checkbox("ray marching", &tracer->m_is_marching);
         if (tracer->m_is_marching) {
             ImGui::SliderInt("Max marching steps", &tracer->m_marching_steps, 1, 200);
+            ImGui::SliderFloat("Marching over-relaxation", &tracer->m_marching_relaxation, 1.0f, 1.9f);
+            ImGui::Checkbox("Cone marching pre-pass", &tracer->m_marching_prepass);
+            ImGui::Checkbox("Brick map SDF cache", &tracer->m_marching_cache);
+            ImGui::SliderFloat("Fractal LOD (pixels)", &tracer->m_marching_lod, 0.0f, 4.0f);
+            ImGui::Checkbox("Soft shadows", &tracer->m_marching_soft_shadows);
+            if (tracer->m_marching_soft_shadows) {
+                ImGui::SliderFloat("Shadow sharpness", &tracer->m_soft_shadow_sharpness, 1.0f, 64.0f);
+            }
+            ImGui::Checkbox("Ambient occlusion", &tracer->m_marching_ao);
+            if (tracer->m_marching_ao) {
+                ImGui::SliderFloat("AO radius", &tracer->m_ao_radius, 0.01f, 2.0f);
+            }
             //ImGui::SliderFloat("Marching min distance", &tracer->m_min_matching_distance, 1.0e-8f, 1.0f);
         }
         float background_color[3];
@@ -14,6 +14,8 @@
 #include <vk_images.h>
 #include <vk_swapchain.h>
 #include <string>
+#include <map>
+#include <tuple>
 #include <iostream>
 #include <render/CrossRT.h>
 #include "raytracing.h"
@@ -40,6 +42,12 @@ public:
   const std::string VERTEX_SHADER_PATH   = "../resources/shaders/simple.vert";
   const std::string FRAGMENT_SHADER_PATH = "../resources/shaders/simple.frag";
   const bool        ENABLE_HARDWARE_RT   = false;
+  const std::string CPU_RT_IMPL_NAME     = "Embree"; // "BVH2Flat" uses in-repo BVH with BLAS cached on disk
+  const bool        ENABLE_SDF_GEOMETRY  = false;    // put bounded SDF objects to the CPU scene as user geometry
+  const bool        ENABLE_SDF_MESH      = false;    // polygonise bounded SDF objects and add them to the scene as a triangle mesh
+  const int         SDF_MESH_RESOLUTION  = 256;      // cells along the longest side of each polygonised object
+  const bool        ENABLE_MESH_SDF      = false;    // bake scene meshes to SDFs for soft shadows and AO in ray marching mode
+  const int         MESH_SDF_RESOLUTION  = 64;       // samples along the longest side of each baked mesh
 
   static constexpr uint64_t STAGING_MEM_SIZE = 16 * 16 * 1024u;
 
@@ -59,6 +67,7 @@ public:
   void UpdateView();
 
   void LoadScene(const char *path) override;
+  void ApplySceneDelta(const char *path); // Hydra change file written on top of the loaded scene
   void DrawFrame(float a_time, DrawMode a_mode) override;
 
   //////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
@@ -156,6 +165,12 @@ protected:
 
   std::shared_ptr<ISceneObject> m_pAccelStruct = nullptr;
   std::unique_ptr<RayTracer> m_pRayTracerCPU;
+  std::vector<uint32_t> m_rtGeomIds;                                 // geometry id in m_pAccelStruct by mesh id
+  std::vector<uint32_t> m_rtInstanceFlags;                           // CRT_INSTANCE_FLAGS for instances by mesh id
+  std::map<std::tuple<int, float, float>, uint16_t> m_rtAlphaMasks;  // see GetAlphaMaskId
+  uint32_t m_rtSdfGeomId = uint32_t(-1);
+  const void* m_rtVertexData = nullptr; // scene manager storage referenced by m_pAccelStruct geometry
+  const void* m_rtIndexData  = nullptr;
   std::unique_ptr<RayTracer_GPU> m_pRayTracerGPU;
   void RayTraceCPU();
   void RayTraceGPU();
@@ -206,6 +221,8 @@ protected:
   void SetupQuadDescriptors();
   void SetupRTImage();
   void SetupRTScene();
+  uint32_t AddRTMesh(uint32_t a_meshId);
+  void AddRTInstances();
   // ***************************
 
   void SetupSimplePipeline();
@@ -214,6 +231,7 @@ protected:
 
   void CreateUniformBuffer();
   void UpdateUniformBuffer(float a_time);
+  void UpdateAnimation(float a_time);
 
   void Cleanup();
 
@@ -1,6 +1,11 @@
 #include <render/VulkanRTX.h>
 #include "simple_render.h"
 #include "raytracing_generated.h"
+#include <render/alpha_mask.h>
+
+#include <map>
+#include <tuple>
+#include <cmath>
 
 // ***************************************************************************************************************************
 // setup full screen quad to display ray traced image
@@ -40,43 +45,182 @@ void SimpleRender::SetupRTImage()
 }
 // ***************************************************************************************************************************
 
-// convert geometry data and pass it to acceleration structure builder
-void SimpleRender::SetupRTScene()
+// alpha masks are shared between meshes; key is (base color texture, base color alpha, cutoff)
+using AlphaMaskKey = std::tuple<int, float, float>;
+
+static uint16_t GetAlphaMaskId(ISceneObject* a_pAccelStruct, const SceneManager& a_scnMgr, uint32_t a_matId, std::map<AlphaMaskKey, uint16_t>& a_masks)
 {
-  m_pAccelStruct = std::shared_ptr<ISceneObject>(CreateSceneRT(""));
-  m_pAccelStruct->ClearGeom();
+  const auto& materials = a_scnMgr.GetMaterials();
+  if(a_matId >= materials.size() || materials[a_matId].alphaMode != 1) // only 'MASK' materials are alpha tested
+    return GeomAlphaTest::NO_MASK;
+
+  const auto& mat      = materials[a_matId];
+  const auto& texInfos = a_scnMgr.GetTextureInfos();
+  const bool  hasTex   = mat.baseColorTexId >= 0 && size_t(mat.baseColorTexId) < texInfos.size() &&
+                         texInfos[mat.baseColorTexId].is_ok && texInfos[mat.baseColorTexId].channels == 4 &&
+                         texInfos[mat.baseColorTexId].bytesPerChannel == 1;
+
+  if(!hasTex && mat.baseColor.w >= mat.alphaCutoff)
+    return GeomAlphaTest::NO_MASK;
+
+  const AlphaMaskKey key = { hasTex ? mat.baseColorTexId : -1, mat.baseColor.w, mat.alphaCutoff };
+  auto found = a_masks.find(key);
+  if(found != a_masks.end())
+    return found->second;
+
+  // texel is opaque if alpha * baseColor.w >= cutoff; without texture (or with too high cutoff) whole triangle is transparent
+  const float threshold = mat.baseColor.w > 0.0f ? 255.0f * mat.alphaCutoff / mat.baseColor.w : 256.0f;
 
+  uint32_t maskId = uint32_t(-1);
+  if(hasTex && threshold <= 255.0f)
+  {
+    const auto& texInfo = texInfos[mat.baseColorTexId];
+    const auto  texels  = loadImageLDR(texInfo);
+    maskId = a_pAccelStruct->AddAlphaMask(texels.data() + 3, texInfo.width, texInfo.height, 4, uint8_t(std::ceil(threshold)));
+  }
+  else
+  {
+    const uint8_t transparent = 0;
+    maskId = a_pAccelStruct->AddAlphaMask(&transparent, 1, 1, 1, 1);
+  }
+
+  const uint16_t res = maskId < GeomAlphaTest::NO_MASK ? uint16_t(maskId) : GeomAlphaTest::NO_MASK;
+  a_masks[key] = res;
+  return res;
+}
+
+// storage referenced by geometry of acceleration structure: split streams if scene manager keeps them, interleaved vertices otherwise
+static std::pair<const void*, const void*> RTGeometryStorage(const std::shared_ptr<SceneManager>& a_pScnMgr)
+{
+  auto splitData = a_pScnMgr->GetSplitMeshData();
+  if(splitData != nullptr)
+    return {splitData->PositionStorage(), splitData->IndexStorage()};
+  return {a_pScnMgr->GetMeshData()->VertexData(), a_pScnMgr->GetMeshData()->IndexData()};
+}
+
+// convert geometry data of a mesh and pass it to acceleration structure builder
+uint32_t SimpleRender::AddRTMesh(uint32_t a_meshId)
+{
   auto meshesData = m_pScnMgr->GetMeshData();
-  std::unordered_map<uint32_t, uint32_t> meshMap;
-  for(size_t i = 0; i < m_pScnMgr->MeshesNum(); ++i)
+  auto splitData  = m_pScnMgr->GetSplitMeshData();
+  const auto& info = m_pScnMgr->GetMeshInfo(a_meshId);
+  const bool split = splitData != nullptr && a_meshId < splitData->MeshesNum();
+  auto vertices = split ? nullptr : reinterpret_cast<float*>((char*)meshesData->VertexData() + info.m_vertexOffset * meshesData->SingleVertexSize());
+  auto stride = meshesData->SingleVertexSize() / sizeof(float);
+
+  // geometry references scene manager storage, see m_rtVertexData
+  uint32_t geomId = uint32_t(-1);
+  if(!split)
+    geomId = m_pAccelStruct->AddGeom_Triangles3fShared(vertices, info.m_vertNum, meshesData->SingleVertexSize(),
+      meshesData->IndexData() + info.m_indexOffset, info.m_indNum);
+  else if(splitData->PositionData(a_meshId) != nullptr && splitData->IndexData32(a_meshId) != nullptr)
+    geomId = m_pAccelStruct->AddGeom_Triangles3fShared(splitData->PositionData(a_meshId), info.m_vertNum, 3 * sizeof(float),
+      splitData->IndexData32(a_meshId), info.m_indNum);
+  else
   {
-    const auto& info = m_pScnMgr->GetMeshInfo(i);
-    auto vertices = reinterpret_cast<float*>((char*)meshesData->VertexData() + info.m_vertexOffset * meshesData->SingleVertexSize());
-    auto indices = meshesData->IndexData() + info.m_indexOffset;
+    // quantised positions and 16-bit indices are unpacked, acceleration structure copies them anyway
+    std::vector<float4> positions(info.m_vertNum);
+    std::vector<uint32_t> indices(info.m_indNum);
+    splitData->DecodePositions(a_meshId, positions.data());
+    splitData->DecodeIndices(a_meshId, indices.data());
+    geomId = m_pAccelStruct->AddGeom_Triangles4f(positions.data(), positions.size(), indices.data(), indices.size());
+  }
 
-    auto stride = meshesData->SingleVertexSize() / sizeof(float);
-    std::vector<float4> m_vPos4f(info.m_vertNum);
-    std::vector<uint32_t> m_indicesReordered(info.m_indNum);
-    for(size_t v = 0; v < info.m_vertNum; ++v)
-    {
-      m_vPos4f[v] = float4(vertices[v * stride + 0], vertices[v * stride + 1], vertices[v * stride + 2], 1.0f);
-    }
-    memcpy(m_indicesReordered.data(), indices, info.m_indNum * sizeof(m_indicesReordered[0]));
+  // alpha test is enabled only for meshes which have at least one triangle with 'MASK' material;
+  // mesh casts shadows unless all its triangles are glass or light sources
+  //
+  const auto& matIds    = m_pScnMgr->GetMaterialIDs();
+  const auto& materials = m_pScnMgr->GetMaterials();
+  std::vector<uint16_t> triMasks(info.m_indNum / 3, GeomAlphaTest::NO_MASK);
+  bool hasAlphaTest = false;
+  bool occluding    = materials.empty() || triMasks.empty() || (!split && info.m_indexOffset / 3 + triMasks.size() > matIds.size());
+  for(size_t t = 0; t < triMasks.size() && (split || info.m_indexOffset / 3 + t < matIds.size()); ++t)
+  {
+    const uint32_t matId = split ? splitData->MaterialId(a_meshId, uint32_t(t)) : matIds[info.m_indexOffset / 3 + t];
+    triMasks[t]  = GetAlphaMaskId(m_pAccelStruct.get(), *m_pScnMgr, matId, m_rtAlphaMasks);
+    hasAlphaTest = hasAlphaTest || (triMasks[t] != GeomAlphaTest::NO_MASK);
+    occluding    = occluding || matId >= materials.size() || !RayTracer::is_non_occluding_material(materials[matId]);
+  }
 
-    auto geomId = m_pAccelStruct->AddGeom_Triangles4f(m_vPos4f.data(), m_vPos4f.size(), m_indicesReordered.data(), m_indicesReordered.size());
-    meshMap[i] = geomId;
+  m_rtInstanceFlags.resize(std::max<size_t>(m_rtInstanceFlags.size(), a_meshId + 1));
+  m_rtInstanceFlags[a_meshId] = occluding ? uint32_t(CRT_INSTANCE_DEFAULT) : uint32_t(CRT_INSTANCE_DEFAULT & ~CRT_INSTANCE_CAST_SHADOWS);
+
+  if(hasAlphaTest)
+  {
+    std::vector<float2> texCoords(info.m_vertNum);
+    for(size_t v = 0; v < info.m_vertNum; ++v)
+      texCoords[v] = split ? splitData->TexCoord(a_meshId, uint32_t(v)) : float2(vertices[v * stride + 4], vertices[v * stride + 5]);
+    m_pAccelStruct->SetGeomAlphaTest(geomId, triMasks.data(), texCoords.data(), texCoords.size());
   }
 
+  return geomId;
+}
+
+// instance ids in acceleration structure are the same as in scene manager, ray tracer relies on it
+void SimpleRender::AddRTInstances()
+{
   m_pAccelStruct->ClearScene();
   for(size_t i = 0; i < m_pScnMgr->InstancesNum(); ++i)
   {
     const auto& info = m_pScnMgr->GetInstanceInfo(i);
-    if(meshMap.count(info.mesh_id))
-      m_pAccelStruct->AddInstance(meshMap[info.mesh_id], m_pScnMgr->GetInstanceMatrix(info.inst_id));
+    m_pAccelStruct->AddInstance(m_rtGeomIds[info.mesh_id], m_pScnMgr->GetInstanceMatrix(info.inst_id), CRT_RAY_MASK_ALL, m_rtInstanceFlags[info.mesh_id]);
   }
+  if(m_rtSdfGeomId != uint32_t(-1))
+    m_pAccelStruct->AddInstance(m_rtSdfGeomId, LiteMath::float4x4());
   m_pAccelStruct->CommitScene();
 }
 
+void SimpleRender::SetupRTScene()
+{
+  m_pAccelStruct = std::shared_ptr<ISceneObject>(CreateSceneRT(CPU_RT_IMPL_NAME.c_str()));
+  m_pAccelStruct->ClearGeom();
+
+  m_rtAlphaMasks.clear();
+  std::tie(m_rtVertexData, m_rtIndexData) = RTGeometryStorage(m_pScnMgr);
+  m_rtGeomIds.resize(m_pScnMgr->MeshesNum());
+  for(size_t i = 0; i < m_pScnMgr->MeshesNum(); ++i)
+    m_rtGeomIds[i] = AddRTMesh(uint32_t(i));
+
+  m_rtSdfGeomId = ENABLE_SDF_GEOMETRY ? RayTracer::add_sdf_geometry(m_pAccelStruct.get()) : uint32_t(-1);
+
+  AddRTInstances();
+}
+
+void SimpleRender::ApplySceneDelta(const char* path)
+{
+  SceneDelta delta;
+  if(!m_pScnMgr->ApplySceneDelta(path, false, &delta) || ENABLE_HARDWARE_RT) // scene manager has already rebuilt TLAS
+    return;
+
+  // geometry ids must stay equal to mesh ids, so SDF geometry placed after meshes makes us rebuild everything;
+  // the same if storage referenced by geometry has been reallocated to fit new meshes
+  const bool storageMoved = RTGeometryStorage(m_pScnMgr) != std::make_pair(m_rtVertexData, m_rtIndexData);
+  if(storageMoved || (!delta.addedMeshes.empty() && m_rtSdfGeomId != uint32_t(-1)))
+  {
+    SetupRTScene();
+    if(m_pRayTracerCPU)
+      m_pRayTracerCPU->SetScene(m_pAccelStruct);
+    return;
+  }
+
+  for(auto meshId : delta.addedMeshes)
+  {
+    m_rtGeomIds.resize(std::max<size_t>(m_rtGeomIds.size(), meshId + 1));
+    m_rtGeomIds[meshId] = AddRTMesh(meshId);
+  }
+
+  if(delta.instancesChanged)
+  {
+    AddRTInstances();
+  }
+  else if(!delta.movedInstances.empty())
+  {
+    for(auto instId : delta.movedInstances)
+      m_pAccelStruct->UpdateInstance(instId, m_pScnMgr->GetInstanceMatrix(instId));
+    m_pAccelStruct->CommitScene();
+  }
+}
+
 // perform ray tracing on the CPU and upload resulting image on the GPU
 void SimpleRender::RayTraceCPU()
 {
@@ -85,6 +229,8 @@ void SimpleRender::RayTraceCPU()
     m_pRayTracerCPU = std::make_unique<RayTracer>(m_width, m_height);
     m_pRayTracerCPU->SetScene(m_pAccelStruct);
     m_pRayTracerCPU->SetSceneManager(m_pScnMgr);
+    if(ENABLE_MESH_SDF)
+      m_pRayTracerCPU->bake_mesh_sdfs(MESH_SDF_RESOLUTION);
     m_pRayTracerCPU->AddLight(m_light_info2.get());
     m_pRayTracerCPU->AddLight(m_light_info.get());
     std::string cubemap_base_dir = "../resources/cubemaps/yokohama/";
@@ -106,13 +252,28 @@ void SimpleRender::RayTraceCPU()
   }
 
   m_pRayTracerCPU->UpdateView(m_cam.pos, m_inverseProjViewMatrix);
+  m_pRayTracerCPU->update_sdf_geometry();
+  if(m_pRayTracerCPU->m_is_marching)
+    m_pRayTracerCPU->prepare_marching();
+  if(m_pRayTracerCPU->m_is_marching)
+  {
 #pragma omp parallel for default(none)
-  for (size_t j = 0; j < m_height; ++j)
+    for (size_t j = 0; j < m_height; ++j)
+    {
+      for (size_t i = 0; i < m_width; i += 8)
+        m_pRayTracerCPU->CastAARays8(i, j, m_raytracedImageData.data(), m_pRayTracerCPU->m_aa_rays);
+    }
+  }
+  else
   {
-    for (size_t i = 0; i < m_width; ++i)
+#pragma omp parallel for default(none)
+    for (size_t j = 0; j < m_height; ++j)
     {
-      m_pRayTracerCPU->CastAARays(i, j, m_raytracedImageData.data(), m_pRayTracerCPU->m_aa_rays);
-      //m_pRayTracerCPU->CastSingleRay(i, j, m_raytracedImageData.data());
+      for (size_t i = 0; i < m_width; ++i)
+      {
+        m_pRayTracerCPU->CastAARays(i, j, m_raytracedImageData.data(), m_pRayTracerCPU->m_aa_rays);
+        //m_pRayTracerCPU->CastSingleRay(i, j, m_raytracedImageData.data());
+      }
     }
   }
 
@@ -0,0 +1,63 @@
+// Incremental update of the brick map must keep cached distance a lower bound of the exact one: an object moved
+// toward empty bricks far from its old and new positions makes their cached center distances stale.
+#include "../sdf_brick_map.hpp"
+
+#include <cstdio>
+
+using namespace fractals;
+
+static const material MAT = {{1.0f, 1.0f, 1.0f}, 0.0f};
+
+// anchors keep the scene box (and so the brick grid) fixed, so moving the sphere updates the map incrementally
+static bool update(sdf_brick_map& cache, float3 sphere_center, sdf_program* out_combined) {
+    const sdf_node_ptr nodes[] = {sphere({-4.0f, -4.0f, -4.0f}, 0.25f, MAT), sphere({4.0f, 4.0f, 4.0f}, 0.25f, MAT),
+                                  sphere(sphere_center, 0.5f, MAT)};
+    std::vector<sdf_program> objects;
+    for (const auto& node : nodes) {
+        objects.push_back(compile(node));
+    }
+    *out_combined = compile(op_union(op_union(nodes[0], nodes[1]), nodes[2]));
+    return cache.update(objects, *out_combined, 64);
+}
+
+// cached distance must not exceed the exact one anywhere outside of surface
+static int count_overestimates(const sdf_brick_map& cache, const sdf_program& exact, const char* stage) {
+    const int steps = 64;
+    int failed = 0;
+    for (int z = 0; z <= steps; ++z) {
+        for (int y = 0; y <= steps; ++y) {
+            for (int x = 0; x <= steps; ++x) {
+                const float3 p = float3(-4.5f, -4.5f, -4.5f) + float3(float(x), float(y), float(z)) * (9.0f / float(steps));
+                const float dist = exact.eval(p);
+                const float cached = cache.eval(p);
+                if (dist > 0.0f && cached > dist + 1.0e-4f) {
+                    if (failed == 0) {
+                        std::printf("%s: cached distance %f > exact %f at (%f, %f, %f)\n", stage, cached, dist, p.x, p.y, p.z);
+                    }
+                    ++failed;
+                }
+            }
+        }
+    }
+    return failed;
+}
+
+int main() {
+    sdf_brick_map cache;
+    sdf_program combined;
+    if (!update(cache, float3(3.0f, -3.0f, 0.0f), &combined)) {
+        std::printf("brick map is not built\n");
+        return 1;
+    }
+    int failed = count_overestimates(cache, combined, "initial bake");
+
+    // toward the bricks around (-3, 3, 0), which were far from everything at the first bake
+    const float3 path[] = {float3(0.0f, 0.0f, 0.0f), float3(-2.0f, 2.0f, 0.0f), float3(-3.0f, 3.0f, 0.0f)};
+    for (const float3& center : path) {
+        update(cache, center, &combined);
+        failed += count_overestimates(cache, combined, "incremental update");
+    }
+
+    std::printf("%s: %d overestimated samples\n", failed == 0 ? "passed" : "FAILED", failed);
+    return failed == 0 ? 0 : 1;
+}
@@ -0,0 +1,67 @@
+#ifndef CHIMERA_CONTENT_HASH_H
+#define CHIMERA_CONTENT_HASH_H
+
+#include <cstdint>
+#include <cstddef>
+#include <cstring>
+#include <string>
+
+/**
+\brief Streaming 64-bit hash for cache keys (FNV-1a style mixing applied to 8-byte words)
+
+Not cryptographic - it is only used to detect that cached data was produced from the same input.
+*/
+struct ContentHash64
+{
+  void Add(const void* a_data, size_t a_size)
+  {
+    auto bytes = static_cast<const uint8_t*>(a_data);
+    size_t i = 0;
+    for(; i + sizeof(uint64_t) <= a_size; i += sizeof(uint64_t))
+    {
+      uint64_t word;
+      memcpy(&word, bytes + i, sizeof(word));
+      Mix(word);
+    }
+    for(; i < a_size; ++i)
+      Mix(bytes[i]);
+    Mix(a_size);
+  }
+
+  template<typename T>
+  void AddValue(const T& a_value) { Add(&a_value, sizeof(T)); }
+
+  void AddString(const std::string& a_str) { Add(a_str.data(), a_str.size()); }
+
+  uint64_t Get() const
+  {
+    // final avalanche (splitmix64 finalizer), so that similar inputs give distant keys
+    uint64_t h = m_state;
+    h ^= h >> 30; h *= 0xbf58476d1ce4e5b9ull;
+    h ^= h >> 27; h *= 0x94d049bb133111ebull;
+    h ^= h >> 31;
+    return h;
+  }
+
+  std::string GetHex() const
+  {
+    static const char digits[] = "0123456789abcdef";
+    uint64_t h = Get();
+    std::string res(16, '0');
+    for(int i = 15; i >= 0; --i, h >>= 4)
+      res[i] = digits[h & 0xF];
+    return res;
+  }
+
+private:
+  void Mix(uint64_t a_word)
+  {
+    m_state ^= a_word;
+    m_state *= 0x100000001b3ull;
+    m_state ^= m_state >> 29;
+  }
+
+  uint64_t m_state = 0xcbf29ce484222325ull;
+};
+
+#endif// CHIMERA_CONTENT_HASH_H
@@ -0,0 +1,40 @@
+#include "geometry_memory.h"
+
+#include <algorithm>
+#include <cstdlib>
+
+#ifdef _WIN32
+#include <malloc.h>
+#else
+#include <sys/mman.h>
+#endif
+
+static constexpr size_t CACHE_LINE_SIZE = 64;
+static constexpr size_t HUGE_PAGE_SIZE  = size_t(2) << 20;
+
+void* AllocateGeometryMemory(size_t a_bytes, bool a_hugePages)
+{
+  const size_t alignment = (a_hugePages && a_bytes >= HUGE_PAGE_SIZE) ? HUGE_PAGE_SIZE : CACHE_LINE_SIZE;
+  const size_t size      = (std::max<size_t>(a_bytes, 1) + alignment - 1) / alignment * alignment;
+#ifdef _WIN32
+  return _aligned_malloc(size, alignment);
+#else
+  void* ptr = nullptr;
+  if(posix_memalign(&ptr, alignment, size) != 0)
+    return nullptr;
+#ifdef MADV_HUGEPAGE
+  if(alignment == HUGE_PAGE_SIZE)
+    madvise(ptr, size, MADV_HUGEPAGE);
+#endif
+  return ptr;
+#endif
+}
+
+void FreeGeometryMemory(void* a_ptr)
+{
+#ifdef _WIN32
+  _aligned_free(a_ptr);
+#else
+  free(a_ptr);
+#endif
+}
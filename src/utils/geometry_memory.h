@@ -0,0 +1,43 @@
+#ifndef CHIMERA_GEOMETRY_MEMORY_H
+#define CHIMERA_GEOMETRY_MEMORY_H
+
+#include <cstddef>
+#include <new>
+
+/**
+\brief Memory for scene geometry (vertices and indices): blocks are aligned to cache lines (64 bytes), so that consumers
+       referencing slices of them in place (GPU upload, Embree shared buffers, CPU shading) read whole lines. With
+       'a_hugePages' large blocks are aligned to 2 MiB and advised to be backed by transparent huge pages (Linux only),
+       which reduces TLB misses of random access to big scenes; elsewhere the hint is ignored
+*/
+void* AllocateGeometryMemory(size_t a_bytes, bool a_hugePages);
+void  FreeGeometryMemory(void* a_ptr);
+
+template<typename T>
+struct GeometryAllocator
+{
+  using value_type = T;
+
+  GeometryAllocator() = default;
+  explicit GeometryAllocator(bool a_hugePages) : hugePages(a_hugePages) {}
+  template<typename U>
+  GeometryAllocator(const GeometryAllocator<U> &a_other) : hugePages(a_other.hugePages) {}
+
+  T* allocate(size_t a_count)
+  {
+    void* ptr = AllocateGeometryMemory(a_count * sizeof(T), hugePages);
+    if(ptr == nullptr)
+      throw std::bad_alloc();
+    return static_cast<T*>(ptr);
+  }
+  void deallocate(T* a_ptr, size_t) { FreeGeometryMemory(a_ptr); }
+
+  bool hugePages = false;
+};
+
+template<typename T, typename U>
+bool operator==(const GeometryAllocator<T>&, const GeometryAllocator<U>&) { return true; } // any instance frees memory of another
+template<typename T, typename U>
+bool operator!=(const GeometryAllocator<T>&, const GeometryAllocator<U>&) { return false; }
+
+#endif// CHIMERA_GEOMETRY_MEMORY_H
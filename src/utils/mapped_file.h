@@ -0,0 +1,43 @@
+#ifndef CHIMERA_MAPPED_FILE_H
+#define CHIMERA_MAPPED_FILE_H
+
+#include <string>
+#include <cstdint>
+#include <cstddef>
+
+/**
+\brief Read-only memory mapping of a whole file (mmap on POSIX, file mapping on Windows)
+*/
+class MappedFile
+{
+public:
+  MappedFile() = default;
+  ~MappedFile() { Close(); }
+
+  MappedFile(const MappedFile&) = delete;
+  MappedFile& operator=(const MappedFile&) = delete;
+  MappedFile(MappedFile&& a_other) noexcept;
+  MappedFile& operator=(MappedFile&& a_other) noexcept;
+
+  bool Open(const std::string& a_path);
+  void Close();
+
+  /**
+  \brief hint that the mapping will be read front to back once (madvise(MADV_SEQUENTIAL) where available)
+  */
+  void AdviseSequential() const;
+
+  bool           IsOpen() const { return m_data != nullptr; }
+  const uint8_t* Data()   const { return m_data; }
+  size_t         Size()   const { return m_size; }
+
+private:
+  const uint8_t* m_data = nullptr;
+  size_t         m_size = 0;
+#ifdef _WIN32
+  void* m_file    = nullptr;
+  void* m_mapping = nullptr;
+#endif
+};
+
+#endif// CHIMERA_MAPPED_FILE_H